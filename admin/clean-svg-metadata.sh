@@ -7,6 +7,14 @@ name=$(basename ${0})
 TOP_DIR=${TOP_DIR:="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"}
 FDL=${FDL:="${TOP_DIR}/fabricators-design-license.txt"}
 TEMPLATE=${TEMPLATE:="${TOP_DIR}/work-template.rdf"}
+
+# Use the native svg-clean from design-aides/svg-generators when installed.
+# Set SVG_CLEAN_SHELL to force this script's own implementation.
+if [[ -z ${SVG_CLEAN_SHELL} ]] && command -v svg-clean > /dev/null; then
+	export FDL TEMPLATE
+	exec svg-clean "${@}"
+fi
+
 AUTHOR=${AUTHOR:="$(git config --get user.name) \&lt\;$(git config --get user.email)\&gt\;"}
 
 usage () {
@@ -27,9 +27,11 @@
 #include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -43,6 +45,12 @@
 #include <sys/types.h>
 
 #include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "noise.h"
+#include "template.h"
+#include "canvas.h"
+#include "cache.h"
 
 static const char program_name[] = "blob-generator";
 
@@ -62,6 +70,7 @@ struct blob_params {
 	float radius_min;
 	float radius_max;
 	float sector_min;
+	unsigned int instance_count;
 };
 
 struct grid_params {
@@ -71,14 +80,85 @@ struct grid_params {
 	float wiggle;
 };
 
+struct pixel_params {
+	float size;
+	unsigned int scales;
+};
+
+struct cell_params {
+	float gap;
+	float smooth;
+};
+
+/*
+ * A field value in -1 to 1 per grid cell, from fractal noise and linear
+ * and radial gradients, scales the blob radius, node count and wiggle and
+ * picks the palette color.  Amounts of 0 leave a parameter uniform.
+ */
+struct field_params {
+	float scale;
+	unsigned int octaves;
+	float noise;
+	float gradient_x;
+	float gradient_y;
+	float radial;
+	float radius;
+	float nodes;
+	float wiggle;
+	float palette;
+};
+
 enum opt_value {opt_undef = 0, opt_yes, opt_no};
 
+enum camo_style {style_undef = 0, style_blob, style_digital, style_voronoi};
+
+enum output_format {
+	format_undef = 0,
+	format_svg,
+	format_svgz,
+	format_pdf,
+	format_png,
+	format_mdgeom,
+};
+
+#define max_outputs 8U
+
+static const float px_per_mm = 96.0 / 25.4;
+
 struct opts {
 	struct blob_params blob_params;
 	struct grid_params grid_params;
-	char *output_file;
+	struct pixel_params pixel_params;
+	struct cell_params cell_params;
+	struct field_params field_params;
+	enum camo_style style;
+	enum output_format format;
+	char *output_files[max_outputs];
+	unsigned int output_count;
+	char *stats_file;
+	char *trace_file;
+	unsigned int preview_size;
 	char *config_file;
+	char *template_file;
+	char *mirror_file;
+	char *jobs_file;
+	char *cache_dir;
+	unsigned int cache_size;
+	enum opt_value cache_stats;
+	unsigned int threads;
+	unsigned int seed;
+	struct svg_rect page_rect;
+	struct svg_rect mirror_rect;
 	enum opt_value background;
+	enum opt_value merge_colors;
+	enum opt_value tile;
+	enum opt_value neighbor_colors;
+	float min_contrast;
+	enum opt_value draft;
+	float panel_width;
+	float panel_overlap;
+	unsigned int shard;
+	unsigned int shard_count;
 	enum opt_value help;
 	enum opt_value verbose;
 	enum opt_value version;
@@ -90,6 +170,7 @@ static const struct blob_params init_blob_params = {
 	.radius_min = HUGE_VALF,
 	.radius_max = HUGE_VALF,
 	.sector_min = HUGE_VALF,
+	.instance_count = UINT_MAX,
 };
 
 static const struct grid_params init_grid_params = {
@@ -99,12 +180,23 @@ static const struct grid_params init_grid_params = {
 	.wiggle = HUGE_VALF,
 };
 
+static const struct pixel_params init_pixel_params = {
+	.size = HUGE_VALF,
+	.scales = UINT_MAX,
+};
+
+static const struct cell_params init_cell_params = {
+	.gap = HUGE_VALF,
+	.smooth = HUGE_VALF,
+};
+
 static const struct blob_params default_blob_params = {
 	.node_count_min = 8U,
 	.node_count_max = 16U,
 	.radius_min = 18.0,
 	.radius_max = 70.0,
 	.sector_min = 15.0,
+	.instance_count = 0U,
 };
 
 static const struct grid_params default_grid_params = {
@@ -112,12 +204,98 @@ static const struct grid_params default_grid_params = {
 	.rows = 15U,
 };
 
+static const struct pixel_params default_pixel_params = {
+	.scales = 3U,
+};
+
+static const struct cell_params default_cell_params = {
+	.smooth = 0.0,
+};
+
+static const struct field_params default_field_params = {
+	.scale = 5.0,
+	.octaves = 3U,
+	.noise = 1.0,
+};
+
+static const char *style_name(enum camo_style style)
+{
+	switch (style) {
+	case style_digital:
+		return "digital";
+	case style_voronoi:
+		return "voronoi";
+	default:
+		return "blob";
+	}
+}
+
+static enum camo_style style_parse(const char *str)
+{
+	if (!strcmp(str, "blob")) {
+		return style_blob;
+	}
+	if (!strcmp(str, "digital")) {
+		return style_digital;
+	}
+	if (!strcmp(str, "voronoi")) {
+		return style_voronoi;
+	}
+	return style_undef;
+}
+
+static const char *const format_names[] = {
+	[format_svg] = "svg",
+	[format_svgz] = "svgz",
+	[format_pdf] = "pdf",
+	[format_png] = "png",
+	[format_mdgeom] = "mdgeom",
+};
+
+static const char *format_name(enum output_format format)
+{
+	return (format == format_undef) ? "svg" : format_names[format];
+}
+
+static const enum sink_kind format_sinks[] = {
+	[format_svg] = sink_svg,
+	[format_svgz] = sink_svgz,
+	[format_pdf] = sink_pdf,
+	[format_png] = sink_preview,
+	[format_mdgeom] = sink_mdgeom,
+};
+
+static enum output_format format_parse(const char *str)
+{
+	unsigned int i;
+
+	for (i = format_svg; i <= format_mdgeom; i++) {
+		if (!strcasecmp(str, format_names[i])) {
+			return i;
+		}
+	}
+	return format_undef;
+}
+
+/* From the file name extension, else the --format one. */
+static enum output_format output_format(const char *file,
+	enum output_format format)
+{
+	const char *ext = strrchr(file, '.');
+	enum output_format result = ext ? format_parse(ext + 1) : format_undef;
+
+	if (result != format_undef) {
+		return result;
+	}
+	return (format == format_undef) ? format_svg : format;
+}
+
 static void print_usage(const struct opts *opts)
 {
 	print_version();
 
 	fprintf(stderr,
-"%s - Generates SVG file of camouflage blobs.\n"
+"%s - Generates SVG, PDF or PNG files of camouflage blobs.\n"
 "Usage: %s [flags]\n"
 "Option flags:\n"
 "  --node-count-min - Blob minimum node count. Default: '%u'.\n"
@@ -125,18 +303,54 @@ static void print_usage(const struct opts *opts)
 "  --radius-min     - Blob minimum node radius. Default: '%f'.\n"
 "  --radius-max     - Blob maximum node radius. Default: '%f'.\n"
 "  --sector_min     - Blob minimum node sector angle. Default: '%f'.\n"
+"  --instances      - Blob shape library size, 0=unique blobs. Default: '%u'.\n"
 
 "  --grid-columns   - Output width. Default: '%u'.\n"
 "  --grid-rows      - Output length. Default: '%u'.\n"
 "  --grid-width     - Output grid width. Default: '%f'.\n"
 "  --grid-wiggle    - Output grid wiggle. Default: '%f'.\n"
 
-"  -o --output-file  - Output file. Default: '%s'.\n"
+"  --pixel-size     - Digital pixel size. Default: '%f'.\n"
+"  --pixel-scales   - Digital pixel block scales. Default: '%u'.\n"
+
+"  --cell-gap       - Voronoi gap between cells. Default: '%f'.\n"
+"  --cell-smooth    - Voronoi corner rounding, 0 to 1. Default: '%f'.\n"
+
+"  -s --style        - Camo style {blob digital voronoi}. Default: '%s'.\n"
+"  -o --output-file  - Output file, repeat for more outputs. Default: '%s'.\n"
+"  --format          - Output format {svg svgz pdf png mdgeom}, by default\n"
+"                      from the output file name. Default: '%s'.\n"
+"  --preview-size    - PNG preview long side pixels. Default: '%u'.\n"
+"  --stats           - Write path and color statistics to a file.\n"
+"  --trace           - Write a Chrome trace of the run's threads to a file.\n"
+"  --template        - Page size from a part template's print area.\n"
+"  --mirror          - The other part of a mirror pair, its camo mirrored\n"
+"                      from --template's, written to <output>-mirror.<ext>.\n"
 "  -f --config-file  - Config file. Default: '%s'.\n"
+"  --seed            - Random seed. Default: from the time.\n"
+"  --jobs            - Run the jobs of a manifest file.\n"
+"  --threads         - Manifest jobs run in parallel. Default: '%u'.\n"
+"  --cache           - Output cache directory.\n"
+"  --cache-size      - Output cache size limit in MiB. Default: '%u'.\n"
+"  --cache-stats     - Show the output cache use and exit.\n"
 "  -b --background   - Generate image background. Default: '%s'.\n"
+"  -m --merge-colors - Merge same color blobs into compound paths. Default: '%s'.\n"
+"  -t --tile         - Generate a seamless tile as an SVG pattern. Default: '%s'.\n"
+"  -n --neighbor-colors - Give touching blobs different colors. Default: '%s'.\n"
+"  --min-contrast    - Neighbor color contrast, 0 to 1. Default: '%f'.\n"
+"  --draft           - Quick low detail output, simplified to a pixel at\n"
+"                      --preview-size, with the full output's layout.\n"
+"  --panel-width     - Split the page into panels this many mm wide, each\n"
+"                      written to <output>-<n>.<ext>. Default: off.\n"
+"  --panel-overlap   - Panel overlap bleed in mm. Default: '%f'.\n"
+"  --shard           - Only generate band <i> of <n> grid row bands, written\n"
+"                      as a shard file for shard-merge, as '<i>/<n>'.  Needs\n"
+"                      --seed, plain blob output and a single -o.\n"
 "  -h --help         - Show this help and exit.\n"
 "  -v --verbose      - Verbose execution.\n"
-"  -V --version      - Display the program version number.\n",
+"  -V --version      - Display the program version number.\n"
+"Manifest lines are '<config> [<template>] <seed> <output>', a config of\n"
+"'-' for the defaults.  Options given are the base of every job.\n",
 		program_name, program_name,
 
 		opts->blob_params.node_count_min,
@@ -144,15 +358,32 @@ static void print_usage(const struct opts *opts)
 		opts->blob_params.radius_min,
 		opts->blob_params.radius_max,
 		opts->blob_params.sector_min,
+		opts->blob_params.instance_count,
 
 		opts->grid_params.columns,
 		opts->grid_params.rows,
 		opts->grid_params.width,
 		opts->grid_params.wiggle,
 
-		opts->output_file,
+		opts->pixel_params.size,
+		opts->pixel_params.scales,
+
+		opts->cell_params.gap,
+		opts->cell_params.smooth,
+
+		style_name(opts->style),
+		(opts->output_count ? opts->output_files[0] : "-"),
+		format_name(opts->format),
+		opts->preview_size,
 		opts->config_file,
-		(opts->background ? "yes" : "no")
+		opts->threads,
+		opts->cache_size,
+		(opts->background ? "yes" : "no"),
+		(opts->merge_colors == opt_yes ? "yes" : "no"),
+		(opts->tile == opt_yes ? "yes" : "no"),
+		(opts->neighbor_colors == opt_yes ? "yes" : "no"),
+		opts->min_contrast,
+		opts->panel_overlap
 	);
 
 	print_bugreport();
@@ -166,28 +397,82 @@ static int opts_parse(struct opts *opts, int argc, char *argv[])
 		{"radius-min",     required_argument, NULL, '3'},
 		{"radius-max",     required_argument, NULL, '4'},
 		{"sector_min",     required_argument, NULL, '5'},
+		{"instances",      required_argument, NULL, 'i'},
 
 		{"grid-columns",   required_argument, NULL, '6'},
 		{"grid-rows",      required_argument, NULL, '7'},
 		{"grid-width",     required_argument, NULL, '8'},
 		{"grid-wiggle",    required_argument, NULL, '9'},
 
+		{"pixel-size",     required_argument, NULL, 'p'},
+		{"pixel-scales",   required_argument, NULL, 'l'},
+
+		{"cell-gap",       required_argument, NULL, 'g'},
+		{"cell-smooth",    required_argument, NULL, 'r'},
+
+		{"style",          required_argument, NULL, 's'},
 		{"output-file",    required_argument, NULL, 'o'},
+		{"format",         required_argument, NULL, 'F'},
+		{"preview-size",   required_argument, NULL, 'P'},
+		{"stats",          required_argument, NULL, 'S'},
+		{"trace",          required_argument, NULL, 'R'},
+		{"template",       required_argument, NULL, 'T'},
+		{"mirror",         required_argument, NULL, 'M'},
 		{"config-file",    required_argument, NULL, 'f'},
+		{"seed",           required_argument, NULL, 'e'},
+		{"jobs",           required_argument, NULL, 'j'},
+		{"threads",        required_argument, NULL, 'J'},
+		{"cache",          required_argument, NULL, 'C'},
+		{"cache-size",     required_argument, NULL, 'Z'},
+		{"cache-stats",    no_argument,       NULL, 'Q'},
 		{"background",     no_argument,       NULL, 'b'},
+		{"merge-colors",   no_argument,       NULL, 'm'},
+		{"tile",           no_argument,       NULL, 't'},
+		{"neighbor-colors", no_argument,      NULL, 'n'},
+		{"min-contrast",   required_argument, NULL, 'k'},
+		{"draft",          no_argument,       NULL, 'D'},
+		{"panel-width",    required_argument, NULL, 'W'},
+		{"panel-overlap",  required_argument, NULL, 'O'},
+		{"shard",          required_argument, NULL, 'X'},
 		{"help",           no_argument,       NULL, 'h'},
 		{"verbose",        no_argument,       NULL, 'v'},
 		{"version",        no_argument,       NULL, 'V'},
 		{ NULL,            0,                 NULL, 0},
 	};
-	static const char short_options[] = "bo:f:hvV";
+	static const char short_options[] = "bmtns:o:f:hvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
 	*opts = (struct opts){
 		.blob_params = init_blob_params,
 		.grid_params = init_grid_params,
-		.output_file = "-",
+		.pixel_params = init_pixel_params,
+		.cell_params = init_cell_params,
+		.field_params = default_field_params,
+		.style = style_undef,
+		.format = format_undef,
+		.output_count = 0,
+		.stats_file = NULL,
+		.trace_file = NULL,
+		.preview_size = 1024U,
 		.config_file = NULL,
+		.template_file = NULL,
+		.mirror_file = NULL,
+		.jobs_file = NULL,
+		.cache_dir = NULL,
+		.cache_size = 1024U,
+		.cache_stats = opt_no,
+		.threads = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.seed = UINT_MAX,
 		.background = opt_no,
+		.merge_colors = opt_no,
+		.tile = opt_no,
+		.neighbor_colors = opt_no,
+		.min_contrast = 0.0,
+		.draft = opt_no,
+		.panel_width = 0.0,
+		.panel_overlap = 10.0,
+		.shard = 0,
+		.shard_count = 0,
 		.help = opt_no,
 		.verbose = opt_no,
 		.version = opt_no,
@@ -251,6 +536,13 @@ static int opts_parse(struct opts *opts, int argc, char *argv[])
 				return -1;
 			}
 			break;
+		case 'i':
+			opts->blob_params.instance_count = to_unsigned(optarg);
+			if (opts->blob_params.instance_count == UINT_MAX) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
 		// grid
 		case '6':
 			opts->grid_params.columns = to_unsigned(optarg);
@@ -280,9 +572,163 @@ static int opts_parse(struct opts *opts, int argc, char *argv[])
 				return -1;
 			}
 			break;
+		// pixel
+		case 'p':
+			opts->pixel_params.size = to_float(optarg);
+			if (opts->pixel_params.size == HUGE_VALF
+				|| opts->pixel_params.size <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'l':
+			opts->pixel_params.scales = to_unsigned(optarg);
+			if (opts->pixel_params.scales == UINT_MAX
+				|| !opts->pixel_params.scales
+				|| opts->pixel_params.scales > 8) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		// cell
+		case 'g':
+			opts->cell_params.gap = to_float(optarg);
+			if (opts->cell_params.gap == HUGE_VALF
+				|| opts->cell_params.gap < 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'r':
+			opts->cell_params.smooth = to_float(optarg);
+			if (opts->cell_params.smooth == HUGE_VALF
+				|| opts->cell_params.smooth < 0
+				|| opts->cell_params.smooth > 1) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 's':
+			opts->style = style_parse(optarg);
+			if (opts->style == style_undef) {
+				error("Unknown style '%s'.\n", optarg);
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'F':
+			opts->format = format_parse(optarg);
+			if (opts->format == format_undef) {
+				error("Unknown format '%s'.\n", optarg);
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'T':
+			opts->template_file = optarg;
+			break;
+		case 'M':
+			opts->mirror_file = optarg;
+			break;
+		case 'e':
+			opts->seed = to_unsigned(optarg);
+			if (opts->seed == UINT_MAX) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'j':
+			opts->jobs_file = optarg;
+			break;
+		case 'J':
+			opts->threads = to_unsigned(optarg);
+			if (opts->threads == UINT_MAX || !opts->threads) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'C':
+			opts->cache_dir = optarg;
+			break;
+		case 'Z':
+			opts->cache_size = to_unsigned(optarg);
+			if (opts->cache_size == UINT_MAX) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'Q':
+			opts->cache_stats = opt_yes;
+			break;
+		case 'D':
+			opts->draft = opt_yes;
+			break;
+		case 'W':
+			opts->panel_width = to_float(optarg);
+			if (opts->panel_width == HUGE_VALF
+				|| opts->panel_width <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'O':
+			opts->panel_overlap = to_float(optarg);
+			if (opts->panel_overlap == HUGE_VALF
+				|| opts->panel_overlap < 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'X': {
+			char extra;
+
+			if (sscanf(optarg, "%u/%u%c", &opts->shard,
+				&opts->shard_count, &extra) != 2
+				|| !opts->shard
+				|| opts->shard > opts->shard_count) {
+				error("Bad shard '%s', expected '<i>/<n>'.\n",
+					optarg);
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		}
+		case 'P':
+			opts->preview_size = to_unsigned(optarg);
+			if (opts->preview_size == UINT_MAX
+				|| !opts->preview_size
+				|| opts->preview_size > 16384) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'S':
+			opts->stats_file = optarg;
+			break;
+		case 'R':
+			opts->trace_file = optarg;
+			break;
 		case 'b':
 			opts->background = opt_yes;
 			break;
+		case 'm':
+			opts->merge_colors = opt_yes;
+			break;
+		case 't':
+			opts->tile = opt_yes;
+			break;
+		case 'n':
+			opts->neighbor_colors = opt_yes;
+			break;
+		case 'k':
+			opts->min_contrast = to_float(optarg);
+			if (opts->min_contrast == HUGE_VALF
+				|| opts->min_contrast < 0
+				|| opts->min_contrast > 1) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
 		// admin
 		case 'o': {
 			size_t len;
@@ -295,9 +741,15 @@ static int opts_parse(struct opts *opts, int argc, char *argv[])
 				opts->help = opt_yes;
 				return -1;
 			}
+			if (opts->output_count == max_outputs) {
+				error("Too many outputs, at most %u.\n",
+					max_outputs);
+				opts->help = opt_yes;
+				return -1;
+			}
 			len = strlen(optarg) + 1;
-			opts->output_file = mem_alloc(len);
-			strcpy(opts->output_file, optarg);
+			opts->output_files[opts->output_count] = mem_alloc(len);
+			strcpy(opts->output_files[opts->output_count++], optarg);
 			break;
 		}
 		case 'f': {
@@ -337,7 +789,7 @@ static int opts_parse(struct opts *opts, int argc, char *argv[])
 
 struct blob {
 	unsigned int node_count;
-	struct node *nodes;
+	struct point_c *nodes;
 };
 
 struct grid_position {
@@ -346,315 +798,3241 @@ struct grid_position {
 	unsigned int number;
 };
 
-static void write_blob(FILE* out_stream, const struct grid_params *grid_params,
-	const struct blob_params *blob_params, const char *color,
-	const struct grid_position *pos)
+/*
+ * Instances are drawn from the shape library with a random rotation, a
+ * random scale in this range and a random mirror flip so that a small
+ * library still gives a non-repeating looking pattern.
+ */
+static const float instance_scale_min = 0.8;
+static const float instance_scale_max = 1.2;
+
+static void make_blob(const struct blob_params *blob_params, struct blob *blob)
 {
-	char blob_id[256];
-	unsigned int node_count;
 	unsigned int node;
 	struct point_p point_p;
-	struct point_c blob_offset;
 
-	snprintf(blob_id, sizeof(blob_id), "blob_%d", pos->number);
-	node_count = random_int(blob_params->node_count_min,
+	blob->node_count = random_int(blob_params->node_count_min,
 		blob_params->node_count_max);
+	blob->nodes = mem_alloc(blob->node_count * sizeof(*blob->nodes));
 
-	blob_offset.x = pos->column * grid_params->width
-		+ random_float(0, grid_params->wiggle);
-	blob_offset.y = pos->row * grid_params->width +
-		random_float(0, grid_params->wiggle);
-
-	log("%s: %u nodes at {%u,%u} => {%f,%f}\n",
-		blob_id, node_count, pos->column, pos->row,
-		blob_offset.x, blob_offset.y);
-
-	svg_open_path(out_stream, blob_id, color, NULL);
-
-	for (node = 0, point_p.angle = 0; node < node_count; node++) {
-		struct point_c point_c;
-		float sector_limit = (node + 1) * 360 / node_count;
+	for (node = 0, point_p.angle = 0; node < blob->node_count; node++) {
+		float sector_limit = (node + 1) * 360 / blob->node_count;
 		float sector_start;
-		struct point_c final;
 
 		sector_start = point_p.angle + blob_params->sector_min;
-		
+
+		/*
+		 * The params are checked up front, but field scaled node
+		 * counts can leave a sector short, squeeze the node in.
+		 */
 		if (sector_start >= sector_limit) {
-			error("node_%u: bad sector: {%f,%f}\n",
+			debug("node_%u: bad sector: {%f,%f}\n",
 				node, sector_start, sector_limit);
-			exit(EXIT_FAILURE);
+			sector_start = sector_limit;
 		}
 
 		point_p.angle = random_float(sector_start, sector_limit);
 		point_p.radius = random_float(blob_params->radius_min,
 			blob_params->radius_max);
 
-		polar_to_cart(&point_p, &point_c);
-
-		final.x = point_c.x + blob_offset.x;
-		final.y = point_c.y + blob_offset.y;
+		polar_to_cart(&point_p, &blob->nodes[node]);
 
 		if (0) {
 			fprintf(stderr,
-				"  node_%u: {%f,%f} => {%f,%f} => {%f,%f}\n",
+				"  node_%u: {%f,%f} => {%f,%f}\n",
 				node,
 				point_p.radius, point_p.angle,
-				point_c.x, point_c.y,
-				final.x, final.y);
+				blob->nodes[node].x, blob->nodes[node].y);
 		}
+	}
+}
+
+static void free_blob(struct blob *blob)
+{
+	mem_free(blob->nodes);
+	blob->nodes = NULL;
+	blob->node_count = 0;
+}
+
+static void write_blob_subpath(struct canvas *canvas, const struct blob *blob,
+	const struct point_c *offset)
+{
+	unsigned int node;
+
+	for (node = 0; node < blob->node_count; node++) {
+		struct point_c final;
+
+		final.x = blob->nodes[node].x + offset->x;
+		final.y = blob->nodes[node].y + offset->y;
 
 		if (node == 0) {
-			fprintf(out_stream, "   d=\"M %f,%f\n", final.x,
-				final.y);
+			canvas_move_to(canvas, final.x, final.y);
 		} else {
-			//echo " L ${x},${y}"
-			fprintf(out_stream, "    L %f,%f\n", final.x, final.y);
+			canvas_line_to(canvas, final.x, final.y);
 		}
 	}
 
-	fprintf(out_stream, "    Z\"/>\n");
-	svg_close_object(out_stream);
+	canvas_close_subpath(canvas);
 }
 
-static void write_background(FILE* out_stream,
-	const struct svg_rect *background_rect, const char *fill_color)
+static void write_blob_path(struct canvas *canvas, const char *id,
+	const char *color, const struct blob *blob,
+	const struct point_c *offset, unsigned int flags)
 {
-	assert(is_hex_color(fill_color));
+	canvas_open_path(canvas, id, color, flags);
+	write_blob_subpath(canvas, blob, offset);
+	canvas_close_path(canvas);
+}
 
-	svg_open_group(out_stream, "background");
-	svg_write_rect(out_stream, "background", fill_color, NULL,
-		background_rect);
-	svg_close_group(out_stream);
+static void get_blob_offset(const struct grid_params *grid_params,
+	const struct grid_position *pos, struct point_c *blob_offset)
+{
+	blob_offset->x = pos->column * grid_params->width
+		+ random_float(0, grid_params->wiggle);
+	blob_offset->y = pos->row * grid_params->width +
+		random_float(0, grid_params->wiggle);
 }
 
-static void write_svg(FILE* out_stream, const struct grid_params *grid_params,
-	const struct blob_params *blob_params, const struct palette *palette,
-	bool background)
+static void write_blob(struct canvas *canvas,
+	const struct grid_params *grid_params,
+	const struct blob_params *blob_params, const char *color,
+	const struct grid_position *pos)
 {
-	unsigned int i;
-	unsigned int *render_order;
-	struct grid_position pos;
-	struct svg_rect background_rect;
+	char blob_id[256];
+	struct blob blob;
+	struct point_c blob_offset;
 
-	background_rect.width = (2 + grid_params->columns) * grid_params->width;
-	background_rect.height = (2 + grid_params->rows) * grid_params->width;
+	snprintf(blob_id, sizeof(blob_id), "blob_%d", pos->number);
 
-	background_rect.x = -grid_params->width;
-	background_rect.y = -grid_params->width;
-	background_rect.rx = 50.0;
+	make_blob(blob_params, &blob);
+	get_blob_offset(grid_params, pos, &blob_offset);
 
-	svg_open_svg(out_stream, &background_rect);
+	log("%s: %u nodes at {%u,%u} => {%f,%f}\n",
+		blob_id, blob.node_count, pos->column, pos->row,
+		blob_offset.x, blob_offset.y);
 
-	if (background) {
-		//write_background(out_stream, &background_rect, "#001aff");
-		write_background(out_stream, &background_rect, "#000099");
-	}
+	write_blob_path(canvas, blob_id, color, &blob, &blob_offset, 0);
 
-	svg_open_group(out_stream, "camo_blobs");
+	free_blob(&blob);
+}
 
-	render_order = random_array(grid_params->columns * grid_params->rows);
+static struct blob *make_library(const struct blob_params *blob_params)
+{
+	struct blob *library;
+	unsigned int i;
 
-	for (i = 0; i < grid_params->columns * grid_params->rows; i++) {
-		pos.number = i;
-		pos.row = render_order[i] / grid_params->columns;
-		pos.column = render_order[i] % grid_params->columns;
-		const char *color = palette_get_random(palette);
+	library = mem_alloc(blob_params->instance_count * sizeof(*library));
 
-		//debug("%u: (%u) = %u, %u\n", i, render_order[i], pos.column, pos.row);
-		write_blob(out_stream, grid_params, blob_params, color, &pos);
+	for (i = 0; i < blob_params->instance_count; i++) {
+		make_blob(blob_params, &library[i]);
 	}
 
-	svg_close_group(out_stream);
-	svg_close_svg(out_stream);
+	return library;
 }
 
-struct config_cb_data {
-	const char *config_file;
-	struct blob_params *blob_params;
-	struct grid_params *grid_params;
-	struct palette* palette;
-	struct color_data *color_data;
-	unsigned color_counter;
-};
-
-static void config_cb(void *cb_data, const char *section, char *config_data)
+static void free_library(const struct blob_params *blob_params,
+	struct blob *library)
 {
-	struct config_cb_data *cbd = cb_data;
-
-	//debug("%s, '%s'\n", section, config_data);
+	unsigned int i;
 
-	if (!strcmp(section, "[params]")) {
-		char *name = strtok(config_data, "=");
-		char *value = strtok(NULL, " \t");
+	for (i = 0; i < blob_params->instance_count; i++) {
+		free_blob(&library[i]);
+	}
+	mem_free(library);
+}
 
-		if (!name) {
-			error("Bad config name, section %s: '%s'\n", section,
-			      config_data);
-			assert(0);
-			exit(EXIT_FAILURE);
-		}
-		if (!value) {
-			error("Bad config value, section %s: '%s'\n", section,
-			      config_data);
-			assert(0);
-			exit(EXIT_FAILURE);
-		}
+static void write_library(struct canvas *canvas,
+	const struct blob_params *blob_params, const struct blob *library)
+{
+	static const struct point_c origin = {0.0, 0.0};
+	unsigned int i;
 
-		name = config_clean_data(name);
-		value = config_clean_data(value);
+	canvas_open_defs(canvas);
 
-		//debug("params: '%s', '%s'\n", name, value);
+	for (i = 0; i < blob_params->instance_count; i++) {
+		char shape_id[256];
 
-		if (cbd->blob_params->node_count_min ==
-			init_blob_params.node_count_min &&
-			!strcmp(name, "blob_node_count_min")) {
-			cbd->blob_params->node_count_min =
-				to_unsigned(value);
-		}
-		if (cbd->blob_params->node_count_max ==
-			init_blob_params.node_count_max &&
-			!strcmp(name, "blob_node_count_max")) {
-			cbd->blob_params->node_count_max =
-				to_unsigned(value);
-		}
-		if (cbd->blob_params->radius_min ==
-			init_blob_params.radius_min &&
-			!strcmp(name, "blob_radius_min")) {
-			cbd->blob_params->radius_min = to_float(value);
-		}
-		if (cbd->blob_params->radius_max ==
-			init_blob_params.radius_max &&
-			!strcmp(name, "blob_radius_max")) {
-			cbd->blob_params->radius_max = to_float(value);
-		}
-		if (cbd->blob_params->sector_min ==
-			init_blob_params.sector_min &&
-			!strcmp(name, "blob_sector_min")) {
-			cbd->blob_params->sector_min = to_float(value);
-		}
-		if (cbd->grid_params->columns == init_grid_params.columns &&
-			!strcmp(name, "grid_columns")) {
-			cbd->grid_params->columns = to_unsigned(value);
-		}
-		if (cbd->grid_params->rows == init_grid_params.rows &&
-			!strcmp(name, "grid_rows")) {
-			cbd->grid_params->rows = to_unsigned(value);
-		}
-		if (cbd->grid_params->width == init_grid_params.width &&
-			!strcmp(name, "grid_width")) {
-			cbd->grid_params->width = to_float(value);
-		}
-		if (cbd->grid_params->wiggle == init_grid_params.wiggle &&
-			!strcmp(name, "grid_wiggle")) {
-			cbd->grid_params->wiggle = to_float(value);
-		}
+		snprintf(shape_id, sizeof(shape_id), "shape_%u", i);
 
-		return;
+		canvas_open_symbol(canvas, shape_id);
+		strcat(shape_id, "_path");
+		write_blob_path(canvas, shape_id, NULL, &library[i], &origin,
+			0);
+		canvas_close_symbol(canvas);
 	}
 
-	if (!strcmp(section, "[palette]")) {
-		char *weight = strtok(config_data, ",");
-		char *value = strtok(NULL, " \t");
+	canvas_close_defs(canvas);
+}
 
-		if (!weight) {
-			error("Bad config weight, section %s: '%s'\n", section,
-			      config_data);
-			assert(0);
-			exit(EXIT_FAILURE);
-		}
-		if (!value) {
-			error("Bad config value, section %s: '%s'\n", section,
-			      config_data);
-			assert(0);
-			exit(EXIT_FAILURE);
-		}
+/* For sinks without symbols, the instance drawn transformed. */
+static void write_instance_path(struct canvas *canvas, const char *id,
+	const char *color, const struct blob *shape,
+	const struct point_c *offset, float angle, float scale_x, float scale)
+{
+	static const struct point_c origin = {0.0, 0.0};
+	struct blob blob;
+	float c = cosf(deg_to_rad(angle));
+	float s = sinf(deg_to_rad(angle));
+	unsigned int node;
 
-		weight = config_clean_data(weight);
-		value = config_clean_data(value);
+	blob.node_count = shape->node_count;
+	blob.nodes = mem_alloc(blob.node_count * sizeof(*blob.nodes));
 
-		//debug("palette: '%s', '%s'\n", weight, value);
-		
-		if (!value || !is_hex_color(value) ) {
-			fprintf(stderr,
-				"Bad config hex color value: '%s'\n",
-				value);
-			assert(0);
-			exit(EXIT_FAILURE);
-		}
-		
-		cbd->color_data = mem_realloc(cbd->color_data,
-			sizeof(*cbd->color_data) * (cbd->color_counter + 1));
-		cbd->color_data[cbd->color_counter].weight = to_unsigned(weight);
-		memcpy(&cbd->color_data[cbd->color_counter].value, value,
-			hex_color_len);
-		cbd->color_counter++;
+	for (node = 0; node < blob.node_count; node++) {
+		float x = shape->nodes[node].x * scale_x;
+		float y = shape->nodes[node].y * scale;
 
-		return;
+		blob.nodes[node].x = offset->x + x * c - y * s;
+		blob.nodes[node].y = offset->y + x * s + y * c;
 	}
 
-	if (!strcmp(section, "ON_EXIT")) {
-		if (cbd->color_data) {
-			palette_fill(cbd->palette, cbd->color_data,
-				cbd->color_counter);
-			mem_free(cbd->color_data);
-			cbd->color_data = NULL;
+	write_blob_path(canvas, id, color, &blob, &origin,
+		canvas_flag_expanded);
+	free_blob(&blob);
+}
+
+static void write_instance(struct canvas *canvas,
+	const struct grid_params *grid_params,
+	const struct blob_params *blob_params, const struct blob *library,
+	const char *color, const struct grid_position *pos)
+{
+	char blob_id[256];
+	char shape_id[256];
+	char transform[256];
+	unsigned int shape;
+	struct point_c blob_offset;
+	float angle;
+	float scale;
+	bool mirror;
+
+	snprintf(blob_id, sizeof(blob_id), "blob_%d", pos->number);
+
+	shape = random_unsigned(0, blob_params->instance_count - 1);
+	get_blob_offset(grid_params, pos, &blob_offset);
+	angle = random_float(0, 360);
+	scale = random_float(instance_scale_min, instance_scale_max);
+	mirror = random_unsigned(0, 1);
+
+	log("%s: shape_%u at {%u,%u} => {%f,%f}\n",
+		blob_id, shape, pos->column, pos->row,
+		blob_offset.x, blob_offset.y);
+
+	snprintf(shape_id, sizeof(shape_id), "shape_%u", shape);
+	snprintf(transform, sizeof(transform),
+		"translate(%f,%f) rotate(%f) scale(%f,%f)",
+		blob_offset.x, blob_offset.y, angle,
+		(mirror ? -scale : scale), scale);
+
+	canvas_use(canvas, blob_id, shape_id, color, transform);
+
+	if (canvas_expanded(canvas)) {
+		write_instance_path(canvas, blob_id, color, &library[shape],
+			&blob_offset, angle, (mirror ? -scale : scale), scale);
+	}
+}
+
+static bool field_enabled(const struct field_params *field_params)
+{
+	return field_params->radius || field_params->nodes
+		|| field_params->wiggle || field_params->palette;
+}
+
+/* Field values for the whole grid, the noise a row at a time. */
+static float *make_field(const struct field_params *field_params,
+	const struct grid_params *grid_params)
+{
+	const unsigned int columns = grid_params->columns;
+	const unsigned int rows = grid_params->rows;
+	float *field = mem_alloc((columns * rows + 1) * sizeof(*field));
+	unsigned int seed = random_next();
+	float x0 = random_float(0, 1000);
+	float y0 = random_float(0, 1000);
+	unsigned int row;
+	unsigned int column;
+
+	for (row = 0; row < rows; row++) {
+		float *values = &field[row * columns];
+		float v = 2.0 * (row + 0.5) / rows - 1.0;
+
+		noise_fbm_row(values, columns, x0, 1.0 / field_params->scale,
+			y0 + row / field_params->scale, field_params->octaves,
+			seed);
+
+		for (column = 0; column < columns; column++) {
+			float u = 2.0 * (column + 0.5) / columns - 1.0;
+			float f = field_params->noise * values[column]
+				+ field_params->gradient_x * u
+				+ field_params->gradient_y * v
+				+ field_params->radial
+					* (1.0 - sqrtf(u * u + v * v));
+
+			values[column] = fminf(1.0, fmaxf(-1.0, f));
+		}
+	}
+
+	return field;
+}
+
+/* Blob and grid params and color for a cell with field value f. */
+static const char *field_cell(const struct field_params *field_params,
+	float f, const struct palette *palette, struct blob_params *blob_params,
+	struct grid_params *grid_params)
+{
+	float radius = fmaxf(0.1, 1.0 + field_params->radius * f);
+	float nodes = fmaxf(0.0, 1.0 + field_params->nodes * f);
+	unsigned int nodes_limit = (blob_params->sector_min > 0.0)
+		? (unsigned int)ceilf(360.0 / blob_params->sector_min) - 1
+		: UINT_MAX;
+	unsigned int color;
+
+	blob_params->radius_min *= radius;
+	blob_params->radius_max *= radius;
+
+	blob_params->node_count_min = (unsigned int)roundf(
+		blob_params->node_count_min * nodes);
+	blob_params->node_count_max = (unsigned int)roundf(
+		blob_params->node_count_max * nodes);
+	blob_params->node_count_max = (blob_params->node_count_max
+		< nodes_limit) ? blob_params->node_count_max : nodes_limit;
+	blob_params->node_count_max = (blob_params->node_count_max > 3)
+		? blob_params->node_count_max : 3;
+	blob_params->node_count_min = (blob_params->node_count_min > 3)
+		? blob_params->node_count_min : 3;
+	blob_params->node_count_min = (blob_params->node_count_min
+		< blob_params->node_count_max) ? blob_params->node_count_min
+		: blob_params->node_count_max;
+
+	grid_params->wiggle *= fmaxf(0.0, 1.0 + field_params->wiggle * f);
+
+	if (!field_params->palette) {
+		return palette_get_random(palette);
+	}
+
+	color = (unsigned int)((field_params->palette * (f + 1.0) / 2.0
+		+ (1.0 - field_params->palette) * random_float(0, 1))
+		* palette->color_count);
+	return palette->colors[(color < palette->color_count) ? color
+		: palette->color_count - 1];
+}
+
+/*
+ * Sheets hold the whole grid of blobs with absolute node coordinates, for
+ * output passes that need to see every blob before writing.
+ */
+
+struct sheet_blob {
+	struct blob blob;
+	struct point_c offset;
+	const char *color;
+	unsigned int number;
+	unsigned int copy;
+	unsigned int color_id;
+};
+
+struct sheet {
+	struct sheet_blob *blobs;
+	unsigned int blob_count;
+};
+
+static void make_sheet(const struct grid_params *grid_params,
+	const struct blob_params *blob_params,
+	const struct field_params *field_params, const float *field,
+	const struct palette *palette, const unsigned int *render_order,
+	unsigned int seed, struct sheet *sheet)
+{
+	unsigned long long start = trace_begin();
+	unsigned int i;
+
+	sheet->blob_count = grid_params->columns * grid_params->rows;
+	sheet->blobs = mem_alloc((sheet->blob_count + 1)
+		* sizeof(*sheet->blobs));
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		struct sheet_blob *sb = &sheet->blobs[i];
+		struct blob_params cell_blob = *blob_params;
+		struct grid_params cell_grid = *grid_params;
+		struct grid_position pos;
+		unsigned int node;
+
+		pos.number = i;
+		pos.row = render_order[i] / grid_params->columns;
+		pos.column = render_order[i] % grid_params->columns;
+		sb->number = i;
+
+		random_seed_stream(seed, i);
+
+		if (field) {
+			sb->color = field_cell(field_params,
+				field[render_order[i]], palette, &cell_blob,
+				&cell_grid);
 		} else {
-			warn("No palette found in config file: '%s'\n",
-				cbd->config_file);
+			sb->color = palette_get_random(palette);
+		}
+
+		make_blob(&cell_blob, &sb->blob);
+		get_blob_offset(&cell_grid, &pos, &sb->offset);
+
+		for (node = 0; node < sb->blob.node_count; node++) {
+			sb->blob.nodes[node].x += sb->offset.x;
+			sb->blob.nodes[node].y += sb->offset.y;
+		}
+	}
+	trace_end("sheet", start);
+}
+
+static void free_sheet(struct sheet *sheet)
+{
+	unsigned int i;
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		free_blob(&sheet->blobs[i].blob);
+	}
+	mem_free(sheet->blobs);
+	sheet->blobs = NULL;
+	sheet->blob_count = 0;
+}
+
+static void write_sheet_blob(struct canvas *canvas,
+	const struct sheet_blob *sb)
+{
+	static const struct point_c origin = {0.0, 0.0};
+	char blob_id[256];
+
+	if (sb->copy) {
+		snprintf(blob_id, sizeof(blob_id), "blob_%u_%u", sb->number,
+			sb->copy);
+	} else {
+		snprintf(blob_id, sizeof(blob_id), "blob_%u", sb->number);
+	}
+
+	write_blob_path(canvas, blob_id, sb->color, &sb->blob, &origin, 0);
+}
+
+static void write_sheet(struct canvas *canvas, const struct sheet *sheet)
+{
+	unsigned int i;
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		write_sheet_blob(canvas, &sheet->blobs[i]);
+	}
+}
+
+/*
+ * Tiling: the sheet is wrapped onto a torus the size of the grid.  Each
+ * blob anchor is wrapped into the tile, then every blob crossing a tile
+ * edge gets copies shifted by the tile size so the tile repeats without
+ * seams.  Copies directly follow their blob to keep the paint order.
+ */
+
+static void tile_sheet(struct sheet *sheet, const struct svg_rect *tile)
+{
+	struct sheet_blob *tiled;
+	unsigned int tiled_count;
+	unsigned int tiled_alloc;
+	unsigned int i;
+
+	tiled_alloc = 4 * sheet->blob_count + 1;
+	tiled = mem_alloc(tiled_alloc * sizeof(*tiled));
+
+	for (i = 0, tiled_count = 0; i < sheet->blob_count; i++) {
+		struct sheet_blob *sb = &sheet->blobs[i];
+		struct point_c wrap;
+		struct bbox box;
+		unsigned int copy;
+		unsigned int node;
+		int r;
+		int c;
+
+		wrap.x = -floorf((sb->offset.x - tile->x) / tile->width)
+			* tile->width;
+		wrap.y = -floorf((sb->offset.y - tile->y) / tile->height)
+			* tile->height;
+
+		bbox_init(&box);
+		for (node = 0; node < sb->blob.node_count; node++) {
+			sb->blob.nodes[node].x += wrap.x;
+			sb->blob.nodes[node].y += wrap.y;
+			bbox_add(&box, &sb->blob.nodes[node]);
+		}
+		sb->offset.x += wrap.x;
+		sb->offset.y += wrap.y;
+
+		for (r = -1, copy = 0; r <= 1; r++) {
+			for (c = -1; c <= 1; c++) {
+				struct sheet_blob *out;
+				struct point_c shift;
+
+				shift.x = c * tile->width;
+				shift.y = r * tile->height;
+
+				if (box.x_max + shift.x <= tile->x
+					|| box.x_min + shift.x >= tile->x + tile->width
+					|| box.y_max + shift.y <= tile->y
+					|| box.y_min + shift.y >= tile->y + tile->height) {
+					continue;
+				}
+
+				if (tiled_count == tiled_alloc) {
+					tiled_alloc *= 2;
+					tiled = mem_realloc(tiled,
+						tiled_alloc * sizeof(*tiled));
+				}
+
+				out = &tiled[tiled_count++];
+				*out = *sb;
+				out->copy = copy++;
+				out->offset.x += shift.x;
+				out->offset.y += shift.y;
+				out->blob.nodes = mem_alloc(sb->blob.node_count
+					* sizeof(*out->blob.nodes));
+
+				for (node = 0; node < sb->blob.node_count;
+					node++) {
+					out->blob.nodes[node].x =
+						sb->blob.nodes[node].x + shift.x;
+					out->blob.nodes[node].y =
+						sb->blob.nodes[node].y + shift.y;
+				}
+			}
+		}
+	}
+
+	debug("%u blobs => %u tiled blobs\n", sheet->blob_count, tiled_count);
+
+	free_sheet(sheet);
+	sheet->blobs = tiled;
+	sheet->blob_count = tiled_count;
+}
+
+/*
+ * Neighbor coloring: blobs whose bounding circles touch are neighbors,
+ * copies of a tiled blob count as the blob itself.  Blobs are colored in
+ * paint order by a weighted random pick among the colors no neighbor has
+ * and that contrast enough with them.  The weights favor colors behind
+ * their palette share, so the palette proportions hold.
+ */
+
+struct neighbor_cb_data {
+	const struct sheet_blob *blobs;
+	const struct point_c *centers;
+	const float *radii;
+	unsigned int current;
+	unsigned int (*pairs)[2];
+	unsigned int pair_count;
+	unsigned int pair_alloc;
+};
+
+static void neighbor_cb(void *cb_data, unsigned int item)
+{
+	struct neighbor_cb_data *cbd = cb_data;
+	unsigned int a = cbd->current;
+	float dx = cbd->centers[a].x - cbd->centers[item].x;
+	float dy = cbd->centers[a].y - cbd->centers[item].y;
+	float r = cbd->radii[a] + cbd->radii[item];
+
+	if (item <= a || cbd->blobs[a].number == cbd->blobs[item].number
+		|| dx * dx + dy * dy >= r * r) {
+		return;
+	}
+
+	if (cbd->pair_count == cbd->pair_alloc) {
+		cbd->pair_alloc = cbd->pair_alloc ? 2 * cbd->pair_alloc : 1024;
+		cbd->pairs = mem_realloc(cbd->pairs,
+			cbd->pair_alloc * sizeof(*cbd->pairs));
+	}
+
+	cbd->pairs[cbd->pair_count][0] = cbd->blobs[a].number;
+	cbd->pairs[cbd->pair_count][1] = cbd->blobs[item].number;
+	cbd->pair_count++;
+}
+
+/* Undirected neighbor lists of the blob numbers, returns the count. */
+static unsigned int build_neighbor_graph(const struct sheet *sheet,
+	unsigned int **edge_start_out, unsigned int **edges_out)
+{
+	struct neighbor_cb_data cbd = {.blobs = sheet->blobs};
+	struct spatial_grid grid;
+	struct bbox *boxes;
+	struct point_c *centers;
+	float *radii;
+	unsigned int *edge_start;
+	unsigned int *edges;
+	unsigned int *fill;
+	unsigned int count = 0;
+	float radius_max = 0.0;
+	unsigned int i;
+
+	boxes = mem_alloc((sheet->blob_count + 1) * sizeof(*boxes));
+	centers = mem_alloc((sheet->blob_count + 1) * sizeof(*centers));
+	radii = mem_alloc((sheet->blob_count + 1) * sizeof(*radii));
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		const struct sheet_blob *sb = &sheet->blobs[i];
+		struct point_c p;
+		unsigned int node;
+
+		for (node = 0; node < sb->blob.node_count; node++) {
+			float dx = sb->blob.nodes[node].x - sb->offset.x;
+			float dy = sb->blob.nodes[node].y - sb->offset.y;
+
+			radii[i] = fmaxf(radii[i], sqrtf(dx * dx + dy * dy));
+		}
+		radius_max = fmaxf(radius_max, radii[i]);
+		centers[i] = sb->offset;
+
+		bbox_init(&boxes[i]);
+		p.x = sb->offset.x - radii[i];
+		p.y = sb->offset.y - radii[i];
+		bbox_add(&boxes[i], &p);
+		p.x = sb->offset.x + radii[i];
+		p.y = sb->offset.y + radii[i];
+		bbox_add(&boxes[i], &p);
+
+		count = (sb->number + 1 > count) ? sb->number + 1 : count;
+	}
+
+	cbd.centers = centers;
+	cbd.radii = radii;
+
+	spatial_grid_build(&grid, boxes, sheet->blob_count,
+		fmaxf(2.0 * radius_max, 1.0));
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		cbd.current = i;
+		spatial_grid_query(&grid, boxes, &boxes[i], neighbor_cb, &cbd);
+	}
+
+	spatial_grid_free(&grid);
+	mem_free(boxes);
+	mem_free(centers);
+	mem_free(radii);
+
+	edge_start = mem_alloc((count + 1) * sizeof(*edge_start));
+	edges = mem_alloc((2 * cbd.pair_count + 1) * sizeof(*edges));
+	fill = mem_alloc((count + 1) * sizeof(*fill));
+
+	for (i = 0; i < cbd.pair_count; i++) {
+		edge_start[cbd.pairs[i][0] + 1]++;
+		edge_start[cbd.pairs[i][1] + 1]++;
+	}
+	for (i = 0; i < count; i++) {
+		edge_start[i + 1] += edge_start[i];
+	}
+	for (i = 0; i < cbd.pair_count; i++) {
+		unsigned int a = cbd.pairs[i][0];
+		unsigned int b = cbd.pairs[i][1];
+
+		edges[edge_start[a] + fill[a]++] = b;
+		edges[edge_start[b] + fill[b]++] = a;
+	}
+
+	mem_free(fill);
+	if (cbd.pairs) {
+		mem_free(cbd.pairs);
+	}
+
+	debug("%u blobs, %u neighbor edges\n", count, cbd.pair_count);
+
+	*edge_start_out = edge_start;
+	*edges_out = edges;
+	return count;
+}
+
+static float color_contrast(const char *a, const char *b)
+{
+	unsigned int ca = strtoul(a + 1, NULL, 16);
+	unsigned int cb = strtoul(b + 1, NULL, 16);
+	float dr = (float)(ca >> 16 & 0xff) - (float)(cb >> 16 & 0xff);
+	float dg = (float)(ca >> 8 & 0xff) - (float)(cb >> 8 & 0xff);
+	float db = (float)(ca & 0xff) - (float)(cb & 0xff);
+
+	/* RGB distance, 0 for the same color to 1 for black and white. */
+	return sqrtf(dr * dr + dg * dg + db * db) / (255.0 * sqrtf(3.0));
+}
+
+static void color_neighbors(struct sheet *sheet, const struct palette *palette,
+	float min_contrast)
+{
+	const char **colors;
+	unsigned int *shares;
+	unsigned int *used;
+	bool *clash;
+	unsigned int *blob_color;
+	unsigned int *edge_start;
+	unsigned int *edges;
+	unsigned int *forbidden;
+	float *weights;
+	unsigned int color_count = 0;
+	unsigned int count;
+	unsigned int conflicts = 0;
+	unsigned int i;
+	unsigned int c;
+
+	colors = mem_alloc(palette->color_count * sizeof(*colors));
+	shares = mem_alloc(palette->color_count * sizeof(*shares));
+
+	for (i = 0; i < palette->color_count; i++) {
+		for (c = 0; c < color_count; c++) {
+			if (!strcmp(colors[c], palette->colors[i])) {
+				break;
+			}
+		}
+		if (c == color_count) {
+			colors[color_count++] = palette->colors[i];
+		}
+		shares[c]++;
+	}
+
+	/* Pairs of colors that can't be neighbors. */
+	clash = mem_alloc(color_count * color_count * sizeof(*clash));
+	for (i = 0; i < color_count; i++) {
+		for (c = 0; c < color_count; c++) {
+			clash[i * color_count + c] = (i == c) || color_contrast(
+				colors[i], colors[c]) < min_contrast;
+		}
+	}
+
+	count = build_neighbor_graph(sheet, &edge_start, &edges);
+
+	blob_color = mem_alloc((count + 1) * sizeof(*blob_color));
+	forbidden = mem_alloc(color_count * sizeof(*forbidden));
+	weights = mem_alloc(color_count * sizeof(*weights));
+	used = mem_alloc(color_count * sizeof(*used));
+
+	for (i = 0; i < count; i++) {
+		blob_color[i] = UINT_MAX;
+	}
+
+	for (i = 0; i < count; i++) {
+		unsigned int least = UINT_MAX;
+		float total = 0.0;
+		float pick;
+		unsigned int e;
+
+		/*
+		 * Count the colored neighbors each color would clash with,
+		 * a same color neighbor counting as many low contrast ones.
+		 */
+		memset(forbidden, 0, color_count * sizeof(*forbidden));
+		for (e = edge_start[i]; e < edge_start[i + 1]; e++) {
+			unsigned int n = blob_color[edges[e]];
+
+			if (n == UINT_MAX) {
+				continue;
+			}
+			for (c = 0; c < color_count; c++) {
+				forbidden[c] += clash[n * color_count + c];
+			}
+			forbidden[n] += 1U << 16;
+		}
+
+		/* With no clash free color take the least clashing ones. */
+		for (c = 0; c < color_count; c++) {
+			least = (forbidden[c] < least) ? forbidden[c] : least;
+		}
+		if (least) {
+			conflicts++;
+		}
+
+		for (c = 0; c < color_count; c++) {
+			float share = (float)shares[c] / palette->color_count;
+			float behind = share * (i + 1) - used[c];
+
+			weights[c] = (forbidden[c] != least) ? 0.0
+				: share * (1.0 + fmaxf(0.0, behind));
+			total += weights[c];
+		}
+
+		pick = random_float(0.0, total);
+		for (c = 0; c + 1 < color_count && pick >= weights[c]; c++) {
+			pick -= weights[c];
+		}
+		while (!weights[c]) {
+			c--;
+		}
+
+		blob_color[i] = c;
+		used[c]++;
+	}
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		sheet->blobs[i].color = colors[blob_color[sheet->blobs[i].number]];
+	}
+
+	if (conflicts) {
+		warn("%u blobs have no color contrasting with all their "
+			"neighbors.\n", conflicts);
+	}
+	debug("%u blobs, %u colors, %u conflicts\n", count, color_count,
+		conflicts);
+
+	mem_free(colors);
+	mem_free(shares);
+	mem_free(clash);
+	mem_free(blob_color);
+	mem_free(edge_start);
+	mem_free(edges);
+	mem_free(forbidden);
+	mem_free(weights);
+	mem_free(used);
+}
+
+/*
+ * Color merging: the sheet is re-ordered into runs of one color that are
+ * each written as a single compound path.  Only overlapping blobs of
+ * different colors constrain the order, so the runs come from a
+ * topological sort of that overlap graph that stays on the current color
+ * for as long as it can.  All blobs wind the same way, so the default
+ * nonzero fill rule gives the union of a run.
+ */
+
+struct overlap_graph {
+	unsigned int *edge_start;
+	unsigned int *edges;
+	unsigned int *in_count;
+};
+
+struct overlap_cb_data {
+	const struct sheet_blob *blobs;
+	unsigned int current;
+	unsigned int (*pairs)[2];
+	unsigned int pair_count;
+	unsigned int pair_alloc;
+};
+
+struct color_run {
+	unsigned int color_id;
+	unsigned int first;
+	unsigned int count;
+};
+
+static void overlap_cb(void *cb_data, unsigned int item)
+{
+	struct overlap_cb_data *cbd = cb_data;
+	const struct sheet_blob *a = &cbd->blobs[cbd->current];
+	const struct sheet_blob *b = &cbd->blobs[item];
+
+	if (item <= cbd->current || a->color_id == b->color_id) {
+		return;
+	}
+
+	if (!polygon_overlap(a->blob.nodes, a->blob.node_count,
+		b->blob.nodes, b->blob.node_count)) {
+		return;
+	}
+
+	if (cbd->pair_count == cbd->pair_alloc) {
+		cbd->pair_alloc = cbd->pair_alloc ? 2 * cbd->pair_alloc : 1024;
+		cbd->pairs = mem_realloc(cbd->pairs,
+			cbd->pair_alloc * sizeof(*cbd->pairs));
+	}
+
+	cbd->pairs[cbd->pair_count][0] = cbd->current;
+	cbd->pairs[cbd->pair_count][1] = item;
+	cbd->pair_count++;
+}
+
+static void build_overlap_graph(const struct sheet_blob *blobs,
+	unsigned int blob_count, float cell_size, struct overlap_graph *graph)
+{
+	struct overlap_cb_data cbd = {.blobs = blobs};
+	struct spatial_grid grid;
+	struct bbox *boxes;
+	unsigned int *fill;
+	unsigned int i;
+
+	boxes = mem_alloc(blob_count * sizeof(*boxes));
+
+	for (i = 0; i < blob_count; i++) {
+		unsigned int node;
+
+		bbox_init(&boxes[i]);
+		for (node = 0; node < blobs[i].blob.node_count; node++) {
+			bbox_add(&boxes[i], &blobs[i].blob.nodes[node]);
+		}
+	}
+
+	spatial_grid_build(&grid, boxes, blob_count, cell_size);
+
+	for (i = 0; i < blob_count; i++) {
+		cbd.current = i;
+		spatial_grid_query(&grid, boxes, &boxes[i], overlap_cb, &cbd);
+	}
+
+	spatial_grid_free(&grid);
+	mem_free(boxes);
+
+	graph->edge_start = mem_alloc((blob_count + 1)
+		* sizeof(*graph->edge_start));
+	graph->edges = mem_alloc((cbd.pair_count + 1) * sizeof(*graph->edges));
+	graph->in_count = mem_alloc(blob_count * sizeof(*graph->in_count));
+	fill = mem_alloc(blob_count * sizeof(*fill));
+
+	for (i = 0; i < cbd.pair_count; i++) {
+		graph->edge_start[cbd.pairs[i][0] + 1]++;
+		graph->in_count[cbd.pairs[i][1]]++;
+	}
+	for (i = 0; i < blob_count; i++) {
+		graph->edge_start[i + 1] += graph->edge_start[i];
+	}
+	for (i = 0; i < cbd.pair_count; i++) {
+		unsigned int from = cbd.pairs[i][0];
+
+		graph->edges[graph->edge_start[from] + fill[from]++] =
+			cbd.pairs[i][1];
+	}
+
+	mem_free(fill);
+	if (cbd.pairs) {
+		mem_free(cbd.pairs);
+	}
+
+	debug("%u blobs, %u overlap edges\n", blob_count, cbd.pair_count);
+}
+
+static void free_overlap_graph(struct overlap_graph *graph)
+{
+	mem_free(graph->edge_start);
+	mem_free(graph->edges);
+	mem_free(graph->in_count);
+}
+
+static unsigned int merge_colors(struct sheet_blob *blobs,
+	unsigned int blob_count, unsigned int color_count, float cell_size,
+	unsigned int *order, struct color_run *runs)
+{
+	struct overlap_graph graph;
+	unsigned int **ready;
+	unsigned int *ready_count;
+	unsigned int out;
+	unsigned int run_count;
+	unsigned int current;
+	unsigned int i;
+
+	build_overlap_graph(blobs, blob_count, cell_size, &graph);
+
+	/* One ready stack per color, each can hold every blob of its color. */
+	ready = mem_alloc(color_count * sizeof(*ready));
+	ready_count = mem_alloc(color_count * sizeof(*ready_count));
+
+	for (i = 0; i < blob_count; i++) {
+		ready_count[blobs[i].color_id]++;
+	}
+	for (i = 0; i < color_count; i++) {
+		ready[i] = mem_alloc((ready_count[i] + 1) * sizeof(**ready));
+		ready_count[i] = 0;
+	}
+
+	for (i = blob_count; i > 0; i--) {
+		unsigned int b = i - 1;
+
+		if (!graph.in_count[b]) {
+			unsigned int c = blobs[b].color_id;
+
+			ready[c][ready_count[c]++] = b;
+		}
+	}
+
+	current = blob_count ? blobs[0].color_id : 0;
+
+	for (out = 0, run_count = 0; out < blob_count; ) {
+		unsigned int b;
+
+		if (!ready_count[current]) {
+			unsigned int best = 0;
+
+			for (i = 1; i < color_count; i++) {
+				if (ready_count[i] > ready_count[best]) {
+					best = i;
+				}
+			}
+			assert(ready_count[best]);
+			current = best;
+		}
+
+		if (!run_count || runs[run_count - 1].color_id != current) {
+			runs[run_count].color_id = current;
+			runs[run_count].first = out;
+			runs[run_count].count = 0;
+			run_count++;
+		}
+
+		b = ready[current][--ready_count[current]];
+		order[out++] = b;
+		runs[run_count - 1].count++;
+
+		for (i = graph.edge_start[b]; i < graph.edge_start[b + 1]; i++) {
+			unsigned int next = graph.edges[i];
+
+			if (!--graph.in_count[next]) {
+				unsigned int c = blobs[next].color_id;
+
+				ready[c][ready_count[c]++] = next;
+			}
+		}
+	}
+
+	for (i = 0; i < color_count; i++) {
+		mem_free(ready[i]);
+	}
+	mem_free(ready);
+	mem_free(ready_count);
+	free_overlap_graph(&graph);
+
+	return run_count;
+}
+
+static void write_merged_blobs(struct canvas *canvas, struct sheet *sheet,
+	float cell_size)
+{
+	static const struct point_c origin = {0.0, 0.0};
+	const char **colors;
+	struct sheet_blob *blobs = sheet->blobs;
+	struct color_run *runs;
+	unsigned int *order;
+	unsigned int color_count;
+	unsigned int run_count;
+	unsigned int i;
+
+	colors = mem_alloc((sheet->blob_count + 1) * sizeof(*colors));
+
+	for (i = 0, color_count = 0; i < sheet->blob_count; i++) {
+		unsigned int c;
+
+		for (c = 0; c < color_count; c++) {
+			if (!strcmp(colors[c], blobs[i].color)) {
+				break;
+			}
+		}
+		if (c == color_count) {
+			colors[color_count++] = blobs[i].color;
+		}
+		blobs[i].color_id = c;
+	}
+
+	order = mem_alloc((sheet->blob_count + 1) * sizeof(*order));
+	runs = mem_alloc((sheet->blob_count + 1) * sizeof(*runs));
+
+	run_count = merge_colors(blobs, sheet->blob_count, color_count,
+		cell_size, order, runs);
+
+	for (i = 0; i < run_count; i++) {
+		char path_id[256];
+		unsigned int j;
+
+		snprintf(path_id, sizeof(path_id), "blobs_%u", i);
+
+		canvas_open_path(canvas, path_id, colors[runs[i].color_id],
+			0);
+
+		for (j = 0; j < runs[i].count; j++) {
+			const struct blob *blob =
+				&blobs[order[runs[i].first + j]].blob;
+
+			write_blob_subpath(canvas, blob, &origin);
+		}
+
+		canvas_close_path(canvas);
+	}
+
+	log("Merged %u blobs into %u paths, %u fewer elements.\n",
+		sheet->blob_count, run_count, sheet->blob_count - run_count);
+
+	mem_free(colors);
+	mem_free(order);
+	mem_free(runs);
+}
+
+/*
+ * Digital camo: a pixel color field built coarse to fine.  The coarsest
+ * blocks get random palette colors, then each finer scale copies the
+ * color of a random neighbour block into some of its blocks, which
+ * breaks up the block edges.  Neighbours wrap around, so the field tiles.
+ * Same color pixels are merged into rectangles, run-length per row, then
+ * runs that match the row above extend its rectangles.  Each color is
+ * written as one compound path of its rectangles.
+ */
+
+struct pixel_field {
+	unsigned int columns;
+	unsigned int rows;
+	unsigned int *cells;
+	const char **colors;
+	unsigned int color_count;
+};
+
+struct pixel_rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned int color;
+};
+
+static const float pixel_copy_chance = 0.4;
+
+static unsigned int pixel_color_id(struct pixel_field *field,
+	const char *color)
+{
+	unsigned int c;
+
+	for (c = 0; c < field->color_count; c++) {
+		if (!strcmp(field->colors[c], color)) {
+			return c;
+		}
+	}
+	field->colors[field->color_count] = color;
+	return field->color_count++;
+}
+
+static void make_pixel_field(const struct pixel_params *pixel_params,
+	const struct palette *palette, unsigned int columns, unsigned int rows,
+	struct pixel_field *field)
+{
+	static const int neighbours[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+	unsigned int *prev;
+	unsigned int block = 1U << (pixel_params->scales - 1);
+	unsigned int x;
+	unsigned int y;
+
+	field->columns = columns;
+	field->rows = rows;
+	field->cells = mem_alloc(columns * rows
+		* sizeof(*field->cells));
+	field->colors = mem_alloc(palette->color_count
+		* sizeof(*field->colors));
+	field->color_count = 0;
+	prev = mem_alloc(columns * rows * sizeof(*prev));
+
+	for (y = 0; y < rows; y += block) {
+		for (x = 0; x < columns; x += block) {
+			unsigned int c = pixel_color_id(field,
+				palette_get_random(palette));
+			unsigned int i;
+			unsigned int j;
+
+			for (j = y; j < y + block && j < rows; j++) {
+				for (i = x; i < x + block && i < columns; i++) {
+					field->cells[j * columns + i] = c;
+				}
+			}
+		}
+	}
+
+	for (block /= 2; block; block /= 2) {
+		memcpy(prev, field->cells,
+			columns * rows * sizeof(*prev));
+
+		for (y = 0; y < rows; y += block) {
+			for (x = 0; x < columns; x += block) {
+				const int *n = neighbours[random_unsigned(0, 3)];
+				unsigned int src_x;
+				unsigned int src_y;
+				unsigned int c;
+				unsigned int i;
+				unsigned int j;
+
+				if (random_float(0.0, 1.0) >= pixel_copy_chance) {
+					continue;
+				}
+
+				src_x = (x + columns + n[0] * block) % columns;
+				src_y = (y + rows + n[1] * block) % rows;
+				c = prev[src_y * columns + src_x];
+
+				for (j = y; j < y + block && j < rows; j++) {
+					for (i = x; i < x + block && i < columns;
+						i++) {
+						field->cells[j * columns + i] = c;
+					}
+				}
+			}
+		}
+	}
+
+	mem_free(prev);
+}
+
+static void free_pixel_field(struct pixel_field *field)
+{
+	mem_free(field->cells);
+	mem_free(field->colors);
+	field->cells = NULL;
+	field->colors = NULL;
+}
+
+static unsigned int merge_pixels(const struct pixel_field *field,
+	struct pixel_rect **rects_out)
+{
+	struct pixel_rect *rects;
+	unsigned int *open;
+	unsigned int *next_open;
+	unsigned int *swap;
+	unsigned int open_count = 0;
+	unsigned int rect_count = 0;
+	unsigned int rect_alloc = field->columns + 1;
+	unsigned int y;
+
+	rects = mem_alloc(rect_alloc * sizeof(*rects));
+	open = mem_alloc((field->columns + 1) * sizeof(*open));
+	next_open = mem_alloc((field->columns + 1) * sizeof(*next_open));
+
+	for (y = 0; y < field->rows; y++) {
+		const unsigned int *row = &field->cells[y * field->columns];
+		unsigned int next_count = 0;
+		unsigned int o = 0;
+		unsigned int x = 0;
+
+		while (x < field->columns) {
+			unsigned int start = x;
+
+			while (x < field->columns && row[x] == row[start]) {
+				x++;
+			}
+
+			/* Open rectangles and runs are both sorted by x. */
+			while (o < open_count && rects[open[o]].x < start) {
+				o++;
+			}
+
+			if (o < open_count && rects[open[o]].x == start
+				&& rects[open[o]].width == x - start
+				&& rects[open[o]].color == row[start]) {
+				rects[open[o]].height++;
+				next_open[next_count++] = open[o++];
+				continue;
+			}
+
+			if (rect_count == rect_alloc) {
+				rect_alloc *= 2;
+				rects = mem_realloc(rects,
+					rect_alloc * sizeof(*rects));
+			}
+			rects[rect_count] = (struct pixel_rect){
+				.x = start,
+				.y = y,
+				.width = x - start,
+				.height = 1,
+				.color = row[start],
+			};
+			next_open[next_count++] = rect_count++;
+		}
+
+		swap = open;
+		open = next_open;
+		next_open = swap;
+		open_count = next_count;
+	}
+
+	mem_free(open);
+	mem_free(next_open);
+
+	*rects_out = rects;
+	return rect_count;
+}
+
+static void write_digital(struct canvas *canvas,
+	const struct pixel_params *pixel_params, const struct palette *palette,
+	const struct svg_rect *area)
+{
+	unsigned int block = 1U << (pixel_params->scales - 1);
+	struct pixel_field field;
+	struct pixel_rect *rects;
+	unsigned int rect_count;
+	unsigned int columns;
+	unsigned int rows;
+	float pixel_width;
+	float pixel_height;
+	unsigned int c;
+
+	/* Whole coarse blocks, so the field wraps at the area edges. */
+	columns = block * (unsigned int)fmaxf(1.0,
+		roundf(area->width / (pixel_params->size * block)));
+	rows = block * (unsigned int)fmaxf(1.0,
+		roundf(area->height / (pixel_params->size * block)));
+	pixel_width = area->width / columns;
+	pixel_height = area->height / rows;
+
+	make_pixel_field(pixel_params, palette, columns, rows, &field);
+	rect_count = merge_pixels(&field, &rects);
+
+	for (c = 0; c < field.color_count; c++) {
+		char path_id[256];
+		unsigned int i;
+
+		snprintf(path_id, sizeof(path_id), "pixels_%u", c);
+
+		canvas_open_path(canvas, path_id, field.colors[c], 0);
+
+		for (i = 0; i < rect_count; i++) {
+			const struct pixel_rect *r = &rects[i];
+			double x0 = area->x + r->x * pixel_width;
+			double y0 = area->y + r->y * pixel_height;
+			double x1 = x0 + r->width * pixel_width;
+			double y1 = y0 + r->height * pixel_height;
+
+			if (r->color != c) {
+				continue;
+			}
+			canvas_move_to(canvas, x0, y0);
+			canvas_line_to(canvas, x1, y0);
+			canvas_line_to(canvas, x1, y1);
+			canvas_line_to(canvas, x0, y1);
+			canvas_close_subpath(canvas);
+		}
+
+		canvas_close_path(canvas);
+	}
+
+	log("Merged %u pixels into %u rectangles, %u paths.\n",
+		columns * rows, rect_count, field.color_count);
+
+	mem_free(rects);
+	free_pixel_field(&field);
+}
+
+/*
+ * Voronoi camo: one cell per grid seed, each seed placed like a blob
+ * anchor but from a hash of its grid position, so any seed can be found
+ * again without storing the diagram.  A cell starts as the output area
+ * and is clipped by the bisector of each neighbour seed, moved in by half
+ * the gap, ring by ring outward.  Once the cell is smaller than the
+ * distance to the next ring it is final, so every cell costs about the
+ * same and cells are written as they are made.
+ */
+
+struct voronoi {
+	const struct grid_params *grid_params;
+	const struct cell_params *cell_params;
+	const struct palette *palette;
+	const struct svg_rect *area;
+	uint32_t seed;
+	bool wrap;
+};
+
+static uint32_t cell_hash_mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x7feb352dU;
+	h ^= h >> 15;
+	h *= 0x846ca68bU;
+	h ^= h >> 16;
+	return h;
+}
+
+static uint32_t cell_hash(const struct voronoi *v, int column, int row,
+	uint32_t k)
+{
+	if (v->wrap) {
+		int columns = (int)v->grid_params->columns;
+		int rows = (int)v->grid_params->rows;
+
+		column = ((column % columns) + columns) % columns;
+		row = ((row % rows) + rows) % rows;
+	}
+
+	return cell_hash_mix(cell_hash_mix(cell_hash_mix(v->seed
+		+ (uint32_t)column) + (uint32_t)row) + k);
+}
+
+static double cell_hash_unit(uint32_t h)
+{
+	return (h >> 8) * (1.0 / 16777216.0);
+}
+
+static void voronoi_seed(const struct voronoi *v, int column, int row,
+	struct point_d *p)
+{
+	p->x = column * v->grid_params->width + cell_hash_unit(cell_hash(v,
+		column, row, 0)) * v->grid_params->wiggle;
+	p->y = row * v->grid_params->width + cell_hash_unit(cell_hash(v,
+		column, row, 1)) * v->grid_params->wiggle;
+}
+
+/* Keep the part of in where p.n <= limit. */
+static void clip_half_plane(const struct ring *in, struct ring *out,
+	const struct point_d *n, double limit)
+{
+	unsigned int i;
+
+	out->count = 0;
+
+	for (i = 0; i < in->count; i++) {
+		const struct point_d *a = &in->points[i];
+		const struct point_d *b = &in->points[(i + 1) % in->count];
+		double da = a->x * n->x + a->y * n->y - limit;
+		double db = b->x * n->x + b->y * n->y - limit;
+
+		if (da <= 0.0) {
+			ring_add(out, a->x, a->y);
+		}
+		if ((da < 0.0 && db > 0.0) || (da > 0.0 && db < 0.0)) {
+			double t = da / (da - db);
+
+			ring_add(out, a->x + t * (b->x - a->x),
+				a->y + t * (b->y - a->y));
+		}
+	}
+}
+
+static void make_cell(const struct voronoi *v, int column, int row,
+	struct ring *cell, struct ring *tmp)
+{
+	const float width = v->grid_params->width;
+	const float gap = v->cell_params->gap;
+	struct point_d s;
+	int k;
+
+	voronoi_seed(v, column, row, &s);
+
+	cell->count = 0;
+	ring_add(cell, v->area->x, v->area->y);
+	ring_add(cell, v->area->x + v->area->width, v->area->y);
+	ring_add(cell, v->area->x + v->area->width,
+		v->area->y + v->area->height);
+	ring_add(cell, v->area->x, v->area->y + v->area->height);
+
+	for (k = 1; cell->count; k++) {
+		double r_max = 0.0;
+		unsigned int i;
+		int dc;
+		int dr;
+
+		for (dr = -k; dr <= k; dr++) {
+			for (dc = -k; dc <= k; dc += (abs(dr) == k) ? 1 : 2 * k) {
+				struct point_d t;
+				struct point_d n;
+				struct ring swap;
+				double len;
+
+				voronoi_seed(v, column + dc, row + dr, &t);
+				n.x = t.x - s.x;
+				n.y = t.y - s.y;
+				len = sqrt(n.x * n.x + n.y * n.y);
+
+				clip_half_plane(cell, tmp, &n,
+					((t.x * t.x + t.y * t.y)
+					- (s.x * s.x + s.y * s.y)) / 2.0
+					- gap / 2.0 * len);
+
+				swap = *cell;
+				*cell = *tmp;
+				*tmp = swap;
+			}
+		}
+
+		for (i = 0; i < cell->count; i++) {
+			double dx = cell->points[i].x - s.x;
+			double dy = cell->points[i].y - s.y;
+
+			r_max = fmax(r_max, dx * dx + dy * dy);
+		}
+
+		/* Seeds of the next ring are at least this far away. */
+		if (2.0 * sqrt(r_max) + gap
+			<= (k + 1) * width - v->grid_params->wiggle) {
+			break;
+		}
+	}
+}
+
+static void write_cell_subpath(struct canvas *canvas, const struct ring *cell,
+	float smooth)
+{
+	unsigned int i;
+
+	if (smooth <= 0.0) {
+		for (i = 0; i < cell->count; i++) {
+			if (i) {
+				canvas_line_to(canvas, cell->points[i].x,
+					cell->points[i].y);
+			} else {
+				canvas_move_to(canvas, cell->points[i].x,
+					cell->points[i].y);
+			}
+		}
+		canvas_close_subpath(canvas);
+		return;
+	}
+
+	/* Round each corner with a quadratic through the edge points. */
+	for (i = 0; i <= cell->count; i++) {
+		const struct point_d *p = &cell->points[i % cell->count];
+		const struct point_d *prev = &cell->points[(i + cell->count - 1)
+			% cell->count];
+		const struct point_d *next = &cell->points[(i + 1)
+			% cell->count];
+		struct point_d a;
+		struct point_d b;
+
+		a.x = p->x + (prev->x - p->x) * smooth / 2.0;
+		a.y = p->y + (prev->y - p->y) * smooth / 2.0;
+		b.x = p->x + (next->x - p->x) * smooth / 2.0;
+		b.y = p->y + (next->y - p->y) * smooth / 2.0;
+
+		if (!i) {
+			canvas_move_to(canvas, b.x, b.y);
+			continue;
+		}
+		canvas_line_to(canvas, a.x, a.y);
+		canvas_quad_to(canvas, p->x, p->y, b.x, b.y);
+	}
+	canvas_close_subpath(canvas);
+}
+
+static void write_voronoi(struct canvas *canvas, const struct opts *opts,
+	const struct palette *palette, const struct svg_rect *area)
+{
+	const struct grid_params *grid_params = &opts->grid_params;
+	const bool merge = (opts->merge_colors == opt_yes);
+	struct voronoi v = {
+		.grid_params = grid_params,
+		.cell_params = &opts->cell_params,
+		.palette = palette,
+		.area = area,
+		.seed = random_next(),
+		.wrap = (opts->tile == opt_yes),
+	};
+	struct ring *cells;
+	unsigned int *cell_colors;
+	unsigned int *first_color;
+	struct ring tmp = {0};
+	unsigned long cell_count = 0;
+	unsigned long path_count = 0;
+	unsigned int row_alloc;
+	int column_min;
+	int column_max;
+	int row_min;
+	int row_max;
+	int column;
+	int row;
+	unsigned int i;
+
+	/* Seeds whose cells can reach into the area. */
+	column_min = (int)floorf((area->x - grid_params->wiggle)
+		/ grid_params->width) - 2;
+	column_max = (int)ceilf((area->x + area->width) / grid_params->width)
+		+ 2;
+	row_min = (int)floorf((area->y - grid_params->wiggle)
+		/ grid_params->width) - 2;
+	row_max = (int)ceilf((area->y + area->height) / grid_params->width)
+		+ 2;
+
+	/* Merged cells are held a row at a time, then written by color. */
+	row_alloc = merge ? (unsigned int)(column_max - column_min + 1) : 1U;
+	cells = mem_alloc(row_alloc * sizeof(*cells));
+	memset(cells, 0, row_alloc * sizeof(*cells));
+	cell_colors = mem_alloc(row_alloc * sizeof(*cell_colors));
+	first_color = mem_alloc(palette->color_count * sizeof(*first_color));
+
+	for (i = 0; i < palette->color_count; i++) {
+		unsigned int j = 0;
+
+		while (strcmp(palette->colors[j], palette->colors[i])) {
+			j++;
+		}
+		first_color[i] = j;
+	}
+
+	for (row = row_min; row <= row_max; row++) {
+		unsigned int n = 0;
+
+		for (column = column_min; column <= column_max; column++) {
+			unsigned int c = cell_hash(&v, column, row, 2)
+				% palette->color_count;
+			char path_id[256];
+
+			make_cell(&v, column, row, &cells[n], &tmp);
+
+			if (cells[n].count < 3) {
+				continue;
+			}
+			cell_count++;
+
+			if (merge) {
+				cell_colors[n++] = first_color[c];
+				continue;
+			}
+
+			snprintf(path_id, sizeof(path_id), "cell_%d_%d", column,
+				row);
+			canvas_open_path(canvas, path_id, palette->colors[c],
+				0);
+			write_cell_subpath(canvas, &cells[0],
+				opts->cell_params.smooth);
+			canvas_close_path(canvas);
+			path_count++;
+		}
+
+		if (!merge) {
+			continue;
+		}
+
+		/* One path per color and row keeps the output streaming. */
+		for (i = 0; i < palette->color_count; i++) {
+			char path_id[256];
+			unsigned int j;
+
+			if (first_color[i] != i) {
+				continue;
+			}
+			for (j = 0; j < n && cell_colors[j] != i; j++) {
+			}
+			if (j == n) {
+				continue;
+			}
+
+			snprintf(path_id, sizeof(path_id), "cells_%d_%u", row,
+				i);
+			canvas_open_path(canvas, path_id, palette->colors[i],
+				0);
+			for (; j < n; j++) {
+				if (cell_colors[j] == i) {
+					write_cell_subpath(canvas, &cells[j],
+						opts->cell_params.smooth);
+				}
+			}
+			canvas_close_path(canvas);
+			path_count++;
+		}
+	}
+
+	log("Wrote %lu cells in %lu paths.\n", cell_count, path_count);
+
+	for (i = 0; i < row_alloc; i++) {
+		if (cells[i].points) {
+			mem_free(cells[i].points);
+		}
+	}
+	mem_free(cells);
+	mem_free(cell_colors);
+	mem_free(first_color);
+	if (tmp.points) {
+		mem_free(tmp.points);
+	}
+}
+
+static void write_background(struct canvas *canvas,
+	const struct svg_rect *background_rect, const char *fill_color)
+{
+	assert(is_hex_color(fill_color));
+
+	canvas_open_group(canvas, "background");
+	canvas_rect(canvas, "background", fill_color, background_rect);
+	canvas_close_group(canvas);
+}
+
+/* The page, a template's or the grid with a border of one cell. */
+static void get_background_rect(const struct opts *opts,
+	struct svg_rect *background_rect)
+{
+	const struct grid_params *grid_params = &opts->grid_params;
+
+	if (opts->page_rect.width > 0.0) {
+		*background_rect = opts->page_rect;
+		return;
+	}
+
+	background_rect->width = (2 + grid_params->columns)
+		* grid_params->width;
+	background_rect->height = (2 + grid_params->rows) * grid_params->width;
+
+	background_rect->x = -grid_params->width;
+	background_rect->y = -grid_params->width;
+	background_rect->rx = 50.0;
+}
+
+static int write_output(struct canvas *canvas, const struct opts *opts,
+	const struct palette *palette)
+{
+	const struct grid_params *grid_params = &opts->grid_params;
+	const struct blob_params *blob_params = &opts->blob_params;
+	unsigned int i;
+	unsigned int *render_order;
+	struct grid_position pos;
+	struct svg_rect background_rect;
+	struct svg_rect tile_rect;
+	struct blob *library = NULL;
+	float *field = NULL;
+	unsigned int band_start = 0;
+	unsigned int band_end = grid_params->rows;
+
+	render_order = NULL;
+
+	if (opts->shard_count) {
+		band_start = grid_params->rows * (opts->shard - 1)
+			/ opts->shard_count;
+		band_end = grid_params->rows * opts->shard / opts->shard_count;
+	}
+
+	get_background_rect(opts, &background_rect);
+
+	tile_rect.width = grid_params->columns * grid_params->width;
+	tile_rect.height = grid_params->rows * grid_params->width;
+	tile_rect.x = 0.0;
+	tile_rect.y = 0.0;
+	tile_rect.rx = 0.0;
+
+	if (canvas_open(canvas,
+		(opts->tile == opt_yes) ? &tile_rect : &background_rect)) {
+		canvas_close(canvas);
+		return -1;
+	}
+
+	if (opts->tile == opt_yes) {
+		canvas_open_tile(canvas, &tile_rect);
+
+		if (opts->background) {
+			canvas_rect(canvas, "background", "#000099",
+				&tile_rect);
+		}
+	} else {
+		if (opts->background) {
+			//write_background(canvas, &background_rect, "#001aff");
+			write_background(canvas, &background_rect, "#000099");
+		}
+
+		if (blob_params->instance_count) {
+			library = make_library(blob_params);
+			write_library(canvas, blob_params, library);
+		}
+
+		canvas_open_group(canvas, "camo_blobs");
+	}
+
+	if (opts->style == style_digital) {
+		write_digital(canvas, &opts->pixel_params, palette,
+			(opts->tile == opt_yes) ? &tile_rect : &background_rect);
+		goto done;
+	}
+	if (opts->style == style_voronoi) {
+		write_voronoi(canvas, opts, palette,
+			(opts->tile == opt_yes) ? &tile_rect : &background_rect);
+		goto done;
+	}
+
+	render_order = random_array(grid_params->columns * grid_params->rows);
+
+	if (field_enabled(&opts->field_params)) {
+		field = make_field(&opts->field_params, grid_params);
+	}
+
+	if (opts->merge_colors == opt_yes || opts->tile == opt_yes
+		|| opts->neighbor_colors == opt_yes) {
+		struct sheet sheet;
+
+		make_sheet(grid_params, blob_params, &opts->field_params, field,
+			palette, render_order, opts->seed, &sheet);
+
+		if (opts->tile == opt_yes) {
+			tile_sheet(&sheet, &tile_rect);
+		}
+
+		if (opts->neighbor_colors == opt_yes) {
+			color_neighbors(&sheet, palette, opts->min_contrast);
+		}
+
+		if (opts->merge_colors == opt_yes) {
+			write_merged_blobs(canvas, &sheet,
+				2.0 * blob_params->radius_max);
+		} else {
+			write_sheet(canvas, &sheet);
+		}
+
+		free_sheet(&sheet);
+		goto done;
+	}
+
+	for (i = 0; i < grid_params->columns * grid_params->rows; i++) {
+		struct blob_params cell_blob = *blob_params;
+		struct grid_params cell_grid = *grid_params;
+		const char *color;
+
+		pos.number = i;
+		pos.row = render_order[i] / grid_params->columns;
+		pos.column = render_order[i] % grid_params->columns;
+
+		if (pos.row < band_start || pos.row >= band_end) {
+			continue;
+		}
+
+		random_seed_stream(opts->seed, i);
+
+		if (field) {
+			color = field_cell(&opts->field_params,
+				field[render_order[i]], palette, &cell_blob,
+				&cell_grid);
+		} else {
+			color = palette_get_random(palette);
+		}
+
+		//debug("%u: (%u) = %u, %u\n", i, render_order[i], pos.column, pos.row);
+		if (library) {
+			write_instance(canvas, &cell_grid, blob_params,
+				library, color, &pos);
+		} else {
+			write_blob(canvas, &cell_grid, &cell_blob, color,
+				&pos);
+		}
+	}
+
+done:
+	if (render_order) {
+		mem_free(render_order);
+	}
+	if (field) {
+		mem_free(field);
+	}
+
+	if (library) {
+		free_library(blob_params, library);
+	}
+
+	if (opts->tile == opt_yes) {
+		canvas_close_tile(canvas, &tile_rect);
+	} else {
+		canvas_close_group(canvas);
+	}
+
+	return canvas_close(canvas);
+}
+
+struct config_cb_data {
+	const char *config_file;
+	struct blob_params *blob_params;
+	struct grid_params *grid_params;
+	struct pixel_params *pixel_params;
+	struct cell_params *cell_params;
+	struct field_params *field_params;
+	enum camo_style *style;
+	struct palette* palette;
+	struct color_data *color_data;
+	unsigned color_counter;
+	unsigned color_alloc;
+};
+
+static int config_cb(void *cb_data, const struct config_line *line,
+	struct config_error *err)
+{
+	struct config_cb_data *cbd = cb_data;
+	const struct config_str *name = &line->name;
+
+	if (!strcmp(line->section, "[params]")) {
+		if (line->sep != '=') {
+			return config_set_error(err, line, line->text.p,
+				"expected '<name> = <value>'");
+		}
+
+		/* Options given on the command line win. */
+		if (cbd->blob_params->node_count_min ==
+			init_blob_params.node_count_min &&
+			config_str_eq(name, "blob_node_count_min")) {
+			return config_get_unsigned(line,
+				&cbd->blob_params->node_count_min, err);
+		}
+		if (cbd->blob_params->node_count_max ==
+			init_blob_params.node_count_max &&
+			config_str_eq(name, "blob_node_count_max")) {
+			return config_get_unsigned(line,
+				&cbd->blob_params->node_count_max, err);
+		}
+		if (cbd->blob_params->radius_min ==
+			init_blob_params.radius_min &&
+			config_str_eq(name, "blob_radius_min")) {
+			return config_get_float(line,
+				&cbd->blob_params->radius_min, err);
+		}
+		if (cbd->blob_params->radius_max ==
+			init_blob_params.radius_max &&
+			config_str_eq(name, "blob_radius_max")) {
+			return config_get_float(line,
+				&cbd->blob_params->radius_max, err);
+		}
+		if (cbd->blob_params->sector_min ==
+			init_blob_params.sector_min &&
+			config_str_eq(name, "blob_sector_min")) {
+			return config_get_float(line,
+				&cbd->blob_params->sector_min, err);
+		}
+		if (cbd->blob_params->instance_count ==
+			init_blob_params.instance_count &&
+			config_str_eq(name, "blob_instances")) {
+			return config_get_unsigned(line,
+				&cbd->blob_params->instance_count, err);
+		}
+		if (cbd->grid_params->columns == init_grid_params.columns &&
+			config_str_eq(name, "grid_columns")) {
+			return config_get_unsigned(line,
+				&cbd->grid_params->columns, err);
+		}
+		if (cbd->grid_params->rows == init_grid_params.rows &&
+			config_str_eq(name, "grid_rows")) {
+			return config_get_unsigned(line,
+				&cbd->grid_params->rows, err);
+		}
+		if (cbd->grid_params->width == init_grid_params.width &&
+			config_str_eq(name, "grid_width")) {
+			return config_get_float(line,
+				&cbd->grid_params->width, err);
+		}
+		if (cbd->grid_params->wiggle == init_grid_params.wiggle &&
+			config_str_eq(name, "grid_wiggle")) {
+			return config_get_float(line,
+				&cbd->grid_params->wiggle, err);
+		}
+		if (cbd->pixel_params->size == init_pixel_params.size &&
+			config_str_eq(name, "pixel_size")) {
+			return config_get_float(line,
+				&cbd->pixel_params->size, err);
+		}
+		if (cbd->pixel_params->scales == init_pixel_params.scales &&
+			config_str_eq(name, "pixel_scales")) {
+			return config_get_unsigned(line,
+				&cbd->pixel_params->scales, err);
+		}
+		if (cbd->cell_params->gap == init_cell_params.gap &&
+			config_str_eq(name, "cell_gap")) {
+			return config_get_float(line,
+				&cbd->cell_params->gap, err);
+		}
+		if (cbd->cell_params->smooth == init_cell_params.smooth &&
+			config_str_eq(name, "cell_smooth")) {
+			return config_get_float(line,
+				&cbd->cell_params->smooth, err);
+		}
+		if (*cbd->style == style_undef && config_str_eq(name, "style")) {
+			char style[16];
+
+			if (config_get_str(line, style, sizeof(style), err)) {
+				return -1;
+			}
+			*cbd->style = style_parse(style);
+			if (*cbd->style == style_undef) {
+				return config_set_error(err, line,
+					line->value.p, "bad style '%s'", style);
+			}
+		}
+
+		return 0;
+	}
+
+	if (!strcmp(line->section, "[field]")) {
+		struct field_params *fp = cbd->field_params;
+		int result;
+
+		if (line->sep != '=') {
+			return config_set_error(err, line, line->text.p,
+				"expected '<name> = <value>'");
+		}
+
+		if (config_str_eq(name, "scale")) {
+			result = config_get_float(line, &fp->scale, err);
+		} else if (config_str_eq(name, "octaves")) {
+			result = config_get_unsigned(line, &fp->octaves, err);
+		} else if (config_str_eq(name, "noise")) {
+			result = config_get_float(line, &fp->noise, err);
+		} else if (config_str_eq(name, "gradient_x")) {
+			result = config_get_float(line, &fp->gradient_x, err);
+		} else if (config_str_eq(name, "gradient_y")) {
+			result = config_get_float(line, &fp->gradient_y, err);
+		} else if (config_str_eq(name, "radial")) {
+			result = config_get_float(line, &fp->radial, err);
+		} else if (config_str_eq(name, "radius")) {
+			result = config_get_float(line, &fp->radius, err);
+		} else if (config_str_eq(name, "nodes")) {
+			result = config_get_float(line, &fp->nodes, err);
+		} else if (config_str_eq(name, "wiggle")) {
+			result = config_get_float(line, &fp->wiggle, err);
+		} else if (config_str_eq(name, "palette")) {
+			result = config_get_float(line, &fp->palette, err);
+		} else {
+			return config_set_error(err, line, name->p,
+				"unknown name '%.*s'", (int)name->len, name->p);
+		}
+
+		if (result) {
+			return result;
+		}
+		if (fp->scale <= 0.0 || !fp->octaves
+			|| fp->palette < 0.0 || fp->palette > 1.0) {
+			return config_set_error(err, line, line->value.p,
+				"bad %.*s value '%.*s'", (int)name->len,
+				name->p, (int)line->value.len, line->value.p);
+		}
+		return 0;
+	}
+
+	if (!strcmp(line->section, "[palette]")) {
+		struct color_data *cd;
+
+		if (line->sep != ',' || !line->value.len) {
+			return config_set_error(err, line, line->text.p,
+				"expected '<weight>, <hex color>'");
+		}
+		if (line->value.len != hex_color_len - 1
+			|| !is_hex_color(line->value.p)) {
+			return config_set_error(err, line, line->value.p,
+				"bad hex color '%.*s'", (int)line->value.len,
+				line->value.p);
+		}
+
+		/* Imported palettes can have thousands of colors. */
+		if (cbd->color_counter == cbd->color_alloc) {
+			cbd->color_alloc = cbd->color_alloc
+				? 2 * cbd->color_alloc : 32;
+			cbd->color_data = mem_realloc(cbd->color_data,
+				sizeof(*cbd->color_data) * cbd->color_alloc);
+		}
+		cd = &cbd->color_data[cbd->color_counter];
+
+		if (config_str_unsigned(line, name, &cd->weight, err)) {
+			return -1;
+		}
+		memcpy(cd->value, line->value.p, hex_color_len - 1);
+		cd->value[hex_color_len - 1] = 0;
+		cbd->color_counter++;
+
+		return 0;
+	}
+
+	if (!strcmp(line->section, "ON_EXIT")) {
+		if (cbd->color_data) {
+			palette_fill(cbd->palette, cbd->color_data,
+				cbd->color_counter);
+			mem_free(cbd->color_data);
+			cbd->color_data = NULL;
+		} else {
+			warn("No palette found in config file: '%s'\n",
+				cbd->config_file);
+		}
+		
+		return 0;
+	}
+	
+	assert(0);
+	return -1;
+}
+
+static const struct color_data default_colors[] = {
+	{2, "#eeffff"},
+	{2, "#bbbbbb"},
+	{2, "#777777"},
+	{1, "#97dcff"},
+	{1, "#a3a3a3"},
+	{2, "#00bbff"},
+	{2, "#009aff"},
+	{2, "#0077ff"},
+	{1, "#004dff"},
+	{1, "#003473"},
+	{2, "#0000bb"},
+	{2, "#000077"},
+	{2, "#000011"},
+
+	//{2, "#ff0000"},
+	//{2, "#00ff00"},
+	//{2, "#ffff00"},
+	//{2, "#ff8800"},
+	//{2, "#888800"},
+	//{2, "#88ff00"},
+
+};
+
+static int get_config_opts(struct opts *opts, struct palette *palette)
+{
+	static const char *sections[] = {
+		"[params]",
+		"[field]",
+		"[palette]",
+	};
+	struct config_cb_data cbd = {
+		.config_file = opts->config_file,
+		.blob_params = &opts->blob_params,
+		.grid_params = &opts->grid_params,
+		.pixel_params = &opts->pixel_params,
+		.cell_params = &opts->cell_params,
+		.field_params = &opts->field_params,
+		.style = &opts->style,
+		.palette = palette,
+	};
+	struct config_error err;
+
+	if (config_process_file(opts->config_file, config_cb, &cbd, sections,
+		sizeof(sections)/sizeof(sections[0]), &err)) {
+		if (cbd.color_data) {
+			mem_free(cbd.color_data);
+		}
+		error("%s:%u:%u: %s\n", err.file, err.line, err.col, err.msg);
+		return -1;
+	}
+	return 0;
+}
+
+/* The page is the print area bounding box, or failing that the part's. */
+static int get_template_page(const char *file, struct svg_rect *page)
+{
+	struct template_part part;
+	struct bbox box;
+
+	if (template_part_get(NULL, file, 0.01, &part)) {
+		return -1;
+	}
+
+	ring_set_bbox(&part.print, &box);
+	if (box.x_min > box.x_max) {
+		box = part.box;
+	}
+	if (box.x_min > box.x_max) {
+		error("%s: no print area or cut line.\n", file);
+		template_part_free(&part);
+		return -1;
+	}
+
+	page->x = 0.0;
+	page->y = 0.0;
+	page->width = (box.x_max - box.x_min) / part.units_per_mm * px_per_mm;
+	page->height = (box.y_max - box.y_min) / part.units_per_mm * px_per_mm;
+	page->rx = 0.0;
+
+	log("%s: page %.1fx%.1f mm\n", file,
+		(box.x_max - box.x_min) / part.units_per_mm,
+		(box.y_max - box.y_min) / part.units_per_mm);
+
+	template_part_free(&part);
+	return 0;
+}
+
+/* Centers both pages in the area covering both. */
+static void mirror_pages(struct svg_rect *page, struct svg_rect *mirror)
+{
+	float width = fmaxf(page->width, mirror->width);
+	float height = fmaxf(page->height, mirror->height);
+
+	page->x = (width - page->width) / 2.0;
+	page->y = (height - page->height) / 2.0;
+	mirror->x = (width - mirror->width) / 2.0;
+	mirror->y = (height - mirror->height) / 2.0;
+}
+
+/* Fills in the params left unset and checks the combination. */
+static int opts_finish(struct opts *opts)
+{
+	if (opts->blob_params.node_count_min ==
+		init_blob_params.node_count_min) {
+		opts->blob_params.node_count_min =
+			default_blob_params.node_count_min;
+	}
+	if (opts->blob_params.node_count_max ==
+		init_blob_params.node_count_max) {
+		opts->blob_params.node_count_max =
+			default_blob_params.node_count_max;
+	}
+	if (opts->blob_params.radius_min == init_blob_params.radius_min) {
+		opts->blob_params.radius_min = default_blob_params.radius_min;
+	}
+	if (opts->blob_params.radius_max == init_blob_params.radius_max) {
+		opts->blob_params.radius_max = default_blob_params.radius_max;
+	}
+	if (opts->blob_params.sector_min == init_blob_params.sector_min) {
+		opts->blob_params.sector_min = default_blob_params.sector_min;
+	}
+	if (opts->blob_params.instance_count ==
+		init_blob_params.instance_count) {
+		opts->blob_params.instance_count =
+			default_blob_params.instance_count;
+	}
+
+	/* Every node needs a sector of sector_min, see make_blob(). */
+	if (!opts->blob_params.node_count_min
+		|| opts->blob_params.node_count_min
+			> opts->blob_params.node_count_max
+		|| opts->blob_params.sector_min < 0.0
+		|| opts->blob_params.sector_min
+			>= 360U / opts->blob_params.node_count_max) {
+		error("Bad blob node counts or sector_min.\n");
+		return -1;
+	}
+
+	if (opts->template_file) {
+		if (opts->tile == opt_yes) {
+			error("--template can't be used with --tile.\n");
+			return -1;
+		}
+		if (get_template_page(opts->template_file, &opts->page_rect)) {
+			return -1;
+		}
+	}
+
+	if (opts->mirror_file) {
+		if (!opts->template_file) {
+			error("--mirror needs --template.\n");
+			return -1;
+		}
+		if (get_template_page(opts->mirror_file, &opts->mirror_rect)) {
+			return -1;
+		}
+		mirror_pages(&opts->page_rect, &opts->mirror_rect);
+	}
+
+	if (opts->grid_params.width == init_grid_params.width) {
+		opts->grid_params.width = 1.1 * opts->blob_params.radius_max;
+	}
+	/* The pixel size, cell gap and page grid derive from it. */
+	if (!(opts->grid_params.width > 0.0)) {
+		error("Bad grid width.\n");
+		return -1;
+	}
+	if (opts->grid_params.wiggle == init_grid_params.wiggle) {
+		opts->grid_params.wiggle = 0.8 * opts->blob_params.radius_max;
+	}
+
+	/* A template page, or both of a mirror pair, is covered by default. */
+	if (opts->grid_params.columns == init_grid_params.columns) {
+		opts->grid_params.columns = (opts->page_rect.width > 0.0)
+			? (unsigned int)ceilf(fmaxf(opts->page_rect.x
+				+ opts->page_rect.width, opts->mirror_rect.x
+				+ opts->mirror_rect.width)
+				/ opts->grid_params.width)
+			: default_grid_params.columns;
+	}
+	if (opts->grid_params.rows == init_grid_params.rows) {
+		opts->grid_params.rows = (opts->page_rect.height > 0.0)
+			? (unsigned int)ceilf(fmaxf(opts->page_rect.y
+				+ opts->page_rect.height, opts->mirror_rect.y
+				+ opts->mirror_rect.height)
+				/ opts->grid_params.width)
+			: default_grid_params.rows;
+	}
+
+	if (opts->pixel_params.size == init_pixel_params.size) {
+		opts->pixel_params.size = opts->grid_params.width / 8.0;
+	}
+	if (opts->pixel_params.scales == init_pixel_params.scales) {
+		opts->pixel_params.scales = default_pixel_params.scales;
+	}
+	if (opts->pixel_params.size <= 0.0 || !opts->pixel_params.scales
+		|| opts->pixel_params.scales > 8) {
+		error("Bad pixel size or scales.\n");
+		return -1;
+	}
+
+	if (opts->cell_params.gap == init_cell_params.gap) {
+		opts->cell_params.gap = opts->grid_params.width / 10.0;
+	}
+	if (opts->cell_params.smooth == init_cell_params.smooth) {
+		opts->cell_params.smooth = default_cell_params.smooth;
+	}
+	if (opts->cell_params.gap < 0.0 || opts->cell_params.smooth < 0.0
+		|| opts->cell_params.smooth > 1.0) {
+		error("Bad cell gap or smooth.\n");
+		return -1;
+	}
+
+	if (opts->style == style_undef) {
+		opts->style = style_blob;
+	}
+
+	if (opts->merge_colors == opt_yes && opts->blob_params.instance_count) {
+		error("--merge-colors can't be used with --instances.\n");
+		return -1;
+	}
+	if (opts->tile == opt_yes && opts->blob_params.instance_count) {
+		error("--tile can't be used with --instances.\n");
+		return -1;
+	}
+	if (opts->neighbor_colors == opt_yes
+		&& opts->blob_params.instance_count) {
+		error("--neighbor-colors can't be used with --instances.\n");
+		return -1;
+	}
+	if (opts->style != style_blob && opts->blob_params.instance_count) {
+		error("--style %s can't be used with --instances.\n",
+			style_name(opts->style));
+		return -1;
+	}
+
+	if (opts->panel_width > 0.0) {
+		if (opts->panel_overlap >= opts->panel_width) {
+			error("--panel-overlap must be less than --panel-width.\n");
+			return -1;
+		}
+		if (opts->style != style_blob || opts->tile == opt_yes
+			|| opts->merge_colors == opt_yes
+			|| opts->blob_params.instance_count) {
+			error("--panel-width only splits plain blob output.\n");
+			return -1;
+		}
+		if (opts->cache_dir) {
+			error("--panel-width can't be used with --cache.\n");
+			return -1;
+		}
+	}
+
+	if (opts->shard_count) {
+		if (opts->style != style_blob || opts->tile == opt_yes
+			|| opts->merge_colors == opt_yes
+			|| opts->neighbor_colors == opt_yes
+			|| opts->blob_params.instance_count) {
+			error("--shard only splits plain blob output, not --style digital or voronoi, -t, -m, -n or --instances.\n");
+			return -1;
+		}
+		if (opts->panel_width > 0.0 || opts->mirror_file
+			|| opts->cache_dir || opts->stats_file
+			|| opts->output_count > 1) {
+			error("--shard writes one shard file, without more -o, --panel-width, --mirror, --cache or --stats.\n");
+			return -1;
+		}
+		if (opts->seed == UINT_MAX) {
+			error("--shard needs --seed, the same for every shard.\n");
+			return -1;
+		}
+	}
+
+	if (opts->mirror_file) {
+		if (opts->style != style_blob || opts->tile == opt_yes
+			|| opts->merge_colors == opt_yes
+			|| opts->blob_params.instance_count) {
+			error("--mirror only mirrors plain blob output.\n");
+			return -1;
+		}
+		if (opts->panel_width > 0.0 || opts->cache_dir) {
+			error("--mirror can't be used with --panel-width or --cache.\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The cache key, every effective param the output depends on after the
+ * command line, config and defaults are merged.  Floats are exact.
+ */
+static void opts_cache_key(const struct opts *opts,
+	const struct palette *palette, struct out_buf *key)
+{
+	const struct blob_params *bp = &opts->blob_params;
+	const struct grid_params *gp = &opts->grid_params;
+	const struct field_params *fp = &opts->field_params;
+	unsigned int i;
+
+	out_printf(key, "generator %s %s\nstyle %s\nseed %u\n",
+		program_name, PACKAGE_VERSION, style_name(opts->style),
+		opts->seed);
+	out_printf(key, "blob %u %u %a %a %a %u\n", bp->node_count_min,
+		bp->node_count_max, bp->radius_min, bp->radius_max,
+		bp->sector_min, bp->instance_count);
+	out_printf(key, "grid %u %u %a %a\n", gp->columns, gp->rows,
+		gp->width, gp->wiggle);
+	out_printf(key, "pixel %a %u\ncell %a %a\n", opts->pixel_params.size,
+		opts->pixel_params.scales, opts->cell_params.gap,
+		opts->cell_params.smooth);
+	out_printf(key, "field %a %u %a %a %a %a %a %a %a %a\n", fp->scale,
+		fp->octaves, fp->noise, fp->gradient_x, fp->gradient_y,
+		fp->radial, fp->radius, fp->nodes, fp->wiggle, fp->palette);
+	out_printf(key, "page %a %a %a %a %a\n", opts->page_rect.x,
+		opts->page_rect.y, opts->page_rect.width,
+		opts->page_rect.height, opts->page_rect.rx);
+	out_printf(key, "flags %d %d %d %d %a\n", opts->background,
+		opts->merge_colors, opts->tile, opts->neighbor_colors,
+		opts->min_contrast);
+	out_printf(key, "draft %u\npalette", (opts->draft == opt_yes)
+		? opts->preview_size : 0);
+	for (i = 0; i < palette->color_count; i++) {
+		out_printf(key, " %s", palette->colors[i]);
+	}
+	out_add_str(key, "\n");
+}
+
+/* The effective params go with the drawing to sinks that keep them. */
+static void set_canvas_info(struct canvas *canvas, const struct opts *opts,
+	const struct palette *palette)
+{
+	struct out_buf key = {0};
+
+	opts_cache_key(opts, palette, &key);
+	out_add(&key, "", 1);
+	canvas_set_info(canvas, key.data, opts->seed, palette);
+	out_free(&key);
+}
+
+/*
+ * Panels: the page is split into panels of the printer's media width,
+ * each overlapping the next by the bleed.  The sheet is generated once,
+ * a spatial grid over the blob boxes finds the panels each blob touches
+ * and the blobs are written to their panels in one pass in paint order.
+ * Registration marks are centered in each overlap, on both panels.
+ */
+
+static const float registration_size = 10.0;
+static const float registration_line = 0.5;
+
+struct panel_cb_data {
+	unsigned char *touches;
+	unsigned int panel_count;
+	unsigned int panel;
+};
+
+static void panel_cb(void *cb_data, unsigned int item)
+{
+	struct panel_cb_data *cbd = cb_data;
+
+	cbd->touches[item * cbd->panel_count + cbd->panel] = 1;
+}
+
+/* Returns the panel count, at least one. */
+static unsigned int make_panel_rects(const struct opts *opts,
+	const struct svg_rect *page, struct svg_rect **rects_out)
+{
+	float width = opts->panel_width * px_per_mm;
+	float pitch = (opts->panel_width - opts->panel_overlap) * px_per_mm;
+	struct svg_rect *rects;
+	unsigned int count = 1;
+	unsigned int i;
+
+	if (page->width > width) {
+		count += (unsigned int)ceilf((page->width - width) / pitch
+			- 0.001);
+	}
+
+	rects = mem_alloc(count * sizeof(*rects));
+
+	for (i = 0; i < count; i++) {
+		rects[i].x = page->x + i * pitch;
+		rects[i].y = page->y;
+		rects[i].width = fminf(width, page->x + page->width
+			- rects[i].x);
+		rects[i].height = page->height;
+		rects[i].rx = 0.0;
+	}
+
+	*rects_out = rects;
+	return count;
+}
+
+static void write_registration(struct canvas *canvas, unsigned int seam,
+	const struct svg_rect *left, const struct svg_rect *right)
+{
+	float size = registration_size * px_per_mm;
+	float line = registration_line * px_per_mm;
+	float x = (right->x + left->x + left->width) / 2.0;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		float y = left->y + size + i * (left->height - 2.0 * size)
+			/ 2.0;
+		struct svg_rect bar = {.rx = 0.0};
+		char id[64];
+
+		bar.x = x - size / 2.0;
+		bar.y = y - line / 2.0;
+		bar.width = size;
+		bar.height = line;
+		snprintf(id, sizeof(id), "registration_%u_%u_h", seam, i);
+		canvas_rect(canvas, id, "#000000", &bar);
+
+		bar.x = x - line / 2.0;
+		bar.y = y - size / 2.0;
+		bar.width = line;
+		bar.height = size;
+		snprintf(id, sizeof(id), "registration_%u_%u_v", seam, i);
+		canvas_rect(canvas, id, "#000000", &bar);
+	}
+}
+
+/* Closes the canvases, the sheet is as write_output() would make. */
+static int write_panels(struct canvas **canvases,
+	const struct svg_rect *rects, unsigned int panel_count,
+	const struct opts *opts, const struct palette *palette)
+{
+	const struct grid_params *grid_params = &opts->grid_params;
+	struct panel_cb_data cbd = {.panel_count = panel_count};
+	struct spatial_grid grid;
+	struct sheet sheet;
+	struct bbox *boxes;
+	unsigned int *render_order;
+	float *field = NULL;
+	unsigned int written = 0;
+	unsigned int i;
+	unsigned int p;
+	int result = 0;
+
+	for (p = 0; p < panel_count; p++) {
+		if (canvas_open(canvases[p], &rects[p])) {
+			result = -1;
+		}
+	}
+	if (result) {
+		goto close;
+	}
+
+	for (p = 0; p < panel_count; p++) {
+		if (opts->background) {
+			write_background(canvases[p], &rects[p], "#000099");
+		}
+		canvas_open_group(canvases[p], "camo_blobs");
+	}
+
+	render_order = random_array(grid_params->columns * grid_params->rows);
+
+	if (field_enabled(&opts->field_params)) {
+		field = make_field(&opts->field_params, grid_params);
+	}
+
+	make_sheet(grid_params, &opts->blob_params, &opts->field_params, field,
+		palette, render_order, opts->seed, &sheet);
+
+	if (opts->neighbor_colors == opt_yes) {
+		color_neighbors(&sheet, palette, opts->min_contrast);
+	}
+
+	boxes = mem_alloc((sheet.blob_count + 1) * sizeof(*boxes));
+
+	for (i = 0; i < sheet.blob_count; i++) {
+		const struct blob *blob = &sheet.blobs[i].blob;
+		unsigned int node;
+
+		bbox_init(&boxes[i]);
+		for (node = 0; node < blob->node_count; node++) {
+			bbox_add(&boxes[i], &blob->nodes[node]);
+		}
+	}
+
+	spatial_grid_build(&grid, boxes, sheet.blob_count,
+		2.0 * opts->blob_params.radius_max);
+
+	cbd.touches = mem_alloc(sheet.blob_count * panel_count + 1);
+
+	for (p = 0; p < panel_count; p++) {
+		struct bbox box;
+
+		box.x_min = rects[p].x;
+		box.y_min = rects[p].y;
+		box.x_max = rects[p].x + rects[p].width;
+		box.y_max = rects[p].y + rects[p].height;
+
+		cbd.panel = p;
+		spatial_grid_query(&grid, boxes, &box, panel_cb, &cbd);
+	}
+
+	for (i = 0; i < sheet.blob_count; i++) {
+		for (p = 0; p < panel_count; p++) {
+			if (cbd.touches[i * panel_count + p]) {
+				write_sheet_blob(canvases[p],
+					&sheet.blobs[i]);
+				written++;
+			}
+		}
+	}
+
+	log("%u panels, %u blobs, %u written\n", panel_count,
+		sheet.blob_count, written);
+
+	for (p = 0; p < panel_count; p++) {
+		canvas_close_group(canvases[p]);
+
+		if (panel_count == 1) {
+			continue;
+		}
+
+		canvas_open_group(canvases[p], "registration");
+		if (p) {
+			write_registration(canvases[p], p, &rects[p - 1],
+				&rects[p]);
+		}
+		if (p + 1 < panel_count) {
+			write_registration(canvases[p], p + 1, &rects[p],
+				&rects[p + 1]);
+		}
+		canvas_close_group(canvases[p]);
+	}
+
+	mem_free(cbd.touches);
+	spatial_grid_free(&grid);
+	mem_free(boxes);
+	free_sheet(&sheet);
+	if (field) {
+		mem_free(field);
+	}
+	mem_free(render_order);
+
+close:
+	for (p = 0; p < panel_count; p++) {
+		if (canvas_close(canvases[p])) {
+			result = -1;
+		}
+		canvases[p] = NULL;
+	}
+	return result;
+}
+
+/* Inserts the suffix before the file name extension. */
+static char *suffix_file(const char *file, const char *suffix)
+{
+	const char *ext = strrchr(file, '.');
+	const char *slash = strrchr(file, '/');
+	size_t len = strlen(file) + strlen(suffix) + 1;
+	char *name;
+
+	if (!ext || (slash && ext < slash)) {
+		ext = file + strlen(file);
+	}
+
+	name = mem_alloc(len);
+	snprintf(name, len, "%.*s%s%s", (int)(ext - file), file, suffix, ext);
+	return name;
+}
+
+/* For runs writing several pages, each output named with a suffix. */
+static int check_named_outputs(const struct opts *opts, const char *option)
+{
+	unsigned int i;
+
+	for (i = 0; i < opts->output_count; i++) {
+		if (!strcmp(opts->output_files[i], "-")) {
+			error("%s needs -o output files.\n", option);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static struct canvas *suffix_canvas(const struct opts *opts,
+	const struct palette *palette, const char *suffix)
+{
+	struct canvas *canvas = canvas_new();
+	unsigned int i;
+
+	if (opts->draft == opt_yes) {
+		canvas_set_draft(canvas, opts->preview_size);
+	}
+	set_canvas_info(canvas, opts, palette);
+
+	for (i = 0; i <= opts->output_count; i++) {
+		const char *file = (i < opts->output_count)
+			? opts->output_files[i] : opts->stats_file;
+		enum sink_kind kind = sink_stats;
+		char *name;
+		int err;
+
+		if (!file) {
+			continue;
+		}
+		if (i < opts->output_count) {
+			kind = format_sinks[output_format(file, opts->format)];
+		}
+
+		name = suffix_file(file, suffix);
+		err = canvas_add_sink(canvas, kind, name, opts->preview_size);
+		mem_free(name);
+		if (err) {
+			canvas_close(canvas);
+			return NULL;
+		}
+	}
+	return canvas;
+}
+
+/* A canvas for each panel, with a sink for each output. */
+static int run_panels(const struct opts *opts, const struct palette *palette)
+{
+	struct svg_rect page;
+	struct svg_rect *rects;
+	struct canvas **canvases;
+	unsigned int panel_count;
+	unsigned int p;
+	int result = -1;
+
+	if (check_named_outputs(opts, "--panel-width")) {
+		return -1;
+	}
+
+	get_background_rect(opts, &page);
+	panel_count = make_panel_rects(opts, &page, &rects);
+	canvases = mem_alloc(panel_count * sizeof(*canvases));
+
+	for (p = 0; p < panel_count; p++) {
+		char suffix[16];
+
+		snprintf(suffix, sizeof(suffix), "-%u", p + 1);
+		canvases[p] = suffix_canvas(opts, palette, suffix);
+		if (!canvases[p]) {
+			goto done;
+		}
+	}
+
+	result = write_panels(canvases, rects, panel_count, opts, palette);
+
+done:
+	for (p = 0; p < panel_count; p++) {
+		if (canvases[p]) {
+			canvas_close(canvases[p]);
+		}
+	}
+	mem_free(canvases);
+	mem_free(rects);
+	return result;
+}
+
+/*
+ * Mirror pairs: the camo of a left/right pair of parts is generated once,
+ * over both print areas centered on each other.  The master side is
+ * written, then the sheet is mirrored left to right in one pass over the
+ * nodes and written for the other side.  Each side only gets the blobs
+ * touching its page.
+ */
+
+static void transform_sheet(struct sheet *sheet, const struct affine *m)
+{
+	unsigned int i;
+
+	for (i = 0; i < sheet->blob_count; i++) {
+		struct sheet_blob *sb = &sheet->blobs[i];
+		struct point_c *p = sb->blob.nodes;
+		struct point_c *end = p + sb->blob.node_count;
+		float x = sb->offset.x;
+
+		sb->offset.x = m->a * x + m->c * sb->offset.y + m->e;
+		sb->offset.y = m->b * x + m->d * sb->offset.y + m->f;
+
+		for (; p < end; p++) {
+			x = p->x;
+			p->x = m->a * x + m->c * p->y + m->e;
+			p->y = m->b * x + m->d * p->y + m->f;
 		}
-		
-		return;
 	}
-	
-	assert(0);
 }
 
-static const struct color_data default_colors[] = {
-	{2, "#eeffff"},
-	{2, "#bbbbbb"},
-	{2, "#777777"},
-	{1, "#97dcff"},
-	{1, "#a3a3a3"},
-	{2, "#00bbff"},
-	{2, "#009aff"},
-	{2, "#0077ff"},
-	{1, "#004dff"},
-	{1, "#003473"},
-	{2, "#0000bb"},
-	{2, "#000077"},
-	{2, "#000011"},
+static unsigned int write_sheet_page(struct canvas *canvas,
+	const struct sheet *sheet, const struct svg_rect *page)
+{
+	struct bbox page_box;
+	unsigned int written = 0;
+	unsigned int i;
 
-	//{2, "#ff0000"},
-	//{2, "#00ff00"},
-	//{2, "#ffff00"},
-	//{2, "#ff8800"},
-	//{2, "#888800"},
-	//{2, "#88ff00"},
+	page_box.x_min = page->x;
+	page_box.y_min = page->y;
+	page_box.x_max = page->x + page->width;
+	page_box.y_max = page->y + page->height;
 
-};
+	for (i = 0; i < sheet->blob_count; i++) {
+		const struct sheet_blob *sb = &sheet->blobs[i];
+		struct bbox box;
+		unsigned int node;
+
+		bbox_init(&box);
+		for (node = 0; node < sb->blob.node_count; node++) {
+			bbox_add(&box, &sb->blob.nodes[node]);
+		}
+
+		if (bbox_overlap(&box, &page_box)) {
+			write_sheet_blob(canvas, sb);
+			written++;
+		}
+	}
+	return written;
+}
 
-static void get_config_opts(struct opts *opts, struct palette *palette)
+/* Closes the canvases, the master side first. */
+static int write_mirror(struct canvas *canvases[2], const struct opts *opts,
+	const struct palette *palette)
 {
-	static const char *sections[] = {
-		"[params]",
-		"[palette]",
-	};
-	struct config_cb_data cbd = {
-		.config_file = opts->config_file,
-		.blob_params = &opts->blob_params,
-		.grid_params = &opts->grid_params,
-		.palette = palette,
+	const struct grid_params *grid_params = &opts->grid_params;
+	const struct svg_rect *pages[2] = {&opts->page_rect, &opts->mirror_rect};
+	const struct affine mirror = {
+		.a = -1.0,
+		.d = 1.0,
+		.e = 2.0 * opts->page_rect.x + opts->page_rect.width,
 	};
+	unsigned int written[2];
+	unsigned int *render_order;
+	float *field = NULL;
+	struct sheet sheet;
+	unsigned int side;
+	int result = 0;
+
+	for (side = 0; side < 2; side++) {
+		if (canvas_open(canvases[side], pages[side])) {
+			result = -1;
+		}
+	}
+	if (result) {
+		goto close;
+	}
+
+	render_order = random_array(grid_params->columns * grid_params->rows);
+
+	if (field_enabled(&opts->field_params)) {
+		field = make_field(&opts->field_params, grid_params);
+	}
+
+	make_sheet(grid_params, &opts->blob_params, &opts->field_params, field,
+		palette, render_order, opts->seed, &sheet);
+
+	if (opts->neighbor_colors == opt_yes) {
+		color_neighbors(&sheet, palette, opts->min_contrast);
+	}
+
+	for (side = 0; side < 2; side++) {
+		if (side) {
+			transform_sheet(&sheet, &mirror);
+		}
+		if (opts->background) {
+			write_background(canvases[side], pages[side],
+				"#000099");
+		}
+		canvas_open_group(canvases[side], "camo_blobs");
+		written[side] = write_sheet_page(canvases[side], &sheet,
+			pages[side]);
+		canvas_close_group(canvases[side]);
+	}
+
+	log("%u blobs, %u master, %u mirror\n", sheet.blob_count, written[0],
+		written[1]);
+
+	free_sheet(&sheet);
+	if (field) {
+		mem_free(field);
+	}
+	mem_free(render_order);
+
+close:
+	for (side = 0; side < 2; side++) {
+		if (canvas_close(canvases[side])) {
+			result = -1;
+		}
+		canvases[side] = NULL;
+	}
+	return result;
+}
+
+/* The outputs for the master side, and with '-mirror' for the other. */
+static int run_mirror(const struct opts *opts, const struct palette *palette)
+{
+	struct canvas *canvases[2] = {NULL, NULL};
+	int result = -1;
+
+	if (check_named_outputs(opts, "--mirror")) {
+		return -1;
+	}
+
+	canvases[0] = suffix_canvas(opts, palette, "");
+	if (canvases[0]) {
+		canvases[1] = suffix_canvas(opts, palette, "-mirror");
+	}
+	if (canvases[1]) {
+		return write_mirror(canvases, opts, palette);
+	}
+
+	if (canvases[0]) {
+		canvas_close(canvases[0]);
+	}
+	return result;
+}
+
+/*
+ * Marks a shard file complete, see the shard sink.  The end line holds
+ * the shard's number, the shard count, the blob count and a hash of the
+ * cache key, so shard-merge only merges the shards of one run.
+ */
+static int end_shard(const char *file, const struct opts *opts,
+	const struct palette *palette)
+{
+	struct out_buf key = {0};
+	uint64_t run = 0xcbf29ce484222325ULL;
+	FILE *stream;
+	size_t i;
+
+	opts_cache_key(opts, palette, &key);
+	for (i = 0; i < key.len; i++) {
+		run ^= (unsigned char)key.data[i];
+		run *= 0x100000001b3ULL;
+	}
+	out_free(&key);
+
+	stream = strcmp(file, "-") ? fopen(file, "a") : stdout;
+	if (!stream) {
+		error("open '%s' failed: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	fprintf(stream, "end %u %u %u %016llx\n", opts->shard,
+		opts->shard_count,
+		opts->grid_params.columns * opts->grid_params.rows,
+		(unsigned long long)run);
+
+	if (stream != stdout ? fclose(stream) : fflush(stream)) {
+		error("write '%s' failed: %s\n", file, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+struct run_output {
+	const char *file;
+	enum sink_kind kind;
+	const char *ext;
+	struct out_buf key;
+	char *temp;
+};
+
+/*
+ * One canvas for all the outputs, a sink each.  With a cache, outputs
+ * found there are copied out and only the others are generated, into
+ * the cache.
+ */
+static int run_output(const struct opts *opts, const struct palette *palette,
+	struct cache *cache)
+{
+	struct run_output outputs[max_outputs + 1];
+	unsigned int count = 0;
+	unsigned int sink_count = 0;
+	unsigned int i;
+	struct canvas *canvas;
+	int result = -1;
+
+	if (opts->panel_width > 0.0) {
+		return run_panels(opts, palette);
+	}
+	if (opts->mirror_file) {
+		return run_mirror(opts, palette);
+	}
+
+	memset(outputs, 0, sizeof(outputs));
+
+	for (i = 0; i < opts->output_count; i++) {
+		enum output_format format = output_format(opts->output_files[i],
+			opts->format);
+
+		outputs[count].file = opts->output_files[i];
+		outputs[count].kind = opts->shard_count ? sink_shard
+			: format_sinks[format];
+		outputs[count++].ext = format_names[format];
+	}
+	if (opts->stats_file) {
+		outputs[count].file = opts->stats_file;
+		outputs[count].kind = sink_stats;
+		outputs[count++].ext = "txt";
+	}
+
+	canvas = canvas_new();
+	if (opts->draft == opt_yes) {
+		canvas_set_draft(canvas, opts->preview_size);
+	}
+	set_canvas_info(canvas, opts, palette);
+
+	for (i = 0; i < count; i++) {
+		struct run_output *ro = &outputs[i];
+		const char *file = ro->file;
+
+		if (cache) {
+			int hit;
+
+			opts_cache_key(opts, palette, &ro->key);
+			out_printf(&ro->key, "output %s %u", ro->ext,
+				(ro->kind == sink_preview) ? opts->preview_size
+					: 0);
+			out_add(&ro->key, "", 1);
+
+			hit = cache_get(cache, ro->key.data, ro->ext, file);
+			if (hit < 0) {
+				goto done;
+			}
+			if (!hit) {
+				continue;
+			}
+			file = ro->temp = cache_temp(cache, ro->ext);
+		}
+
+		if (canvas_add_sink(canvas, ro->kind, file,
+			opts->preview_size)) {
+			goto done;
+		}
+		sink_count++;
+	}
+
+	if (!sink_count) {
+		result = 0;
+		goto done;
+	}
+
+	result = write_output(canvas, opts, palette);
+	canvas = NULL;
+
+	if (!result && opts->shard_count) {
+		result = end_shard(opts->output_files[0], opts, palette);
+	}
+
+	for (i = 0; i < count && !result; i++) {
+		if (outputs[i].temp) {
+			result = cache_put(cache, outputs[i].key.data,
+				outputs[i].ext, outputs[i].temp,
+				outputs[i].file);
+		}
+	}
+
+done:
+	if (canvas) {
+		canvas_close(canvas);
+	}
+	for (i = 0; i < count; i++) {
+		if (outputs[i].temp) {
+			unlink(outputs[i].temp);
+			mem_free(outputs[i].temp);
+		}
+		out_free(&outputs[i].key);
+	}
+	return result;
+}
+
+/*
+ * Manifest jobs.  Each distinct config file is parsed once on top of the
+ * command line options, the jobs using it share the result read only.
+ */
+
+struct job_config {
+	struct opts opts;
+	struct palette palette;
+	int result;
+};
+
+struct job {
+	unsigned int line;
+	unsigned int config;
+	char *template_file;
+	unsigned int seed;
+	char *output_file;
+	int result;
+	double seconds;
+};
+
+struct manifest {
+	struct cache *cache;
+	struct job_config *configs;
+	unsigned int config_count;
+	struct job *jobs;
+	unsigned int job_count;
+	char *data;
+};
+
+static unsigned int manifest_config(struct manifest *manifest,
+	const struct opts *opts, const struct palette *palette,
+	char *config_file)
+{
+	struct job_config *jc;
+	unsigned int i;
+
+	for (i = 0; i < manifest->config_count; i++) {
+		const char *file = manifest->configs[i].opts.config_file;
+
+		if ((!file && !config_file)
+			|| (file && config_file && !strcmp(file, config_file))) {
+			return i;
+		}
+	}
+
+	manifest->configs = mem_realloc(manifest->configs,
+		(manifest->config_count + 1) * sizeof(*manifest->configs));
+	jc = &manifest->configs[manifest->config_count];
+
+	jc->opts = *opts;
+	jc->opts.config_file = config_file;
+	jc->palette.color_count = 0;
+	jc->palette.colors = NULL;
+	jc->result = config_file ? get_config_opts(&jc->opts, &jc->palette)
+		: 0;
+
+	if (!jc->palette.color_count) {
+		if (palette->color_count) {
+			jc->palette.color_count = palette->color_count;
+			jc->palette.colors = mem_alloc(palette->color_count
+				* hex_color_len);
+			memcpy(jc->palette.colors, palette->colors,
+				palette->color_count * hex_color_len);
+		} else {
+			palette_fill(&jc->palette, default_colors,
+				sizeof(default_colors)
+					/ sizeof(default_colors[0]));
+		}
+	}
+
+	return manifest->config_count++;
+}
+
+static int manifest_parse(struct manifest *manifest, const char *file,
+	const struct opts *opts, const struct palette *palette)
+{
+	struct mapped_file mf;
+	unsigned int line = 0;
+	char *p;
+
+	if (map_file(file, &mf)) {
+		return -1;
+	}
+	manifest->data = mem_alloc(mf.size + 1);
+	memcpy(manifest->data, mf.data, mf.size);
+	manifest->data[mf.size] = 0;
+	unmap_file(&mf);
+
+	for (p = manifest->data; *p; ) {
+		char *end = strchr(p, '\n');
+		char *fields[5];
+		unsigned int count = 0;
+		struct job *job;
+		char *save;
+		char *f;
+
+		if (end) {
+			*end = 0;
+		}
+		line++;
+
+		f = strchr(p, '#');
+		if (f) {
+			*f = 0;
+		}
+
+		for (f = strtok_r(p, " \t\r", &save); f && count < 5;
+			f = strtok_r(NULL, " \t\r", &save)) {
+			fields[count++] = f;
+		}
+
+		p = end ? end + 1 : p + strlen(p);
+
+		if (!count) {
+			continue;
+		}
+		if (count < 3 || count > 4) {
+			error("%s:%u: expected <config> [<template>] <seed> <output>.\n",
+				file, line);
+			return -1;
+		}
+
+		manifest->jobs = mem_realloc(manifest->jobs,
+			(manifest->job_count + 1) * sizeof(*manifest->jobs));
+		job = &manifest->jobs[manifest->job_count++];
+		memset(job, 0, sizeof(*job));
+
+		job->line = line;
+		job->template_file = (count == 4 && strcmp(fields[1], "-"))
+			? fields[1] : NULL;
+		job->seed = to_unsigned(fields[count - 2]);
+		job->output_file = fields[count - 1];
+		if (job->seed == UINT_MAX) {
+			error("%s:%u: bad seed '%s'.\n", file, line,
+				fields[count - 2]);
+			return -1;
+		}
+
+		job->config = manifest_config(manifest, opts, palette,
+			strcmp(fields[0], "-") ? fields[0] : NULL);
+	}
+
+	return 0;
+}
+
+static void manifest_free(struct manifest *manifest)
+{
+	unsigned int i;
+
+	for (i = 0; i < manifest->config_count; i++) {
+		if (manifest->configs[i].palette.colors) {
+			mem_free(manifest->configs[i].palette.colors);
+		}
+	}
+	if (manifest->configs) {
+		mem_free(manifest->configs);
+	}
+	if (manifest->jobs) {
+		mem_free(manifest->jobs);
+	}
+	if (manifest->data) {
+		mem_free(manifest->data);
+	}
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int job_run(void *cb_data, unsigned int index)
+{
+	struct manifest *manifest = cb_data;
+	struct job *job = &manifest->jobs[index];
+	const struct job_config *jc = &manifest->configs[job->config];
+	struct opts opts = jc->opts;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	job->result = jc->result;
+	if (!job->result) {
+		if (job->template_file) {
+			opts.template_file = job->template_file;
+		}
+		opts.output_files[0] = job->output_file;
+		opts.output_count = 1;
+		opts.stats_file = NULL;
+		opts.seed = job->seed;
+
+		random_seed(job->seed);
+
+		job->result = opts_finish(&opts);
+		if (!job->result) {
+			job->result = run_output(&opts, &jc->palette,
+				manifest->cache);
+		}
+	}
+
+	job->seconds = seconds_since(&start);
+	log("line %u: %s: %s, %.2f s\n", job->line, job->output_file,
+		job->result ? "failed" : "done", job->seconds);
+	return job->result;
+}
+
+static int run_manifest(const struct opts *opts, const struct palette *palette,
+	struct cache *cache)
+{
+	struct manifest manifest = {.cache = cache};
+	struct timespec start;
+	unsigned int failed_count;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (manifest_parse(&manifest, opts->jobs_file, opts, palette)) {
+		manifest_free(&manifest);
+		return -1;
+	}
+
+	failed_count = run_jobs(opts->threads, manifest.job_count, job_run,
+		&manifest);
 
-	config_process_file(opts->config_file, config_cb, &cbd,
-		sections, sizeof(sections)/sizeof(sections[0]));
+	for (i = 0; i < manifest.job_count; i++) {
+		const struct job *job = &manifest.jobs[i];
+
+		fprintf(stderr, "%s: line %u: %s: %s, %.2f s\n", program_name,
+			job->line, job->output_file,
+			job->result ? "FAILED" : "ok", job->seconds);
+	}
+	fprintf(stderr, "%s: %u jobs, %u configs, %u failed, %.2f s.\n",
+		program_name, manifest.job_count, manifest.config_count,
+		failed_count, seconds_since(&start));
+
+	manifest_free(&manifest);
+	return failed_count ? -1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
 	struct opts opts;
-	FILE *out_stream;
 	struct palette palette = {0};
+	struct cache *cache = NULL;
+	int result = -1;
 
 	if (opts_parse(&opts, argc, argv)) {
 		print_usage(&opts);
@@ -666,63 +4044,56 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
-	if (opts.config_file){
-		get_config_opts(&opts, &palette);
-	}
+	set_verbose(opts.verbose == opt_yes);
 
-	if (!palette.color_count) {
-		palette_fill(&palette, default_colors,
-			sizeof(default_colors) / sizeof(default_colors[0]));
+	if (opts.trace_file && trace_start()) {
+		return EXIT_FAILURE;
 	}
 
-	if (opts.blob_params.node_count_min ==
-		init_blob_params.node_count_min) {
-		opts.blob_params.node_count_min =
-			default_blob_params.node_count_min;
-	}
-	if (opts.blob_params.node_count_max ==
-		init_blob_params.node_count_max) {
-		opts.blob_params.node_count_max =
-			default_blob_params.node_count_max;
-	}
-	if (opts.blob_params.radius_min == init_blob_params.radius_min) {
-		opts.blob_params.radius_min = default_blob_params.radius_min;
-	}
-	if (opts.blob_params.radius_max == init_blob_params.radius_max) {
-		opts.blob_params.radius_max = default_blob_params.radius_max;
-	}
-	if (opts.blob_params.sector_min == init_blob_params.sector_min) {
-		opts.blob_params.sector_min = default_blob_params.sector_min;
+	if (opts.cache_dir) {
+		cache = cache_open(opts.cache_dir,
+			(unsigned long long)opts.cache_size << 20);
+		if (!cache) {
+			return EXIT_FAILURE;
+		}
 	}
 
-	if (opts.grid_params.columns == init_grid_params.columns) {
-		opts.grid_params.columns = default_grid_params.columns;
+	if (opts.cache_stats == opt_yes) {
+		if (!cache) {
+			error("--cache-stats needs --cache.\n");
+			return EXIT_FAILURE;
+		}
+		cache_print_stats(cache, stdout);
+		cache_close(cache);
+		return EXIT_SUCCESS;
 	}
-	if (opts.grid_params.rows == init_grid_params.rows) {
-		opts.grid_params.rows = default_grid_params.rows;
+
+	if (opts.jobs_file && opts.help != opt_yes) {
+		if (opts.output_count || opts.stats_file || opts.config_file) {
+			error("--jobs can't be used with -o, --stats or -f.\n");
+			goto done;
+		}
+		result = run_manifest(&opts, &palette, cache);
+		goto done;
 	}
-	if (opts.grid_params.width == init_grid_params.width) {
-		opts.grid_params.width = 1.1 * opts.blob_params.radius_max;
+
+	if (opts.config_file && get_config_opts(&opts, &palette)) {
+		goto done;
 	}
-	if (opts.grid_params.wiggle == init_grid_params.wiggle) {
-		opts.grid_params.wiggle = 0.8 * opts.blob_params.radius_max;
+
+	if (!palette.color_count) {
+		palette_fill(&palette, default_colors,
+			sizeof(default_colors) / sizeof(default_colors[0]));
 	}
 
-	if (!strcmp(opts.output_file, "-")) {
-		out_stream = stdout;
-	} else {
-		out_stream = fopen(opts.output_file, "w");
-		if (!out_stream) {
-			error("open <output-file> '%s' failed: %s\n",
-				opts.output_file, strerror(errno));
-			assert(0);
-			return EXIT_FAILURE;
-		}
+	if (opts_finish(&opts)) {
+		goto done;
 	}
 
 	if (opts.help == opt_yes) {
 		print_usage(&opts);
-		return EXIT_SUCCESS;
+		result = 0;
+		goto done;
 	}
 
 	if (opts.config_file){
@@ -730,13 +4101,27 @@ int main(int argc, char *argv[])
 		opts.config_file = NULL;
 	}
 
-	srand((unsigned int)time(NULL));
+	if (opts.seed == UINT_MAX) {
+		opts.seed = (unsigned int)time(NULL);
+	}
+	log("seed %u\n", opts.seed);
+	random_seed(opts.seed);
 
-	write_svg(out_stream, &opts.grid_params, &opts.blob_params, &palette,
-		opts.background);
+	if (!opts.output_count) {
+		opts.output_files[opts.output_count++] = "-";
+	}
 
-	mem_free(palette.colors);
+	result = run_output(&opts, &palette, cache);
 
-	return EXIT_SUCCESS;
+done:
+	if (palette.colors) {
+		mem_free(palette.colors);
+	}
+	if (cache) {
+		cache_close(cache);
+	}
+	if (opts.trace_file && trace_write(opts.trace_file)) {
+		result = -1;
+	}
+	return result ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-
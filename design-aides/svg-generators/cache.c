@@ -0,0 +1,431 @@
+/*
+ *  moto-design random image generator.
+ */
+
+/*
+ * Entries are '<hash>.<ext>' with the key text in '<hash>.<ext>.key',
+ * both moved in by rename, so readers never see a partial entry.  The
+ * entry mtime is its last use.  Hit and miss counts are in 'counters',
+ * updated under a file lock since jobs and processes share the cache.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "cache.h"
+
+struct cache {
+	char *dir;
+	unsigned long long max_size;
+	unsigned int temp_count;
+};
+
+enum cache_counter {cache_hits, cache_misses, cache_counter_count};
+
+static uint64_t cache_hash(const char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *key; key++) {
+		hash ^= (unsigned char)*key;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static char *cache_entry(const struct cache *cache, const char *key,
+	const char *ext, const char *suffix)
+{
+	struct out_buf path = {0};
+
+	out_printf(&path, "%s/%016llx.%s%s", cache->dir,
+		(unsigned long long)cache_hash(key), ext, suffix);
+	return path.data;
+}
+
+static void cache_count(struct cache *cache, enum cache_counter counter,
+	unsigned long long counts[cache_counter_count])
+{
+	struct out_buf path = {0};
+	char buf[64] = "";
+	int fd;
+
+	counts[cache_hits] = counts[cache_misses] = 0;
+
+	out_printf(&path, "%s/counters", cache->dir);
+	fd = open(path.data, O_RDWR | O_CREAT, 0666);
+	out_free(&path);
+
+	if (fd < 0 || flock(fd, LOCK_EX)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	if (pread(fd, buf, sizeof(buf) - 1, 0) > 0) {
+		sscanf(buf, "hits %llu\nmisses %llu", &counts[cache_hits],
+			&counts[cache_misses]);
+	}
+
+	if (counter < cache_counter_count) {
+		int len;
+
+		counts[counter]++;
+		len = snprintf(buf, sizeof(buf), "hits %llu\nmisses %llu\n",
+			counts[cache_hits], counts[cache_misses]);
+		if (pwrite(fd, buf, len, 0) != len || ftruncate(fd, len)) {
+			warn("update cache counters failed: %s\n",
+				strerror(errno));
+		}
+	}
+
+	close(fd);
+}
+
+struct cache *cache_open(const char *dir, unsigned long long max_size)
+{
+	struct cache *cache;
+	struct stat st;
+
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		error("mkdir '%s' failed: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+	if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+		error("cache '%s' is not a directory.\n", dir);
+		return NULL;
+	}
+
+	cache = mem_alloc(sizeof(*cache));
+	cache->dir = str_dup(dir);
+	cache->max_size = max_size;
+	return cache;
+}
+
+void cache_close(struct cache *cache)
+{
+	mem_free(cache->dir);
+	mem_free(cache);
+}
+
+static bool cache_key_matches(const char *key_file, const char *key)
+{
+	size_t len = strlen(key);
+	char *data;
+	struct stat st;
+	bool result;
+	int fd;
+
+	fd = open(key_file, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) || (size_t)st.st_size != len) {
+		close(fd);
+		return false;
+	}
+
+	data = mem_alloc(len + 1);
+	result = (read(fd, data, len) == (ssize_t)len
+		&& !memcmp(data, key, len));
+	mem_free(data);
+	close(fd);
+	return result;
+}
+
+/* Kernel side copy, sendfile takes any output since Linux 2.6.33. */
+static int cache_copy(int in, int out, off_t size)
+{
+	off_t offset = 0;
+
+	while (offset < size) {
+		ssize_t len = sendfile(out, in, &offset, size - offset);
+
+		if (len <= 0) {
+			error("sendfile failed: %s\n",
+				len ? strerror(errno) : "short file");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A new output file rather than a hard link, writing the output later
+ * would change the entry.
+ */
+static int cache_serve(int in, const char *output)
+{
+	struct stat st;
+	int result;
+	int out;
+
+	if (fstat(in, &st)) {
+		error("stat failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (!strcmp(output, "-")) {
+		return cache_copy(in, STDOUT_FILENO, st.st_size);
+	}
+
+	if (unlink(output) && errno != ENOENT) {
+		error("unlink '%s' failed: %s\n", output, strerror(errno));
+		return -1;
+	}
+	out = open(output, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (out < 0) {
+		error("open '%s' failed: %s\n", output, strerror(errno));
+		return -1;
+	}
+
+	if (!ioctl(out, FICLONE, in)) {
+		result = 0;
+	} else {
+		result = cache_copy(in, out, st.st_size);
+	}
+
+	if (close(out)) {
+		error("close '%s' failed: %s\n", output, strerror(errno));
+		result = -1;
+	}
+	return result;
+}
+
+int cache_get(struct cache *cache, const char *key, const char *ext,
+	const char *output)
+{
+	unsigned long long counts[cache_counter_count];
+	char *entry = cache_entry(cache, key, ext, "");
+	char *key_file = cache_entry(cache, key, ext, ".key");
+	int result = 1;
+	int in;
+
+	in = open(entry, O_RDONLY);
+	if (in >= 0 && cache_key_matches(key_file, key)) {
+		result = cache_serve(in, output);
+	}
+
+	if (!result) {
+		/* Bumps the mtime, the LRU order. */
+		futimens(in, NULL);
+		cache_count(cache, cache_hits, counts);
+		log("hit %s\n", entry);
+	} else if (result > 0) {
+		cache_count(cache, cache_misses, counts);
+		log("miss %s\n", entry);
+	}
+
+	if (in >= 0) {
+		close(in);
+	}
+	mem_free(entry);
+	mem_free(key_file);
+	return result;
+}
+
+char *cache_temp(struct cache *cache, const char *ext)
+{
+	struct out_buf path = {0};
+
+	out_printf(&path, "%s/tmp-%d-%u.%s", cache->dir, (int)getpid(),
+		__atomic_fetch_add(&cache->temp_count, 1, __ATOMIC_RELAXED),
+		ext);
+	return path.data;
+}
+
+struct cache_file {
+	char *name;
+	off_t size;
+	struct timespec mtime;
+};
+
+static int cache_file_compare(const void *a, const void *b)
+{
+	const struct cache_file *fa = a;
+	const struct cache_file *fb = b;
+
+	if (fa->mtime.tv_sec != fb->mtime.tv_sec) {
+		return (fa->mtime.tv_sec < fb->mtime.tv_sec) ? -1 : 1;
+	}
+	if (fa->mtime.tv_nsec != fb->mtime.tv_nsec) {
+		return (fa->mtime.tv_nsec < fb->mtime.tv_nsec) ? -1 : 1;
+	}
+	return 0;
+}
+
+static bool cache_is_entry(const char *name)
+{
+	size_t len = strlen(name);
+
+	return (name[0] != '.' && strncmp(name, "tmp-", 4)
+		&& strcmp(name, "counters")
+		&& (len < 4 || strcmp(name + len - 4, ".key")));
+}
+
+/* Removes the least recently used entries over the size limit. */
+static void cache_trim(struct cache *cache)
+{
+	struct cache_file *files = NULL;
+	unsigned int count = 0;
+	unsigned long long total = 0;
+	struct dirent *de;
+	unsigned int i;
+	DIR *dir;
+
+	dir = opendir(cache->dir);
+	if (!dir) {
+		warn("opendir '%s' failed: %s\n", cache->dir, strerror(errno));
+		return;
+	}
+
+	while ((de = readdir(dir))) {
+		struct stat st;
+
+		if (!cache_is_entry(de->d_name)
+			|| fstatat(dirfd(dir), de->d_name, &st, 0)
+			|| !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		files = mem_realloc(files, (count + 1) * sizeof(*files));
+		files[count].name = str_dup(de->d_name);
+		files[count].size = st.st_size;
+		files[count].mtime = st.st_mtim;
+		total += st.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	if (total > cache->max_size) {
+		qsort(files, count, sizeof(*files), cache_file_compare);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (total > cache->max_size) {
+			struct out_buf path = {0};
+
+			out_printf(&path, "%s/%s", cache->dir, files[i].name);
+			if (!unlink(path.data) || errno == ENOENT) {
+				total -= files[i].size;
+				log("evict %s\n", path.data);
+			}
+			out_add_str(&path, ".key");
+			out_add(&path, "", 1);
+			unlink(path.data);
+			out_free(&path);
+		}
+		mem_free(files[i].name);
+	}
+	if (files) {
+		mem_free(files);
+	}
+}
+
+int cache_put(struct cache *cache, const char *key, const char *ext,
+	const char *temp, const char *output)
+{
+	char *entry = cache_entry(cache, key, ext, "");
+	char *key_file = cache_entry(cache, key, ext, ".key");
+	char *key_temp = cache_temp(cache, "key");
+	FILE *stream;
+	int result = -1;
+	int in;
+
+	stream = fopen(key_temp, "w");
+	if (!stream) {
+		error("open '%s' failed: %s\n", key_temp, strerror(errno));
+		goto done;
+	}
+	if (fputs(key, stream) == EOF) {
+		error("write '%s' failed: %s\n", key_temp, strerror(errno));
+		fclose(stream);
+		goto done;
+	}
+	if (fclose(stream) || rename(key_temp, key_file)) {
+		error("write '%s' failed: %s\n", key_file, strerror(errno));
+		goto done;
+	}
+
+	in = open(temp, O_RDONLY);
+	if (in < 0) {
+		error("open '%s' failed: %s\n", temp, strerror(errno));
+		goto done;
+	}
+	result = cache_serve(in, output);
+	close(in);
+	if (result) {
+		goto done;
+	}
+
+	if (chmod(temp, 0444) || rename(temp, entry)) {
+		error("rename '%s' failed: %s\n", entry, strerror(errno));
+		result = -1;
+		goto done;
+	}
+
+	cache_trim(cache);
+
+done:
+	if (result) {
+		unlink(key_temp);
+		unlink(temp);
+	}
+	mem_free(entry);
+	mem_free(key_file);
+	mem_free(key_temp);
+	return result;
+}
+
+void cache_print_stats(struct cache *cache, FILE *stream)
+{
+	unsigned long long counts[cache_counter_count];
+	unsigned long long total = 0;
+	unsigned int count = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	cache_count(cache, cache_counter_count, counts);
+
+	dir = opendir(cache->dir);
+	if (dir) {
+		while ((de = readdir(dir))) {
+			struct stat st;
+
+			if (cache_is_entry(de->d_name)
+				&& !fstatat(dirfd(dir), de->d_name, &st, 0)) {
+				total += st.st_size;
+				count++;
+			}
+		}
+		closedir(dir);
+	}
+
+	fprintf(stream, "%s: %u entries, %.1f of %.1f MiB, %llu hits, "
+		"%llu misses\n", cache->dir, count, total / 1048576.0,
+		cache->max_size / 1048576.0, counts[cache_hits],
+		counts[cache_misses]);
+}
@@ -0,0 +1,36 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_CACHE_H)
+#define _MD_GENERATOR_CACHE_H
+
+/*
+ * Content addressed output cache.  Entries are named by a hash of a key
+ * text that holds everything the output depends on, the key text is kept
+ * next to the entry and compared on lookup, so a hash collision is just a
+ * miss.  Hits are copied out by reflink where the file system has it, by
+ * sendfile otherwise.  Entries are read only, and the least recently used
+ * go when the cache grows over its size.
+ */
+
+struct cache;
+
+struct cache *cache_open(const char *dir, unsigned long long max_size);
+void cache_close(struct cache *cache);
+
+/* Writes the entry to output, "-" for stdout.  Returns 1 on a miss. */
+int cache_get(struct cache *cache, const char *key, const char *ext,
+	const char *output);
+
+/*
+ * A file name in the cache dir to generate a new entry into, put writes
+ * it to output and adds it.
+ */
+char *cache_temp(struct cache *cache, const char *ext);
+int cache_put(struct cache *cache, const char *key, const char *ext,
+	const char *temp, const char *output);
+
+void cache_print_stats(struct cache *cache, FILE *stream);
+
+#endif /* _MD_GENERATOR_CACHE_H */
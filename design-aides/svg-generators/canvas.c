@@ -0,0 +1,762 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "geom.h"
+#include "canvas.h"
+
+/* Commands per batch, and batches a sink can fall behind. */
+#define canvas_batch_len 8192U
+#define canvas_queue_len 4U
+
+/* Draft subpath node limit, after simplifying. */
+#define canvas_draft_nodes 32U
+
+struct canvas_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct canvas_batch *batches[canvas_queue_len];
+	unsigned int head;
+	unsigned int count;
+};
+
+struct canvas_sink {
+	struct canvas *canvas;
+	struct sink *sink;
+	FILE *file;
+	pthread_t thread;
+	bool started;
+	struct canvas_queue queue;
+	int result;
+	const char *trace_name;
+};
+
+/*
+ * Draft paths are collected as flattened rings and written at the path
+ * end, simplified to the draft tolerance, a pixel at the draft size.
+ */
+struct canvas_draft {
+	unsigned int pixels;
+	double tolerance;
+	char *id;
+	char *fill;
+	struct ring_set rings;
+	unsigned int ring_count;
+	struct point_d pen;
+};
+
+/* The params text and the palette colors separated by spaces. */
+struct canvas_info {
+	char *params;
+	struct out_buf palette;
+	unsigned int seed;
+};
+
+struct canvas {
+	struct canvas_sink *sinks;
+	unsigned int sink_count;
+	struct canvas_batch *batch;
+	unsigned int flags;
+	bool symbols;
+	bool expanded;
+	struct canvas_draft draft;
+	struct canvas_info info;
+	unsigned long long trace_start;
+};
+
+/* Sink thread names in traces, by sink_kind. */
+static const char *const canvas_trace_names[] = {
+	[sink_svg] = "sink svg",
+	[sink_svgz] = "sink svgz",
+	[sink_pdf] = "sink pdf",
+	[sink_preview] = "sink preview",
+	[sink_stats] = "sink stats",
+	[sink_shard] = "sink shard",
+	[sink_mdgeom] = "sink mdgeom",
+};
+
+const char *canvas_str(const struct canvas_batch *batch, unsigned int str)
+{
+	return str ? batch->text.data + str : NULL;
+}
+
+void canvas_cmd_rect(const struct canvas_cmd *cmd, struct svg_rect *rect)
+{
+	rect->x = cmd->p[0];
+	rect->y = cmd->p[1];
+	rect->width = cmd->p[2];
+	rect->height = cmd->p[3];
+	rect->rx = cmd->p[4];
+}
+
+void canvas_rect_outline(const struct svg_rect *rect, struct ring *ring)
+{
+	static const unsigned int steps = 8;
+	const double x0 = rect->x;
+	const double y0 = rect->y;
+	const double x1 = rect->x + rect->width;
+	const double y1 = rect->y + rect->height;
+	double r = fmin(rect->rx, fmin(rect->width, rect->height) / 2.0);
+	const struct point_d centers[4] = {
+		{x1 - r, y0 + r}, {x1 - r, y1 - r},
+		{x0 + r, y1 - r}, {x0 + r, y0 + r},
+	};
+	unsigned int c;
+	unsigned int i;
+
+	ring->count = 0;
+
+	if (!(r > 0.0)) {
+		ring_add(ring, x0, y0);
+		ring_add(ring, x1, y0);
+		ring_add(ring, x1, y1);
+		ring_add(ring, x0, y1);
+		return;
+	}
+
+	/* Corners clockwise from the top right, y down. */
+	for (c = 0; c < 4; c++) {
+		for (i = 0; i <= steps; i++) {
+			double a = M_PI / 2.0 * (c - 1 + (double)i / steps);
+
+			ring_add(ring, centers[c].x + r * cos(a),
+				centers[c].y + r * sin(a));
+		}
+	}
+}
+
+static struct canvas_batch *canvas_batch_new(void)
+{
+	struct canvas_batch *batch = mem_alloc(sizeof(*batch));
+
+	batch->cmds = mem_alloc(canvas_batch_len * sizeof(*batch->cmds));
+	/* Offset 0 is no string. */
+	out_add(&batch->text, "", 1);
+	return batch;
+}
+
+static void canvas_batch_release(struct canvas_batch *batch)
+{
+	if (__atomic_sub_fetch(&batch->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	out_free(&batch->text);
+	mem_free(batch->cmds);
+	mem_free(batch);
+}
+
+static void canvas_queue_push(struct canvas_queue *queue,
+	struct canvas_batch *batch)
+{
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count == canvas_queue_len) {
+		unsigned long long start = trace_begin();
+
+		while (queue->count == canvas_queue_len) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		}
+		trace_end("sink wait", start);
+	}
+	queue->batches[(queue->head + queue->count) % canvas_queue_len]
+		= batch;
+	queue->count++;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static struct canvas_batch *canvas_queue_pop(struct canvas_queue *queue)
+{
+	struct canvas_batch *batch;
+
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->count) {
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+	batch = queue->batches[queue->head];
+	queue->head = (queue->head + 1) % canvas_queue_len;
+	queue->count--;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return batch;
+}
+
+/* A NULL batch ends the stream. */
+static void *canvas_sink_worker(void *arg)
+{
+	struct canvas_sink *cs = arg;
+	const struct sink_ops *ops = cs->sink->ops;
+	struct canvas_batch *batch;
+	unsigned long long start;
+
+	trace_thread(cs->trace_name);
+
+	while ((batch = canvas_queue_pop(&cs->queue))) {
+		unsigned int skip = ops->symbols ? canvas_flag_expanded
+			: canvas_flag_symbols;
+		unsigned int i;
+
+		start = trace_begin();
+
+		for (i = 0; i < batch->count && !cs->result; i++) {
+			const struct canvas_cmd *cmd = &batch->cmds[i];
+
+			if (cmd->flags & skip) {
+				continue;
+			}
+			cs->result = ops->cmd(cs->sink, batch, cmd);
+		}
+		canvas_batch_release(batch);
+		trace_end("serialize", start);
+	}
+
+	start = trace_begin();
+	if (ops->finish(cs->sink)) {
+		cs->result = -1;
+	}
+	trace_end("finish", start);
+	return NULL;
+}
+
+static void canvas_publish(struct canvas *canvas)
+{
+	struct canvas_batch *batch = canvas->batch;
+	unsigned int i;
+
+	canvas->batch = NULL;
+	if (!batch) {
+		return;
+	}
+	trace_end("generate", canvas->trace_start);
+
+	batch->refs = canvas->sink_count;
+	for (i = 0; i < canvas->sink_count; i++) {
+		canvas_queue_push(&canvas->sinks[i].queue, batch);
+	}
+}
+
+static struct canvas_cmd *canvas_cmd(struct canvas *canvas,
+	enum canvas_op op)
+{
+	struct canvas_cmd *cmd;
+
+	if (canvas->batch && canvas->batch->count == canvas_batch_len) {
+		canvas_publish(canvas);
+	}
+	if (!canvas->batch) {
+		canvas->batch = canvas_batch_new();
+		canvas->trace_start = trace_begin();
+	}
+
+	cmd = &canvas->batch->cmds[canvas->batch->count++];
+	cmd->op = op;
+	cmd->flags = canvas->flags;
+	return cmd;
+}
+
+static unsigned int canvas_add_str(struct canvas *canvas, const char *s)
+{
+	unsigned int str;
+
+	if (!s) {
+		return 0;
+	}
+	str = canvas->batch->text.len;
+	out_add(&canvas->batch->text, s, strlen(s) + 1);
+	return str;
+}
+
+static void canvas_cmd_str(struct canvas *canvas, enum canvas_op op,
+	const char *s0, const char *s1, const char *s2)
+{
+	struct canvas_cmd *cmd = canvas_cmd(canvas, op);
+
+	cmd->str[0] = canvas_add_str(canvas, s0);
+	cmd->str[1] = canvas_add_str(canvas, s1);
+	cmd->str[2] = canvas_add_str(canvas, s2);
+}
+
+static void canvas_cmd_point(struct canvas *canvas, enum canvas_op op,
+	double x, double y)
+{
+	struct canvas_cmd *cmd = canvas_cmd(canvas, op);
+
+	cmd->p[0] = x;
+	cmd->p[1] = y;
+}
+
+static void canvas_cmd_rect_str(struct canvas *canvas, enum canvas_op op,
+	const struct svg_rect *rect, const char *id, const char *fill)
+{
+	struct canvas_cmd *cmd = canvas_cmd(canvas, op);
+
+	cmd->p[0] = rect->x;
+	cmd->p[1] = rect->y;
+	cmd->p[2] = rect->width;
+	cmd->p[3] = rect->height;
+	cmd->p[4] = rect->rx;
+	cmd->str[0] = canvas_add_str(canvas, id);
+	cmd->str[1] = canvas_add_str(canvas, fill);
+}
+
+struct canvas *canvas_new(void)
+{
+	return mem_alloc(sizeof(struct canvas));
+}
+
+int canvas_add_sink(struct canvas *canvas, enum sink_kind kind,
+	const char *file, unsigned int preview_size)
+{
+	struct canvas_sink *cs;
+	FILE *stream;
+	struct sink *sink;
+
+	assert(!canvas->batch);
+
+	if (!strcmp(file, "-")) {
+		stream = stdout;
+	} else {
+		stream = fopen(file, "w");
+		if (!stream) {
+			error("open '%s' failed: %s\n", file, strerror(errno));
+			return -1;
+		}
+	}
+
+	switch (kind) {
+	case sink_svgz:
+		sink = sink_svgz_new(stream);
+		break;
+	case sink_pdf:
+		sink = sink_pdf_new(stream);
+		break;
+	case sink_preview:
+		sink = sink_preview_new(stream, preview_size);
+		break;
+	case sink_stats:
+		sink = sink_stats_new(stream);
+		break;
+	case sink_shard:
+		sink = sink_shard_new(stream);
+		break;
+	case sink_mdgeom:
+		sink = sink_mdgeom_new(stream);
+		break;
+	default:
+		sink = sink_svg_new(stream);
+		break;
+	}
+
+	if (!sink) {
+		if (stream != stdout) {
+			fclose(stream);
+		}
+		return -1;
+	}
+
+	canvas->sinks = mem_realloc(canvas->sinks, (canvas->sink_count + 1)
+		* sizeof(*canvas->sinks));
+	cs = &canvas->sinks[canvas->sink_count++];
+	memset(cs, 0, sizeof(*cs));
+	cs->canvas = canvas;
+	cs->sink = sink;
+	cs->file = stream;
+	cs->trace_name = canvas_trace_names[kind];
+
+	if (sink->ops->symbols) {
+		canvas->symbols = true;
+	} else {
+		canvas->expanded = true;
+	}
+	return 0;
+}
+
+/* Whether any sink wants the expanded paths for use elements. */
+bool canvas_expanded(const struct canvas *canvas)
+{
+	return canvas->expanded;
+}
+
+void canvas_set_draft(struct canvas *canvas, unsigned int pixels)
+{
+	canvas->draft.pixels = pixels;
+}
+
+void canvas_set_info(struct canvas *canvas, const char *params,
+	unsigned int seed, const struct palette *palette)
+{
+	struct canvas_info *info = &canvas->info;
+	unsigned int i;
+
+	info->params = str_dup(params);
+	info->seed = seed;
+	for (i = 0; i < palette->color_count; i++) {
+		out_printf(&info->palette, "%s%s", i ? " " : "",
+			palette->colors[i]);
+	}
+	out_add(&info->palette, "", 1);
+}
+
+int canvas_open(struct canvas *canvas, const struct svg_rect *page)
+{
+	unsigned int i;
+	int result;
+
+	if (canvas->draft.pixels) {
+		canvas->draft.tolerance = fmax(page->width, page->height)
+			/ canvas->draft.pixels;
+		canvas->flags |= canvas_flag_draft;
+	}
+
+	for (i = 0; i < canvas->sink_count; i++) {
+		struct canvas_sink *cs = &canvas->sinks[i];
+
+		pthread_mutex_init(&cs->queue.lock, NULL);
+		pthread_cond_init(&cs->queue.cond, NULL);
+
+		result = pthread_create(&cs->thread, NULL, canvas_sink_worker,
+			cs);
+		if (result) {
+			error("pthread_create failed: %s\n", strerror(result));
+			return -1;
+		}
+		cs->started = true;
+	}
+
+	canvas_cmd_rect_str(canvas, canvas_op_open, page, NULL, NULL);
+
+	if (canvas->info.params) {
+		struct canvas_cmd *cmd = canvas_cmd(canvas, canvas_op_info);
+
+		cmd->str[0] = canvas_add_str(canvas, canvas->info.params);
+		cmd->str[1] = canvas_add_str(canvas, canvas->info.palette.data);
+		cmd->p[0] = canvas->info.seed;
+	}
+	return 0;
+}
+
+/* Ends the stream, waits for the sinks and frees the canvas. */
+int canvas_close(struct canvas *canvas)
+{
+	int result = 0;
+	unsigned int i;
+
+	canvas_publish(canvas);
+
+	for (i = 0; i < canvas->sink_count; i++) {
+		struct canvas_sink *cs = &canvas->sinks[i];
+		unsigned long long start = trace_begin();
+
+		if (cs->started) {
+			canvas_queue_push(&cs->queue, NULL);
+			pthread_join(cs->thread, NULL);
+			pthread_mutex_destroy(&cs->queue.lock);
+			pthread_cond_destroy(&cs->queue.cond);
+		} else {
+			cs->sink->ops->finish(cs->sink);
+			cs->result = -1;
+		}
+		trace_end("sink join", start);
+
+		start = trace_begin();
+		if (fflush(cs->file) || ferror(cs->file)) {
+			error("write failed: %s\n", strerror(errno));
+			cs->result = -1;
+		}
+		if (cs->file != stdout) {
+			fclose(cs->file);
+		}
+		trace_end("flush", start);
+		mem_free(cs->sink);
+
+		if (cs->result) {
+			result = -1;
+		}
+	}
+
+	if (canvas->sinks) {
+		mem_free(canvas->sinks);
+	}
+	ring_set_free(&canvas->draft.rings);
+	if (canvas->info.params) {
+		mem_free(canvas->info.params);
+	}
+	out_free(&canvas->info.palette);
+	mem_free(canvas);
+	return result;
+}
+
+void canvas_open_group(struct canvas *canvas, const char *id)
+{
+	canvas_cmd_str(canvas, canvas_op_group, id, NULL, NULL);
+}
+
+void canvas_close_group(struct canvas *canvas)
+{
+	canvas_cmd(canvas, canvas_op_group_end);
+}
+
+/* A path without fill inherits it, for symbols. */
+void canvas_open_path(struct canvas *canvas, const char *id,
+	const char *fill, unsigned int flags)
+{
+	canvas->flags |= flags;
+
+	if (canvas->draft.tolerance > 0.0) {
+		canvas->draft.id = id ? str_dup(id) : NULL;
+		canvas->draft.fill = fill ? str_dup(fill) : NULL;
+		canvas->draft.ring_count = 0;
+		return;
+	}
+	canvas_cmd_str(canvas, canvas_op_path, id, fill, NULL);
+}
+
+/* Evenly spaced nodes of a ring over the limit. */
+static void canvas_draft_limit(struct ring *ring)
+{
+	unsigned int i;
+
+	if (ring->count <= canvas_draft_nodes) {
+		return;
+	}
+	for (i = 0; i < canvas_draft_nodes; i++) {
+		ring->points[i] = ring->points[(unsigned long)i * ring->count
+			/ canvas_draft_nodes];
+	}
+	ring->count = canvas_draft_nodes;
+}
+
+/*
+ * Rings under a pixel are dropped, a path left without rings is not
+ * written at all.
+ */
+static void canvas_draft_path(struct canvas *canvas)
+{
+	struct canvas_draft *draft = &canvas->draft;
+	bool open = false;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < draft->ring_count; i++) {
+		struct ring *ring = &draft->rings.rings[i];
+		struct bbox box;
+		struct ring_set one = {.rings = ring, .count = 1};
+
+		ring_set_bbox(&one, &box);
+		if (box.x_max - box.x_min < draft->tolerance
+			&& box.y_max - box.y_min < draft->tolerance) {
+			continue;
+		}
+
+		ring_simplify(ring, draft->tolerance);
+		canvas_draft_limit(ring);
+		if (ring->count < 3) {
+			continue;
+		}
+
+		if (!open) {
+			canvas_cmd_str(canvas, canvas_op_path, draft->id,
+				draft->fill, NULL);
+			open = true;
+		}
+		canvas_cmd_point(canvas, canvas_op_move, ring->points[0].x,
+			ring->points[0].y);
+		for (j = 1; j < ring->count; j++) {
+			canvas_cmd_point(canvas, canvas_op_line,
+				ring->points[j].x, ring->points[j].y);
+		}
+		canvas_cmd(canvas, canvas_op_close);
+	}
+
+	if (open) {
+		canvas_cmd(canvas, canvas_op_path_end);
+	}
+
+	if (draft->id) {
+		mem_free(draft->id);
+		draft->id = NULL;
+	}
+	if (draft->fill) {
+		mem_free(draft->fill);
+		draft->fill = NULL;
+	}
+}
+
+void canvas_close_path(struct canvas *canvas)
+{
+	if (canvas->draft.tolerance > 0.0) {
+		canvas_draft_path(canvas);
+	} else {
+		canvas_cmd(canvas, canvas_op_path_end);
+	}
+	canvas->flags &= ~canvas_flag_expanded;
+}
+
+static struct ring *canvas_draft_ring(struct canvas *canvas)
+{
+	struct canvas_draft *draft = &canvas->draft;
+
+	assert(draft->ring_count);
+	return &draft->rings.rings[draft->ring_count - 1];
+}
+
+void canvas_move_to(struct canvas *canvas, double x, double y)
+{
+	struct canvas_draft *draft = &canvas->draft;
+	struct ring *ring;
+
+	if (!(draft->tolerance > 0.0)) {
+		canvas_cmd_point(canvas, canvas_op_move, x, y);
+		return;
+	}
+
+	/* Rings are reused from path to path. */
+	if (draft->ring_count < draft->rings.count) {
+		ring = &draft->rings.rings[draft->ring_count];
+		ring->count = 0;
+	} else {
+		ring = ring_set_add(&draft->rings);
+	}
+	draft->ring_count++;
+
+	ring_add(ring, x, y);
+	draft->pen.x = x;
+	draft->pen.y = y;
+}
+
+void canvas_line_to(struct canvas *canvas, double x, double y)
+{
+	if (!(canvas->draft.tolerance > 0.0)) {
+		canvas_cmd_point(canvas, canvas_op_line, x, y);
+		return;
+	}
+
+	ring_add(canvas_draft_ring(canvas), x, y);
+	canvas->draft.pen.x = x;
+	canvas->draft.pen.y = y;
+}
+
+void canvas_quad_to(struct canvas *canvas, double x1, double y1, double x,
+	double y)
+{
+	struct canvas_draft *draft = &canvas->draft;
+	struct canvas_cmd *cmd;
+	struct ring *ring;
+	double dx;
+	double dy;
+	unsigned int steps;
+	unsigned int i;
+
+	if (!(draft->tolerance > 0.0)) {
+		cmd = canvas_cmd(canvas, canvas_op_quad);
+		cmd->p[0] = x1;
+		cmd->p[1] = y1;
+		cmd->p[2] = x;
+		cmd->p[3] = y;
+		return;
+	}
+
+	/*
+	 * n segments are off the curve by at most |p0 - 2 p1 + p2| / 4n^2,
+	 * so only as many as the tolerance needs.
+	 */
+	ring = canvas_draft_ring(canvas);
+	dx = draft->pen.x - 2.0 * x1 + x;
+	dy = draft->pen.y - 2.0 * y1 + y;
+	steps = (unsigned int)ceil(sqrt(hypot(dx, dy)
+		/ (4.0 * draft->tolerance)));
+	steps = steps ? ((steps < 16) ? steps : 16) : 1;
+
+	for (i = 1; i <= steps; i++) {
+		double t = (double)i / steps;
+		double u = 1.0 - t;
+
+		ring_add(ring, u * u * draft->pen.x + 2.0 * u * t * x1
+			+ t * t * x, u * u * draft->pen.y + 2.0 * u * t * y1
+			+ t * t * y);
+	}
+	draft->pen.x = x;
+	draft->pen.y = y;
+}
+
+void canvas_close_subpath(struct canvas *canvas)
+{
+	struct canvas_draft *draft = &canvas->draft;
+
+	if (!(draft->tolerance > 0.0)) {
+		canvas_cmd(canvas, canvas_op_close);
+		return;
+	}
+	draft->pen = canvas_draft_ring(canvas)->points[0];
+}
+
+void canvas_rect(struct canvas *canvas, const char *id, const char *fill,
+	const struct svg_rect *rect)
+{
+	canvas_cmd_rect_str(canvas, canvas_op_rect, rect, id, fill);
+}
+
+/*
+ * A seamless tile is an SVG pattern filling a tile sized rect, other
+ * sinks draw the tile itself, clipped to the page.
+ */
+void canvas_open_tile(struct canvas *canvas, const struct svg_rect *tile_rect)
+{
+	canvas_cmd_rect_str(canvas, canvas_op_tile, tile_rect, NULL, NULL);
+}
+
+void canvas_close_tile(struct canvas *canvas, const struct svg_rect *tile_rect)
+{
+	canvas_cmd_rect_str(canvas, canvas_op_tile_end, tile_rect, NULL, NULL);
+}
+
+void canvas_open_defs(struct canvas *canvas)
+{
+	canvas->flags |= canvas_flag_symbols;
+	canvas_cmd(canvas, canvas_op_defs);
+}
+
+void canvas_close_defs(struct canvas *canvas)
+{
+	canvas_cmd(canvas, canvas_op_defs_end);
+	canvas->flags &= ~canvas_flag_symbols;
+}
+
+void canvas_open_symbol(struct canvas *canvas, const char *id)
+{
+	canvas_cmd_str(canvas, canvas_op_symbol, id, NULL, NULL);
+}
+
+void canvas_close_symbol(struct canvas *canvas)
+{
+	canvas_cmd(canvas, canvas_op_symbol_end);
+}
+
+void canvas_use(struct canvas *canvas, const char *id, const char *href,
+	const char *fill, const char *transform)
+{
+	struct canvas_cmd *cmd = canvas_cmd(canvas, canvas_op_use);
+
+	cmd->flags |= canvas_flag_symbols;
+	cmd->str[0] = canvas_add_str(canvas, id);
+	cmd->str[1] = canvas_add_str(canvas, href);
+	cmd->str[2] = canvas_add_str(canvas, fill);
+	cmd->str[3] = canvas_add_str(canvas, transform);
+}
@@ -0,0 +1,148 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_CANVAS_H)
+#define _MD_GENERATOR_CANVAS_H
+
+/*
+ * Geometry output pipeline.  Generators draw on a canvas once, the canvas
+ * records the drawing commands into batches and hands every batch to each
+ * registered sink.  Sinks run on their own threads, share the batches
+ * read only and drop their reference when done with one, the last one
+ * frees it.  A sink that falls behind blocks the canvas after a few
+ * batches, which bounds the memory.
+ */
+
+enum canvas_op {
+	canvas_op_open,
+	canvas_op_group,
+	canvas_op_group_end,
+	canvas_op_path,
+	canvas_op_path_end,
+	canvas_op_move,
+	canvas_op_line,
+	canvas_op_quad,
+	canvas_op_close,
+	canvas_op_rect,
+	canvas_op_tile,
+	canvas_op_tile_end,
+	canvas_op_defs,
+	canvas_op_defs_end,
+	canvas_op_symbol,
+	canvas_op_symbol_end,
+	canvas_op_use,
+	canvas_op_info,
+};
+
+/*
+ * Defs and use elements only go to sinks with symbols.  Sinks without
+ * get the expanded paths, a use drawn out, which the others skip.  Draft
+ * commands can be written with less precision.
+ */
+enum canvas_flags {
+	canvas_flag_symbols = 1,
+	canvas_flag_expanded = 2,
+	canvas_flag_draft = 4,
+};
+
+/*
+ * Strings are offsets into the batch text, 0 for none.  Open, rect and
+ * tile commands carry a rect in p: x, y, width, height and rx.  Info has
+ * the params text, the palette colors separated by spaces and the seed
+ * in p[0].
+ */
+struct canvas_cmd {
+	unsigned short op;
+	unsigned short flags;
+	unsigned int str[4];
+	double p[5];
+};
+
+struct canvas_batch {
+	struct canvas_cmd *cmds;
+	unsigned int count;
+	struct out_buf text;
+	unsigned int refs;
+};
+
+const char *canvas_str(const struct canvas_batch *batch, unsigned int str);
+void canvas_cmd_rect(const struct canvas_cmd *cmd, struct svg_rect *rect);
+
+/* Rect outline, rounded corners flattened. */
+void canvas_rect_outline(const struct svg_rect *rect, struct ring *ring);
+
+struct sink;
+
+struct sink_ops {
+	bool symbols;
+	int (*cmd)(struct sink *sink, const struct canvas_batch *batch,
+		const struct canvas_cmd *cmd);
+	int (*finish)(struct sink *sink);
+};
+
+struct sink {
+	const struct sink_ops *ops;
+	FILE *stream;
+	void *data;
+};
+
+enum sink_kind {
+	sink_svg,
+	sink_svgz,
+	sink_pdf,
+	sink_preview,
+	sink_stats,
+	sink_shard,
+	sink_mdgeom,
+};
+
+struct canvas;
+
+struct canvas *canvas_new(void);
+int canvas_add_sink(struct canvas *canvas, enum sink_kind kind,
+	const char *file, unsigned int preview_size);
+bool canvas_expanded(const struct canvas *canvas);
+void canvas_set_draft(struct canvas *canvas, unsigned int pixels);
+
+/*
+ * What the drawing is made from, an info command after the open for the
+ * sinks that keep it.
+ */
+void canvas_set_info(struct canvas *canvas, const char *params,
+	unsigned int seed, const struct palette *palette);
+int canvas_open(struct canvas *canvas, const struct svg_rect *page);
+int canvas_close(struct canvas *canvas);
+
+void canvas_open_group(struct canvas *canvas, const char *id);
+void canvas_close_group(struct canvas *canvas);
+void canvas_open_path(struct canvas *canvas, const char *id,
+	const char *fill, unsigned int flags);
+void canvas_close_path(struct canvas *canvas);
+void canvas_move_to(struct canvas *canvas, double x, double y);
+void canvas_line_to(struct canvas *canvas, double x, double y);
+void canvas_quad_to(struct canvas *canvas, double x1, double y1, double x,
+	double y);
+void canvas_close_subpath(struct canvas *canvas);
+void canvas_rect(struct canvas *canvas, const char *id, const char *fill,
+	const struct svg_rect *rect);
+void canvas_open_tile(struct canvas *canvas, const struct svg_rect *tile_rect);
+void canvas_close_tile(struct canvas *canvas, const struct svg_rect *tile_rect);
+void canvas_open_defs(struct canvas *canvas);
+void canvas_close_defs(struct canvas *canvas);
+void canvas_open_symbol(struct canvas *canvas, const char *id);
+void canvas_close_symbol(struct canvas *canvas);
+void canvas_use(struct canvas *canvas, const char *id, const char *href,
+	const char *fill, const char *transform);
+
+/* Sinks, in sink.c. */
+
+struct sink *sink_svg_new(FILE *stream);
+struct sink *sink_svgz_new(FILE *stream);
+struct sink *sink_pdf_new(FILE *stream);
+struct sink *sink_preview_new(FILE *stream, unsigned int size);
+struct sink *sink_stats_new(FILE *stream);
+struct sink *sink_shard_new(FILE *stream);
+struct sink *sink_mdgeom_new(FILE *stream);
+
+#endif /* _MD_GENERATOR_CANVAS_H */
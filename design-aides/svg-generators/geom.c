@@ -0,0 +1,404 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "geom.h"
+
+void bbox_init(struct bbox *box)
+{
+	box->x_min = FLT_MAX;
+	box->y_min = FLT_MAX;
+	box->x_max = -FLT_MAX;
+	box->y_max = -FLT_MAX;
+}
+
+void bbox_add(struct bbox *box, const struct point_c *p)
+{
+	box->x_min = (p->x < box->x_min) ? p->x : box->x_min;
+	box->y_min = (p->y < box->y_min) ? p->y : box->y_min;
+	box->x_max = (p->x > box->x_max) ? p->x : box->x_max;
+	box->y_max = (p->y > box->y_max) ? p->y : box->y_max;
+}
+
+bool bbox_overlap(const struct bbox *a, const struct bbox *b)
+{
+	return a->x_min <= b->x_max && b->x_min <= a->x_max
+		&& a->y_min <= b->y_max && b->y_min <= a->y_max;
+}
+
+bool polygon_contains(const struct point_c *poly, unsigned int count,
+	const struct point_c *p)
+{
+	unsigned int i;
+	unsigned int j;
+	bool inside = false;
+
+	for (i = 0, j = count - 1; i < count; j = i++) {
+		if ((poly[i].y > p->y) != (poly[j].y > p->y)
+			&& p->x < (poly[j].x - poly[i].x) * (p->y - poly[i].y)
+				/ (poly[j].y - poly[i].y) + poly[i].x) {
+			inside = !inside;
+		}
+	}
+
+	return inside;
+}
+
+static float cross(const struct point_c *o, const struct point_c *a,
+	const struct point_c *b)
+{
+	return (a->x - o->x) * (b->y - o->y) - (a->y - o->y) * (b->x - o->x);
+}
+
+static bool segment_intersect(const struct point_c *a1,
+	const struct point_c *a2, const struct point_c *b1,
+	const struct point_c *b2)
+{
+	float d1 = cross(b1, b2, a1);
+	float d2 = cross(b1, b2, a2);
+	float d3 = cross(a1, a2, b1);
+	float d4 = cross(a1, a2, b2);
+
+	return ((d1 > 0) != (d2 > 0) || d1 == 0 || d2 == 0)
+		&& ((d3 > 0) != (d4 > 0) || d3 == 0 || d4 == 0);
+}
+
+bool polygon_overlap(const struct point_c *a, unsigned int a_count,
+	const struct point_c *b, unsigned int b_count)
+{
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	unsigned int l;
+
+	for (i = 0, j = a_count - 1; i < a_count; j = i++) {
+		for (k = 0, l = b_count - 1; k < b_count; l = k++) {
+			if (segment_intersect(&a[j], &a[i], &b[l], &b[k])) {
+				return true;
+			}
+		}
+	}
+
+	/* No edge crossings, so either disjoint or one inside the other. */
+	return polygon_contains(b, b_count, &a[0])
+		|| polygon_contains(a, a_count, &b[0]);
+}
+
+void ring_add(struct ring *ring, double x, double y)
+{
+	if (ring->count == ring->alloc) {
+		ring->alloc = ring->alloc ? 2 * ring->alloc : 16;
+		ring->points = mem_realloc(ring->points,
+			ring->alloc * sizeof(*ring->points));
+	}
+	ring->points[ring->count].x = x;
+	ring->points[ring->count].y = y;
+	ring->count++;
+}
+
+struct ring *ring_set_add(struct ring_set *set)
+{
+	if (set->count == set->alloc) {
+		set->alloc = set->alloc ? 2 * set->alloc : 8;
+		set->rings = mem_realloc(set->rings,
+			set->alloc * sizeof(*set->rings));
+	}
+	memset(&set->rings[set->count], 0, sizeof(*set->rings));
+	return &set->rings[set->count++];
+}
+
+void ring_set_free(struct ring_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->rings[i].points) {
+			mem_free(set->rings[i].points);
+		}
+	}
+	if (set->rings) {
+		mem_free(set->rings);
+	}
+	memset(set, 0, sizeof(*set));
+}
+
+void ring_set_bbox(const struct ring_set *set, struct bbox *box)
+{
+	unsigned int i;
+	unsigned int j;
+
+	bbox_init(box);
+
+	for (i = 0; i < set->count; i++) {
+		for (j = 0; j < set->rings[i].count; j++) {
+			struct point_c p;
+
+			p.x = set->rings[i].points[j].x;
+			p.y = set->rings[i].points[j].y;
+			bbox_add(box, &p);
+		}
+	}
+}
+
+double ring_area(const struct ring *ring)
+{
+	double area = 0;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0, j = ring->count - 1; i < ring->count; j = i++) {
+		area += ring->points[j].x * ring->points[i].y
+			- ring->points[i].x * ring->points[j].y;
+	}
+
+	return area / 2;
+}
+
+static double segment_distance(const struct point_d *p,
+	const struct point_d *a, const struct point_d *b)
+{
+	double dx = b->x - a->x;
+	double dy = b->y - a->y;
+	double len2 = dx * dx + dy * dy;
+	double t = 0.0;
+
+	if (len2 > 0.0) {
+		t = ((p->x - a->x) * dx + (p->y - a->y) * dy) / len2;
+		t = fmax(0.0, fmin(1.0, t));
+	}
+	return hypot(p->x - (a->x + t * dx), p->y - (a->y + t * dy));
+}
+
+/*
+ * Douglas-Peucker on a closed ring, split at point 0 and the point
+ * farthest from it.  Spans are kept on a stack rather than recursed.
+ */
+void ring_simplify(struct ring *ring, double tolerance)
+{
+	const unsigned int n = ring->count;
+	const struct point_d *pts = ring->points;
+	unsigned int (*spans)[2];
+	unsigned int span_count = 0;
+	unsigned int far = 0;
+	double far_d = -1.0;
+	bool *keep;
+	unsigned int i;
+	unsigned int out;
+
+	if (n <= 3) {
+		return;
+	}
+
+	for (i = 1; i < n; i++) {
+		double d = hypot(pts[i].x - pts[0].x, pts[i].y - pts[0].y);
+
+		if (d > far_d) {
+			far_d = d;
+			far = i;
+		}
+	}
+
+	keep = mem_alloc(n * sizeof(*keep));
+	spans = mem_alloc((n + 2) * sizeof(*spans));
+	keep[0] = keep[far] = true;
+
+	/* Index n is point 0 again, closing the ring. */
+	spans[span_count][0] = 0;
+	spans[span_count++][1] = far;
+	spans[span_count][0] = far;
+	spans[span_count++][1] = n;
+
+	while (span_count) {
+		unsigned int first = spans[--span_count][0];
+		unsigned int last = spans[span_count][1];
+		unsigned int split = 0;
+		double max_d = tolerance;
+
+		for (i = first + 1; i < last; i++) {
+			double d = segment_distance(&pts[i], &pts[first],
+				&pts[last % n]);
+
+			if (d > max_d) {
+				max_d = d;
+				split = i;
+			}
+		}
+
+		if (split) {
+			keep[split] = true;
+			spans[span_count][0] = first;
+			spans[span_count++][1] = split;
+			spans[span_count][0] = split;
+			spans[span_count++][1] = last;
+		}
+	}
+
+	for (i = 0, out = 0; i < n; i++) {
+		if (keep[i]) {
+			ring->points[out++] = ring->points[i];
+		}
+	}
+	ring->count = out;
+
+	mem_free(keep);
+	mem_free(spans);
+}
+
+static unsigned int grid_column(const struct spatial_grid *grid, float x)
+{
+	float c = floorf((x - grid->origin.x) / grid->cell_size);
+
+	if (c < 0) {
+		return 0;
+	}
+	return (c >= grid->columns) ? grid->columns - 1 : (unsigned int)c;
+}
+
+static unsigned int grid_row(const struct spatial_grid *grid, float y)
+{
+	float r = floorf((y - grid->origin.y) / grid->cell_size);
+
+	if (r < 0) {
+		return 0;
+	}
+	return (r >= grid->rows) ? grid->rows - 1 : (unsigned int)r;
+}
+
+void spatial_grid_build(struct spatial_grid *grid, const struct bbox *boxes,
+	unsigned int count, float cell_size)
+{
+	struct bbox extent;
+	unsigned int cell_count;
+	unsigned int *fill;
+	unsigned int i;
+
+	assert(cell_size > 0);
+
+	bbox_init(&extent);
+	for (i = 0; i < count; i++) {
+		struct point_c p;
+
+		p.x = boxes[i].x_min;
+		p.y = boxes[i].y_min;
+		bbox_add(&extent, &p);
+		p.x = boxes[i].x_max;
+		p.y = boxes[i].y_max;
+		bbox_add(&extent, &p);
+	}
+
+	if (!count) {
+		extent.x_min = extent.y_min = 0;
+		extent.x_max = extent.y_max = 0;
+	}
+
+	grid->origin.x = extent.x_min;
+	grid->origin.y = extent.y_min;
+	grid->cell_size = cell_size;
+	grid->columns = 1 + (unsigned int)((extent.x_max - extent.x_min)
+		/ cell_size);
+	grid->rows = 1 + (unsigned int)((extent.y_max - extent.y_min)
+		/ cell_size);
+
+	cell_count = grid->columns * grid->rows;
+	grid->cell_start = mem_alloc((cell_count + 1) * sizeof(unsigned int));
+
+	/* Count, prefix sum, then fill. */
+	for (i = 0; i < count; i++) {
+		unsigned int r;
+		unsigned int c;
+
+		for (r = grid_row(grid, boxes[i].y_min);
+			r <= grid_row(grid, boxes[i].y_max); r++) {
+			for (c = grid_column(grid, boxes[i].x_min);
+				c <= grid_column(grid, boxes[i].x_max); c++) {
+				grid->cell_start[r * grid->columns + c + 1]++;
+			}
+		}
+	}
+
+	for (i = 0; i < cell_count; i++) {
+		grid->cell_start[i + 1] += grid->cell_start[i];
+	}
+
+	grid->items = mem_alloc((grid->cell_start[cell_count] + 1)
+		* sizeof(unsigned int));
+	fill = mem_alloc(cell_count * sizeof(unsigned int));
+
+	for (i = 0; i < count; i++) {
+		unsigned int r;
+		unsigned int c;
+
+		for (r = grid_row(grid, boxes[i].y_min);
+			r <= grid_row(grid, boxes[i].y_max); r++) {
+			for (c = grid_column(grid, boxes[i].x_min);
+				c <= grid_column(grid, boxes[i].x_max); c++) {
+				unsigned int cell = r * grid->columns + c;
+
+				grid->items[grid->cell_start[cell]
+					+ fill[cell]++] = i;
+			}
+		}
+	}
+
+	mem_free(fill);
+
+	grid->stamp = mem_alloc((count + 1) * sizeof(unsigned int));
+	grid->stamp_counter = 0;
+}
+
+void spatial_grid_free(struct spatial_grid *grid)
+{
+	mem_free(grid->cell_start);
+	mem_free(grid->items);
+	mem_free(grid->stamp);
+	memset(grid, 0, sizeof(*grid));
+}
+
+void spatial_grid_query(struct spatial_grid *grid, const struct bbox *boxes,
+	const struct bbox *box, spatial_grid_cb cb, void *cb_data)
+{
+	unsigned int r;
+	unsigned int c;
+
+	/* The stamp array reports items spanning several cells once. */
+	grid->stamp_counter++;
+
+	for (r = grid_row(grid, box->y_min); r <= grid_row(grid, box->y_max);
+		r++) {
+		for (c = grid_column(grid, box->x_min);
+			c <= grid_column(grid, box->x_max); c++) {
+			unsigned int cell = r * grid->columns + c;
+			unsigned int i;
+
+			for (i = grid->cell_start[cell];
+				i < grid->cell_start[cell + 1]; i++) {
+				unsigned int item = grid->items[i];
+
+				if (grid->stamp[item] == grid->stamp_counter) {
+					continue;
+				}
+				grid->stamp[item] = grid->stamp_counter;
+
+				if (bbox_overlap(&boxes[item], box)) {
+					cb(cb_data, item);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_GEOM_H)
+#define _MD_GENERATOR_GEOM_H
+
+struct bbox {
+	float x_min;
+	float y_min;
+	float x_max;
+	float y_max;
+};
+
+void bbox_init(struct bbox *box);
+void bbox_add(struct bbox *box, const struct point_c *p);
+bool bbox_overlap(const struct bbox *a, const struct bbox *b);
+
+bool polygon_contains(const struct point_c *poly, unsigned int count,
+	const struct point_c *p);
+bool polygon_overlap(const struct point_c *a, unsigned int a_count,
+	const struct point_c *b, unsigned int b_count);
+
+/*
+ * Double precision rings, used for template geometry where the float
+ * point_c is too coarse.
+ */
+
+struct point_d {
+	double x;
+	double y;
+};
+
+struct ring {
+	struct point_d *points;
+	unsigned int count;
+	unsigned int alloc;
+	bool closed;
+};
+
+struct ring_set {
+	struct ring *rings;
+	unsigned int count;
+	unsigned int alloc;
+};
+
+void ring_add(struct ring *ring, double x, double y);
+struct ring *ring_set_add(struct ring_set *set);
+void ring_set_free(struct ring_set *set);
+void ring_set_bbox(const struct ring_set *set, struct bbox *box);
+double ring_area(const struct ring *ring);
+void ring_simplify(struct ring *ring, double tolerance);
+
+/*
+ * Uniform grid spatial index over bounding boxes.  Items are stored in
+ * every cell their box touches, cell contents in one flat array.
+ */
+
+struct spatial_grid {
+	struct point_c origin;
+	float cell_size;
+	unsigned int columns;
+	unsigned int rows;
+	unsigned int *cell_start;
+	unsigned int *items;
+	unsigned int *stamp;
+	unsigned int stamp_counter;
+};
+
+typedef void (*spatial_grid_cb)(void *cb_data, unsigned int item);
+
+void spatial_grid_build(struct spatial_grid *grid, const struct bbox *boxes,
+	unsigned int count, float cell_size);
+void spatial_grid_free(struct spatial_grid *grid);
+void spatial_grid_query(struct spatial_grid *grid, const struct bbox *boxes,
+	const struct bbox *box, spatial_grid_cb cb, void *cb_data);
+
+#endif /* _MD_GENERATOR_GEOM_H */
@@ -0,0 +1,531 @@
+/*
+ *  moto-design random image generator.
+ */
+
+/*
+ * PNG rows are inflated straight out of the mapped IDAT chunks into a row
+ * buffer, unfiltered against the previous row and widened to RGBA.  PPM
+ * and PGM rows are read from the mapping.  Chunk CRCs are not checked,
+ * the zlib stream has its own check.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "util.h"
+#include "image.h"
+
+/* Rows wider than this are a broken header, not a photo. */
+static const unsigned int image_max_size = 1U << 16;
+
+enum png_type {
+	png_gray = 0,
+	png_rgb = 2,
+	png_indexed = 3,
+	png_gray_alpha = 4,
+	png_rgb_alpha = 6,
+};
+
+struct png {
+	const char *file;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int type;
+	unsigned int bpp;
+	size_t stride;
+	unsigned char palette[256][4];
+	unsigned char *row;
+	unsigned char *prev;
+	unsigned char *rgba;
+	size_t fill;
+	unsigned int y;
+	z_stream z;
+	image_row_callback cb;
+	void *cb_data;
+};
+
+static uint32_t png_get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+		| (uint32_t)p[2] << 8 | p[3];
+}
+
+static unsigned int png_channels(unsigned int type)
+{
+	switch (type) {
+	case png_gray:
+	case png_indexed:
+		return 1;
+	case png_gray_alpha:
+		return 2;
+	case png_rgb:
+		return 3;
+	case png_rgb_alpha:
+		return 4;
+	}
+	return 0;
+}
+
+static int png_header(struct png *png, const unsigned char *ihdr,
+	uint32_t len)
+{
+	unsigned int channels;
+	bool depth_ok;
+
+	if (len != 13) {
+		error("%s: bad IHDR.\n", png->file);
+		return -1;
+	}
+
+	png->width = png_get32(ihdr);
+	png->height = png_get32(ihdr + 4);
+	png->depth = ihdr[8];
+	png->type = ihdr[9];
+	channels = png_channels(png->type);
+
+	switch (png->type) {
+	case png_gray:
+		depth_ok = (png->depth == 1 || png->depth == 2
+			|| png->depth == 4 || png->depth == 8
+			|| png->depth == 16);
+		break;
+	case png_indexed:
+		depth_ok = (png->depth == 1 || png->depth == 2
+			|| png->depth == 4 || png->depth == 8);
+		break;
+	default:
+		depth_ok = (channels && (png->depth == 8 || png->depth == 16));
+		break;
+	}
+
+	if (!depth_ok || ihdr[10] || ihdr[11]) {
+		error("%s: unsupported PNG type %u, depth %u.\n", png->file,
+			png->type, png->depth);
+		return -1;
+	}
+	if (ihdr[12]) {
+		error("%s: interlaced PNG not supported.\n", png->file);
+		return -1;
+	}
+	if (!png->width || !png->height || png->width > image_max_size
+		|| png->height > image_max_size) {
+		error("%s: bad size %ux%u.\n", png->file, png->width,
+			png->height);
+		return -1;
+	}
+
+	png->bpp = (channels * png->depth + 7) / 8;
+	png->stride = ((size_t)png->width * channels * png->depth + 7) / 8;
+	return 0;
+}
+
+static unsigned char png_paeth(unsigned char a, unsigned char b,
+	unsigned char c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return (pb <= pc) ? b : c;
+}
+
+static int png_unfilter(struct png *png)
+{
+	unsigned char *row = png->row + 1;
+	const unsigned char *prev = png->prev + 1;
+	const size_t bpp = png->bpp;
+	size_t i;
+
+	switch (png->row[0]) {
+	case 0:
+		break;
+	case 1:
+		for (i = bpp; i < png->stride; i++) {
+			row[i] += row[i - bpp];
+		}
+		break;
+	case 2:
+		for (i = 0; i < png->stride; i++) {
+			row[i] += prev[i];
+		}
+		break;
+	case 3:
+		for (i = 0; i < bpp; i++) {
+			row[i] += prev[i] / 2;
+		}
+		for (; i < png->stride; i++) {
+			row[i] += (row[i - bpp] + prev[i]) / 2;
+		}
+		break;
+	case 4:
+		for (i = 0; i < bpp; i++) {
+			row[i] += prev[i];
+		}
+		for (; i < png->stride; i++) {
+			row[i] += png_paeth(row[i - bpp], prev[i],
+				prev[i - bpp]);
+		}
+		break;
+	default:
+		error("%s: bad filter %u, row %u.\n", png->file, png->row[0],
+			png->y);
+		return -1;
+	}
+	return 0;
+}
+
+/* Sample x of a row of 1, 2 or 4 bit samples. */
+static unsigned int png_sample(const unsigned char *row, unsigned int depth,
+	unsigned int x)
+{
+	unsigned int bit = x * depth;
+	unsigned int shift = 8 - depth - bit % 8;
+
+	return (row[bit / 8] >> shift) & ((1U << depth) - 1);
+}
+
+static void png_to_rgba(struct png *png)
+{
+	const unsigned char *row = png->row + 1;
+	unsigned char *out = png->rgba;
+	/* 16 bit samples use the high byte. */
+	const unsigned int step = png->depth / 8;
+	unsigned int x;
+
+	switch (png->type) {
+	case png_gray:
+		for (x = 0; x < png->width; x++, out += 4) {
+			unsigned int v = (png->depth < 8)
+				? png_sample(row, png->depth, x) * 255
+					/ ((1U << png->depth) - 1)
+				: row[x * step];
+
+			out[0] = out[1] = out[2] = v;
+			out[3] = 255;
+		}
+		break;
+	case png_indexed:
+		for (x = 0; x < png->width; x++, out += 4) {
+			unsigned int i = (png->depth < 8)
+				? png_sample(row, png->depth, x) : row[x];
+
+			memcpy(out, png->palette[i], 4);
+		}
+		break;
+	case png_gray_alpha:
+		for (x = 0; x < png->width; x++, out += 4) {
+			out[0] = out[1] = out[2] = row[2 * x * step];
+			out[3] = row[(2 * x + 1) * step];
+		}
+		break;
+	case png_rgb:
+		if (step == 1) {
+			for (x = 0; x < png->width; x++, out += 4, row += 3) {
+				out[0] = row[0];
+				out[1] = row[1];
+				out[2] = row[2];
+				out[3] = 255;
+			}
+			break;
+		}
+		for (x = 0; x < png->width; x++, out += 4, row += 6) {
+			out[0] = row[0];
+			out[1] = row[2];
+			out[2] = row[4];
+			out[3] = 255;
+		}
+		break;
+	case png_rgb_alpha:
+		if (step == 1) {
+			png->rgba = (unsigned char *)row;
+			return;
+		}
+		for (x = 0; x < png->width; x++, out += 4, row += 8) {
+			out[0] = row[0];
+			out[1] = row[2];
+			out[2] = row[4];
+			out[3] = row[6];
+		}
+		break;
+	}
+}
+
+/* Inflates an IDAT chunk, returns 1 when the last row is done. */
+static int png_data(struct png *png, const unsigned char *data, uint32_t len)
+{
+	int result;
+
+	png->z.next_in = (unsigned char *)data;
+	png->z.avail_in = len;
+
+	do {
+		png->z.next_out = png->row + png->fill;
+		png->z.avail_out = png->stride + 1 - png->fill;
+
+		result = inflate(&png->z, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END
+			&& result != Z_BUF_ERROR) {
+			error("%s: inflate failed: %s\n", png->file,
+				png->z.msg ? png->z.msg : "bad data");
+			return -1;
+		}
+
+		png->fill = png->stride + 1 - png->z.avail_out;
+		if (png->fill == png->stride + 1) {
+			unsigned char *rgba = png->rgba;
+			unsigned char *swap;
+			int cb_result;
+
+			if (png_unfilter(png)) {
+				return -1;
+			}
+			png_to_rgba(png);
+			cb_result = png->cb(png->cb_data, png->y, png->rgba,
+				png->width);
+			png->rgba = rgba;
+			if (cb_result) {
+				return -1;
+			}
+
+			swap = png->prev;
+			png->prev = png->row;
+			png->row = swap;
+			png->fill = 0;
+
+			if (++png->y == png->height) {
+				return 1;
+			}
+		}
+	} while (result != Z_STREAM_END
+		&& (png->z.avail_in || !png->z.avail_out));
+
+	if (result == Z_STREAM_END) {
+		error("%s: image data ends at row %u.\n", png->file, png->y);
+		return -1;
+	}
+	return 0;
+}
+
+static int png_read(const char *file, const struct mapped_file *mf,
+	struct image_info *info, image_row_callback cb, void *cb_data)
+{
+	const unsigned char *p = (const unsigned char *)mf->data + 8;
+	const unsigned char *end = (const unsigned char *)mf->data + mf->size;
+	struct png png = {
+		.file = file,
+		.cb = cb,
+		.cb_data = cb_data,
+	};
+	bool header = false;
+	int result = -1;
+	unsigned int i;
+
+	for (i = 0; i < 256; i++) {
+		png.palette[i][3] = 255;
+	}
+
+	while (end - p >= 12) {
+		uint32_t len = png_get32(p);
+		const unsigned char *type = p + 4;
+		const unsigned char *data = p + 8;
+
+		if (len > (size_t)(end - data) - 4) {
+			error("%s: truncated chunk.\n", file);
+			goto done;
+		}
+		p = data + len + 4;
+
+		if (!memcmp(type, "IHDR", 4)) {
+			if (header || png_header(&png, data, len)) {
+				goto done;
+			}
+			header = true;
+			info->width = png.width;
+			info->height = png.height;
+
+			if (inflateInit(&png.z) != Z_OK) {
+				error("inflateInit failed.\n");
+				goto done;
+			}
+			png.row = mem_alloc(png.stride + 1);
+			png.prev = mem_alloc(png.stride + 1);
+			png.rgba = mem_alloc((size_t)png.width * 4);
+			memset(png.prev, 0, png.stride + 1);
+		} else if (!header) {
+			error("%s: no IHDR.\n", file);
+			goto done;
+		} else if (!memcmp(type, "PLTE", 4)) {
+			for (i = 0; i < len / 3 && i < 256; i++) {
+				memcpy(png.palette[i], data + 3 * i, 3);
+			}
+		} else if (!memcmp(type, "tRNS", 4)
+			&& png.type == png_indexed) {
+			for (i = 0; i < len && i < 256; i++) {
+				png.palette[i][3] = data[i];
+			}
+		} else if (!memcmp(type, "IDAT", 4)) {
+			int data_result = png_data(&png, data, len);
+
+			if (data_result < 0) {
+				goto done;
+			}
+			if (data_result > 0) {
+				result = 0;
+				goto done;
+			}
+		} else if (!memcmp(type, "IEND", 4)) {
+			break;
+		}
+	}
+
+	error("%s: image data ends at row %u.\n", file, png.y);
+
+done:
+	if (header) {
+		inflateEnd(&png.z);
+		mem_free(png.row);
+		mem_free(png.prev);
+		mem_free(png.rgba);
+	}
+	return result;
+}
+
+/* Header number, skipping white space and comments. */
+static int pnm_number(const char **p, const char *end, unsigned int *value)
+{
+	unsigned long v = 0;
+
+	while (*p < end) {
+		if (**p == '#') {
+			while (*p < end && **p != '\n') {
+				(*p)++;
+			}
+		} else if (isspace((unsigned char)**p)) {
+			(*p)++;
+		} else {
+			break;
+		}
+	}
+
+	if (*p == end || !isdigit((unsigned char)**p)) {
+		return -1;
+	}
+	for (; *p < end && isdigit((unsigned char)**p); (*p)++) {
+		v = v * 10 + (**p - '0');
+		if (v > UINT32_MAX) {
+			return -1;
+		}
+	}
+	*value = v;
+	return 0;
+}
+
+static int pnm_read(const char *file, const struct mapped_file *mf,
+	struct image_info *info, image_row_callback cb, void *cb_data)
+{
+	const char *p = mf->data + 2;
+	const char *end = mf->data + mf->size;
+	const bool gray = (mf->data[1] == '5');
+	unsigned int channels = gray ? 1 : 3;
+	unsigned int maxval;
+	unsigned int bytes;
+	unsigned char *rgba;
+	size_t stride;
+	unsigned int y;
+	int result = 0;
+
+	if (pnm_number(&p, end, &info->width)
+		|| pnm_number(&p, end, &info->height)
+		|| pnm_number(&p, end, &maxval)
+		|| p == end || !isspace((unsigned char)*p)
+		|| !maxval || maxval > 65535
+		|| !info->width || info->width > image_max_size
+		|| !info->height || info->height > image_max_size) {
+		error("%s: bad header.\n", file);
+		return -1;
+	}
+	p++;
+
+	bytes = (maxval > 255) ? 2 : 1;
+	stride = (size_t)info->width * channels * bytes;
+	if ((size_t)(end - p) < stride * info->height) {
+		error("%s: truncated image.\n", file);
+		return -1;
+	}
+
+	rgba = mem_alloc((size_t)info->width * 4);
+
+	for (y = 0; y < info->height && !result; y++, p += stride) {
+		const unsigned char *row = (const unsigned char *)p;
+		unsigned char *out = rgba;
+		unsigned int x;
+
+		for (x = 0; x < info->width; x++, out += 4) {
+			unsigned int c;
+
+			for (c = 0; c < 3; c++) {
+				const unsigned char *s = row + (x * channels
+					+ (gray ? 0 : c)) * bytes;
+				unsigned int v = (bytes == 2)
+					? (unsigned int)s[0] << 8 | s[1] : s[0];
+
+				out[c] = (maxval == 255) ? v
+					: (v * 255 + maxval / 2) / maxval;
+			}
+			out[3] = 255;
+		}
+		result = cb(cb_data, y, rgba, info->width);
+	}
+
+	mem_free(rgba);
+	return result ? -1 : 0;
+}
+
+int image_read(const char *file, struct image_info *info,
+	image_row_callback cb, void *cb_data)
+{
+	static const unsigned char png_signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+	};
+	struct mapped_file mf;
+	int result;
+
+	*info = (struct image_info){0};
+
+	if (map_file(file, &mf)) {
+		return -1;
+	}
+
+	if (mf.size > sizeof(png_signature)
+		&& !memcmp(mf.data, png_signature, sizeof(png_signature))) {
+		result = png_read(file, &mf, info, cb, cb_data);
+	} else if (mf.size > 2 && mf.data[0] == 'P'
+		&& (mf.data[1] == '5' || mf.data[1] == '6')) {
+		result = pnm_read(file, &mf, info, cb, cb_data);
+	} else {
+		error("%s: not a PNG, PPM or PGM file.\n", file);
+		result = -1;
+	}
+
+	unmap_file(&mf);
+	return result;
+}
@@ -0,0 +1,26 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_IMAGE_H)
+#define _MD_GENERATOR_IMAGE_H
+
+/*
+ * Image file reader for PNG and binary PPM or PGM files.  The file is
+ * mapped and decoded a row at a time into 8 bit RGBA, so a photo is never
+ * held whole.  Interlaced PNGs are not supported.
+ */
+
+struct image_info {
+	unsigned int width;
+	unsigned int height;
+};
+
+typedef int (*image_row_callback)(void *cb_data, unsigned int y,
+	const unsigned char *rgba, unsigned int width);
+
+/* Stops at the first row the callback fails, returns -1 on errors. */
+int image_read(const char *file, struct image_info *info,
+	image_row_callback cb, void *cb_data);
+
+#endif /* _MD_GENERATOR_IMAGE_H */
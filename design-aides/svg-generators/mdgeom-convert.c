@@ -0,0 +1,717 @@
+/*
+ *  moto-design geometry converter.
+ */
+
+/*
+ * Converts blob-generator drawings between .mdgeom geometry files and SVG,
+ * and writes either as compressed SVG, PDF, a PNG preview or statistics,
+ * through the same canvas sinks as the generator.  A .mdgeom input is
+ * mapped and drawn from the file in place.  An SVG input is tokenized in
+ * place: its paths and rects are drawn with their transforms applied,
+ * quadratics raised to cubics by the path reader are drawn as quadratics
+ * again and other cubics and arcs are flattened to the tolerance.  Paths
+ * in defs, symbols, patterns, masks, markers and clip paths are skipped,
+ * other shapes and <use> are refused.  Fills are passed on as #rrggbb,
+ * color keywords and three digit hex expanded, other paints are refused.
+ *
+ * Groups aren't kept, outputs have the background rect in a background
+ * group and the other paths in a camo_blobs group, as the generator
+ * writes them.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "xml.h"
+#include "walk.h"
+#include "canvas.h"
+#include "mdgeom.h"
+
+static const char program_name[] = "mdgeom-convert";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+#define max_outputs 8U
+
+struct opts {
+	char *output_files[max_outputs];
+	unsigned int output_count;
+	char *stats_file;
+	unsigned int preview_size;
+	float tolerance;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Convert between .mdgeom geometry files and SVG.\n"
+"Usage: %s [flags] <input>\n"
+"Option flags:\n"
+"  -o --output-file <file> - Output file, repeat for more. Default: '-'.\n"
+"  -p --preview-size <px>  - PNG preview long side pixels. Default: '%u'.\n"
+"  -s --stats <file>       - Write path and color statistics to a file.\n"
+"  -t --tolerance <units>  - SVG curve flattening tolerance. Default: '%f'.\n"
+"  -h --help               - Show this help and exit.\n"
+"  -v --verbose            - Verbose execution.\n"
+"  -V --version            - Display the program version number.\n"
+"The input is a .mdgeom or an SVG file.  The output format is from the\n"
+"output file name extension {svg svgz pdf png mdgeom}, SVG otherwise.\n",
+		program_name, program_name,
+		opts->preview_size,
+		opts->tolerance
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"output-file",  required_argument, NULL, 'o'},
+		{"preview-size", required_argument, NULL, 'p'},
+		{"stats",        required_argument, NULL, 's'},
+		{"tolerance",    required_argument, NULL, 't'},
+		{"help",         no_argument,       NULL, 'h'},
+		{"verbose",      no_argument,       NULL, 'v'},
+		{"version",      no_argument,       NULL, 'V'},
+		{ NULL,          0,                 NULL, 0},
+	};
+	static const char short_options[] = "o:p:s:t:hvV";
+
+	*opts = (struct opts){
+		.preview_size = 1024U,
+		.tolerance = 0.01,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'o':
+			if (opts->output_count == max_outputs) {
+				error("More than %u outputs.\n", max_outputs);
+				return -1;
+			}
+			opts->output_files[opts->output_count++] = optarg;
+			break;
+		case 'p':
+			opts->preview_size = to_unsigned(optarg);
+			if (opts->preview_size == UINT_MAX
+				|| !opts->preview_size) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 's':
+			opts->stats_file = optarg;
+			break;
+		case 't':
+			opts->tolerance = to_float(optarg);
+			if (!(opts->tolerance > 0.0)) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	if (!opts->output_count && !opts->stats_file) {
+		opts->output_files[opts->output_count++] = "-";
+	}
+	return 0;
+}
+
+static enum sink_kind output_kind(const char *file)
+{
+	static const struct {
+		const char *ext;
+		enum sink_kind kind;
+	} kinds[] = {
+		{"svgz", sink_svgz},
+		{"pdf", sink_pdf},
+		{"png", sink_preview},
+		{"mdgeom", sink_mdgeom},
+	};
+	const char *ext = strrchr(file, '.');
+	unsigned int i;
+
+	for (i = 0; ext && i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		if (!strcasecmp(ext + 1, kinds[i].ext)) {
+			return kinds[i].kind;
+		}
+	}
+	return sink_svg;
+}
+
+static double ms_since(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec)
+		/ 1e6;
+}
+
+/* .mdgeom input, drawn as the generator drew it. */
+
+static void draw_mdgeom_path(struct canvas *canvas,
+	const struct mdgeom_path *path)
+{
+	unsigned int p = 0;
+	unsigned int i;
+
+	for (i = 0; i < path->verb_count; i++) {
+		switch (path->verbs[i]) {
+		case mdgeom_verb_move:
+			canvas_move_to(canvas, path->x[p], path->y[p]);
+			p++;
+			break;
+		case mdgeom_verb_line:
+			canvas_line_to(canvas, path->x[p], path->y[p]);
+			p++;
+			break;
+		case mdgeom_verb_quad:
+			canvas_quad_to(canvas, path->x[p], path->y[p],
+				path->x[p + 1], path->y[p + 1]);
+			p += 2;
+			break;
+		case mdgeom_verb_close:
+			canvas_close_subpath(canvas);
+			break;
+		}
+	}
+}
+
+static int draw_mdgeom(struct canvas *canvas, const char *file)
+{
+	struct mdgeom mg;
+	const struct mdgeom_header *h;
+	struct palette palette = {0};
+	struct svg_rect page;
+	struct svg_rect rect;
+	char color[hex_color_len];
+	unsigned int flags;
+	bool tile;
+	struct timespec t0;
+	unsigned int i;
+	int result = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (mdgeom_open(&mg, file)) {
+		return -1;
+	}
+	h = mg.header;
+	log("%s: %u paths, %u points, opened in %.3f ms\n", file,
+		h->path_count, h->point_count, ms_since(&t0));
+
+	flags = (h->flags & mdgeom_flag_draft) ? canvas_flag_draft : 0;
+	tile = h->flags & mdgeom_flag_tile;
+
+	if (*mg.params) {
+		palette.color_count = h->palette_count;
+		palette.colors = mem_alloc((h->palette_count + 1)
+			* sizeof(*palette.colors));
+		for (i = 0; i < h->palette_count; i++) {
+			mdgeom_color(&mg, i, palette.colors[i]);
+		}
+		canvas_set_info(canvas, mg.params, h->seed, &palette);
+		mem_free(palette.colors);
+	}
+
+	mdgeom_rect(h->page, &page);
+	if (canvas_open(canvas, &page)) {
+		mdgeom_close(&mg);
+		return -1;
+	}
+
+	if (tile) {
+		canvas_open_tile(canvas, &page);
+	}
+	if (h->flags & mdgeom_flag_background) {
+		mdgeom_rect(h->background_rect, &rect);
+		mdgeom_color(&mg, h->background, color);
+		if (!tile) {
+			canvas_open_group(canvas, "background");
+		}
+		canvas_rect(canvas, "background", color, &rect);
+		if (!tile) {
+			canvas_close_group(canvas);
+		}
+	}
+	if (!tile) {
+		canvas_open_group(canvas, "camo_blobs");
+	}
+
+	for (i = 0; i < h->path_count; i++) {
+		struct mdgeom_path path;
+
+		if (mdgeom_path(&mg, i, &path)) {
+			error("Bad .mdgeom file: '%s'\n", file);
+			result = -1;
+			break;
+		}
+		mdgeom_color(&mg, path.color, color);
+		canvas_open_path(canvas, *path.id ? path.id : NULL, color,
+			flags);
+		draw_mdgeom_path(canvas, &path);
+		canvas_close_path(canvas);
+	}
+
+	if (tile) {
+		canvas_close_tile(canvas, &page);
+	} else {
+		canvas_close_group(canvas);
+	}
+
+	debug("%s: drawn in %.3f ms\n", file, ms_since(&t0));
+	mdgeom_close(&mg);
+	return result;
+}
+
+/* SVG input. */
+
+struct svg_input {
+	const struct opts *opts;
+	struct canvas *canvas;
+	const char *file;
+	bool open;
+	bool in_blobs;
+	struct ring_set flat;
+	unsigned long paths;
+};
+
+/* Painted elements that would be lost. */
+static bool is_unsupported(const struct xml_token *tok)
+{
+	static const char *const names[] = {
+		"use", "circle", "ellipse", "line", "polyline", "polygon",
+		"image", "text",
+	};
+
+	return svg_name_in(tok, names, sizeof(names) / sizeof(names[0]));
+}
+
+static double attr_number(const struct xml_attr *attr)
+{
+	const char *p = attr->value;
+	double value;
+
+	return path_number(&p, attr->value + attr->value_len, &value)
+		? value : 0.0;
+}
+
+static bool is_identity(const struct affine *m)
+{
+	return m->a == 1.0 && m->b == 0.0 && m->c == 0.0 && m->d == 1.0
+		&& m->e == 0.0 && m->f == 0.0;
+}
+
+/* The root's viewBox, else its width and height. */
+static int open_page(struct svg_input *in, const struct xml_token *tok)
+{
+	struct svg_rect page = {0};
+	struct xml_attr attr;
+
+	if (!xml_name_is(tok, "svg")) {
+		error("Not an SVG file: '%s'\n", in->file);
+		return -1;
+	}
+
+	if (xml_attr_get(tok, "viewBox", &attr)) {
+		const char *p = attr.value;
+		const char *end = attr.value + attr.value_len;
+		double v[4];
+		unsigned int i;
+
+		for (i = 0; i < 4; i++) {
+			if (!path_number(&p, end, &v[i])) {
+				error("Bad viewBox: %s:%u\n", in->file,
+					tok->line);
+				return -1;
+			}
+		}
+		page.x = v[0];
+		page.y = v[1];
+		page.width = v[2];
+		page.height = v[3];
+	} else {
+		if (xml_attr_get(tok, "width", &attr)) {
+			page.width = attr_number(&attr);
+		}
+		if (xml_attr_get(tok, "height", &attr)) {
+			page.height = attr_number(&attr);
+		}
+	}
+
+	if (!(page.width > 0.0 && page.height > 0.0)) {
+		error("No page size: %s:%u\n", in->file, tok->line);
+		return -1;
+	}
+
+	in->open = true;
+	return canvas_open(in->canvas, &page);
+}
+
+static void open_blobs(struct svg_input *in)
+{
+	if (!in->in_blobs) {
+		canvas_open_group(in->canvas, "camo_blobs");
+		in->in_blobs = true;
+	}
+}
+
+static void draw_point(struct svg_input *in, enum path_seg_type type,
+	const struct affine *ctm, const struct point_d *p)
+{
+	struct point_d t;
+
+	affine_apply(ctm, p->x, p->y, &t);
+	if (type == path_seg_move) {
+		canvas_move_to(in->canvas, t.x, t.y);
+	} else {
+		canvas_line_to(in->canvas, t.x, t.y);
+	}
+}
+
+/*
+ * A cubic raised from a quadratic has both controls two thirds of the way
+ * from its ends to the quadratic's control, anything else is flattened.
+ */
+static void draw_cubic(struct svg_input *in, const struct affine *ctm,
+	const struct point_d *from, const struct path_segment *seg)
+{
+	struct point_d q1 = {
+		(3.0 * seg->c1.x - from->x) / 2.0,
+		(3.0 * seg->c1.y - from->y) / 2.0,
+	};
+	struct point_d q2 = {
+		(3.0 * seg->c2.x - seg->to.x) / 2.0,
+		(3.0 * seg->c2.y - seg->to.y) / 2.0,
+	};
+	double scale = fmax(1.0, fmax(fabs(q1.x), fabs(q1.y)));
+	struct point_d p[4];
+	struct ring *ring;
+	unsigned int i;
+
+	affine_apply(ctm, seg->to.x, seg->to.y, &p[3]);
+
+	if (fabs(q1.x - q2.x) <= 1e-9 * scale
+		&& fabs(q1.y - q2.y) <= 1e-9 * scale) {
+		affine_apply(ctm, q1.x, q1.y, &p[1]);
+		canvas_quad_to(in->canvas, p[1].x, p[1].y, p[3].x, p[3].y);
+		return;
+	}
+
+	affine_apply(ctm, from->x, from->y, &p[0]);
+	affine_apply(ctm, seg->c1.x, seg->c1.y, &p[1]);
+	affine_apply(ctm, seg->c2.x, seg->c2.y, &p[2]);
+
+	ring = in->flat.count ? in->flat.rings : ring_set_add(&in->flat);
+	ring->count = 0;
+	path_flatten_cubic(ring, &p[0], &p[1], &p[2], &p[3],
+		in->opts->tolerance);
+	for (i = 0; i < ring->count; i++) {
+		canvas_line_to(in->canvas, ring->points[i].x,
+			ring->points[i].y);
+	}
+}
+
+static int draw_path(struct svg_input *in, const struct svg_frame *frame,
+	const char *id, const char *fill, const char *d, const char *end)
+{
+	struct path_reader pr;
+	struct path_segment seg;
+	enum path_seg_type type;
+	struct point_d from = {0.0, 0.0};
+
+	open_blobs(in);
+	canvas_open_path(in->canvas, id, fill, 0);
+
+	path_reader_init(&pr, d, end);
+	while ((type = path_read(&pr, &seg)) > path_seg_error) {
+		switch (type) {
+		case path_seg_move:
+		case path_seg_line:
+			draw_point(in, type, &frame->ctm, &seg.to);
+			break;
+		case path_seg_cubic:
+			draw_cubic(in, &frame->ctm, &from, &seg);
+			break;
+		case path_seg_close:
+			canvas_close_subpath(in->canvas);
+			break;
+		default:
+			break;
+		}
+		from = seg.to;
+	}
+
+	canvas_close_path(in->canvas);
+	in->paths++;
+	return (type == path_seg_error) ? -1 : 0;
+}
+
+static int draw_rect(struct svg_input *in, const struct svg_frame *frame,
+	const struct xml_token *tok, const char *id, const char *fill)
+{
+	struct svg_rect rect = {0};
+	struct xml_attr attr;
+	struct ring *ring;
+	struct point_d p;
+	unsigned int i;
+
+	if (xml_attr_get(tok, "x", &attr)) {
+		rect.x = attr_number(&attr);
+	}
+	if (xml_attr_get(tok, "y", &attr)) {
+		rect.y = attr_number(&attr);
+	}
+	if (xml_attr_get(tok, "width", &attr)) {
+		rect.width = attr_number(&attr);
+	}
+	if (xml_attr_get(tok, "height", &attr)) {
+		rect.height = attr_number(&attr);
+	}
+	if (xml_attr_get(tok, "rx", &attr)) {
+		rect.rx = attr_number(&attr);
+	}
+
+	if (is_identity(&frame->ctm)) {
+		if (id && !strcmp(id, "background") && !in->in_blobs) {
+			canvas_open_group(in->canvas, "background");
+			canvas_rect(in->canvas, id, fill, &rect);
+			canvas_close_group(in->canvas);
+		} else {
+			open_blobs(in);
+			canvas_rect(in->canvas, id, fill, &rect);
+		}
+		return 0;
+	}
+
+	/* Transformed, the outline. */
+	ring = in->flat.count ? in->flat.rings : ring_set_add(&in->flat);
+	canvas_rect_outline(&rect, ring);
+	open_blobs(in);
+	canvas_open_path(in->canvas, id, fill, 0);
+	for (i = 0; i < ring->count; i++) {
+		affine_apply(&frame->ctm, ring->points[i].x,
+			ring->points[i].y, &p);
+		if (i) {
+			canvas_line_to(in->canvas, p.x, p.y);
+		} else {
+			canvas_move_to(in->canvas, p.x, p.y);
+		}
+	}
+	canvas_close_subpath(in->canvas);
+	canvas_close_path(in->canvas);
+	in->paths++;
+	return 0;
+}
+
+/* Draws the element when it is a painted path or rect. */
+static int draw_element(struct svg_input *in, const struct xml_token *tok,
+	const struct svg_frame *frame)
+{
+	char id[256] = "";
+	char fill[hex_color_len];
+	struct xml_attr attr;
+
+	if (frame->hidden) {
+		return 0;
+	}
+	if (is_unsupported(tok)) {
+		error("Unsupported <%.*s>: %s:%u\n", (int)tok->name_len,
+			tok->name, in->file, tok->line);
+		return -1;
+	}
+	if (svg_value_is(frame->fill, frame->fill_len, "none")) {
+		return 0;
+	}
+	if (!svg_fill_color(frame->fill, frame->fill_len, fill)) {
+		error("Unsupported fill '%.*s': %s:%u\n",
+			(int)frame->fill_len, frame->fill, in->file, tok->line);
+		return -1;
+	}
+
+	if (xml_attr_get(tok, "id", &attr)) {
+		snprintf(id, sizeof(id), "%.*s", (int)attr.value_len,
+			attr.value);
+	}
+
+	if (xml_name_is(tok, "path") && xml_attr_get(tok, "d", &attr)) {
+		if (draw_path(in, frame, *id ? id : NULL, fill, attr.value,
+			attr.value + attr.value_len)) {
+			error("Bad path data: %s:%u\n", in->file, tok->line);
+			return -1;
+		}
+	} else if (xml_name_is(tok, "rect")) {
+		return draw_rect(in, frame, tok, *id ? id : NULL, fill);
+	}
+	return 0;
+}
+
+static int draw_svg(const struct opts *opts, struct canvas *canvas,
+	const char *file, const struct mapped_file *mf)
+{
+	struct svg_input in = {
+		.opts = opts,
+		.canvas = canvas,
+		.file = file,
+	};
+	const struct svg_frame *frame;
+	enum xml_token_type type;
+	struct svg_walk sw;
+	struct xml_token tok;
+	struct timespec t0;
+	int result = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	svg_walk_init(&sw, mf->data, mf->size);
+
+	while ((type = svg_walk_next(&sw, &tok, &frame)) != xml_eof) {
+		if (type == xml_error) {
+			error("Invalid SVG: %s: %s\n", file, sw.error);
+			goto done;
+		}
+		if (!in.open && open_page(&in, &tok)) {
+			goto done;
+		}
+		if (draw_element(&in, &tok, frame)) {
+			goto done;
+		}
+	}
+
+	if (!in.open) {
+		error("Not an SVG file: '%s'\n", file);
+		goto done;
+	}
+	if (in.in_blobs) {
+		canvas_close_group(canvas);
+	}
+
+	log("%s: %lu paths, read in %.3f ms\n", file, in.paths,
+		ms_since(&t0));
+	result = 0;
+
+done:
+	svg_walk_free(&sw);
+	ring_set_free(&in.flat);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct canvas *canvas;
+	struct mapped_file mf;
+	const char *input;
+	unsigned int i;
+	int result;
+
+	if (opts_parse(&opts, argc, argv)) {
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return EXIT_SUCCESS;
+	}
+
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+
+	set_verbose(opts.verbose == opt_yes);
+
+	if (optind != argc - 1) {
+		error("One input file needed.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+	input = argv[optind];
+
+	if (map_file(input, &mf)) {
+		return EXIT_FAILURE;
+	}
+
+	canvas = canvas_new();
+	for (i = 0; i <= opts.output_count; i++) {
+		const char *file = (i < opts.output_count)
+			? opts.output_files[i] : opts.stats_file;
+
+		if (file && canvas_add_sink(canvas, (i < opts.output_count)
+			? output_kind(file) : sink_stats, file,
+			opts.preview_size)) {
+			canvas_close(canvas);
+			unmap_file(&mf);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (mdgeom_is(mf.data, mf.size)) {
+		unmap_file(&mf);
+		result = draw_mdgeom(canvas, input);
+	} else {
+		result = draw_svg(&opts, canvas, input, &mf);
+		unmap_file(&mf);
+	}
+
+	if (canvas_close(canvas)) {
+		result = -1;
+	}
+	return result ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,460 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "mdgeom.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error ".mdgeom files are little endian."
+#endif
+
+static const char mdgeom_magic[8] = "\x89MDGEOM\n";
+
+/* Writer, each section is built in a buffer of its own. */
+
+struct mdgeom_writer {
+	struct mdgeom_header header;
+	struct out_buf sections[mdgeom_section_count];
+	unsigned int last_color;
+};
+
+static void mdgeom_add_u32(struct mdgeom_writer *mw,
+	enum mdgeom_section_id id, uint32_t value)
+{
+	out_add(&mw->sections[id], (const char *)&value, sizeof(value));
+}
+
+static void mdgeom_add_verb(struct mdgeom_writer *mw, enum mdgeom_verb verb)
+{
+	const uint8_t v = verb;
+
+	out_add(&mw->sections[mdgeom_verbs], (const char *)&v, sizeof(v));
+	mw->header.verb_count++;
+}
+
+static void mdgeom_add_point(struct mdgeom_writer *mw, double x, double y)
+{
+	const float fx = x;
+	const float fy = y;
+
+	out_add(&mw->sections[mdgeom_x], (const char *)&fx, sizeof(fx));
+	out_add(&mw->sections[mdgeom_y], (const char *)&fy, sizeof(fy));
+	mw->header.point_count++;
+}
+
+static int mdgeom_rgb(const char *color, uint32_t *rgb)
+{
+	if (!color || !is_hex_color(color)) {
+		error("Fill '%s' is not a #rrggbb color.\n",
+			color ? color : "(none)");
+		return -1;
+	}
+	*rgb = (uint32_t)strtoul(color + 1, NULL, 16);
+	return 0;
+}
+
+/* The index of a color, added to the table when new. */
+static int mdgeom_color_index(struct mdgeom_writer *mw, const char *color,
+	unsigned int *index)
+{
+	const uint32_t *colors = (const uint32_t *)mw->sections[
+		mdgeom_colors].data;
+	uint32_t rgb;
+	unsigned int i;
+
+	if (mdgeom_rgb(color, &rgb)) {
+		return -1;
+	}
+
+	/* Paths mostly come in runs of one color. */
+	if (mw->last_color < mw->header.color_count
+		&& colors[mw->last_color] == rgb) {
+		*index = mw->last_color;
+		return 0;
+	}
+	for (i = 0; i < mw->header.color_count; i++) {
+		if (colors[i] == rgb) {
+			*index = mw->last_color = i;
+			return 0;
+		}
+	}
+
+	if (mw->header.color_count > UINT16_MAX) {
+		error("More than %u colors.\n", UINT16_MAX + 1);
+		return -1;
+	}
+	mdgeom_add_u32(mw, mdgeom_colors, rgb);
+	*index = mw->last_color = mw->header.color_count++;
+	return 0;
+}
+
+struct mdgeom_writer *mdgeom_writer_new(void)
+{
+	struct mdgeom_writer *mw = mem_alloc(sizeof(*mw));
+
+	memcpy(mw->header.magic, mdgeom_magic, sizeof(mdgeom_magic));
+	mw->header.version = mdgeom_version;
+	mw->header.header_size = sizeof(mw->header);
+
+	/* Offset 0 is no params and no id. */
+	out_add(&mw->sections[mdgeom_params], "", 1);
+	out_add(&mw->sections[mdgeom_ids], "", 1);
+	return mw;
+}
+
+void mdgeom_writer_free(struct mdgeom_writer *mw)
+{
+	unsigned int i;
+
+	for (i = 0; i < mdgeom_section_count; i++) {
+		out_free(&mw->sections[i]);
+	}
+	mem_free(mw);
+}
+
+static void mdgeom_put_rect(float *values, const struct svg_rect *rect)
+{
+	values[0] = rect->x;
+	values[1] = rect->y;
+	values[2] = rect->width;
+	values[3] = rect->height;
+	values[4] = rect->rx;
+}
+
+void mdgeom_set_page(struct mdgeom_writer *mw, const struct svg_rect *page)
+{
+	mdgeom_put_rect(mw->header.page, page);
+}
+
+void mdgeom_set_flags(struct mdgeom_writer *mw, unsigned int flags)
+{
+	mw->header.flags |= flags;
+}
+
+void mdgeom_set_params(struct mdgeom_writer *mw, const char *params,
+	unsigned int seed)
+{
+	struct out_buf *text = &mw->sections[mdgeom_params];
+
+	text->len = 0;
+	out_add(text, params, strlen(params) + 1);
+	mw->header.seed = seed;
+}
+
+/* Palette colors are kept in order, even when one repeats. */
+int mdgeom_add_palette(struct mdgeom_writer *mw, const char *color)
+{
+	uint32_t rgb;
+
+	assert(mw->header.color_count == mw->header.palette_count);
+
+	if (mdgeom_rgb(color, &rgb)) {
+		return -1;
+	}
+	mdgeom_add_u32(mw, mdgeom_colors, rgb);
+	mw->header.color_count++;
+	mw->header.palette_count++;
+	return 0;
+}
+
+int mdgeom_set_background(struct mdgeom_writer *mw, const char *fill,
+	const struct svg_rect *rect)
+{
+	unsigned int index;
+
+	if (mdgeom_color_index(mw, fill, &index)) {
+		return -1;
+	}
+	mw->header.background = index;
+	mw->header.flags |= mdgeom_flag_background;
+	mdgeom_put_rect(mw->header.background_rect, rect);
+	return 0;
+}
+
+/* A path runs to the next path or the end. */
+int mdgeom_open_path(struct mdgeom_writer *mw, const char *id,
+	const char *fill)
+{
+	struct out_buf *ids = &mw->sections[mdgeom_ids];
+	unsigned int index;
+	uint16_t color;
+
+	if (mdgeom_color_index(mw, fill, &index)) {
+		return -1;
+	}
+	color = index;
+
+	mdgeom_add_u32(mw, mdgeom_path_verbs, mw->header.verb_count);
+	mdgeom_add_u32(mw, mdgeom_path_points, mw->header.point_count);
+	out_add(&mw->sections[mdgeom_path_colors], (const char *)&color,
+		sizeof(color));
+
+	if (id && *id) {
+		mdgeom_add_u32(mw, mdgeom_path_ids, ids->len);
+		out_add(ids, id, strlen(id) + 1);
+	} else {
+		mdgeom_add_u32(mw, mdgeom_path_ids, 0);
+	}
+
+	mw->header.path_count++;
+	return 0;
+}
+
+void mdgeom_move_to(struct mdgeom_writer *mw, double x, double y)
+{
+	mdgeom_add_verb(mw, mdgeom_verb_move);
+	mdgeom_add_point(mw, x, y);
+}
+
+void mdgeom_line_to(struct mdgeom_writer *mw, double x, double y)
+{
+	mdgeom_add_verb(mw, mdgeom_verb_line);
+	mdgeom_add_point(mw, x, y);
+}
+
+void mdgeom_quad_to(struct mdgeom_writer *mw, double x1, double y1, double x,
+	double y)
+{
+	mdgeom_add_verb(mw, mdgeom_verb_quad);
+	mdgeom_add_point(mw, x1, y1);
+	mdgeom_add_point(mw, x, y);
+}
+
+void mdgeom_close_subpath(struct mdgeom_writer *mw)
+{
+	mdgeom_add_verb(mw, mdgeom_verb_close);
+}
+
+static size_t mdgeom_align(size_t offset)
+{
+	return (offset + 7) & ~(size_t)7;
+}
+
+int mdgeom_writer_write(struct mdgeom_writer *mw, FILE *stream)
+{
+	static const char zeros[8];
+	struct mdgeom_header *header = &mw->header;
+	size_t offset = mdgeom_align(sizeof(*header));
+	unsigned int i;
+
+	/* Counts and id offsets are 32 bit. */
+	if (mw->sections[mdgeom_x].len / sizeof(float) > UINT32_MAX
+		|| mw->sections[mdgeom_verbs].len > UINT32_MAX
+		|| mw->sections[mdgeom_ids].len > UINT32_MAX) {
+		error("Too many points for a .mdgeom file.\n");
+		return -1;
+	}
+
+	/* The end offsets of the last path. */
+	mdgeom_add_u32(mw, mdgeom_path_verbs, header->verb_count);
+	mdgeom_add_u32(mw, mdgeom_path_points, header->point_count);
+
+	for (i = 0; i < mdgeom_section_count; i++) {
+		header->sections[i].offset = offset;
+		header->sections[i].size = mw->sections[i].len;
+		offset = mdgeom_align(offset + mw->sections[i].len);
+	}
+
+	fwrite(header, 1, sizeof(*header), stream);
+	fwrite(zeros, 1, mdgeom_align(sizeof(*header)) - sizeof(*header),
+		stream);
+	for (i = 0; i < mdgeom_section_count; i++) {
+		const struct out_buf *section = &mw->sections[i];
+
+		if (section->len) {
+			fwrite(section->data, 1, section->len, stream);
+		}
+		fwrite(zeros, 1, mdgeom_align(section->len) - section->len,
+			stream);
+	}
+
+	if (ferror(stream)) {
+		error("write failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Reader. */
+
+bool mdgeom_is(const char *data, size_t size)
+{
+	return size >= sizeof(mdgeom_magic)
+		&& !memcmp(data, mdgeom_magic, sizeof(mdgeom_magic));
+}
+
+/* A section's pointer, when it is aligned, in the file and the size. */
+static const void *mdgeom_section(const struct mdgeom *mg,
+	enum mdgeom_section_id id, uint64_t size)
+{
+	const struct mdgeom_section *section = &mg->header->sections[id];
+
+	if (section->offset % 8 || section->offset > mg->mf.size
+		|| section->size > mg->mf.size - section->offset
+		|| (size != UINT64_MAX && section->size != size)) {
+		return NULL;
+	}
+	return mg->mf.data + section->offset;
+}
+
+static bool mdgeom_text_ok(const char *text, uint64_t size)
+{
+	return text && size && !text[size - 1];
+}
+
+static int mdgeom_check(struct mdgeom *mg)
+{
+	const struct mdgeom_header *h = mg->header;
+	const uint64_t paths = h->path_count;
+
+	if (h->version != mdgeom_version) {
+		error("Unsupported version %u.\n", h->version);
+		return -1;
+	}
+	if (h->header_size < sizeof(*h) || h->header_size > mg->mf.size) {
+		return -1;
+	}
+
+	mg->params = mdgeom_section(mg, mdgeom_params, UINT64_MAX);
+	mg->colors = mdgeom_section(mg, mdgeom_colors, 4 * (uint64_t)
+		h->color_count);
+	mg->path_verbs = mdgeom_section(mg, mdgeom_path_verbs,
+		4 * (paths + 1));
+	mg->path_points = mdgeom_section(mg, mdgeom_path_points,
+		4 * (paths + 1));
+	mg->path_colors = mdgeom_section(mg, mdgeom_path_colors, 2 * paths);
+	mg->path_ids = mdgeom_section(mg, mdgeom_path_ids, 4 * paths);
+	mg->ids = mdgeom_section(mg, mdgeom_ids, UINT64_MAX);
+	mg->ids_size = h->sections[mdgeom_ids].size;
+	mg->verbs = mdgeom_section(mg, mdgeom_verbs, h->verb_count);
+	mg->x = mdgeom_section(mg, mdgeom_x, 4 * (uint64_t)h->point_count);
+	mg->y = mdgeom_section(mg, mdgeom_y, 4 * (uint64_t)h->point_count);
+
+	if (!mdgeom_text_ok(mg->params, h->sections[mdgeom_params].size)
+		|| !mdgeom_text_ok(mg->ids, mg->ids_size)
+		|| !mg->colors || !mg->path_verbs || !mg->path_points
+		|| !mg->path_colors || !mg->path_ids || !mg->verbs
+		|| !mg->x || !mg->y) {
+		return -1;
+	}
+
+	if (mg->path_verbs[paths] != h->verb_count
+		|| mg->path_points[paths] != h->point_count
+		|| h->palette_count > h->color_count
+		|| ((h->flags & mdgeom_flag_background)
+			&& h->background >= h->color_count)) {
+		return -1;
+	}
+	return 0;
+}
+
+int mdgeom_open(struct mdgeom *mg, const char *file)
+{
+	*mg = (struct mdgeom){0};
+
+	if (map_file(file, &mg->mf)) {
+		return -1;
+	}
+
+	if (!mdgeom_is(mg->mf.data, mg->mf.size)
+		|| mg->mf.size < sizeof(*mg->header)) {
+		error("Not a .mdgeom file: '%s'\n", file);
+		unmap_file(&mg->mf);
+		return -1;
+	}
+
+	mg->header = (const struct mdgeom_header *)mg->mf.data;
+	if (mdgeom_check(mg)) {
+		error("Bad .mdgeom file: '%s'\n", file);
+		unmap_file(&mg->mf);
+		return -1;
+	}
+	return 0;
+}
+
+void mdgeom_close(struct mdgeom *mg)
+{
+	unmap_file(&mg->mf);
+	*mg = (struct mdgeom){0};
+}
+
+/* The path's ranges, and that its verbs use exactly its points. */
+int mdgeom_path(const struct mdgeom *mg, unsigned int index,
+	struct mdgeom_path *path)
+{
+	static const unsigned int verb_points[] = {
+		[mdgeom_verb_move] = 1,
+		[mdgeom_verb_line] = 1,
+		[mdgeom_verb_quad] = 2,
+		[mdgeom_verb_close] = 0,
+	};
+	const uint32_t verb = mg->path_verbs[index];
+	const uint32_t point = mg->path_points[index];
+	unsigned int points = 0;
+	unsigned int i;
+
+	assert(index < mg->header->path_count);
+
+	if (verb > mg->path_verbs[index + 1]
+		|| mg->path_verbs[index + 1] > mg->header->verb_count
+		|| point > mg->path_points[index + 1]
+		|| mg->path_points[index + 1] > mg->header->point_count
+		|| mg->path_ids[index] >= mg->ids_size
+		|| mg->path_colors[index] >= mg->header->color_count) {
+		error("Bad path %u.\n", index);
+		return -1;
+	}
+
+	path->id = mg->ids + mg->path_ids[index];
+	path->color = mg->path_colors[index];
+	path->verbs = mg->verbs + verb;
+	path->verb_count = mg->path_verbs[index + 1] - verb;
+	path->x = mg->x + point;
+	path->y = mg->y + point;
+	path->point_count = mg->path_points[index + 1] - point;
+
+	for (i = 0; i < path->verb_count; i++) {
+		if (!path->verbs[i] || path->verbs[i] > mdgeom_verb_close) {
+			error("Bad verb in path %u.\n", index);
+			return -1;
+		}
+		points += verb_points[path->verbs[i]];
+	}
+	if (points != path->point_count) {
+		error("Bad point count in path %u.\n", index);
+		return -1;
+	}
+	return 0;
+}
+
+void mdgeom_rect(const float *values, struct svg_rect *rect)
+{
+	rect->x = values[0];
+	rect->y = values[1];
+	rect->width = values[2];
+	rect->height = values[3];
+	rect->rx = values[4];
+}
+
+void mdgeom_color(const struct mdgeom *mg, unsigned int index,
+	char color[hex_color_len])
+{
+	snprintf(color, hex_color_len, "#%06x",
+		(unsigned int)mg->colors[index] & 0xffffffU);
+}
@@ -0,0 +1,144 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_MDGEOM_H)
+#define _MD_GENERATOR_MDGEOM_H
+
+/*
+ * .mdgeom geometry files, the filled paths of a drawing in a form tools
+ * can use without parsing SVG.  A fixed header is followed by sections at
+ * 8 byte aligned offsets: the generator params text, the color table, the
+ * per path offset, color and id tables, the path ids, the path verbs and
+ * the x and y coordinates as separate float arrays.  Integers and floats
+ * are little endian.
+ *
+ * Path i has verbs path_verbs[i] to path_verbs[i + 1] and points
+ * path_points[i] to path_points[i + 1], a move or line takes one point, a
+ * quadratic its control point and end point and a close none.  Colors are
+ * 0xrrggbb, the first palette_count of them the generator's palette in
+ * order, path colors and the background are indices into them.
+ *
+ * The writer keeps the drawing in memory and writes the file at the end.
+ * The reader maps the file and points into it, opening only checks the
+ * header and the section bounds, a path's tables are checked when it is
+ * read.
+ */
+
+#define mdgeom_version 1U
+
+enum mdgeom_flags {
+	mdgeom_flag_background = 1,
+	mdgeom_flag_tile = 2,
+	mdgeom_flag_draft = 4,
+};
+
+enum mdgeom_verb {
+	mdgeom_verb_move = 1,
+	mdgeom_verb_line,
+	mdgeom_verb_quad,
+	mdgeom_verb_close,
+};
+
+/* In file order. */
+enum mdgeom_section_id {
+	mdgeom_params,
+	mdgeom_colors,
+	mdgeom_path_verbs,
+	mdgeom_path_points,
+	mdgeom_path_colors,
+	mdgeom_path_ids,
+	mdgeom_ids,
+	mdgeom_verbs,
+	mdgeom_x,
+	mdgeom_y,
+	mdgeom_section_count,
+};
+
+struct mdgeom_section {
+	uint64_t offset;
+	uint64_t size;
+};
+
+/* Rects are x, y, width, height and rx. */
+struct mdgeom_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t flags;
+	uint32_t seed;
+	uint32_t path_count;
+	uint32_t verb_count;
+	uint32_t point_count;
+	uint32_t color_count;
+	uint32_t palette_count;
+	uint32_t background;
+	float page[5];
+	float background_rect[5];
+	struct mdgeom_section sections[mdgeom_section_count];
+};
+
+/* Writer. */
+
+struct mdgeom_writer;
+
+struct mdgeom_writer *mdgeom_writer_new(void);
+int mdgeom_writer_write(struct mdgeom_writer *mw, FILE *stream);
+void mdgeom_writer_free(struct mdgeom_writer *mw);
+
+void mdgeom_set_page(struct mdgeom_writer *mw, const struct svg_rect *page);
+void mdgeom_set_flags(struct mdgeom_writer *mw, unsigned int flags);
+
+/* The params text, seed and palette, before any path. */
+void mdgeom_set_params(struct mdgeom_writer *mw, const char *params,
+	unsigned int seed);
+int mdgeom_add_palette(struct mdgeom_writer *mw, const char *color);
+
+int mdgeom_set_background(struct mdgeom_writer *mw, const char *fill,
+	const struct svg_rect *rect);
+int mdgeom_open_path(struct mdgeom_writer *mw, const char *id,
+	const char *fill);
+void mdgeom_move_to(struct mdgeom_writer *mw, double x, double y);
+void mdgeom_line_to(struct mdgeom_writer *mw, double x, double y);
+void mdgeom_quad_to(struct mdgeom_writer *mw, double x1, double y1, double x,
+	double y);
+void mdgeom_close_subpath(struct mdgeom_writer *mw);
+
+/* Reader, the pointers are into the mapped file. */
+
+struct mdgeom {
+	struct mapped_file mf;
+	const struct mdgeom_header *header;
+	const char *params;
+	const uint32_t *colors;
+	const uint32_t *path_verbs;
+	const uint32_t *path_points;
+	const uint16_t *path_colors;
+	const uint32_t *path_ids;
+	const char *ids;
+	size_t ids_size;
+	const uint8_t *verbs;
+	const float *x;
+	const float *y;
+};
+
+struct mdgeom_path {
+	const char *id;
+	unsigned int color;
+	const uint8_t *verbs;
+	unsigned int verb_count;
+	const float *x;
+	const float *y;
+	unsigned int point_count;
+};
+
+bool mdgeom_is(const char *data, size_t size);
+int mdgeom_open(struct mdgeom *mg, const char *file);
+void mdgeom_close(struct mdgeom *mg);
+int mdgeom_path(const struct mdgeom *mg, unsigned int index,
+	struct mdgeom_path *path);
+void mdgeom_rect(const float *values, struct svg_rect *rect);
+void mdgeom_color(const struct mdgeom *mg, unsigned int index,
+	char color[hex_color_len]);
+
+#endif /* _MD_GENERATOR_MDGEOM_H */
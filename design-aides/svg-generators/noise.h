@@ -0,0 +1,17 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_NOISE_H)
+#define _MD_GENERATOR_NOISE_H
+
+/*
+ * 2D simplex noise summed over octaves, each octave at twice the
+ * frequency and half the amplitude of the last, in about -1 to 1.
+ * Evaluated for a row of count points at x + i * dx, y.
+ */
+
+void noise_fbm_row(float *out, unsigned int count, float x, float dx, float y,
+	unsigned int octaves, unsigned int seed);
+
+#endif /* _MD_GENERATOR_NOISE_H */
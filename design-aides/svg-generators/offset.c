@@ -0,0 +1,1108 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "geom.h"
+#include "offset.h"
+
+/*
+ * The outset boundary is made of pieces: both offset sides of every
+ * edge, and a round join arc on the convex side of every vertex.  The
+ * pieces are split where they cross, each sub-piece is kept when it is
+ * at least the offset distance from every edge and outside every closed
+ * ring, then the kept sub-pieces are linked end to start into rings.
+ * Pieces are oriented with the covered region on their left, so linking
+ * never needs to reverse anything.
+ */
+
+enum piece_type {
+	piece_segment,
+	piece_arc,
+};
+
+struct piece {
+	enum piece_type type;
+	struct point_d p0;
+	struct point_d p1;
+	struct point_d center;
+	double angle;
+	double sweep;
+};
+
+struct edge {
+	struct point_d p0;
+	struct point_d p1;
+	unsigned int ring;
+	bool closed;
+};
+
+struct split {
+	unsigned int piece;
+	double t;
+	struct point_d p;
+};
+
+struct span {
+	unsigned int piece;
+	double t0;
+	double t1;
+	struct point_d p0;
+	struct point_d p1;
+};
+
+struct link_key {
+	int64_t cx;
+	int64_t cy;
+	unsigned int span;
+};
+
+struct offset_ctx {
+	double distance;
+	double tolerance;
+	double eps;
+	double link_tol;
+
+	struct edge *edges;
+	unsigned int edge_count;
+	unsigned int edge_alloc;
+	struct bbox *edge_boxes;
+	struct spatial_grid edge_grid;
+
+	unsigned int *fill_edges;
+	unsigned int fill_count;
+	struct bbox *fill_boxes;
+	struct spatial_grid fill_grid;
+	float fill_x_max;
+	unsigned char *parity;
+	unsigned int *touched;
+	unsigned int touched_count;
+	unsigned int ring_count;
+
+	struct piece *pieces;
+	unsigned int piece_count;
+	unsigned int piece_alloc;
+	struct bbox *piece_boxes;
+	struct spatial_grid piece_grid;
+
+	struct split *splits;
+	unsigned int split_count;
+	unsigned int split_alloc;
+
+	struct span *spans;
+	unsigned int span_count;
+	unsigned int span_alloc;
+
+	/* Grid query state. */
+	unsigned int current;
+	struct point_d query;
+	bool too_close;
+};
+
+static double cross(double ax, double ay, double bx, double by)
+{
+	return ax * by - ay * bx;
+}
+
+static double point_distance(const struct point_d *a, const struct point_d *b)
+{
+	return hypot(a->x - b->x, a->y - b->y);
+}
+
+static void box_add(struct bbox *box, double x, double y)
+{
+	struct point_c p;
+
+	p.x = x;
+	p.y = y;
+	bbox_add(box, &p);
+}
+
+static void box_pad(struct bbox *box, float pad)
+{
+	box->x_min -= pad;
+	box->y_min -= pad;
+	box->x_max += pad;
+	box->y_max += pad;
+}
+
+/* A cell size near the typical box size, capped at 1024 cells a side. */
+static float grid_cell_size(const struct bbox *boxes, unsigned int count)
+{
+	struct bbox extent;
+	double sum = 0;
+	float size;
+	unsigned int i;
+
+	bbox_init(&extent);
+
+	for (i = 0; i < count; i++) {
+		struct point_c p;
+
+		sum += fmaxf(boxes[i].x_max - boxes[i].x_min,
+			boxes[i].y_max - boxes[i].y_min);
+		p.x = boxes[i].x_min;
+		p.y = boxes[i].y_min;
+		bbox_add(&extent, &p);
+		p.x = boxes[i].x_max;
+		p.y = boxes[i].y_max;
+		bbox_add(&extent, &p);
+	}
+
+	if (!count) {
+		return 1.0f;
+	}
+
+	size = fmaxf(sum / count, fmaxf(extent.x_max - extent.x_min,
+		extent.y_max - extent.y_min) / 1024.0f);
+	return (size > 0.0f) ? size : 1.0f;
+}
+
+static double normalize_angle(double a)
+{
+	a = fmod(a, 2 * M_PI);
+	return (a < 0) ? a + 2 * M_PI : a;
+}
+
+static void piece_point(const struct offset_ctx *ctx, const struct piece *pc,
+	double t, struct point_d *out)
+{
+	if (pc->type == piece_segment) {
+		out->x = pc->p0.x + t * (pc->p1.x - pc->p0.x);
+		out->y = pc->p0.y + t * (pc->p1.y - pc->p0.y);
+	} else {
+		double a = pc->angle + t * pc->sweep;
+
+		out->x = pc->center.x + ctx->distance * cos(a);
+		out->y = pc->center.y + ctx->distance * sin(a);
+	}
+}
+
+static double piece_length(const struct offset_ctx *ctx,
+	const struct piece *pc)
+{
+	if (pc->type == piece_segment) {
+		return point_distance(&pc->p0, &pc->p1);
+	}
+	return ctx->distance * pc->sweep;
+}
+
+/* The arc parameter of a point on the arc circle, or -1 if off the arc. */
+static double arc_param(const struct offset_ctx *ctx, const struct piece *pc,
+	const struct point_d *p)
+{
+	double slack = ctx->eps / ctx->distance;
+	double a = normalize_angle(atan2(p->y - pc->center.y,
+		p->x - pc->center.x) - pc->angle);
+
+	if (a > pc->sweep + slack) {
+		if (2 * M_PI - a <= slack) {
+			return 0.0;
+		}
+		return -1.0;
+	}
+	return fmin(a / pc->sweep, 1.0);
+}
+
+static void add_edge(struct offset_ctx *ctx, const struct point_d *p0,
+	const struct point_d *p1, unsigned int ring, bool closed)
+{
+	struct edge *e;
+
+	if (ctx->edge_count == ctx->edge_alloc) {
+		ctx->edge_alloc = ctx->edge_alloc ? 2 * ctx->edge_alloc : 256;
+		ctx->edges = mem_realloc(ctx->edges,
+			ctx->edge_alloc * sizeof(*ctx->edges));
+	}
+
+	e = &ctx->edges[ctx->edge_count++];
+	e->p0 = *p0;
+	e->p1 = *p1;
+	e->ring = ring;
+	e->closed = closed;
+}
+
+static struct piece *add_piece(struct offset_ctx *ctx, enum piece_type type)
+{
+	struct piece *pc;
+
+	if (ctx->piece_count == ctx->piece_alloc) {
+		ctx->piece_alloc = ctx->piece_alloc ? 2 * ctx->piece_alloc
+			: 256;
+		ctx->pieces = mem_realloc(ctx->pieces,
+			ctx->piece_alloc * sizeof(*ctx->pieces));
+	}
+
+	pc = &ctx->pieces[ctx->piece_count++];
+	memset(pc, 0, sizeof(*pc));
+	pc->type = type;
+	return pc;
+}
+
+static void offset_point(const struct point_d *p, double nx, double ny,
+	double d, struct point_d *out)
+{
+	out->x = p->x + nx * d;
+	out->y = p->y + ny * d;
+}
+
+static void add_segment(struct offset_ctx *ctx, const struct point_d *a,
+	const struct point_d *b, double nx, double ny)
+{
+	struct piece *pc = add_piece(ctx, piece_segment);
+
+	offset_point(a, nx, ny, ctx->distance, &pc->p0);
+	offset_point(b, nx, ny, ctx->distance, &pc->p1);
+}
+
+/* An arc about v from normal n0 to normal n1, counter clockwise. */
+static void add_arc(struct offset_ctx *ctx, const struct point_d *v,
+	double n0x, double n0y, double n1x, double n1y, double sweep)
+{
+	struct piece *pc;
+
+	if (sweep <= 1e-12) {
+		return;
+	}
+
+	pc = add_piece(ctx, piece_arc);
+	pc->center = *v;
+	pc->angle = atan2(n0y, n0x);
+	pc->sweep = sweep;
+	offset_point(v, n0x, n0y, ctx->distance, &pc->p0);
+	offset_point(v, n1x, n1y, ctx->distance, &pc->p1);
+}
+
+static void build_ring_pieces(struct offset_ctx *ctx, const struct ring *ring,
+	unsigned int ring_index)
+{
+	struct point_d *pts = mem_alloc((ring->count + 1) * sizeof(*pts));
+	struct point_d *normals;
+	unsigned int edge_count;
+	unsigned int count = 0;
+	unsigned int i;
+	bool closed;
+
+	/* Drop repeated points, they have no direction. */
+	for (i = 0; i < ring->count; i++) {
+		if (!count || point_distance(&pts[count - 1],
+			&ring->points[i]) > ctx->eps) {
+			pts[count++] = ring->points[i];
+		}
+	}
+
+	closed = ring->closed;
+	if (count > 2 && point_distance(&pts[0], &pts[count - 1]) <= ctx->eps) {
+		closed = true;
+		count--;
+	}
+	if (count < 3) {
+		closed = false;
+	}
+
+	if (!count) {
+		mem_free(pts);
+		return;
+	}
+
+	if (count == 1) {
+		struct piece *pc = add_piece(ctx, piece_arc);
+
+		pc->center = pts[0];
+		pc->angle = 0.0;
+		pc->sweep = 2 * M_PI;
+		offset_point(&pts[0], 1.0, 0.0, ctx->distance, &pc->p0);
+		pc->p1 = pc->p0;
+		add_edge(ctx, &pts[0], &pts[0], ring_index, false);
+		mem_free(pts);
+		return;
+	}
+
+	edge_count = closed ? count : count - 1;
+	normals = mem_alloc(edge_count * sizeof(*normals));
+
+	for (i = 0; i < edge_count; i++) {
+		const struct point_d *a = &pts[i];
+		const struct point_d *b = &pts[(i + 1) % count];
+		double len = point_distance(a, b);
+
+		/* Left hand normal. */
+		normals[i].x = -(b->y - a->y) / len;
+		normals[i].y = (b->x - a->x) / len;
+
+		add_edge(ctx, a, b, ring_index, closed);
+
+		/* Region on the left: the left side runs backwards. */
+		add_segment(ctx, b, a, normals[i].x, normals[i].y);
+		add_segment(ctx, a, b, -normals[i].x, -normals[i].y);
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct point_d *n_in;
+		const struct point_d *n_out;
+		double turn;
+
+		if (!closed && (i == 0 || i == count - 1)) {
+			continue;
+		}
+
+		n_in = &normals[(i + edge_count - 1) % edge_count];
+		n_out = &normals[i % edge_count];
+
+		/* Normals turn as the edges do. */
+		turn = atan2(cross(n_in->x, n_in->y, n_out->x, n_out->y),
+			n_in->x * n_out->x + n_in->y * n_out->y);
+
+		if (turn > 0) {
+			add_arc(ctx, &pts[i], -n_in->x, -n_in->y, -n_out->x,
+				-n_out->y, turn);
+		} else {
+			add_arc(ctx, &pts[i], n_out->x, n_out->y, n_in->x,
+				n_in->y, -turn);
+		}
+	}
+
+	if (!closed) {
+		const struct point_d *n0 = &normals[0];
+		const struct point_d *n1 = &normals[edge_count - 1];
+
+		add_arc(ctx, &pts[0], n0->x, n0->y, -n0->x, -n0->y, M_PI);
+		add_arc(ctx, &pts[count - 1], -n1->x, -n1->y, n1->x, n1->y,
+			M_PI);
+	}
+
+	mem_free(normals);
+	mem_free(pts);
+}
+
+static int piece_compare(const void *a, const void *b)
+{
+	const struct piece *pa = a;
+	const struct piece *pb = b;
+	const double ka[] = {pa->type, pa->p0.x, pa->p0.y, pa->p1.x, pa->p1.y,
+		pa->center.x, pa->center.y};
+	const double kb[] = {pb->type, pb->p0.x, pb->p0.y, pb->p1.x, pb->p1.y,
+		pb->center.x, pb->center.y};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ka) / sizeof(ka[0]); i++) {
+		if (ka[i] != kb[i]) {
+			return (ka[i] < kb[i]) ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Duplicated paths are common in the templates, and an edge shared by
+ * two rings gives the same pieces from both sides.  Duplicate pieces
+ * would make duplicate spans that can't be linked reliably.
+ */
+static void remove_duplicate_pieces(struct offset_ctx *ctx)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	qsort(ctx->pieces, ctx->piece_count, sizeof(*ctx->pieces),
+		piece_compare);
+
+	for (i = 0; i < ctx->piece_count; i++) {
+		const struct piece *pc = &ctx->pieces[i];
+
+		if (count) {
+			const struct piece *last = &ctx->pieces[count - 1];
+
+			if (last->type == pc->type
+				&& point_distance(&last->p0, &pc->p0) <= ctx->eps
+				&& point_distance(&last->p1, &pc->p1) <= ctx->eps
+				&& point_distance(&last->center, &pc->center)
+					<= ctx->eps) {
+				continue;
+			}
+		}
+		ctx->pieces[count++] = *pc;
+	}
+
+	ctx->piece_count = count;
+}
+
+static void add_split(struct offset_ctx *ctx, unsigned int piece, double t,
+	const struct point_d *p)
+{
+	struct split *s;
+
+	if (ctx->split_count == ctx->split_alloc) {
+		ctx->split_alloc = ctx->split_alloc ? 2 * ctx->split_alloc
+			: 1024;
+		ctx->splits = mem_realloc(ctx->splits,
+			ctx->split_alloc * sizeof(*ctx->splits));
+	}
+
+	s = &ctx->splits[ctx->split_count++];
+	s->piece = piece;
+	s->t = fmin(fmax(t, 0.0), 1.0);
+	s->p = *p;
+}
+
+static void intersect_segments(struct offset_ctx *ctx, unsigned int i,
+	unsigned int j)
+{
+	const struct piece *a = &ctx->pieces[i];
+	const struct piece *b = &ctx->pieces[j];
+	double rx = a->p1.x - a->p0.x;
+	double ry = a->p1.y - a->p0.y;
+	double vx = b->p1.x - b->p0.x;
+	double vy = b->p1.y - b->p0.y;
+	double wx = b->p0.x - a->p0.x;
+	double wy = b->p0.y - a->p0.y;
+	double r_len = hypot(rx, ry);
+	double v_len = hypot(vx, vy);
+	double den = cross(rx, ry, vx, vy);
+	double t;
+	double s;
+	struct point_d p;
+
+	/* Parallel pieces meet only at shared ends, handled by linking. */
+	if (fabs(den) <= 1e-12 * r_len * v_len) {
+		return;
+	}
+
+	t = cross(wx, wy, vx, vy) / den;
+	s = cross(wx, wy, rx, ry) / den;
+
+	if (t < -ctx->eps / r_len || t > 1 + ctx->eps / r_len
+		|| s < -ctx->eps / v_len || s > 1 + ctx->eps / v_len) {
+		return;
+	}
+
+	p.x = a->p0.x + t * rx;
+	p.y = a->p0.y + t * ry;
+	add_split(ctx, i, t, &p);
+	add_split(ctx, j, s, &p);
+}
+
+static void intersect_segment_arc(struct offset_ctx *ctx, unsigned int i,
+	unsigned int j)
+{
+	const struct piece *a = &ctx->pieces[i];
+	const struct piece *b = &ctx->pieces[j];
+	double rx = a->p1.x - a->p0.x;
+	double ry = a->p1.y - a->p0.y;
+	double fx = a->p0.x - b->center.x;
+	double fy = a->p0.y - b->center.y;
+	double qa = rx * rx + ry * ry;
+	double qb = 2 * (rx * fx + ry * fy);
+	double qc = fx * fx + fy * fy - ctx->distance * ctx->distance;
+	double disc = qb * qb - 4 * qa * qc;
+	double slack = ctx->eps / sqrt(qa);
+	double root;
+	unsigned int k;
+
+	if (disc < 0) {
+		return;
+	}
+	root = sqrt(disc);
+
+	for (k = 0; k < (root > 0 ? 2 : 1); k++) {
+		double t = (-qb + (k ? root : -root)) / (2 * qa);
+		struct point_d p;
+		double s;
+
+		if (t < -slack || t > 1 + slack) {
+			continue;
+		}
+
+		p.x = a->p0.x + t * rx;
+		p.y = a->p0.y + t * ry;
+		s = arc_param(ctx, b, &p);
+		if (s < 0) {
+			continue;
+		}
+
+		add_split(ctx, i, t, &p);
+		add_split(ctx, j, s, &p);
+	}
+}
+
+static void intersect_arcs(struct offset_ctx *ctx, unsigned int i,
+	unsigned int j)
+{
+	const struct piece *a = &ctx->pieces[i];
+	const struct piece *b = &ctx->pieces[j];
+	double dx = b->center.x - a->center.x;
+	double dy = b->center.y - a->center.y;
+	double dist = hypot(dx, dy);
+	double h;
+	unsigned int k;
+
+	if (dist <= ctx->eps || dist > 2 * ctx->distance + ctx->eps) {
+		return;
+	}
+
+	h = ctx->distance * ctx->distance - dist * dist / 4;
+	h = (h > 0) ? sqrt(h) : 0.0;
+
+	for (k = 0; k < (h > 0 ? 2 : 1); k++) {
+		struct point_d p;
+		double sa;
+		double sb;
+		double side = k ? h : -h;
+
+		p.x = a->center.x + dx / 2 - side * dy / dist;
+		p.y = a->center.y + dy / 2 + side * dx / dist;
+
+		sa = arc_param(ctx, a, &p);
+		sb = arc_param(ctx, b, &p);
+		if (sa < 0 || sb < 0) {
+			continue;
+		}
+
+		add_split(ctx, i, sa, &p);
+		add_split(ctx, j, sb, &p);
+	}
+}
+
+static void intersect_cb(void *cb_data, unsigned int item)
+{
+	struct offset_ctx *ctx = cb_data;
+	unsigned int i = ctx->current;
+	const struct piece *a = &ctx->pieces[i];
+	const struct piece *b = &ctx->pieces[item];
+
+	if (item <= i) {
+		return;
+	}
+
+	if (a->type == piece_segment && b->type == piece_segment) {
+		intersect_segments(ctx, i, item);
+	} else if (a->type == piece_segment) {
+		intersect_segment_arc(ctx, i, item);
+	} else if (b->type == piece_segment) {
+		intersect_segment_arc(ctx, item, i);
+	} else {
+		intersect_arcs(ctx, i, item);
+	}
+}
+
+static double segment_distance(const struct point_d *p,
+	const struct point_d *a, const struct point_d *b)
+{
+	double dx = b->x - a->x;
+	double dy = b->y - a->y;
+	double len2 = dx * dx + dy * dy;
+	double t = 0.0;
+	struct point_d q;
+
+	if (len2 > 0) {
+		t = ((p->x - a->x) * dx + (p->y - a->y) * dy) / len2;
+		t = fmin(fmax(t, 0.0), 1.0);
+	}
+
+	q.x = a->x + t * dx;
+	q.y = a->y + t * dy;
+	return point_distance(p, &q);
+}
+
+static void distance_cb(void *cb_data, unsigned int item)
+{
+	struct offset_ctx *ctx = cb_data;
+	const struct edge *e = &ctx->edges[item];
+
+	if (ctx->too_close) {
+		return;
+	}
+
+	if (segment_distance(&ctx->query, &e->p0, &e->p1)
+		< ctx->distance - ctx->eps) {
+		ctx->too_close = true;
+	}
+}
+
+static void inside_cb(void *cb_data, unsigned int item)
+{
+	struct offset_ctx *ctx = cb_data;
+	const struct edge *e = &ctx->edges[ctx->fill_edges[item]];
+	const struct point_d *p = &ctx->query;
+	double x;
+
+	if ((e->p0.y > p->y) == (e->p1.y > p->y)) {
+		return;
+	}
+
+	x = e->p0.x + (p->y - e->p0.y) * (e->p1.x - e->p0.x)
+		/ (e->p1.y - e->p0.y);
+
+	if (x > p->x) {
+		if (!ctx->parity[e->ring]) {
+			ctx->touched[ctx->touched_count++] = e->ring;
+		}
+		ctx->parity[e->ring] ^= 1;
+	}
+}
+
+static bool is_boundary(struct offset_ctx *ctx, const struct point_d *p)
+{
+	struct bbox box;
+	bool inside = false;
+	unsigned int i;
+
+	ctx->query = *p;
+	ctx->too_close = false;
+
+	box.x_min = box.x_max = p->x;
+	box.y_min = box.y_max = p->y;
+	spatial_grid_query(&ctx->edge_grid, ctx->edge_boxes, &box,
+		distance_cb, ctx);
+
+	if (ctx->too_close) {
+		return false;
+	}
+
+	if (!ctx->fill_count) {
+		return true;
+	}
+
+	/* Even-odd ray cast to the right, per closed ring. */
+	box.x_max = ctx->fill_x_max;
+	ctx->touched_count = 0;
+	spatial_grid_query(&ctx->fill_grid, ctx->fill_boxes, &box, inside_cb,
+		ctx);
+
+	for (i = 0; i < ctx->touched_count; i++) {
+		inside |= ctx->parity[ctx->touched[i]];
+		ctx->parity[ctx->touched[i]] = 0;
+	}
+
+	return !inside;
+}
+
+static int split_compare(const void *a, const void *b)
+{
+	const struct split *sa = a;
+	const struct split *sb = b;
+
+	if (sa->piece != sb->piece) {
+		return (sa->piece < sb->piece) ? -1 : 1;
+	}
+	return (sa->t < sb->t) ? -1 : (sa->t > sb->t);
+}
+
+static void add_span(struct offset_ctx *ctx, unsigned int piece, double t0,
+	const struct point_d *p0, double t1, const struct point_d *p1)
+{
+	const struct piece *pc = &ctx->pieces[piece];
+	struct point_d mid;
+	struct span *s;
+
+	if ((t1 - t0) * piece_length(ctx, pc) <= ctx->eps) {
+		return;
+	}
+
+	piece_point(ctx, pc, (t0 + t1) / 2, &mid);
+	if (!is_boundary(ctx, &mid)) {
+		return;
+	}
+
+	if (ctx->span_count == ctx->span_alloc) {
+		ctx->span_alloc = ctx->span_alloc ? 2 * ctx->span_alloc : 256;
+		ctx->spans = mem_realloc(ctx->spans,
+			ctx->span_alloc * sizeof(*ctx->spans));
+	}
+
+	s = &ctx->spans[ctx->span_count++];
+	s->piece = piece;
+	s->t0 = t0;
+	s->t1 = t1;
+	s->p0 = *p0;
+	s->p1 = *p1;
+}
+
+static void build_spans(struct offset_ctx *ctx)
+{
+	unsigned int piece;
+	unsigned int k = 0;
+
+	qsort(ctx->splits, ctx->split_count, sizeof(*ctx->splits),
+		split_compare);
+
+	for (piece = 0; piece < ctx->piece_count; piece++) {
+		const struct piece *pc = &ctx->pieces[piece];
+		struct point_d p0 = pc->p0;
+		double t0 = 0.0;
+
+		for (; k < ctx->split_count && ctx->splits[k].piece == piece;
+			k++) {
+			const struct split *s = &ctx->splits[k];
+
+			add_span(ctx, piece, t0, &p0, s->t, &s->p);
+			if ((s->t - t0) * piece_length(ctx, pc) > ctx->eps) {
+				t0 = s->t;
+				p0 = s->p;
+			}
+		}
+
+		add_span(ctx, piece, t0, &p0, 1.0, &pc->p1);
+	}
+}
+
+static int link_compare(const void *a, const void *b)
+{
+	const struct link_key *ka = a;
+	const struct link_key *kb = b;
+
+	if (ka->cx != kb->cx) {
+		return (ka->cx < kb->cx) ? -1 : 1;
+	}
+	return (ka->cy < kb->cy) ? -1 : (ka->cy > kb->cy);
+}
+
+static void link_cell(const struct offset_ctx *ctx, const struct point_d *p,
+	int64_t *cx, int64_t *cy)
+{
+	*cx = (int64_t)floor(p->x / ctx->link_tol);
+	*cy = (int64_t)floor(p->y / ctx->link_tol);
+}
+
+/* The nearest unused span starting within the link tolerance of p. */
+static int find_next(const struct offset_ctx *ctx, const struct link_key *keys,
+	const bool *used, const struct point_d *p)
+{
+	double best_dist = ctx->link_tol;
+	int best = -1;
+	int64_t cx;
+	int64_t cy;
+	int dx;
+	int dy;
+
+	link_cell(ctx, p, &cx, &cy);
+
+	for (dx = -1; dx <= 1; dx++) {
+		for (dy = -1; dy <= 1; dy++) {
+			struct link_key key = {cx + dx, cy + dy, 0};
+			unsigned int lo = 0;
+			unsigned int hi = ctx->span_count;
+
+			while (lo < hi) {
+				unsigned int mid = (lo + hi) / 2;
+
+				if (link_compare(&keys[mid], &key) < 0) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+
+			for (; lo < ctx->span_count
+				&& !link_compare(&keys[lo], &key); lo++) {
+				unsigned int s = keys[lo].span;
+				double d;
+
+				if (used[s]) {
+					continue;
+				}
+				d = point_distance(p, &ctx->spans[s].p0);
+				if (d <= best_dist) {
+					best_dist = d;
+					best = s;
+				}
+			}
+		}
+	}
+
+	return best;
+}
+
+static void emit_point(struct offset_ctx *ctx, struct ring *ring,
+	const struct point_d *p)
+{
+	if (ring->count && point_distance(&ring->points[ring->count - 1], p)
+		<= ctx->eps) {
+		return;
+	}
+	ring_add(ring, p->x, p->y);
+}
+
+/* Adds the span less its end point, arcs to the chord tolerance. */
+static void emit_span(struct offset_ctx *ctx, struct ring *ring,
+	const struct span *s)
+{
+	const struct piece *pc = &ctx->pieces[s->piece];
+	double step;
+	unsigned int n;
+	unsigned int i;
+
+	emit_point(ctx, ring, &s->p0);
+
+	if (pc->type != piece_arc) {
+		return;
+	}
+
+	step = (ctx->tolerance < ctx->distance)
+		? 2 * acos(1 - ctx->tolerance / ctx->distance) : M_PI / 2;
+	n = (unsigned int)ceil((s->t1 - s->t0) * pc->sweep / step);
+
+	for (i = 1; i < n; i++) {
+		struct point_d p;
+
+		piece_point(ctx, pc, s->t0 + (s->t1 - s->t0) * i / n, &p);
+		emit_point(ctx, ring, &p);
+	}
+}
+
+static double chain_length(const struct ring *ring, const struct point_d *end)
+{
+	double length = 0;
+	unsigned int i;
+
+	for (i = 1; i < ring->count; i++) {
+		length += point_distance(&ring->points[i - 1], &ring->points[i]);
+	}
+	if (ring->count) {
+		length += point_distance(&ring->points[ring->count - 1], end);
+	}
+	return length;
+}
+
+static unsigned int link_spans(struct offset_ctx *ctx, struct ring_set *out)
+{
+	struct link_key *keys;
+	bool *used;
+	unsigned int dropped = 0;
+	unsigned int i;
+
+	keys = mem_alloc((ctx->span_count + 1) * sizeof(*keys));
+	used = mem_alloc((ctx->span_count + 1) * sizeof(*used));
+	memset(used, 0, (ctx->span_count + 1) * sizeof(*used));
+
+	for (i = 0; i < ctx->span_count; i++) {
+		link_cell(ctx, &ctx->spans[i].p0, &keys[i].cx, &keys[i].cy);
+		keys[i].span = i;
+	}
+	qsort(keys, ctx->span_count, sizeof(*keys), link_compare);
+
+	for (i = 0; i < ctx->span_count; i++) {
+		struct ring ring;
+		unsigned int current = i;
+		bool closed = false;
+
+		if (used[i]) {
+			continue;
+		}
+
+		memset(&ring, 0, sizeof(ring));
+
+		while (1) {
+			const struct span *s = &ctx->spans[current];
+			int next;
+
+			used[current] = true;
+			emit_span(ctx, &ring, s);
+
+			if (ring.count > 2 && point_distance(&s->p1,
+				&ctx->spans[i].p0) <= ctx->link_tol) {
+				closed = true;
+				break;
+			}
+
+			next = find_next(ctx, keys, used, &s->p1);
+			if (next < 0) {
+				break;
+			}
+			current = next;
+		}
+
+		if (closed && fabs(ring_area(&ring))
+			> 10 * ctx->link_tol * ctx->link_tol) {
+			struct ring *r = ring_set_add(out);
+
+			*r = ring;
+			r->closed = true;
+			continue;
+		}
+
+		/* Slivers from nearly coincident crossings are expected. */
+		if (chain_length(&ring, &ctx->spans[current].p1)
+			> 10 * ctx->link_tol) {
+			dropped++;
+		}
+		if (ring.points) {
+			mem_free(ring.points);
+		}
+	}
+
+	mem_free(used);
+	mem_free(keys);
+	return dropped;
+}
+
+static void build_grids(struct offset_ctx *ctx, float pad)
+{
+	struct bbox fill_extent;
+	unsigned int i;
+
+	ctx->edge_boxes = mem_alloc((ctx->edge_count + 1)
+		* sizeof(*ctx->edge_boxes));
+	ctx->fill_boxes = mem_alloc((ctx->edge_count + 1)
+		* sizeof(*ctx->fill_boxes));
+	ctx->fill_edges = mem_alloc((ctx->edge_count + 1)
+		* sizeof(*ctx->fill_edges));
+	bbox_init(&fill_extent);
+
+	for (i = 0; i < ctx->edge_count; i++) {
+		const struct edge *e = &ctx->edges[i];
+		struct bbox box;
+
+		bbox_init(&box);
+		box_add(&box, e->p0.x, e->p0.y);
+		box_add(&box, e->p1.x, e->p1.y);
+		box_pad(&box, pad);
+
+		ctx->edge_boxes[i] = box;
+		box_pad(&ctx->edge_boxes[i], ctx->distance);
+
+		if (e->closed) {
+			ctx->fill_boxes[ctx->fill_count] = box;
+			ctx->fill_edges[ctx->fill_count++] = i;
+			box_add(&fill_extent, box.x_max, box.y_max);
+		}
+	}
+
+	ctx->fill_x_max = fill_extent.x_max + 1.0f;
+
+	spatial_grid_build(&ctx->edge_grid, ctx->edge_boxes, ctx->edge_count,
+		grid_cell_size(ctx->edge_boxes, ctx->edge_count));
+	spatial_grid_build(&ctx->fill_grid, ctx->fill_boxes, ctx->fill_count,
+		grid_cell_size(ctx->fill_boxes, ctx->fill_count));
+
+	ctx->piece_boxes = mem_alloc((ctx->piece_count + 1)
+		* sizeof(*ctx->piece_boxes));
+
+	for (i = 0; i < ctx->piece_count; i++) {
+		const struct piece *pc = &ctx->pieces[i];
+		struct bbox *box = &ctx->piece_boxes[i];
+		unsigned int k;
+
+		bbox_init(box);
+		box_add(box, pc->p0.x, pc->p0.y);
+		box_add(box, pc->p1.x, pc->p1.y);
+
+		if (pc->type == piece_arc) {
+			/* The axis extremes the arc passes through. */
+			for (k = 0; k < 4; k++) {
+				if (normalize_angle(k * M_PI / 2 - pc->angle)
+					<= pc->sweep) {
+					box_add(box, pc->center.x
+						+ ctx->distance * cos(k * M_PI / 2),
+						pc->center.y + ctx->distance
+						* sin(k * M_PI / 2));
+				}
+			}
+		}
+		box_pad(box, pad);
+	}
+
+	spatial_grid_build(&ctx->piece_grid, ctx->piece_boxes, ctx->piece_count,
+		grid_cell_size(ctx->piece_boxes, ctx->piece_count));
+}
+
+static void free_ctx(struct offset_ctx *ctx)
+{
+	spatial_grid_free(&ctx->edge_grid);
+	spatial_grid_free(&ctx->fill_grid);
+	spatial_grid_free(&ctx->piece_grid);
+	mem_free(ctx->edge_boxes);
+	mem_free(ctx->fill_boxes);
+	mem_free(ctx->fill_edges);
+	mem_free(ctx->piece_boxes);
+	mem_free(ctx->parity);
+	mem_free(ctx->touched);
+	if (ctx->edges) {
+		mem_free(ctx->edges);
+	}
+	if (ctx->pieces) {
+		mem_free(ctx->pieces);
+	}
+	if (ctx->splits) {
+		mem_free(ctx->splits);
+	}
+	if (ctx->spans) {
+		mem_free(ctx->spans);
+	}
+}
+
+int offset_rings(const struct ring_set *in, double distance, double tolerance,
+	struct ring_set *out)
+{
+	struct offset_ctx ctx;
+	struct bbox extent;
+	double size;
+	unsigned int dropped;
+	unsigned int i;
+
+	if (distance <= 0.0 || tolerance <= 0.0) {
+		error("bad offset distance %f or tolerance %f\n", distance,
+			tolerance);
+		return -1;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ring_set_bbox(in, &extent);
+
+	size = fmax(extent.x_max - extent.x_min, extent.y_max - extent.y_min);
+	size = fmax(size, 0.0) + 2 * distance;
+
+	ctx.distance = distance;
+	ctx.tolerance = tolerance;
+	ctx.eps = size * 1e-10;
+	/* Near tangent crossings are only good to about sqrt(eps). */
+	ctx.link_tol = fmax(tolerance, ctx.eps * 100);
+	ctx.ring_count = in->count;
+
+	for (i = 0; i < in->count; i++) {
+		build_ring_pieces(&ctx, &in->rings[i], i);
+	}
+
+	remove_duplicate_pieces(&ctx);
+
+	ctx.parity = mem_alloc(ctx.ring_count + 1);
+	memset(ctx.parity, 0, ctx.ring_count + 1);
+	ctx.touched = mem_alloc((ctx.ring_count + 1) * sizeof(*ctx.touched));
+
+	/* Float boxes, pad them past the rounding error. */
+	build_grids(&ctx, size * 1e-6);
+
+	for (i = 0; i < ctx.piece_count; i++) {
+		ctx.current = i;
+		spatial_grid_query(&ctx.piece_grid, ctx.piece_boxes,
+			&ctx.piece_boxes[i], intersect_cb, &ctx);
+	}
+
+	build_spans(&ctx);
+	dropped = link_spans(&ctx, out);
+
+	debug("edges %u, pieces %u, splits %u, spans %u, rings %u\n",
+		ctx.edge_count, ctx.piece_count, ctx.split_count,
+		ctx.span_count, out->count);
+
+	if (dropped) {
+		warn("dropped %u unclosed outline pieces\n", dropped);
+	}
+
+	free_ctx(&ctx);
+	return 0;
+}
@@ -0,0 +1,17 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_OFFSET_H)
+#define _MD_GENERATOR_OFFSET_H
+
+/*
+ * Polygon outset with round joins.  The result is the boundary of the
+ * union of the closed input rings and every point within distance of an
+ * input edge, so self-intersecting and overlapping input is fine.
+ */
+
+int offset_rings(const struct ring_set *in, double distance, double tolerance,
+	struct ring_set *out);
+
+#endif /* _MD_GENERATOR_OFFSET_H */
@@ -0,0 +1,723 @@
+/*
+ *  moto-design palette extractor.
+ */
+
+/*
+ * Derives a blob-generator [palette] from a photo.  Pixels are counted
+ * into a 15 bit RGB histogram as the image is decoded, keeping the mean
+ * color of each bin, so clustering works on the occupied bins weighted by
+ * their pixel counts instead of on every pixel.  The bin means go to
+ * CIELAB and are clustered by k-means++ seeding and Lloyd iterations.
+ * The assignment step runs on chunks of bins in parallel with a vector
+ * distance kernel, and the chunk sums are added in chunk order so the
+ * result doesn't depend on the thread count.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "image.h"
+
+static const char program_name[] = "palette-extract";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+static const unsigned int max_colors = 256;
+
+struct opts {
+	char *output_file;
+	unsigned int colors;
+	unsigned int iterations;
+	unsigned int seed;
+	unsigned int jobs;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Extract a blob-generator palette from an image.\n"
+"Usage: %s [flags] <image>\n"
+"Option flags:\n"
+"  -c --colors <count>     - Palette colors. Default: '%u'.\n"
+"  -i --iterations <count> - K-means iteration limit. Default: '%u'.\n"
+"  -s --seed <seed>        - Random seed for the k-means++ start. Default: '%u'.\n"
+"  -j --jobs <count>       - Threads. Default: '%u'.\n"
+"  -o --output-file <file> - Output file. Default: '%s'.\n"
+"  -h --help               - Show this help and exit.\n"
+"  -v --verbose            - Verbose execution.\n"
+"  -V --version            - Display the program version number.\n"
+"The image is a PNG or a binary PPM or PGM file.  Transparent pixels are\n"
+"left out.  The output is a [palette] config section with each color's\n"
+"share of the image in percent as its weight.\n",
+		program_name, program_name,
+		opts->colors,
+		opts->iterations,
+		opts->seed,
+		opts->jobs,
+		opts->output_file
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"colors",      required_argument, NULL, 'c'},
+		{"iterations",  required_argument, NULL, 'i'},
+		{"seed",        required_argument, NULL, 's'},
+		{"jobs",        required_argument, NULL, 'j'},
+		{"output-file", required_argument, NULL, 'o'},
+		{"help",        no_argument,       NULL, 'h'},
+		{"verbose",     no_argument,       NULL, 'v'},
+		{"version",     no_argument,       NULL, 'V'},
+		{ NULL,         0,                 NULL, 0},
+	};
+	static const char short_options[] = "c:i:s:j:o:hvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.output_file = "-",
+		.colors = 8,
+		.iterations = 100,
+		.seed = 1,
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'c':
+			opts->colors = to_unsigned(optarg);
+			if (opts->colors == UINT_MAX || !opts->colors
+				|| opts->colors > max_colors) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'i':
+			opts->iterations = to_unsigned(optarg);
+			if (opts->iterations == UINT_MAX || !opts->iterations) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 's':
+			opts->seed = to_unsigned(optarg);
+			if (opts->seed == UINT_MAX) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'o':
+			opts->output_file = optarg;
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			set_verbose(true);
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+#define hist_bits 5U
+#define hist_size (1U << (3 * hist_bits))
+
+struct hist_bin {
+	uint64_t sum[3];
+	uint32_t count;
+};
+
+struct histogram {
+	struct hist_bin *bins;
+	uint64_t pixels;
+};
+
+static int hist_row(void *cb_data, unsigned int y, const unsigned char *rgba,
+	unsigned int width)
+{
+	struct histogram *hist = cb_data;
+	const unsigned int shift = 8 - hist_bits;
+	unsigned int x;
+
+	(void)y;
+
+	for (x = 0; x < width; x++, rgba += 4) {
+		struct hist_bin *bin;
+
+		if (rgba[3] < 128) {
+			continue;
+		}
+		bin = &hist->bins[(rgba[0] >> shift) << (2 * hist_bits)
+			| (rgba[1] >> shift) << hist_bits | rgba[2] >> shift];
+		bin->sum[0] += rgba[0];
+		bin->sum[1] += rgba[1];
+		bin->sum[2] += rgba[2];
+		bin->count++;
+	}
+	hist->pixels += width;
+	return 0;
+}
+
+struct lab {
+	float l;
+	float a;
+	float b;
+};
+
+/* D65 white point. */
+static const float lab_white[3] = {0.95047, 1.0, 1.08883};
+
+static float srgb_to_linear(float v)
+{
+	return (v <= 0.04045) ? v / 12.92 : powf((v + 0.055) / 1.055, 2.4);
+}
+
+static float linear_to_srgb(float v)
+{
+	return (v <= 0.0031308) ? v * 12.92
+		: 1.055 * powf(v, 1.0 / 2.4) - 0.055;
+}
+
+static float lab_f(float t)
+{
+	return (t > 216.0 / 24389.0) ? cbrtf(t)
+		: (24389.0 / 27.0 * t + 16.0) / 116.0;
+}
+
+static float lab_f_inv(float t)
+{
+	return (t > 6.0 / 29.0) ? t * t * t
+		: (116.0 * t - 16.0) * 27.0 / 24389.0;
+}
+
+/* sRGB 0 to 255 to CIELAB. */
+static struct lab lab_from_rgb(float r, float g, float b)
+{
+	float lr = srgb_to_linear(r / 255.0);
+	float lg = srgb_to_linear(g / 255.0);
+	float lb = srgb_to_linear(b / 255.0);
+	float fx = lab_f((0.4124564 * lr + 0.3575761 * lg + 0.1804375 * lb)
+		/ lab_white[0]);
+	float fy = lab_f((0.2126729 * lr + 0.7151522 * lg + 0.0721750 * lb)
+		/ lab_white[1]);
+	float fz = lab_f((0.0193339 * lr + 0.1191920 * lg + 0.9503041 * lb)
+		/ lab_white[2]);
+
+	return (struct lab){116.0 * fy - 16.0, 500.0 * (fx - fy),
+		200.0 * (fy - fz)};
+}
+
+static unsigned int lab_to_rgb(const struct lab *lab)
+{
+	float fy = (lab->l + 16.0) / 116.0;
+	float x = lab_f_inv(fy + lab->a / 500.0) * lab_white[0];
+	float y = lab_f_inv(fy) * lab_white[1];
+	float z = lab_f_inv(fy - lab->b / 200.0) * lab_white[2];
+	float rgb[3] = {
+		3.2404542 * x - 1.5371385 * y - 0.4985314 * z,
+		-0.9692660 * x + 1.8760108 * y + 0.0415560 * z,
+		0.0556434 * x - 0.2040259 * y + 1.0572252 * z,
+	};
+	unsigned int result = 0;
+	unsigned int c;
+
+	for (c = 0; c < 3; c++) {
+		float v = linear_to_srgb(fminf(fmaxf(rgb[c], 0.0), 1.0));
+
+		result = result << 8 | (unsigned int)lrintf(v * 255.0);
+	}
+	return result;
+}
+
+#define kmeans_lanes 4U
+
+typedef float vfloat __attribute__((vector_size(kmeans_lanes * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(kmeans_lanes * sizeof(int32_t))));
+
+/* Bins per assignment job. */
+static const unsigned int kmeans_chunk = 2048;
+
+/* Per chunk sums for each center: weight, l, a and b. */
+struct kmeans_sums {
+	double *sums;
+	double cost;
+	unsigned int changed;
+};
+
+/*
+ * Points and centers are stored as separate l, a and b arrays so the
+ * kernel loads kmeans_lanes points at once.  Points are padded to a
+ * whole vector with zero weight.
+ */
+struct kmeans {
+	unsigned int count;
+	unsigned int padded;
+	float *l;
+	float *a;
+	float *b;
+	float *w;
+	float *dist;
+	unsigned int *labels;
+	unsigned int k;
+	float cl[256];
+	float ca[256];
+	float cb[256];
+	unsigned int chunk_count;
+	struct kmeans_sums *chunks;
+};
+
+static float kmeans_d2(const struct kmeans *km, unsigned int i,
+	unsigned int c)
+{
+	float dl = km->l[i] - km->cl[c];
+	float da = km->a[i] - km->ca[c];
+	float db = km->b[i] - km->cb[c];
+
+	return dl * dl + da * da + db * db;
+}
+
+static int kmeans_assign(void *cb_data, unsigned int index)
+{
+	struct kmeans *km = cb_data;
+	struct kmeans_sums *chunk = &km->chunks[index];
+	unsigned int start = index * kmeans_chunk;
+	unsigned int end = start + kmeans_chunk;
+	unsigned int i;
+
+	if (end > km->padded) {
+		end = km->padded;
+	}
+
+	memset(chunk->sums, 0, km->k * 4 * sizeof(*chunk->sums));
+	chunk->cost = 0.0;
+	chunk->changed = 0;
+
+	for (i = start; i < end; i += kmeans_lanes) {
+		vfloat l, a, b;
+		vfloat best = (vfloat){0} + FLT_MAX;
+		vint label = {0};
+		unsigned int c;
+		unsigned int j;
+
+		memcpy(&l, km->l + i, sizeof(l));
+		memcpy(&a, km->a + i, sizeof(a));
+		memcpy(&b, km->b + i, sizeof(b));
+
+		for (c = 0; c < km->k; c++) {
+			vfloat dl = l - km->cl[c];
+			vfloat da = a - km->ca[c];
+			vfloat db = b - km->cb[c];
+			vfloat d = dl * dl + da * da + db * db;
+			/* Comparisons give -1 for true. */
+			vint closer = d < best;
+
+			best = (vfloat)((closer & (vint)d)
+				| (~closer & (vint)best));
+			label = (closer & (int32_t)c) | (~closer & label);
+		}
+
+		memcpy(km->dist + i, &best, sizeof(best));
+
+		for (j = 0; j < kmeans_lanes; j++) {
+			double *sums = chunk->sums + 4 * label[j];
+			float w = km->w[i + j];
+
+			if (km->labels[i + j] != (unsigned int)label[j]) {
+				km->labels[i + j] = label[j];
+				chunk->changed++;
+			}
+			sums[0] += w;
+			sums[1] += w * km->l[i + j];
+			sums[2] += w * km->a[i + j];
+			sums[3] += w * km->b[i + j];
+			chunk->cost += w * best[j];
+		}
+	}
+	return 0;
+}
+
+static unsigned int kmeans_pick(const struct kmeans *km, double total)
+{
+	double r = (double)random_next() / UINT_MAX * total;
+	unsigned int i;
+
+	for (i = 0; i < km->count - 1; i++) {
+		r -= (double)km->w[i] * km->dist[i];
+		if (r < 0.0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* K-means++, later centers picked by their squared distance. */
+static void kmeans_seed(struct kmeans *km, unsigned int k)
+{
+	unsigned int pick;
+	unsigned int i;
+
+	for (i = 0; i < km->count; i++) {
+		km->dist[i] = 1.0;
+	}
+
+	for (km->k = 0; km->k < k; km->k++) {
+		double total = 0.0;
+		unsigned int c = km->k;
+
+		for (i = 0; i < km->count; i++) {
+			total += (double)km->w[i] * km->dist[i];
+		}
+		if (total <= 0.0) {
+			debug("only %u distinct colors\n", c);
+			break;
+		}
+
+		pick = kmeans_pick(km, total);
+		km->cl[c] = km->l[pick];
+		km->ca[c] = km->a[pick];
+		km->cb[c] = km->b[pick];
+
+		for (i = 0; i < km->count; i++) {
+			km->dist[i] = c ? fminf(km->dist[i], kmeans_d2(km, i, c))
+				: kmeans_d2(km, i, c);
+		}
+	}
+}
+
+/* Moves an empty center to the point farthest from its center. */
+static void kmeans_respawn(struct kmeans *km, unsigned int c)
+{
+	unsigned int far = 0;
+	float far_cost = -1.0;
+	unsigned int i;
+
+	for (i = 0; i < km->count; i++) {
+		float cost = km->w[i] * km->dist[i];
+
+		if (cost > far_cost) {
+			far_cost = cost;
+			far = i;
+		}
+	}
+	km->cl[c] = km->l[far];
+	km->ca[c] = km->a[far];
+	km->cb[c] = km->b[far];
+	km->dist[far] = 0.0;
+}
+
+static unsigned int kmeans_run(struct kmeans *km, unsigned int iterations,
+	unsigned int jobs, double *weights)
+{
+	unsigned int iteration;
+	unsigned int i;
+
+	for (iteration = 1; ; iteration++) {
+		unsigned int changed = 0;
+		double cost = 0.0;
+		unsigned int c;
+
+		run_jobs(jobs, km->chunk_count, kmeans_assign, km);
+
+		memset(weights, 0, km->k * sizeof(*weights));
+		for (c = 0; c < km->k; c++) {
+			double sums[4] = {0.0, 0.0, 0.0, 0.0};
+
+			for (i = 0; i < km->chunk_count; i++) {
+				const double *s = km->chunks[i].sums + 4 * c;
+
+				sums[0] += s[0];
+				sums[1] += s[1];
+				sums[2] += s[2];
+				sums[3] += s[3];
+			}
+			weights[c] = sums[0];
+			if (sums[0] > 0.0) {
+				km->cl[c] = sums[1] / sums[0];
+				km->ca[c] = sums[2] / sums[0];
+				km->cb[c] = sums[3] / sums[0];
+			}
+		}
+		for (i = 0; i < km->chunk_count; i++) {
+			changed += km->chunks[i].changed;
+			cost += km->chunks[i].cost;
+		}
+
+		debug("iteration %u: %u changed, cost %g\n", iteration, changed,
+			cost);
+
+		if ((iteration > 1 && !changed) || iteration >= iterations) {
+			break;
+		}
+		for (c = 0; c < km->k; c++) {
+			if (weights[c] <= 0.0) {
+				kmeans_respawn(km, c);
+			}
+		}
+	}
+	return iteration;
+}
+
+static void kmeans_init(struct kmeans *km, const struct histogram *hist)
+{
+	unsigned int bin;
+	unsigned int i;
+
+	memset(km, 0, sizeof(*km));
+
+	for (bin = 0; bin < hist_size; bin++) {
+		km->count += !!hist->bins[bin].count;
+	}
+	km->padded = (km->count + kmeans_lanes - 1) / kmeans_lanes
+		* kmeans_lanes;
+
+	km->l = mem_alloc(km->padded * sizeof(*km->l));
+	km->a = mem_alloc(km->padded * sizeof(*km->a));
+	km->b = mem_alloc(km->padded * sizeof(*km->b));
+	km->w = mem_alloc(km->padded * sizeof(*km->w));
+	km->dist = mem_alloc(km->padded * sizeof(*km->dist));
+	km->labels = mem_alloc(km->padded * sizeof(*km->labels));
+
+	for (bin = 0, i = 0; bin < hist_size; bin++) {
+		const struct hist_bin *hb = &hist->bins[bin];
+		struct lab lab;
+
+		if (!hb->count) {
+			continue;
+		}
+		lab = lab_from_rgb((double)hb->sum[0] / hb->count,
+			(double)hb->sum[1] / hb->count,
+			(double)hb->sum[2] / hb->count);
+		km->l[i] = lab.l;
+		km->a[i] = lab.a;
+		km->b[i] = lab.b;
+		km->w[i] = hb->count;
+		km->labels[i] = UINT_MAX;
+		i++;
+	}
+	for (; i < km->padded; i++) {
+		km->l[i] = km->a[i] = km->b[i] = km->w[i] = 0.0;
+		km->labels[i] = UINT_MAX;
+	}
+
+	km->chunk_count = (km->padded + kmeans_chunk - 1) / kmeans_chunk;
+	km->chunks = mem_alloc(km->chunk_count * sizeof(*km->chunks));
+	for (i = 0; i < km->chunk_count; i++) {
+		km->chunks[i].sums = mem_alloc(max_colors * 4
+			* sizeof(*km->chunks[i].sums));
+	}
+}
+
+static void kmeans_free(struct kmeans *km)
+{
+	unsigned int i;
+
+	for (i = 0; i < km->chunk_count; i++) {
+		mem_free(km->chunks[i].sums);
+	}
+	mem_free(km->chunks);
+	mem_free(km->l);
+	mem_free(km->a);
+	mem_free(km->b);
+	mem_free(km->w);
+	mem_free(km->dist);
+	mem_free(km->labels);
+}
+
+struct palette_entry {
+	double weight;
+	unsigned int rgb;
+};
+
+static int palette_entry_compare(const void *a, const void *b)
+{
+	const struct palette_entry *ea = a;
+	const struct palette_entry *eb = b;
+
+	if (ea->weight != eb->weight) {
+		return (ea->weight > eb->weight) ? -1 : 1;
+	}
+	return (ea->rgb < eb->rgb) ? -1 : (ea->rgb > eb->rgb);
+}
+
+static void write_palette(FILE *stream, const char *image_file,
+	const struct kmeans *km, const double *weights)
+{
+	struct palette_entry entries[256];
+	unsigned int count = 0;
+	double total = 0.0;
+	unsigned int c;
+
+	for (c = 0; c < km->k; c++) {
+		struct lab lab = {km->cl[c], km->ca[c], km->cb[c]};
+
+		if (weights[c] <= 0.0) {
+			continue;
+		}
+		entries[count].weight = weights[c];
+		entries[count].rgb = lab_to_rgb(&lab);
+		total += weights[c];
+		count++;
+	}
+	qsort(entries, count, sizeof(*entries), palette_entry_compare);
+
+	fprintf(stream, "# %s palette from '%s'\n\n[palette]\n\n"
+		"# {weight, hex color}\n\n", program_name, image_file);
+
+	for (c = 0; c < count; c++) {
+		double share = 100.0 * entries[c].weight / total;
+		unsigned int weight = (unsigned int)lrint(share);
+
+		fprintf(stream, "%u, #%06x  # %.1f%%\n", weight ? weight : 1,
+			entries[c].rgb, share);
+	}
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	struct histogram hist = {0};
+	struct image_info info;
+	struct timespec start;
+	struct kmeans km;
+	struct opts opts;
+	double weights[256];
+	unsigned int iterations;
+	FILE *out_stream;
+	int result = EXIT_FAILURE;
+	int arg;
+
+	arg = opts_parse(&opts, argc, argv);
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return (arg < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+	if (argc - arg != 1) {
+		error("Need one <image> file.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	hist.bins = mem_alloc(hist_size * sizeof(*hist.bins));
+	memset(hist.bins, 0, hist_size * sizeof(*hist.bins));
+
+	if (image_read(argv[arg], &info, hist_row, &hist)) {
+		mem_free(hist.bins);
+		return EXIT_FAILURE;
+	}
+	log("%s: %ux%u, read in %.3f s\n", argv[arg], info.width, info.height,
+		seconds_since(&start));
+
+	kmeans_init(&km, &hist);
+	mem_free(hist.bins);
+
+	if (!km.count) {
+		error("%s: no opaque pixels.\n", argv[arg]);
+		goto done;
+	}
+
+	random_seed(opts.seed);
+	kmeans_seed(&km, opts.colors);
+	iterations = kmeans_run(&km, opts.iterations, opts.jobs, weights);
+
+	log("%u bins, %u colors, %u iterations, %.3f s\n", km.count, km.k,
+		iterations, seconds_since(&start));
+
+	if (!strcmp(opts.output_file, "-")) {
+		out_stream = stdout;
+	} else {
+		out_stream = fopen(opts.output_file, "w");
+		if (!out_stream) {
+			error("open '%s' failed: %s\n", opts.output_file,
+				strerror(errno));
+			goto done;
+		}
+	}
+
+	write_palette(out_stream, argv[arg], &km, weights);
+
+	if (out_stream != stdout ? fclose(out_stream) : fflush(out_stream)) {
+		error("write '%s' failed: %s\n", opts.output_file,
+			strerror(errno));
+		goto done;
+	}
+	result = EXIT_SUCCESS;
+
+done:
+	kmeans_free(&km);
+	return result;
+}
@@ -0,0 +1,713 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+
+void affine_identity(struct affine *m)
+{
+	*m = (struct affine){1.0, 0.0, 0.0, 1.0, 0.0, 0.0};
+}
+
+void affine_multiply(struct affine *out, const struct affine *l,
+	const struct affine *r)
+{
+	struct affine m;
+
+	m.a = l->a * r->a + l->c * r->b;
+	m.b = l->b * r->a + l->d * r->b;
+	m.c = l->a * r->c + l->c * r->d;
+	m.d = l->b * r->c + l->d * r->d;
+	m.e = l->a * r->e + l->c * r->f + l->e;
+	m.f = l->b * r->e + l->d * r->f + l->f;
+
+	*out = m;
+}
+
+bool affine_invert(struct affine *out, const struct affine *m)
+{
+	double det = m->a * m->d - m->b * m->c;
+	struct affine i;
+
+	if (det == 0.0) {
+		return false;
+	}
+
+	i.a = m->d / det;
+	i.b = -m->b / det;
+	i.c = -m->c / det;
+	i.d = m->a / det;
+	i.e = -(i.a * m->e + i.c * m->f);
+	i.f = -(i.b * m->e + i.d * m->f);
+
+	*out = i;
+	return true;
+}
+
+void affine_apply(const struct affine *m, double x, double y,
+	struct point_d *out)
+{
+	out->x = m->a * x + m->c * y + m->e;
+	out->y = m->b * x + m->d * y + m->f;
+}
+
+static const char *skip_separators(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == ',' || *p == '\t'
+		|| *p == '\n' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+/*
+ * A locale independent number scanner, much faster than strtod() for
+ * the short numbers in path data.
+ */
+bool path_number(const char **pp, const char *end, double *value)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22,
+	};
+	const char *p = skip_separators(*pp, end);
+	uint64_t mantissa = 0;
+	unsigned int digits = 0;
+	int exponent = 0;
+	bool negative = false;
+	bool any = false;
+	double v;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	for (; p < end && isdigit(*p); p++) {
+		any = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += (mantissa != 0);
+		} else {
+			exponent++;
+		}
+	}
+
+	if (p < end && *p == '.') {
+		for (p++; p < end && isdigit(*p); p++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += (mantissa != 0);
+				exponent--;
+			}
+		}
+	}
+
+	if (!any) {
+		return false;
+	}
+
+	if (p + 1 < end && (*p == 'e' || *p == 'E')
+		&& (isdigit(p[1]) || ((p[1] == '-' || p[1] == '+')
+		&& p + 2 < end && isdigit(p[2])))) {
+		bool exp_negative = false;
+		int e = 0;
+
+		p++;
+		if (*p == '-' || *p == '+') {
+			exp_negative = (*p == '-');
+			p++;
+		}
+		for (; p < end && isdigit(*p); p++) {
+			if (e < 10000) {
+				e = e * 10 + (*p - '0');
+			}
+		}
+		exponent += exp_negative ? -e : e;
+	}
+
+	v = (double)mantissa;
+
+	if (exponent < 0 && exponent >= -22) {
+		v /= pow10[-exponent];
+	} else if (exponent > 0 && exponent <= 22) {
+		v *= pow10[exponent];
+	} else if (exponent) {
+		v *= pow(10.0, exponent);
+	}
+
+	*value = negative ? -v : v;
+	*pp = p;
+	return true;
+}
+
+static bool path_flag(const char **pp, const char *end, bool *flag)
+{
+	const char *p = skip_separators(*pp, end);
+
+	if (p >= end || (*p != '0' && *p != '1')) {
+		return false;
+	}
+
+	*flag = (*p == '1');
+	*pp = p + 1;
+	return true;
+}
+
+static int parse_args(const char **p, const char *end, double *args,
+	unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (!path_number(p, end, &args[i])) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int affine_parse(struct affine *m, const char *p, const char *end)
+{
+	affine_identity(m);
+
+	while (1) {
+		static const struct {
+			const char *name;
+			unsigned int min_args;
+			unsigned int max_args;
+		} functions[] = {
+			{"matrix", 6, 6},
+			{"translate", 1, 2},
+			{"scale", 1, 2},
+			{"rotate", 1, 3},
+			{"skewX", 1, 1},
+			{"skewY", 1, 1},
+		};
+		double args[6];
+		struct affine t;
+		unsigned int count;
+		unsigned int i;
+		size_t len;
+
+		p = skip_separators(p, end);
+		if (p >= end) {
+			return 0;
+		}
+
+		for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+			len = strlen(functions[i].name);
+			if ((size_t)(end - p) > len
+				&& !memcmp(p, functions[i].name, len)) {
+				break;
+			}
+		}
+		if (i == sizeof(functions) / sizeof(functions[0])) {
+			return -1;
+		}
+
+		p = skip_separators(p + len, end);
+		if (p >= end || *p != '(') {
+			return -1;
+		}
+		p++;
+
+		for (count = 0; count < functions[i].max_args; count++) {
+			const char *q = skip_separators(p, end);
+
+			if (q < end && *q == ')') {
+				break;
+			}
+			if (!path_number(&p, end, &args[count])) {
+				return -1;
+			}
+		}
+
+		p = skip_separators(p, end);
+		if (count < functions[i].min_args || p >= end || *p != ')') {
+			return -1;
+		}
+		p++;
+
+		switch (i) {
+		case 0:
+			t = (struct affine){args[0], args[1], args[2], args[3],
+				args[4], args[5]};
+			break;
+		case 1:
+			t = (struct affine){1.0, 0.0, 0.0, 1.0, args[0],
+				(count > 1) ? args[1] : 0.0};
+			break;
+		case 2:
+			t = (struct affine){args[0], 0.0, 0.0,
+				(count > 1) ? args[1] : args[0], 0.0, 0.0};
+			break;
+		case 3: {
+			double rad = args[0] * M_PI / 180.0;
+			double cx = (count == 3) ? args[1] : 0.0;
+			double cy = (count == 3) ? args[2] : 0.0;
+			double cs = cos(rad);
+			double sn = sin(rad);
+
+			/* translate(cx,cy) rotate(a) translate(-cx,-cy) */
+			t = (struct affine){cs, sn, -sn, cs,
+				cx - cs * cx + sn * cy, cy - sn * cx - cs * cy};
+			break;
+		}
+		case 4:
+			t = (struct affine){1.0, 0.0,
+				tan(args[0] * M_PI / 180.0), 1.0, 0.0, 0.0};
+			break;
+		case 5:
+			t = (struct affine){1.0, tan(args[0] * M_PI / 180.0),
+				0.0, 1.0, 0.0, 0.0};
+			break;
+		default:
+			assert(0);
+			return -1;
+		}
+
+		affine_multiply(m, m, &t);
+	}
+}
+
+static void flatten_cubic(struct ring *ring, const struct point_d *p0,
+	const struct point_d *p1, const struct point_d *p2,
+	const struct point_d *p3, double tolerance, unsigned int depth)
+{
+	double dx = p3->x - p0->x;
+	double dy = p3->y - p0->y;
+	double d1 = fabs((p1->x - p3->x) * dy - (p1->y - p3->y) * dx);
+	double d2 = fabs((p2->x - p3->x) * dy - (p2->y - p3->y) * dx);
+	double len2 = dx * dx + dy * dy;
+	struct point_d p01, p12, p23, p012, p123, mid;
+
+	if (len2 < 1e-24) {
+		/* Closed loop, measure the controls from the end points. */
+		d1 = hypot(p1->x - p0->x, p1->y - p0->y);
+		d2 = hypot(p2->x - p0->x, p2->y - p0->y);
+		len2 = 1.0;
+	}
+
+	if (depth >= 16 || (d1 + d2) * (d1 + d2) <= tolerance * tolerance
+		* len2) {
+		ring_add(ring, p3->x, p3->y);
+		return;
+	}
+
+	p01.x = (p0->x + p1->x) / 2;
+	p01.y = (p0->y + p1->y) / 2;
+	p12.x = (p1->x + p2->x) / 2;
+	p12.y = (p1->y + p2->y) / 2;
+	p23.x = (p2->x + p3->x) / 2;
+	p23.y = (p2->y + p3->y) / 2;
+	p012.x = (p01.x + p12.x) / 2;
+	p012.y = (p01.y + p12.y) / 2;
+	p123.x = (p12.x + p23.x) / 2;
+	p123.y = (p12.y + p23.y) / 2;
+	mid.x = (p012.x + p123.x) / 2;
+	mid.y = (p012.y + p123.y) / 2;
+
+	flatten_cubic(ring, p0, &p01, &p012, &mid, tolerance, depth + 1);
+	flatten_cubic(ring, &mid, &p123, &p23, p3, tolerance, depth + 1);
+}
+
+/* Adds the flattened cubic to the ring, p0 is the current point. */
+void path_flatten_cubic(struct ring *ring, const struct point_d *p0,
+	const struct point_d *p1, const struct point_d *p2,
+	const struct point_d *p3, double tolerance)
+{
+	flatten_cubic(ring, p0, p1, p2, p3, tolerance, 0);
+}
+
+void path_reader_init(struct path_reader *pr, const char *p,
+	const char *end)
+{
+	*pr = (struct path_reader){
+		.p = p,
+		.end = end,
+	};
+}
+
+static void set_cubic(struct path_segment *seg, double x1, double y1,
+	double x2, double y2, double x, double y)
+{
+	seg->type = path_seg_cubic;
+	seg->c1.x = x1;
+	seg->c1.y = y1;
+	seg->c2.x = x2;
+	seg->c2.y = y2;
+	seg->to.x = x;
+	seg->to.y = y;
+}
+
+static void read_quadratic(struct path_reader *pr, struct path_segment *seg,
+	double x1, double y1, double x, double y)
+{
+	double cx1 = pr->current.x + 2.0 / 3.0 * (x1 - pr->current.x);
+	double cy1 = pr->current.y + 2.0 / 3.0 * (y1 - pr->current.y);
+	double cx2 = x + 2.0 / 3.0 * (x1 - x);
+	double cy2 = y + 2.0 / 3.0 * (y1 - y);
+
+	set_cubic(seg, cx1, cy1, cx2, cy2, x, y);
+
+	pr->control.x = x1;
+	pr->control.y = y1;
+}
+
+static double vector_angle(double ux, double uy, double vx, double vy)
+{
+	return atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+}
+
+/* Endpoint to center conversion, SVG 1.1 implementation notes F.6.5. */
+static void read_arc(struct path_reader *pr, double rx, double ry,
+	double angle, bool large_arc, bool sweep, double x, double y)
+{
+	double x1 = pr->current.x;
+	double y1 = pr->current.y;
+	double phi = angle * M_PI / 180.0;
+	double cs = cos(phi);
+	double sn = sin(phi);
+	double x1p, y1p, lambda, num, den, coef, cxp, cyp, cx, cy;
+	double theta, delta, k;
+	unsigned int n;
+	unsigned int i;
+
+	rx = fabs(rx);
+	ry = fabs(ry);
+
+	if ((x1 == x && y1 == y)) {
+		return;
+	}
+	if (rx == 0.0 || ry == 0.0) {
+		pr->arc[0] = (struct path_segment){
+			.type = path_seg_line,
+			.node = true,
+			.to = {x, y},
+		};
+		pr->arc_count = 1;
+		return;
+	}
+
+	x1p = cs * (x1 - x) / 2 + sn * (y1 - y) / 2;
+	y1p = -sn * (x1 - x) / 2 + cs * (y1 - y) / 2;
+
+	lambda = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry);
+	if (lambda > 1.0) {
+		rx *= sqrt(lambda);
+		ry *= sqrt(lambda);
+	}
+
+	num = rx * rx * ry * ry - rx * rx * y1p * y1p - ry * ry * x1p * x1p;
+	den = rx * rx * y1p * y1p + ry * ry * x1p * x1p;
+	coef = (num > 0 && den > 0) ? sqrt(num / den) : 0.0;
+	if (large_arc == sweep) {
+		coef = -coef;
+	}
+
+	cxp = coef * rx * y1p / ry;
+	cyp = -coef * ry * x1p / rx;
+	cx = cs * cxp - sn * cyp + (x1 + x) / 2;
+	cy = sn * cxp + cs * cyp + (y1 + y) / 2;
+
+	theta = vector_angle(1.0, 0.0, (x1p - cxp) / rx, (y1p - cyp) / ry);
+	delta = vector_angle((x1p - cxp) / rx, (y1p - cyp) / ry,
+		(-x1p - cxp) / rx, (-y1p - cyp) / ry);
+
+	if (!sweep && delta > 0) {
+		delta -= 2 * M_PI;
+	} else if (sweep && delta < 0) {
+		delta += 2 * M_PI;
+	}
+
+	n = (unsigned int)ceil(fabs(delta) / (M_PI / 2) - 1e-9);
+	n = n ? n : 1;
+	delta /= n;
+	k = 4.0 / 3.0 * tan(delta / 4);
+
+	for (i = 0; i < n; i++) {
+		double t1 = theta + i * delta;
+		double t2 = t1 + delta;
+		double u[4][2] = {
+			{cos(t1), sin(t1)},
+			{cos(t1) - k * sin(t1), sin(t1) + k * cos(t1)},
+			{cos(t2) + k * sin(t2), sin(t2) - k * cos(t2)},
+			{cos(t2), sin(t2)},
+		};
+		double q[4][2];
+		unsigned int j;
+
+		for (j = 0; j < 4; j++) {
+			q[j][0] = cx + rx * u[j][0] * cs - ry * u[j][1] * sn;
+			q[j][1] = cy + rx * u[j][0] * sn + ry * u[j][1] * cs;
+		}
+
+		set_cubic(&pr->arc[i], q[1][0], q[1][1], q[2][0], q[2][1],
+			(i == n - 1) ? x : q[3][0], (i == n - 1) ? y : q[3][1]);
+		pr->arc[i].node = (i == n - 1);
+	}
+	pr->arc_count = n;
+}
+
+/*
+ * Reads the next segment.  Relative and shorthand commands are made
+ * absolute, quadratics are raised to cubics and arcs split into cubics
+ * of up to a quarter turn.  A close segment ends at the subpath start.
+ */
+enum path_seg_type path_read(struct path_reader *pr, struct path_segment *seg)
+{
+	if (pr->arc_next < pr->arc_count) {
+		*seg = pr->arc[pr->arc_next++];
+		pr->current = seg->to;
+		return seg->type;
+	}
+	pr->arc_count = pr->arc_next = 0;
+
+	while (1) {
+		double a[7];
+		bool rel;
+		bool large_arc;
+		bool sweep;
+
+		pr->p = skip_separators(pr->p, pr->end);
+		if (pr->p >= pr->end) {
+			return path_seg_end;
+		}
+
+		if (isalpha(*pr->p)) {
+			pr->cmd = *pr->p++;
+		} else if (!pr->cmd || pr->cmd == 'z' || pr->cmd == 'Z') {
+			return path_seg_error;
+		}
+
+		rel = islower(pr->cmd);
+		seg->node = true;
+
+		switch (toupper(pr->cmd)) {
+		case 'M':
+			if (parse_args(&pr->p, pr->end, a, 2)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[0] += pr->current.x;
+				a[1] += pr->current.y;
+			}
+			seg->type = path_seg_move;
+			seg->to.x = a[0];
+			seg->to.y = a[1];
+			pr->start = seg->to;
+			/* Following pairs are implicit lineto commands. */
+			pr->cmd = rel ? 'l' : 'L';
+			break;
+		case 'L':
+			if (parse_args(&pr->p, pr->end, a, 2)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[0] += pr->current.x;
+				a[1] += pr->current.y;
+			}
+			seg->type = path_seg_line;
+			seg->to.x = a[0];
+			seg->to.y = a[1];
+			break;
+		case 'H':
+			if (parse_args(&pr->p, pr->end, a, 1)) {
+				return path_seg_error;
+			}
+			seg->type = path_seg_line;
+			seg->to.x = rel ? pr->current.x + a[0] : a[0];
+			seg->to.y = pr->current.y;
+			break;
+		case 'V':
+			if (parse_args(&pr->p, pr->end, a, 1)) {
+				return path_seg_error;
+			}
+			seg->type = path_seg_line;
+			seg->to.x = pr->current.x;
+			seg->to.y = rel ? pr->current.y + a[0] : a[0];
+			break;
+		case 'C':
+			if (parse_args(&pr->p, pr->end, a, 6)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				unsigned int i;
+
+				for (i = 0; i < 6; i += 2) {
+					a[i] += pr->current.x;
+					a[i + 1] += pr->current.y;
+				}
+			}
+			set_cubic(seg, a[0], a[1], a[2], a[3], a[4], a[5]);
+			pr->control = seg->c2;
+			break;
+		case 'S':
+			if (parse_args(&pr->p, pr->end, a, 4)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[0] += pr->current.x;
+				a[1] += pr->current.y;
+				a[2] += pr->current.x;
+				a[3] += pr->current.y;
+			}
+			if (strchr("CcSs", pr->last_cmd)) {
+				a[4] = 2 * pr->current.x - pr->control.x;
+				a[5] = 2 * pr->current.y - pr->control.y;
+			} else {
+				a[4] = pr->current.x;
+				a[5] = pr->current.y;
+			}
+			set_cubic(seg, a[4], a[5], a[0], a[1], a[2], a[3]);
+			pr->control = seg->c2;
+			break;
+		case 'Q':
+			if (parse_args(&pr->p, pr->end, a, 4)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[0] += pr->current.x;
+				a[1] += pr->current.y;
+				a[2] += pr->current.x;
+				a[3] += pr->current.y;
+			}
+			read_quadratic(pr, seg, a[0], a[1], a[2], a[3]);
+			break;
+		case 'T':
+			if (parse_args(&pr->p, pr->end, a, 2)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[0] += pr->current.x;
+				a[1] += pr->current.y;
+			}
+			if (strchr("QqTt", pr->last_cmd)) {
+				a[2] = 2 * pr->current.x - pr->control.x;
+				a[3] = 2 * pr->current.y - pr->control.y;
+			} else {
+				a[2] = pr->current.x;
+				a[3] = pr->current.y;
+			}
+			read_quadratic(pr, seg, a[2], a[3], a[0], a[1]);
+			break;
+		case 'A':
+			if (parse_args(&pr->p, pr->end, a, 3)
+				|| !path_flag(&pr->p, pr->end, &large_arc)
+				|| !path_flag(&pr->p, pr->end, &sweep)
+				|| parse_args(&pr->p, pr->end, a + 3, 2)) {
+				return path_seg_error;
+			}
+			if (rel) {
+				a[3] += pr->current.x;
+				a[4] += pr->current.y;
+			}
+			read_arc(pr, a[0], a[1], a[2], large_arc, sweep, a[3],
+				a[4]);
+			pr->last_cmd = pr->cmd;
+			if (!pr->arc_count) {
+				/* A zero length arc is dropped. */
+				continue;
+			}
+			*seg = pr->arc[0];
+			pr->arc_next = 1;
+			break;
+		case 'Z':
+			seg->type = path_seg_close;
+			seg->to = pr->start;
+			break;
+		default:
+			return path_seg_error;
+		}
+
+		pr->last_cmd = pr->cmd;
+		pr->current = seg->to;
+		return seg->type;
+	}
+}
+
+int path_flatten(const char *p, const char *end, const struct affine *ctm,
+	double tolerance, struct ring_set *out)
+{
+	struct path_reader pr;
+	struct path_segment seg;
+	struct point_d from = {0.0, 0.0};
+	enum path_seg_type type;
+	int ring = -1;
+
+	path_reader_init(&pr, p, end);
+
+	while ((type = path_read(&pr, &seg)) > path_seg_error) {
+		struct point_d p0, p1, p2, p3;
+		struct ring *r;
+
+		if (type == path_seg_close) {
+			if (ring >= 0) {
+				r = &out->rings[ring];
+
+				/* Drop an explicit closing point. */
+				affine_apply(ctm, seg.to.x, seg.to.y, &p3);
+				if (r->count > 1
+					&& fabs(r->points[r->count - 1].x - p3.x)
+						< 1e-9
+					&& fabs(r->points[r->count - 1].y - p3.y)
+						< 1e-9) {
+					r->count--;
+				}
+				r->closed = true;
+			}
+			ring = -1;
+			from = seg.to;
+			continue;
+		}
+
+		if (type == path_seg_move) {
+			ring = -1;
+			from = seg.to;
+		}
+
+		/* Lines after a close start a ring at the subpath start. */
+		if (ring < 0) {
+			r = ring_set_add(out);
+			ring = out->count - 1;
+			affine_apply(ctm, from.x, from.y, &p0);
+			ring_add(r, p0.x, p0.y);
+		}
+		r = &out->rings[ring];
+
+		if (type == path_seg_line) {
+			affine_apply(ctm, seg.to.x, seg.to.y, &p3);
+			ring_add(r, p3.x, p3.y);
+		} else if (type == path_seg_cubic) {
+			affine_apply(ctm, from.x, from.y, &p0);
+			affine_apply(ctm, seg.c1.x, seg.c1.y, &p1);
+			affine_apply(ctm, seg.c2.x, seg.c2.y, &p2);
+			affine_apply(ctm, seg.to.x, seg.to.y, &p3);
+			flatten_cubic(r, &p0, &p1, &p2, &p3, tolerance, 0);
+		}
+		from = seg.to;
+	}
+
+	return (type == path_seg_error) ? -1 : 0;
+}
@@ -0,0 +1,76 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_PATH_H)
+#define _MD_GENERATOR_PATH_H
+
+/*
+ * SVG transforms and path data.  Paths are flattened to rings of line
+ * segments in the coordinates given by a current transform matrix.
+ */
+
+struct affine {
+	double a;
+	double b;
+	double c;
+	double d;
+	double e;
+	double f;
+};
+
+void affine_identity(struct affine *m);
+void affine_multiply(struct affine *out, const struct affine *l,
+	const struct affine *r);
+bool affine_invert(struct affine *out, const struct affine *m);
+void affine_apply(const struct affine *m, double x, double y,
+	struct point_d *out);
+int affine_parse(struct affine *m, const char *p, const char *end);
+
+bool path_number(const char **p, const char *end, double *value);
+
+/*
+ * Path data read as absolute segments, zero-copy.  A cubic's start is the
+ * previous segment's end.  node is false for the inner cubics of an arc.
+ */
+enum path_seg_type {
+	path_seg_end = 0,
+	path_seg_error,
+	path_seg_move,
+	path_seg_line,
+	path_seg_cubic,
+	path_seg_close,
+};
+
+struct path_segment {
+	enum path_seg_type type;
+	bool node;
+	struct point_d c1;
+	struct point_d c2;
+	struct point_d to;
+};
+
+struct path_reader {
+	const char *p;
+	const char *end;
+	char cmd;
+	char last_cmd;
+	struct point_d current;
+	struct point_d start;
+	struct point_d control;
+	struct path_segment arc[4];
+	unsigned int arc_count;
+	unsigned int arc_next;
+};
+
+void path_reader_init(struct path_reader *pr, const char *p,
+	const char *end);
+enum path_seg_type path_read(struct path_reader *pr, struct path_segment *seg);
+
+int path_flatten(const char *p, const char *end, const struct affine *ctm,
+	double tolerance, struct ring_set *out);
+void path_flatten_cubic(struct ring *ring, const struct point_d *p0,
+	const struct point_d *p1, const struct point_d *p2,
+	const struct point_d *p3, double tolerance);
+
+#endif /* _MD_GENERATOR_PATH_H */
@@ -0,0 +1,332 @@
+/*
+ *  moto-design random image generator.
+ */
+
+/*
+ * The file has a fixed set of objects: catalog, page tree, page, content
+ * stream and the stream length.  Everything but the content stream is
+ * known when the page is opened, so the writer counts bytes as it goes
+ * for the xref table and never seeks, and it can write to a pipe.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "util.h"
+#include "geom.h"
+#include "pdf.h"
+
+enum pdf_object {
+	pdf_catalog = 1,
+	pdf_pages,
+	pdf_page,
+	pdf_contents,
+	pdf_length,
+	pdf_object_count,
+};
+
+/* PDF points per SVG user unit, 72 to 96 per inch. */
+static const double pdf_scale = 72.0 / 96.0;
+
+/*
+ * Readers limit the page to 14400 units, bigger pages get a UserUnit of
+ * several points.
+ */
+static const double pdf_page_limit = 14400.0;
+
+/* Coordinate decimals, 0.01 user units is under 3 microns. */
+static const unsigned int pdf_decimals = 2;
+
+/* Content bytes collected before a deflate call. */
+static const size_t pdf_chunk = 64 * 1024;
+
+struct pdf {
+	FILE *stream;
+	unsigned long offset;
+	unsigned long objects[pdf_object_count];
+	unsigned long stream_len;
+	z_stream z;
+	unsigned char *z_out;
+	struct out_buf content;
+	struct out_buf text;
+	struct point_d start;
+	struct point_d current;
+	char fill[hex_color_len];
+	bool failed;
+};
+
+static void pdf_write(struct pdf *pdf, const void *data, size_t len)
+{
+	if (!pdf->failed && fwrite(data, 1, len, pdf->stream) != len) {
+		error("write failed: %s\n", strerror(errno));
+		pdf->failed = true;
+	}
+	pdf->offset += len;
+}
+
+static void __attribute__ ((format (printf, 2, 3)))
+	pdf_printf(struct pdf *pdf, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	pdf->text.len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if (pdf->text.len + 1 > pdf->text.alloc) {
+		pdf->text.alloc = pdf->text.len + 1;
+		pdf->text.data = mem_realloc(pdf->text.data, pdf->text.alloc);
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(pdf->text.data, pdf->text.alloc, fmt, ap);
+	va_end(ap);
+
+	pdf_write(pdf, pdf->text.data, pdf->text.len);
+}
+
+static void pdf_begin_object(struct pdf *pdf, enum pdf_object object)
+{
+	pdf->objects[object] = pdf->offset;
+	pdf_printf(pdf, "%d 0 obj\n", object);
+}
+
+static int pdf_deflate(struct pdf *pdf, int flush)
+{
+	unsigned long long start = trace_begin();
+	int result;
+
+	pdf->z.next_in = (unsigned char *)pdf->content.data;
+	pdf->z.avail_in = pdf->content.len;
+
+	do {
+		size_t len;
+
+		pdf->z.next_out = pdf->z_out;
+		pdf->z.avail_out = pdf_chunk;
+
+		result = deflate(&pdf->z, flush);
+		if (result == Z_STREAM_ERROR) {
+			error("deflate failed.\n");
+			pdf->failed = true;
+			trace_end("compress", start);
+			return -1;
+		}
+
+		len = pdf_chunk - pdf->z.avail_out;
+		pdf_write(pdf, pdf->z_out, len);
+		pdf->stream_len += len;
+	} while (!pdf->z.avail_out
+		|| (flush == Z_FINISH && result != Z_STREAM_END));
+
+	pdf->content.len = 0;
+	trace_end("compress", start);
+	return 0;
+}
+
+static void pdf_op_number(struct pdf *pdf, double value)
+{
+	out_add_number(&pdf->content, value, pdf_decimals);
+	out_add(&pdf->content, " ", 1);
+}
+
+static void pdf_op(struct pdf *pdf, const char *op)
+{
+	out_add_str(&pdf->content, op);
+
+	if (pdf->content.len >= pdf_chunk) {
+		pdf_deflate(pdf, Z_NO_FLUSH);
+	}
+}
+
+struct pdf *pdf_open(FILE *stream, const struct svg_rect *page)
+{
+	struct pdf *pdf = mem_alloc(sizeof(*pdf));
+	double size = fmax(page->width, page->height) * pdf_scale;
+	double user_unit = fmax(1.0, ceil(size / pdf_page_limit));
+	double scale = pdf_scale / user_unit;
+
+	memset(pdf, 0, sizeof(*pdf));
+	pdf->stream = stream;
+
+	/* Deflate dominates the run time, path data packs well anyway. */
+	if (deflateInit(&pdf->z, Z_BEST_SPEED) != Z_OK) {
+		error("deflateInit failed.\n");
+		mem_free(pdf);
+		return NULL;
+	}
+	pdf->z_out = mem_alloc(pdf_chunk);
+
+	/* The binary comment marks the file as binary for transfer tools. */
+	pdf_printf(pdf, "%%PDF-%s\n%%\xe2\xe3\xcf\xd3\n",
+		(user_unit > 1.0) ? "1.6" : "1.4");
+
+	pdf_begin_object(pdf, pdf_catalog);
+	pdf_printf(pdf, "<< /Type /Catalog /Pages %d 0 R >>\nendobj\n",
+		pdf_pages);
+
+	pdf_begin_object(pdf, pdf_pages);
+	pdf_printf(pdf, "<< /Type /Pages /Kids [%d 0 R] /Count 1 >>\nendobj\n",
+		pdf_page);
+
+	pdf_begin_object(pdf, pdf_page);
+	pdf_printf(pdf, "<< /Type /Page /Parent %d 0 R\n"
+		"   /MediaBox [0 0 %.3f %.3f]\n", pdf_pages,
+		page->width * scale, page->height * scale);
+	if (user_unit > 1.0) {
+		pdf_printf(pdf, "   /UserUnit %g\n", user_unit);
+	}
+	pdf_printf(pdf, "   /Resources << >>\n"
+		"   /Contents %d 0 R >>\nendobj\n", pdf_contents);
+
+	pdf_begin_object(pdf, pdf_contents);
+	pdf_printf(pdf, "<< /Length %d 0 R /Filter /FlateDecode >>\nstream\n",
+		pdf_length);
+
+	/* Flip y and move the page rect onto the media box. */
+	out_printf(&pdf->content, "%.6f 0 0 %.6f ", scale, -scale);
+	pdf_op_number(pdf, -page->x * scale);
+	pdf_op_number(pdf, (page->y + page->height) * scale);
+	pdf_op(pdf, "cm\n");
+
+	return pdf;
+}
+
+int pdf_close(struct pdf *pdf)
+{
+	unsigned long xref;
+	int result;
+	int i;
+
+	pdf_deflate(pdf, Z_FINISH);
+	deflateEnd(&pdf->z);
+
+	pdf_printf(pdf, "\nendstream\nendobj\n");
+
+	pdf_begin_object(pdf, pdf_length);
+	pdf_printf(pdf, "%lu\nendobj\n", pdf->stream_len);
+
+	xref = pdf->offset;
+	pdf_printf(pdf, "xref\n0 %d\n0000000000 65535 f \n", pdf_object_count);
+	for (i = pdf_catalog; i < pdf_object_count; i++) {
+		pdf_printf(pdf, "%010lu 00000 n \n", pdf->objects[i]);
+	}
+	pdf_printf(pdf, "trailer\n<< /Size %d /Root %d 0 R >>\n"
+		"startxref\n%lu\n%%%%EOF\n", pdf_object_count, pdf_catalog,
+		xref);
+
+	result = pdf->failed ? -1 : 0;
+
+	out_free(&pdf->content);
+	out_free(&pdf->text);
+	mem_free(pdf->z_out);
+	mem_free(pdf);
+
+	return result;
+}
+
+void pdf_set_fill(struct pdf *pdf, const char *color)
+{
+	unsigned int rgb;
+
+	assert(is_hex_color(color));
+
+	if (!strcmp(pdf->fill, color)) {
+		return;
+	}
+	strcpy(pdf->fill, color);
+
+	rgb = (unsigned int)strtoul(color + 1, NULL, 16);
+	pdf_op_number(pdf, ((rgb >> 16) & 0xff) / 255.0);
+	pdf_op_number(pdf, ((rgb >> 8) & 0xff) / 255.0);
+	pdf_op_number(pdf, (rgb & 0xff) / 255.0);
+	pdf_op(pdf, "rg\n");
+}
+
+void pdf_move_to(struct pdf *pdf, double x, double y)
+{
+	pdf_op_number(pdf, x);
+	pdf_op_number(pdf, y);
+	pdf_op(pdf, "m\n");
+	pdf->start.x = pdf->current.x = x;
+	pdf->start.y = pdf->current.y = y;
+}
+
+void pdf_line_to(struct pdf *pdf, double x, double y)
+{
+	pdf_op_number(pdf, x);
+	pdf_op_number(pdf, y);
+	pdf_op(pdf, "l\n");
+	pdf->current.x = x;
+	pdf->current.y = y;
+}
+
+void pdf_curve_to(struct pdf *pdf, double x1, double y1, double x2, double y2,
+	double x, double y)
+{
+	pdf_op_number(pdf, x1);
+	pdf_op_number(pdf, y1);
+	pdf_op_number(pdf, x2);
+	pdf_op_number(pdf, y2);
+	pdf_op_number(pdf, x);
+	pdf_op_number(pdf, y);
+	pdf_op(pdf, "c\n");
+	pdf->current.x = x;
+	pdf->current.y = y;
+}
+
+/* PDF has no quadratic curves, raise it to the equivalent cubic. */
+void pdf_quad_to(struct pdf *pdf, double x1, double y1, double x, double y)
+{
+	const struct point_d p0 = pdf->current;
+
+	pdf_curve_to(pdf, p0.x + 2.0 * (x1 - p0.x) / 3.0,
+		p0.y + 2.0 * (y1 - p0.y) / 3.0,
+		x + 2.0 * (x1 - x) / 3.0, y + 2.0 * (y1 - y) / 3.0, x, y);
+}
+
+void pdf_close_path(struct pdf *pdf)
+{
+	pdf_op(pdf, "h\n");
+	pdf->current = pdf->start;
+}
+
+void pdf_fill(struct pdf *pdf)
+{
+	pdf_op(pdf, "f\n");
+}
+
+void pdf_clip_rect(struct pdf *pdf, const struct svg_rect *rect)
+{
+	pdf_op_number(pdf, rect->x);
+	pdf_op_number(pdf, rect->y);
+	pdf_op_number(pdf, rect->width);
+	pdf_op_number(pdf, rect->height);
+	pdf_op(pdf, "re W n\n");
+}
+
+void pdf_save(struct pdf *pdf)
+{
+	pdf_op(pdf, "q\n");
+}
+
+void pdf_restore(struct pdf *pdf)
+{
+	pdf_op(pdf, "Q\n");
+	pdf->fill[0] = 0;
+}
@@ -0,0 +1,33 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_PDF_H)
+#define _MD_GENERATOR_PDF_H
+
+/*
+ * Streaming single page PDF writer.  Path operators go into a Flate
+ * compressed content stream as they are made, the stream length is an
+ * indirect object written after it, so nothing is held but one deflate
+ * buffer.  Coordinates are SVG user units, y down, 96 per inch, mapped
+ * onto a page the size of the page rect.
+ */
+
+struct pdf;
+
+struct pdf *pdf_open(FILE *stream, const struct svg_rect *page);
+int pdf_close(struct pdf *pdf);
+
+void pdf_set_fill(struct pdf *pdf, const char *color);
+void pdf_move_to(struct pdf *pdf, double x, double y);
+void pdf_line_to(struct pdf *pdf, double x, double y);
+void pdf_curve_to(struct pdf *pdf, double x1, double y1, double x2, double y2,
+	double x, double y);
+void pdf_quad_to(struct pdf *pdf, double x1, double y1, double x, double y);
+void pdf_close_path(struct pdf *pdf);
+void pdf_fill(struct pdf *pdf);
+void pdf_clip_rect(struct pdf *pdf, const struct svg_rect *rect);
+void pdf_save(struct pdf *pdf);
+void pdf_restore(struct pdf *pdf);
+
+#endif /* _MD_GENERATOR_PDF_H */
@@ -0,0 +1,345 @@
+/*
+ *  moto-design random image generator.
+ */
+
+/*
+ * Scanline fill with an active edge list, so a path with thousands of
+ * subpaths, like a merged color, costs its crossings and not its edges
+ * times its rows.  Coverage of a pixel row is summed over the sample
+ * rows, then the color is blended in by it.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "util.h"
+#include "geom.h"
+#include "raster.h"
+
+#define raster_samples 4U
+
+struct raster_edge {
+	double x0;
+	double y0;
+	double y1;
+	double dxdy;
+	int dir;
+};
+
+struct raster_crossing {
+	double x;
+	int dir;
+};
+
+void raster_init(struct raster *raster, unsigned int width,
+	unsigned int height, unsigned int rgb)
+{
+	size_t i;
+
+	memset(raster, 0, sizeof(*raster));
+	raster->width = width;
+	raster->height = height;
+	raster->pixels = mem_alloc((size_t)width * height * 3 + 1);
+	raster->cover = mem_alloc((width + 1) * sizeof(*raster->cover));
+
+	for (i = 0; i < (size_t)width * height; i++) {
+		raster->pixels[3 * i] = (rgb >> 16) & 0xff;
+		raster->pixels[3 * i + 1] = (rgb >> 8) & 0xff;
+		raster->pixels[3 * i + 2] = rgb & 0xff;
+	}
+}
+
+void raster_free(struct raster *raster)
+{
+	mem_free(raster->pixels);
+	mem_free(raster->cover);
+	if (raster->edges) {
+		mem_free(raster->edges);
+	}
+	if (raster->active) {
+		mem_free(raster->active);
+		mem_free(raster->crossings);
+	}
+	memset(raster, 0, sizeof(*raster));
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	const struct raster_edge *ea = a;
+	const struct raster_edge *eb = b;
+
+	return (ea->y0 > eb->y0) - (ea->y0 < eb->y0);
+}
+
+static unsigned int raster_edges(struct raster *raster,
+	const struct ring_set *rings)
+{
+	unsigned int count = 0;
+	unsigned int r;
+
+	for (r = 0; r < rings->count; r++) {
+		const struct ring *ring = &rings->rings[r];
+		unsigned int i;
+
+		if (raster->edge_alloc < count + ring->count) {
+			raster->edge_alloc = 2 * (count + ring->count);
+			raster->edges = mem_realloc(raster->edges,
+				raster->edge_alloc * sizeof(*raster->edges));
+		}
+
+		for (i = 0; i < ring->count; i++) {
+			const struct point_d *a = &ring->points[i];
+			const struct point_d *b = &ring->points[(i + 1)
+				% ring->count];
+			struct raster_edge *e = &raster->edges[count];
+
+			if (a->y == b->y) {
+				continue;
+			}
+			if (a->y < b->y) {
+				e->x0 = a->x;
+				e->y0 = a->y;
+				e->y1 = b->y;
+				e->dir = 1;
+			} else {
+				e->x0 = b->x;
+				e->y0 = b->y;
+				e->y1 = a->y;
+				e->dir = -1;
+			}
+			e->dxdy = (b->x - a->x) / (b->y - a->y);
+			count++;
+		}
+	}
+
+	qsort(raster->edges, count, sizeof(*raster->edges), compare_edges);
+	return count;
+}
+
+static void raster_span(struct raster *raster, double x0, double x1,
+	unsigned int *col_min, unsigned int *col_max)
+{
+	const float w = 1.0 / raster_samples;
+	unsigned int i0;
+	unsigned int i1;
+	unsigned int i;
+
+	x0 = fmax(x0, 0.0);
+	x1 = fmin(x1, raster->width);
+	if (x1 <= x0) {
+		return;
+	}
+
+	i0 = (unsigned int)x0;
+	i1 = (unsigned int)x1;
+
+	if (i0 == i1) {
+		raster->cover[i0] += (x1 - x0) * w;
+	} else {
+		raster->cover[i0] += (i0 + 1 - x0) * w;
+		for (i = i0 + 1; i < i1; i++) {
+			raster->cover[i] += w;
+		}
+		raster->cover[i1] += (x1 - i1) * w;
+	}
+
+	*col_min = (i0 < *col_min) ? i0 : *col_min;
+	*col_max = (i1 > *col_max) ? i1 : *col_max;
+}
+
+void raster_fill(struct raster *raster, const struct ring_set *rings,
+	unsigned int rgb)
+{
+	const unsigned char color[3] = {
+		(rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff,
+	};
+	unsigned int edge_count = raster_edges(raster, rings);
+	unsigned int active_count = 0;
+	unsigned int next = 0;
+	double y_max = 0.0;
+	unsigned int row_end;
+	unsigned int row;
+	unsigned int i;
+
+	if (!edge_count) {
+		return;
+	}
+	if (raster->active_alloc < edge_count) {
+		raster->active_alloc = edge_count;
+		raster->active = mem_realloc(raster->active,
+			edge_count * sizeof(*raster->active));
+		raster->crossings = mem_realloc(raster->crossings,
+			edge_count * sizeof(*raster->crossings));
+	}
+
+	for (i = 0; i < edge_count; i++) {
+		y_max = fmax(y_max, raster->edges[i].y1);
+	}
+	row = (unsigned int)fmax(0.0, floor(raster->edges[0].y0));
+	row_end = (unsigned int)fmin(raster->height, ceil(y_max));
+
+	for (; row < row_end; row++) {
+		unsigned int col_min = raster->width;
+		unsigned int col_max = 0;
+		unsigned int k;
+
+		for (k = 0; k < raster_samples; k++) {
+			double sy = row + (k + 0.5) / raster_samples;
+			unsigned int n = 0;
+			unsigned int a;
+			int wind = 0;
+			double x_start = 0.0;
+
+			while (next < edge_count
+				&& raster->edges[next].y0 <= sy) {
+				raster->active[active_count++] = next++;
+			}
+
+			for (a = 0, i = 0; a < active_count; a++) {
+				const struct raster_edge *e =
+					&raster->edges[raster->active[a]];
+				struct raster_crossing c;
+				unsigned int j;
+
+				if (e->y1 <= sy) {
+					continue;
+				}
+				raster->active[i++] = raster->active[a];
+
+				c.x = e->x0 + (sy - e->y0) * e->dxdy;
+				c.dir = e->dir;
+
+				/* Insertion sort, crossings move little. */
+				for (j = n; j && raster->crossings[j - 1].x
+					> c.x; j--) {
+					raster->crossings[j] =
+						raster->crossings[j - 1];
+				}
+				raster->crossings[j] = c;
+				n++;
+			}
+			active_count = i;
+
+			for (i = 0; i < n; i++) {
+				const struct raster_crossing *c =
+					&raster->crossings[i];
+
+				if (!wind) {
+					x_start = c->x;
+				}
+				wind += c->dir;
+				if (!wind) {
+					raster_span(raster, x_start, c->x,
+						&col_min, &col_max);
+				}
+			}
+		}
+
+		for (i = col_min; i <= col_max && i < raster->width; i++) {
+			unsigned char *p = &raster->pixels[3 * ((size_t)row
+				* raster->width + i)];
+			float cover = fminf(raster->cover[i], 1.0);
+			unsigned int c;
+
+			for (c = 0; c < 3; c++) {
+				p[c] = (unsigned char)lrintf(p[c]
+					+ (color[c] - p[c]) * cover);
+			}
+			raster->cover[i] = 0.0;
+		}
+		raster->cover[raster->width] = 0.0;
+	}
+}
+
+static void png_put32(unsigned char *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static void png_chunk(FILE *stream, const char *type,
+	const unsigned char *data, size_t len)
+{
+	unsigned char head[8];
+	unsigned char crc_data[4];
+	uLong crc;
+
+	png_put32(head, len);
+	memcpy(head + 4, type, 4);
+	crc = crc32(0, head + 4, 4);
+	if (len) {
+		crc = crc32(crc, data, len);
+	}
+	png_put32(crc_data, crc);
+
+	fwrite(head, 1, sizeof(head), stream);
+	if (len) {
+		fwrite(data, 1, len, stream);
+	}
+	fwrite(crc_data, 1, sizeof(crc_data), stream);
+}
+
+int raster_write_png(const struct raster *raster, FILE *stream)
+{
+	static const unsigned char signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+	};
+	const size_t stride = (size_t)raster->width * 3;
+	size_t raw_len = (stride + 1) * raster->height;
+	unsigned char *raw = mem_alloc(raw_len + 1);
+	uLongf z_len = compressBound(raw_len);
+	unsigned char *z = mem_alloc(z_len);
+	unsigned char ihdr[13] = {0};
+	unsigned int row;
+	int result = 0;
+
+	/* Filter type 0 for every row. */
+	for (row = 0; row < raster->height; row++) {
+		raw[row * (stride + 1)] = 0;
+		memcpy(&raw[row * (stride + 1) + 1],
+			&raster->pixels[row * stride], stride);
+	}
+
+	if (compress2(z, &z_len, raw, raw_len, Z_DEFAULT_COMPRESSION)
+		!= Z_OK) {
+		error("compress failed.\n");
+		result = -1;
+		goto done;
+	}
+
+	png_put32(ihdr, raster->width);
+	png_put32(ihdr + 4, raster->height);
+	ihdr[8] = 8;	/* bit depth */
+	ihdr[9] = 2;	/* RGB */
+
+	fwrite(signature, 1, sizeof(signature), stream);
+	png_chunk(stream, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(stream, "IDAT", z, z_len);
+	png_chunk(stream, "IEND", NULL, 0);
+
+	if (ferror(stream)) {
+		error("write failed: %s\n", strerror(errno));
+		result = -1;
+	}
+
+done:
+	mem_free(raw);
+	mem_free(z);
+	return result;
+}
@@ -0,0 +1,32 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_RASTER_H)
+#define _MD_GENERATOR_RASTER_H
+
+/*
+ * RGB raster for previews.  Rings are filled with the nonzero rule like
+ * SVG paths, anti-aliased with exact horizontal and 4x vertical coverage.
+ */
+
+struct raster {
+	unsigned int width;
+	unsigned int height;
+	unsigned char *pixels;
+	float *cover;
+	struct raster_edge *edges;
+	unsigned int edge_alloc;
+	unsigned int *active;
+	struct raster_crossing *crossings;
+	unsigned int active_alloc;
+};
+
+void raster_init(struct raster *raster, unsigned int width,
+	unsigned int height, unsigned int rgb);
+void raster_free(struct raster *raster);
+void raster_fill(struct raster *raster, const struct ring_set *rings,
+	unsigned int rgb);
+int raster_write_png(const struct raster *raster, FILE *stream);
+
+#endif /* _MD_GENERATOR_RASTER_H */
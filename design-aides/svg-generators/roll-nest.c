@@ -0,0 +1,1131 @@
+/*
+ *  moto-design print roll nesting.
+ */
+
+/*
+ * Lays out the parts of an order on a print roll of a given width,
+ * keeping the roll short.  Each part's print area is rasterized at every
+ * rotation step into a bitmap grown by half the gap, kept in 64 copies
+ * shifted by each bit so a fit test is a few word ANDs per row.  Parts
+ * go one at a time to the rotation and position that reach least far
+ * down the roll, then leftmost.  Part orderings are searched in
+ * parallel: the first is largest first and the others shuffle it a
+ * little from the seed.  The shortest roll wins, ties to the lower
+ * ordering, so the layout doesn't depend on the thread count.  The SVG
+ * has each part's design clipped to its print area and its cut line.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "xml.h"
+#include "template.h"
+#include "raster.h"
+
+static const char program_name[] = "roll-nest";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+static const double px_per_mm = 96.0 / 25.4;
+static const double template_tolerance = 0.01;
+static const unsigned int max_rotations = 360;
+
+struct opts {
+	char *output_file;
+	char *index_file;
+	float roll_width;
+	float resolution;
+	float gap;
+	unsigned int rotations;
+	unsigned int orderings;
+	unsigned int seed;
+	unsigned int jobs;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Nest part print areas on a print roll.\n"
+"Usage: %s [flags] <order>\n"
+"Option flags:\n"
+"  -w --roll-width <mm>     - Roll width, required.\n"
+"  -g --gap <mm>            - Gap between parts. Default: '%f'.\n"
+"  -r --resolution <mm>     - Placement grid cell size. Default: '%f'.\n"
+"  -a --rotations <count>   - Rotation steps in a turn. Default: '%u'.\n"
+"  -n --orderings <count>   - Part orderings searched. Default: '%u'.\n"
+"  -s --seed <seed>         - Random seed for the orderings. Default: '%u'.\n"
+"  -j --jobs <count>        - Threads. Default: '%u'.\n"
+"  -x --index <file>        - Template index to read parts from.\n"
+"  -o --output-file <file>  - Output SVG file. Default: '%s'.\n"
+"  -h --help                - Show this help and exit.\n"
+"  -v --verbose             - Verbose execution.\n"
+"  -V --version             - Display the program version number.\n"
+"Order lines are '<template> [<design>] <count>', the design an SVG of the\n"
+"part's print area as written by 'blob-generator --template', or '-' for\n"
+"none.  Parts are half the gap from the roll edges.\n",
+		program_name, program_name,
+		opts->gap,
+		opts->resolution,
+		opts->rotations,
+		opts->orderings,
+		opts->seed,
+		opts->jobs,
+		opts->output_file
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"roll-width",  required_argument, NULL, 'w'},
+		{"gap",         required_argument, NULL, 'g'},
+		{"resolution",  required_argument, NULL, 'r'},
+		{"rotations",   required_argument, NULL, 'a'},
+		{"orderings",   required_argument, NULL, 'n'},
+		{"seed",        required_argument, NULL, 's'},
+		{"jobs",        required_argument, NULL, 'j'},
+		{"index",       required_argument, NULL, 'x'},
+		{"output-file", required_argument, NULL, 'o'},
+		{"help",        no_argument,       NULL, 'h'},
+		{"verbose",     no_argument,       NULL, 'v'},
+		{"version",     no_argument,       NULL, 'V'},
+		{ NULL,         0,                 NULL, 0},
+	};
+	static const char short_options[] = "w:g:r:a:n:s:j:x:o:hvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.output_file = "-",
+		.index_file = NULL,
+		.roll_width = 0.0,
+		.resolution = 2.0,
+		.gap = 4.0,
+		.rotations = 4,
+		.orderings = 32,
+		.seed = 1,
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'w':
+			opts->roll_width = to_float(optarg);
+			if (opts->roll_width == HUGE_VALF
+				|| opts->roll_width <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'g':
+			opts->gap = to_float(optarg);
+			if (opts->gap == HUGE_VALF || opts->gap < 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'r':
+			opts->resolution = to_float(optarg);
+			if (opts->resolution == HUGE_VALF
+				|| opts->resolution < 0.1) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'a':
+			opts->rotations = to_unsigned(optarg);
+			if (opts->rotations == UINT_MAX || !opts->rotations
+				|| opts->rotations > max_rotations) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'n':
+			opts->orderings = to_unsigned(optarg);
+			if (opts->orderings == UINT_MAX || !opts->orderings) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 's':
+			opts->seed = to_unsigned(optarg);
+			if (opts->seed == UINT_MAX) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'x':
+			opts->index_file = optarg;
+			break;
+		case 'o':
+			opts->output_file = optarg;
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			set_verbose(true);
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+/*
+ * A part's print area at one rotation.  The bitmap rows are words bits
+ * wide, bit x of a row is cell x, and copy s of the bitmap is shifted s
+ * cells right.  The origin cell is the rotated print area box corner.
+ */
+struct nest_shape {
+	double angle;
+	double x_min;
+	double y_min;
+	unsigned int width;
+	unsigned int height;
+	unsigned int words;
+	unsigned int area;
+	uint64_t *bits;
+};
+
+struct nest_part {
+	const char *template_file;
+	const char *design_file;
+	unsigned int line;
+	unsigned int count;
+	struct template_part part;
+	struct bbox box;
+	struct mapped_file design;
+	double view[4];
+	struct nest_shape *shapes;
+};
+
+struct nest_item {
+	unsigned int part;
+	unsigned int area;
+};
+
+struct placement {
+	unsigned int rotation;
+	unsigned int x;
+	unsigned int y;
+};
+
+struct nest_result {
+	unsigned int length;
+	struct placement *placements;
+};
+
+struct nest {
+	const struct opts *opts;
+	char *data;
+	struct nest_part *parts;
+	unsigned int part_count;
+	struct nest_item *items;
+	unsigned int item_count;
+	unsigned int *area_order;
+	unsigned int columns;
+	unsigned int margin;
+	unsigned int max_rows;
+	struct nest_result *results;
+};
+
+static int order_parse(struct nest *nest, const char *file)
+{
+	struct mapped_file mf;
+	unsigned int line = 0;
+	char *p;
+
+	if (map_file(file, &mf)) {
+		return -1;
+	}
+	nest->data = mem_alloc(mf.size + 1);
+	memcpy(nest->data, mf.data, mf.size);
+	nest->data[mf.size] = 0;
+	unmap_file(&mf);
+
+	for (p = nest->data; *p; ) {
+		char *end = strchr(p, '\n');
+		char *fields[4];
+		unsigned int count = 0;
+		struct nest_part *np;
+		char *save;
+		char *f;
+
+		if (end) {
+			*end = 0;
+		}
+		line++;
+
+		f = strchr(p, '#');
+		if (f) {
+			*f = 0;
+		}
+
+		for (f = strtok_r(p, " \t\r", &save); f && count < 4;
+			f = strtok_r(NULL, " \t\r", &save)) {
+			fields[count++] = f;
+		}
+
+		p = end ? end + 1 : p + strlen(p);
+
+		if (!count) {
+			continue;
+		}
+		if (count < 2 || count > 3) {
+			error("%s:%u: expected <template> [<design>] <count>.\n",
+				file, line);
+			return -1;
+		}
+
+		nest->parts = mem_realloc(nest->parts,
+			(nest->part_count + 1) * sizeof(*nest->parts));
+		np = &nest->parts[nest->part_count++];
+		memset(np, 0, sizeof(*np));
+
+		np->line = line;
+		np->template_file = fields[0];
+		np->design_file = (count == 3 && strcmp(fields[1], "-"))
+			? fields[1] : NULL;
+		np->count = to_unsigned(fields[count - 1]);
+		if (np->count == UINT_MAX || !np->count) {
+			error("%s:%u: bad count '%s'.\n", file, line,
+				fields[count - 1]);
+			return -1;
+		}
+		nest->item_count += np->count;
+	}
+
+	if (!nest->item_count) {
+		error("%s: no parts.\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+/* Checks the design is well-formed and reads its root viewBox. */
+static int design_load(struct nest_part *np)
+{
+	struct xml_parser xp;
+	struct xml_token tok;
+	bool have_view = false;
+	int result = 0;
+
+	if (map_file(np->design_file, &np->design)) {
+		return -1;
+	}
+
+	xml_parser_init(&xp, np->design.data, np->design.size);
+
+	while (xml_next(&xp, &tok) != xml_eof) {
+		if (tok.type == xml_error) {
+			error("Invalid XML: %s: %s\n", np->design_file,
+				xp.error);
+			result = -1;
+			break;
+		}
+		if (xp.depth == 1 && tok.type == xml_start && !have_view) {
+			struct xml_attr attr;
+			const char *p;
+			const char *end;
+
+			if (!xml_name_is(&tok, "svg")
+				|| !xml_attr_get(&tok, "viewBox", &attr)) {
+				break;
+			}
+			p = attr.value;
+			end = attr.value + attr.value_len;
+			have_view = path_number(&p, end, &np->view[0])
+				&& path_number(&p, end, &np->view[1])
+				&& path_number(&p, end, &np->view[2])
+				&& path_number(&p, end, &np->view[3])
+				&& np->view[2] > 0.0 && np->view[3] > 0.0;
+		}
+	}
+
+	xml_parser_free(&xp);
+
+	if (!result && !have_view) {
+		error("%s: no svg root viewBox.\n", np->design_file);
+		result = -1;
+	}
+	return result;
+}
+
+static void shape_dilate(unsigned char *cells, unsigned int width,
+	unsigned int height, unsigned int radius)
+{
+	unsigned char *tmp = mem_alloc((size_t)width * height + 1);
+	unsigned int x;
+	unsigned int y;
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *in = cells + (size_t)y * width;
+		unsigned char *out = tmp + (size_t)y * width;
+
+		for (x = 0; x < width; x++) {
+			unsigned int x0 = (x > radius) ? x - radius : 0;
+			unsigned int x1 = (x + radius < width) ? x + radius
+				: width - 1;
+
+			for (out[x] = 0; x0 <= x1 && !out[x]; x0++) {
+				out[x] = in[x0];
+			}
+		}
+	}
+
+	for (y = 0; y < height; y++) {
+		unsigned int y0 = (y > radius) ? y - radius : 0;
+		unsigned int y1 = (y + radius < height) ? y + radius
+			: height - 1;
+		unsigned char *out = cells + (size_t)y * width;
+
+		for (x = 0; x < width; x++) {
+			unsigned int i;
+
+			for (out[x] = 0, i = y0; i <= y1 && !out[x]; i++) {
+				out[x] = tmp[(size_t)i * width + x];
+			}
+		}
+	}
+
+	mem_free(tmp);
+}
+
+static void make_shape(const struct nest *nest, const struct nest_part *np,
+	double angle, struct nest_shape *shape)
+{
+	const double res = nest->opts->resolution;
+	const double scale = 1.0 / np->part.units_per_mm;
+	const double c = cos(angle * M_PI / 180.0);
+	const double s = sin(angle * M_PI / 180.0);
+	struct ring_set rings = {0};
+	struct raster raster;
+	struct bbox box;
+	unsigned char *cells;
+	size_t row_size;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < np->part.print.count; i++) {
+		const struct ring *in = &np->part.print.rings[i];
+		struct ring *out = ring_set_add(&rings);
+
+		for (j = 0; j < in->count; j++) {
+			double x = (in->points[j].x - np->box.x_min) * scale;
+			double y = (in->points[j].y - np->box.y_min) * scale;
+
+			ring_add(out, x * c - y * s, x * s + y * c);
+		}
+	}
+
+	ring_set_bbox(&rings, &box);
+	shape->angle = angle;
+	shape->x_min = box.x_min;
+	shape->y_min = box.y_min;
+	shape->width = (unsigned int)ceil((box.x_max - box.x_min) / res)
+		+ 2 * nest->margin;
+	shape->height = (unsigned int)ceil((box.y_max - box.y_min) / res)
+		+ 2 * nest->margin;
+
+	for (i = 0; i < rings.count; i++) {
+		for (j = 0; j < rings.rings[i].count; j++) {
+			struct point_d *p = &rings.rings[i].points[j];
+
+			p->x = (p->x - box.x_min) / res + nest->margin;
+			p->y = (p->y - box.y_min) / res + nest->margin;
+		}
+	}
+
+	/* Any coverage at all marks a cell. */
+	raster_init(&raster, shape->width, shape->height, 0xffffff);
+	raster_fill(&raster, &rings, 0);
+	ring_set_free(&rings);
+
+	cells = mem_alloc((size_t)shape->width * shape->height + 1);
+	for (i = 0; i < shape->width * shape->height; i++) {
+		cells[i] = raster.pixels[3 * i] != 0xff;
+		shape->area += cells[i];
+	}
+	raster_free(&raster);
+
+	if (nest->margin) {
+		shape_dilate(cells, shape->width, shape->height,
+			nest->margin);
+	}
+
+	shape->words = (shape->width + 63) / 64 + 1;
+	row_size = (size_t)shape->height * shape->words;
+	shape->bits = mem_alloc(64 * row_size * sizeof(*shape->bits));
+
+	for (i = 0; i < shape->height; i++) {
+		uint64_t *row = shape->bits + i * shape->words;
+
+		for (j = 0; j < shape->width; j++) {
+			if (cells[(size_t)i * shape->width + j]) {
+				row[j / 64] |= (uint64_t)1 << (j % 64);
+			}
+		}
+	}
+	mem_free(cells);
+
+	for (i = 1; i < 64; i++) {
+		const uint64_t *in = shape->bits;
+		uint64_t *out = shape->bits + i * row_size;
+		size_t k;
+
+		for (k = 0; k < row_size; k++) {
+			out[k] = in[k] << i;
+			if (k % shape->words) {
+				out[k] |= in[k - 1] >> (64 - i);
+			}
+		}
+	}
+}
+
+static int part_load(struct nest *nest, struct nest_part *np,
+	const struct template_index *index)
+{
+	const unsigned int rotations = nest->opts->rotations;
+	unsigned int fits = 0;
+	unsigned int i;
+
+	if (template_part_get(index, np->template_file, template_tolerance,
+		&np->part)) {
+		return -1;
+	}
+
+	ring_set_bbox(&np->part.print, &np->box);
+	if (np->box.x_min > np->box.x_max) {
+		error("%s: no print area.\n", np->template_file);
+		return -1;
+	}
+
+	if (np->design_file && design_load(np)) {
+		return -1;
+	}
+
+	np->shapes = mem_alloc(rotations * sizeof(*np->shapes));
+	for (i = 0; i < rotations; i++) {
+		make_shape(nest, np, 360.0 * i / rotations, &np->shapes[i]);
+		fits += np->shapes[i].width <= nest->columns;
+	}
+
+	if (!fits) {
+		error("%s: print area doesn't fit a %.1f mm roll.\n",
+			np->template_file, nest->opts->roll_width);
+		return -1;
+	}
+
+	log("%s: %.1fx%.1f mm print area\n", np->template_file,
+		(np->box.x_max - np->box.x_min) / np->part.units_per_mm,
+		(np->box.y_max - np->box.y_min) / np->part.units_per_mm);
+	return 0;
+}
+
+static void part_free(struct nest_part *np, unsigned int rotations)
+{
+	unsigned int i;
+
+	if (np->shapes) {
+		for (i = 0; i < rotations; i++) {
+			if (np->shapes[i].bits) {
+				mem_free(np->shapes[i].bits);
+			}
+		}
+		mem_free(np->shapes);
+	}
+	if (np->design.data) {
+		unmap_file(&np->design);
+	}
+	template_part_free(&np->part);
+}
+
+static int compare_items(const void *a, const void *b, void *cb_data)
+{
+	const struct nest_item *items = cb_data;
+	unsigned int ia = *(const unsigned int *)a;
+	unsigned int ib = *(const unsigned int *)b;
+
+	if (items[ia].area != items[ib].area) {
+		return (items[ia].area < items[ib].area) ? 1 : -1;
+	}
+	return (ia > ib) - (ia < ib);
+}
+
+static uint64_t order_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+struct roll {
+	uint64_t *bits;
+	unsigned int words;
+	unsigned int columns;
+	unsigned int rows;
+};
+
+static bool shape_fits(const struct roll *roll, const struct nest_shape *shape,
+	unsigned int x, unsigned int y)
+{
+	const uint64_t *bits = shape->bits
+		+ (size_t)(x % 64) * shape->height * shape->words;
+	const uint64_t *row = roll->bits + (size_t)y * roll->words + x / 64;
+	unsigned int r;
+	unsigned int k;
+
+	for (r = 0; r < shape->height; r++) {
+		for (k = 0; k < shape->words; k++) {
+			if (row[k] & bits[k]) {
+				return false;
+			}
+		}
+		bits += shape->words;
+		row += roll->words;
+	}
+	return true;
+}
+
+static void shape_place(struct roll *roll, const struct nest_shape *shape,
+	unsigned int x, unsigned int y)
+{
+	const uint64_t *bits = shape->bits
+		+ (size_t)(x % 64) * shape->height * shape->words;
+	uint64_t *row = roll->bits + (size_t)y * roll->words + x / 64;
+	unsigned int r;
+	unsigned int k;
+
+	for (r = 0; r < shape->height; r++) {
+		for (k = 0; k < shape->words; k++) {
+			row[k] |= bits[k];
+		}
+		bits += shape->words;
+		row += roll->words;
+	}
+}
+
+/* The first free position by row then column, reaching at most limit. */
+static bool shape_find(const struct roll *roll, const struct nest_shape *shape,
+	unsigned int limit, unsigned int *x_out, unsigned int *y_out)
+{
+	unsigned int x;
+	unsigned int y;
+
+	if (shape->width > roll->columns) {
+		return false;
+	}
+
+	for (y = 0; y + shape->height <= limit; y++) {
+		for (x = 0; x + shape->width <= roll->columns; x++) {
+			if (shape_fits(roll, shape, x, y)) {
+				*x_out = x;
+				*y_out = y;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int order_job(void *cb_data, unsigned int index)
+{
+	struct nest *nest = cb_data;
+	struct nest_result *result = &nest->results[index];
+	uint64_t state = ((uint64_t)nest->opts->seed << 32) | index;
+	struct roll roll;
+	unsigned int *order;
+	unsigned int i;
+	unsigned int r;
+
+	order = mem_alloc(nest->item_count * sizeof(*order));
+	memcpy(order, nest->area_order, nest->item_count * sizeof(*order));
+
+	if (index) {
+		for (i = 0; i < nest->item_count; i++) {
+			unsigned int span = nest->item_count - i;
+			unsigned int j = i + order_random(&state)
+				% ((span < 4) ? span : 4);
+			unsigned int tmp = order[i];
+
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+	}
+
+	roll.columns = nest->columns;
+	roll.rows = nest->max_rows;
+	roll.words = (roll.columns + 63) / 64 + 1;
+	roll.bits = mem_alloc((size_t)roll.rows * roll.words
+		* sizeof(*roll.bits));
+	memset(roll.bits, 0, (size_t)roll.rows * roll.words
+		* sizeof(*roll.bits));
+
+	result->placements = mem_alloc(nest->item_count
+		* sizeof(*result->placements));
+	result->length = 0;
+
+	for (i = 0; i < nest->item_count; i++) {
+		unsigned int item = order[i];
+		const struct nest_part *np =
+			&nest->parts[nest->items[item].part];
+		struct placement *best = &result->placements[item];
+		unsigned int best_end = roll.rows;
+		bool found = false;
+
+		for (r = 0; r < nest->opts->rotations; r++) {
+			const struct nest_shape *shape = &np->shapes[r];
+			unsigned int x;
+			unsigned int y;
+			unsigned int end;
+
+			if (!shape_find(&roll, shape, best_end, &x, &y)) {
+				continue;
+			}
+			end = y + shape->height;
+			if (!found || end < best_end
+				|| (end == best_end && x < best->x)) {
+				best->rotation = r;
+				best->x = x;
+				best->y = y;
+				best_end = end;
+				found = true;
+			}
+		}
+
+		/* The rows fit every part one below the other. */
+		assert(found);
+
+		shape_place(&roll, &np->shapes[best->rotation], best->x,
+			best->y);
+		if (best_end > result->length) {
+			result->length = best_end;
+		}
+	}
+
+	debug("ordering %u: %u rows\n", index, result->length);
+
+	mem_free(roll.bits);
+	mem_free(order);
+	return 0;
+}
+
+static void write_rings(FILE *stream, const struct ring_set *rings,
+	const struct nest_part *np)
+{
+	const double scale = px_per_mm / np->part.units_per_mm;
+	struct out_buf d = {0};
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < rings->count; i++) {
+		const struct ring *ring = &rings->rings[i];
+
+		for (j = 0; j < ring->count; j++) {
+			out_add_str(&d, j ? " L " : (i ? " M " : "M "));
+			out_add_number(&d, (ring->points[j].x - np->box.x_min)
+				* scale, 3);
+			out_add_str(&d, ",");
+			out_add_number(&d, (ring->points[j].y - np->box.y_min)
+				* scale, 3);
+		}
+		if (ring->count) {
+			out_add_str(&d, " Z");
+		}
+	}
+
+	fprintf(stream, "d=\"%.*s\"", (int)d.len, d.data ? d.data : "");
+	out_free(&d);
+}
+
+static void write_attr_value(FILE *stream, const struct xml_attr *attr,
+	const char *prefix)
+{
+	const char *p = attr->value;
+	const char *end = attr->value + attr->value_len;
+
+	if (p < end && *p == '#') {
+		fprintf(stream, "#%s", prefix);
+		p++;
+	}
+
+	while (p < end) {
+		const char *url = memmem(p, end - p, "url(#", 5);
+
+		if (!url) {
+			fwrite(p, 1, end - p, stream);
+			break;
+		}
+		fwrite(p, 1, url + 5 - p, stream);
+		fputs(prefix, stream);
+		p = url + 5;
+	}
+}
+
+/*
+ * Copies the content of the design's root element into a group scaled
+ * from its viewBox to the print area.  Ids and the references to them
+ * get the prefix, so the copies of designs don't clash.
+ */
+static void write_design(FILE *stream, const struct nest_part *np,
+	const char *prefix)
+{
+	const double scale = px_per_mm / np->part.units_per_mm;
+	struct xml_parser xp;
+	struct xml_token tok;
+
+	xml_parser_init(&xp, np->design.data, np->design.size);
+
+	while (xml_next(&xp, &tok) != xml_eof) {
+		const char *pos = tok.attrs;
+		struct xml_attr attr;
+		bool root;
+
+		if (tok.type == xml_error) {
+			break;
+		}
+
+		root = (tok.type == xml_start && xp.depth == 1)
+			|| (tok.type == xml_end && !xp.depth);
+
+		if (root && tok.type == xml_end) {
+			fprintf(stream, "</g>\n");
+			continue;
+		}
+		if (!xp.depth && tok.type != xml_end) {
+			continue;
+		}
+
+		switch (tok.type) {
+		case xml_start:
+		case xml_empty:
+			if (root) {
+				fprintf(stream, "<g transform=\"scale(%f %f) translate(%f %f)\"",
+					(np->box.x_max - np->box.x_min)
+						* scale / np->view[2],
+					(np->box.y_max - np->box.y_min)
+						* scale / np->view[3],
+					-np->view[0], -np->view[1]);
+			} else {
+				fprintf(stream, "<%.*s", tok.name_len,
+					tok.name);
+			}
+			while (xml_attr_next(&pos, tok.attrs_end, &attr)) {
+				char quote = attr.value[-1];
+
+				if (root && (attr.name_len < 6
+					|| strncmp(attr.name, "xmlns:", 6))) {
+					continue;
+				}
+				fprintf(stream, " %.*s=%c", attr.name_len,
+					attr.name, quote);
+				if (xml_attr_is(&attr, "id")) {
+					fputs(prefix, stream);
+					fwrite(attr.value, 1, attr.value_len,
+						stream);
+				} else {
+					write_attr_value(stream, &attr,
+						prefix);
+				}
+				fputc(quote, stream);
+			}
+			fputs((tok.type == xml_empty) ? "/>" : ">", stream);
+			break;
+		case xml_end:
+			fprintf(stream, "</%.*s>", tok.name_len, tok.name);
+			break;
+		case xml_text:
+		case xml_comment:
+		case xml_cdata:
+			fwrite(tok.start, 1, tok.end - tok.start, stream);
+			break;
+		default:
+			break;
+		}
+	}
+
+	xml_parser_free(&xp);
+}
+
+static void write_roll(FILE *stream, const struct nest *nest,
+	const struct nest_result *best)
+{
+	const double res = nest->opts->resolution;
+	struct svg_rect page = {.rx = 0.0};
+	unsigned int i;
+	int pass;
+
+	page.width = nest->opts->roll_width * px_per_mm;
+	page.height = best->length * res * px_per_mm;
+
+	fprintf(stream, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n");
+	svg_open_svg(stream, &page);
+
+	/* The designs first, then the cut lines over all of them. */
+	for (pass = 0; pass < 2; pass++) {
+		svg_open_group(stream, pass ? "cut" : "parts");
+
+		for (i = 0; i < nest->item_count; i++) {
+			const struct placement *pl = &best->placements[i];
+			const struct nest_part *np =
+				&nest->parts[nest->items[i].part];
+			const struct nest_shape *shape =
+				&np->shapes[pl->rotation];
+			double x = (pl->x + nest->margin) * res - shape->x_min;
+			double y = (pl->y + nest->margin) * res - shape->y_min;
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "part_%u_", i + 1);
+
+			fprintf(stream, "  <g id=\"%s%s\" transform=\"translate(%f %f) rotate(%g)\">\n",
+				prefix, pass ? "cut" : "design",
+				x * px_per_mm, y * px_per_mm, shape->angle);
+
+			if (pass) {
+				fprintf(stream, "   <path style=\"fill:none;stroke:#ff00ff;stroke-width:1\" ");
+				write_rings(stream, &np->part.cut, np);
+				fprintf(stream, "/>\n");
+			} else if (np->design.data) {
+				fprintf(stream, "   <clipPath id=\"%sclip\">\n    <path ",
+					prefix);
+				write_rings(stream, &np->part.print, np);
+				fprintf(stream, "/>\n   </clipPath>\n   <g clip-path=\"url(#%sclip)\">\n",
+					prefix);
+				write_design(stream, np, prefix);
+				fprintf(stream, "   </g>\n");
+			} else {
+				fprintf(stream, "   <path style=\"fill:#cccccc\" ");
+				write_rings(stream, &np->part.print, np);
+				fprintf(stream, "/>\n");
+			}
+
+			fprintf(stream, "  </g>\n");
+		}
+
+		svg_close_group(stream);
+	}
+
+	svg_close_svg(stream);
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct nest nest = {.opts = &opts};
+	struct template_index index = {0};
+	const struct nest_result *best;
+	struct timespec start;
+	FILE *out_stream;
+	unsigned int area = 0;
+	unsigned int item;
+	unsigned int i;
+	unsigned int j;
+	int result = EXIT_FAILURE;
+	int arg;
+
+	arg = opts_parse(&opts, argc, argv);
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return (arg < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+	if (argc - arg != 1) {
+		error("Need one <order> file.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+	if (opts.roll_width <= 0.0) {
+		error("Need a --roll-width.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (opts.index_file
+		&& template_index_open(&index, opts.index_file) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	nest.columns = (unsigned int)floor(opts.roll_width / opts.resolution);
+	nest.margin = (unsigned int)ceil(opts.gap / 2.0 / opts.resolution);
+
+	if (order_parse(&nest, argv[arg])) {
+		goto done;
+	}
+
+	nest.items = mem_alloc(nest.item_count * sizeof(*nest.items));
+	nest.area_order = mem_alloc(nest.item_count
+		* sizeof(*nest.area_order));
+
+	for (i = 0, item = 0; i < nest.part_count; i++) {
+		struct nest_part *np = &nest.parts[i];
+		unsigned int rows = 0;
+
+		if (part_load(&nest, np, opts.index_file ? &index : NULL)) {
+			error("%s:%u: failed.\n", argv[arg], np->line);
+			goto done;
+		}
+
+		for (j = 0; j < opts.rotations; j++) {
+			if (np->shapes[j].height > rows) {
+				rows = np->shapes[j].height;
+			}
+			if (np->shapes[j].width > rows) {
+				rows = np->shapes[j].width;
+			}
+		}
+
+		for (j = 0; j < np->count; j++, item++) {
+			nest.items[item].part = i;
+			nest.items[item].area = np->shapes[0].area;
+			nest.area_order[item] = item;
+			nest.max_rows += rows;
+			area += np->shapes[0].area;
+		}
+	}
+
+	qsort_r(nest.area_order, nest.item_count, sizeof(*nest.area_order),
+		compare_items, nest.items);
+
+	nest.results = mem_alloc(opts.orderings * sizeof(*nest.results));
+	run_jobs(opts.jobs, opts.orderings, order_job, &nest);
+
+	best = &nest.results[0];
+	for (i = 1; i < opts.orderings; i++) {
+		if (nest.results[i].length < best->length) {
+			best = &nest.results[i];
+		}
+	}
+
+	log("%u parts, %u orderings, best %u of %u rows, %.3f s\n",
+		nest.item_count, opts.orderings, best->length,
+		nest.results[0].length, seconds_since(&start));
+
+	if (!strcmp(opts.output_file, "-")) {
+		out_stream = stdout;
+	} else {
+		out_stream = fopen(opts.output_file, "w");
+		if (!out_stream) {
+			error("open '%s' failed: %s\n", opts.output_file,
+				strerror(errno));
+			goto done;
+		}
+	}
+
+	write_roll(out_stream, &nest, best);
+
+	if (out_stream != stdout ? fclose(out_stream) : fflush(out_stream)) {
+		error("write '%s' failed: %s\n", opts.output_file,
+			strerror(errno));
+		goto done;
+	}
+
+	fprintf(stderr, "%s: %u parts on %.1fx%.1f mm, %.0f%% used.\n",
+		program_name, nest.item_count, opts.roll_width,
+		best->length * opts.resolution,
+		100.0 * area / ((double)nest.columns * best->length));
+	result = EXIT_SUCCESS;
+
+done:
+	if (nest.results) {
+		for (i = 0; i < opts.orderings; i++) {
+			if (nest.results[i].placements) {
+				mem_free(nest.results[i].placements);
+			}
+		}
+		mem_free(nest.results);
+	}
+	for (i = 0; i < nest.part_count; i++) {
+		part_free(&nest.parts[i], opts.rotations);
+	}
+	if (nest.parts) {
+		mem_free(nest.parts);
+	}
+	if (nest.items) {
+		mem_free(nest.items);
+		mem_free(nest.area_order);
+	}
+	if (nest.data) {
+		mem_free(nest.data);
+	}
+	if (opts.index_file) {
+		template_index_close(&index);
+	}
+	return result;
+}
@@ -0,0 +1,524 @@
+/*
+ *  moto-design shard merger.
+ */
+
+/*
+ * Merges the shard files of a sharded blob-generator run into the SVG a
+ * single run with the same seed writes.  The shards are mapped and their
+ * blob records streamed out in paint order by a k-way merge on the blob
+ * numbers, so memory doesn't grow with the sheet.  Every shard must be
+ * complete, of the same run and there exactly once: the shards' end lines
+ * have the same shard count, blob count and run hash.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static const char program_name[] = "shard-merge";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	char *output_file;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Merge blob-generator shard files into one SVG.\n"
+"Usage: %s [flags] <shard> <shard> ...\n"
+"Option flags:\n"
+"  -o --output-file <file> - Output SVG file. Default: '%s'.\n"
+"  -h --help               - Show this help and exit.\n"
+"  -v --verbose            - Verbose execution.\n"
+"  -V --version            - Display the program version number.\n"
+"The shards are the outputs of 'blob-generator --shard <i>/<n>' with the\n"
+"same options and seed, all <n> of them in any order.\n",
+		program_name, program_name,
+		opts->output_file
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"output-file", required_argument, NULL, 'o'},
+		{"help",        no_argument,       NULL, 'h'},
+		{"verbose",     no_argument,       NULL, 'v'},
+		{"version",     no_argument,       NULL, 'V'},
+		{ NULL,         0,                 NULL, 0},
+	};
+	static const char short_options[] = "o:hvV";
+
+	*opts = (struct opts){
+		.output_file = "-",
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'o':
+			opts->output_file = optarg;
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			set_verbose(true);
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+/* A shard file record, its data points into the mapped file. */
+struct record {
+	char kind[8];
+	unsigned int number;
+	const char *data;
+	size_t len;
+};
+
+struct shard {
+	const char *file;
+	struct mapped_file mf;
+	const char *p;
+	const char *end;
+	struct record head;
+	struct record tail;
+	struct record blob;
+	bool has_blob;
+	unsigned int index;
+	unsigned int count;
+	unsigned int total;
+	unsigned long long run;
+	unsigned int blob_count;
+};
+
+static const char shard_magic[] = "blob-generator shard\n";
+
+/* Reads the record at p, returns 1 at the end line. */
+static int shard_next(struct shard *shard, struct record *rec)
+{
+	const char *nl;
+	char line[64];
+	unsigned long long len;
+	int n;
+
+	if (shard->p == shard->end) {
+		return 1;
+	}
+
+	nl = memchr(shard->p, '\n', shard->end - shard->p);
+	if (!nl || (size_t)(nl - shard->p) >= sizeof(line)) {
+		error("%s: bad record.\n", shard->file);
+		return -1;
+	}
+	memcpy(line, shard->p, nl - shard->p);
+	line[nl - shard->p] = 0;
+
+	rec->number = 0;
+	if (sscanf(line, "blob %u %llu%n", &rec->number, &len, &n) == 2
+		&& !line[n]) {
+		strcpy(rec->kind, "blob");
+	} else if (sscanf(line, "%7s %llu%n", rec->kind, &len, &n) != 2
+		|| line[n] || (strcmp(rec->kind, "head")
+			&& strcmp(rec->kind, "tail"))) {
+		error("%s: bad record '%s'.\n", shard->file, line);
+		return -1;
+	}
+	if (len > (unsigned long long)(shard->end - nl - 1)) {
+		error("%s: truncated shard.\n", shard->file);
+		return -1;
+	}
+
+	rec->data = nl + 1;
+	rec->len = len;
+	shard->p = rec->data + len;
+	return 0;
+}
+
+/*
+ * Maps the shard, reads its end line and its head.  The end line is
+ * written last, so a shard without one is from a failed run.
+ */
+static int shard_open(struct shard *shard, const char *file)
+{
+	const char *line;
+	char end[80];
+	size_t len;
+	int n;
+
+	shard->file = file;
+	if (map_file(file, &shard->mf)) {
+		return -1;
+	}
+	shard->p = shard->mf.data;
+	shard->end = shard->mf.data + shard->mf.size;
+
+	if (shard->mf.size < sizeof(shard_magic) - 1
+		|| memcmp(shard->p, shard_magic, sizeof(shard_magic) - 1)) {
+		error("%s: not a blob-generator shard.\n", file);
+		return -1;
+	}
+	shard->p += sizeof(shard_magic) - 1;
+
+	line = shard->end - 1;
+	while (line > shard->p && line[-1] != '\n') {
+		line--;
+	}
+	len = shard->end - line;
+	if (len < 2 || len >= sizeof(end) || shard->end[-1] != '\n') {
+		error("%s: truncated shard.\n", file);
+		return -1;
+	}
+	memcpy(end, line, len - 1);
+	end[len - 1] = 0;
+
+	if (sscanf(end, "end %u %u %u %llx%n", &shard->index, &shard->count,
+		&shard->total, &shard->run, &n) != 4 || end[n]) {
+		error("%s: truncated shard.\n", file);
+		return -1;
+	}
+	shard->end = line;
+
+	n = shard_next(shard, &shard->head);
+	if (n || strcmp(shard->head.kind, "head")) {
+		if (n >= 0) {
+			error("%s: no head.\n", file);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/* Moves to the next blob, or reads the tail. */
+static int shard_advance(struct shard *shard)
+{
+	int result;
+
+	shard->has_blob = false;
+
+	result = shard_next(shard, &shard->blob);
+	if (result) {
+		if (result > 0) {
+			error("%s: no tail.\n", shard->file);
+		}
+		return -1;
+	}
+
+	if (!strcmp(shard->blob.kind, "blob")) {
+		if (shard->blob_count
+			&& shard->blob.number <= shard->tail.number) {
+			error("%s: blobs out of order.\n", shard->file);
+			return -1;
+		}
+		shard->tail.number = shard->blob.number;
+		shard->blob_count++;
+		shard->has_blob = true;
+		return 0;
+	}
+
+	if (strcmp(shard->blob.kind, "tail")) {
+		error("%s: unexpected %s.\n", shard->file, shard->blob.kind);
+		return -1;
+	}
+	shard->tail = shard->blob;
+
+	if (shard->p != shard->end) {
+		error("%s: data after the tail.\n", shard->file);
+		return -1;
+	}
+	return 0;
+}
+
+/* Min heap of the shards with a blob, on the blob number. */
+struct heap {
+	struct shard **items;
+	unsigned int count;
+};
+
+static bool heap_less(const struct heap *heap, unsigned int a,
+	unsigned int b)
+{
+	return heap->items[a]->blob.number < heap->items[b]->blob.number;
+}
+
+static void heap_swap(struct heap *heap, unsigned int a, unsigned int b)
+{
+	struct shard *tmp = heap->items[a];
+
+	heap->items[a] = heap->items[b];
+	heap->items[b] = tmp;
+}
+
+static void heap_down(struct heap *heap, unsigned int i)
+{
+	while (1) {
+		unsigned int min = i;
+		unsigned int l = 2 * i + 1;
+		unsigned int r = l + 1;
+
+		if (l < heap->count && heap_less(heap, l, min)) {
+			min = l;
+		}
+		if (r < heap->count && heap_less(heap, r, min)) {
+			min = r;
+		}
+		if (min == i) {
+			return;
+		}
+		heap_swap(heap, i, min);
+		i = min;
+	}
+}
+
+static void heap_push(struct heap *heap, struct shard *shard)
+{
+	unsigned int i = heap->count++;
+
+	heap->items[i] = shard;
+	while (i && heap_less(heap, i, (i - 1) / 2)) {
+		heap_swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static int merge(struct shard *shards, unsigned int count, FILE *stream,
+	unsigned int *blob_count)
+{
+	struct heap heap = {0};
+	unsigned int last = 0;
+	unsigned int i;
+	int result = -1;
+
+	heap.items = mem_alloc(count * sizeof(*heap.items));
+
+	for (i = 0; i < count; i++) {
+		if (shard_advance(&shards[i])) {
+			goto done;
+		}
+		if (shards[i].has_blob) {
+			heap_push(&heap, &shards[i]);
+		}
+	}
+
+	fwrite(shards[0].head.data, 1, shards[0].head.len, stream);
+
+	*blob_count = 0;
+	while (heap.count) {
+		struct shard *shard = heap.items[0];
+
+		if (*blob_count && shard->blob.number == last) {
+			error("%s: blob %u is in two shards.\n", shard->file,
+				last);
+			goto done;
+		}
+		last = shard->blob.number;
+		(*blob_count)++;
+
+		fwrite(shard->blob.data, 1, shard->blob.len, stream);
+
+		if (shard_advance(shard)) {
+			goto done;
+		}
+		if (!shard->has_blob) {
+			heap.items[0] = heap.items[--heap.count];
+		}
+		heap_down(&heap, 0);
+	}
+
+	for (i = 1; i < count; i++) {
+		if (shards[i].tail.len != shards[0].tail.len
+			|| memcmp(shards[i].tail.data, shards[0].tail.data,
+				shards[0].tail.len)) {
+			error("%s: tail differs from %s.\n", shards[i].file,
+				shards[0].file);
+			goto done;
+		}
+	}
+	if (*blob_count != shards[0].total) {
+		error("%u of %u blobs in the shards.\n", *blob_count,
+			shards[0].total);
+		goto done;
+	}
+
+	fwrite(shards[0].tail.data, 1, shards[0].tail.len, stream);
+	result = 0;
+
+done:
+	mem_free(heap.items);
+	return result;
+}
+
+/* The shards must be one of each of the same run. */
+static int check_shards(const struct shard *shards, unsigned int count)
+{
+	bool *seen = mem_alloc(count * sizeof(*seen));
+	int result = -1;
+	unsigned int i;
+
+	memset(seen, 0, count * sizeof(*seen));
+
+	for (i = 0; i < count; i++) {
+		const struct shard *s = &shards[i];
+
+		if (s->count != count) {
+			error("%s: shard %u/%u, %u shards given.\n", s->file,
+				s->index, s->count, count);
+			goto done;
+		}
+		if (s->total != shards[0].total || s->run != shards[0].run) {
+			error("%s: shard %u/%u is not of the run of %s.\n",
+				s->file, s->index, s->count, shards[0].file);
+			goto done;
+		}
+		if (!s->index || s->index > count || seen[s->index - 1]) {
+			error("%s: shard %u/%u given twice.\n", s->file,
+				s->index, s->count);
+			goto done;
+		}
+		seen[s->index - 1] = true;
+
+		if (s->head.len != shards[0].head.len
+			|| memcmp(s->head.data, shards[0].head.data,
+				s->head.len)) {
+			error("%s: head differs from %s.\n", s->file,
+				shards[0].file);
+			goto done;
+		}
+	}
+	result = 0;
+
+done:
+	mem_free(seen);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct shard *shards = NULL;
+	unsigned int count;
+	unsigned int blob_count = 0;
+	unsigned int i;
+	FILE *out_stream = NULL;
+	int result = EXIT_FAILURE;
+	int arg;
+
+	arg = opts_parse(&opts, argc, argv);
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return (arg < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+	if (arg == argc) {
+		error("No shards specified.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	count = argc - arg;
+	shards = mem_alloc(count * sizeof(*shards));
+	memset(shards, 0, count * sizeof(*shards));
+
+	for (i = 0; i < count; i++) {
+		if (shard_open(&shards[i], argv[arg + i])) {
+			goto done;
+		}
+	}
+	if (check_shards(shards, count)) {
+		goto done;
+	}
+
+	if (!strcmp(opts.output_file, "-")) {
+		out_stream = stdout;
+	} else {
+		out_stream = fopen(opts.output_file, "w");
+		if (!out_stream) {
+			error("open '%s' failed: %s\n", opts.output_file,
+				strerror(errno));
+			goto done;
+		}
+	}
+
+	if (merge(shards, count, out_stream, &blob_count)) {
+		goto done;
+	}
+
+	if (out_stream != stdout ? fclose(out_stream) : fflush(out_stream)) {
+		out_stream = NULL;
+		error("write '%s' failed: %s\n", opts.output_file,
+			strerror(errno));
+		goto done;
+	}
+	out_stream = NULL;
+
+	log("%u shards, %u blobs\n", count, blob_count);
+	result = EXIT_SUCCESS;
+
+done:
+	if (out_stream && out_stream != stdout) {
+		fclose(out_stream);
+		unlink(opts.output_file);
+	}
+	for (i = 0; i < count; i++) {
+		if (shards[i].mf.data) {
+			unmap_file(&shards[i].mf);
+		}
+	}
+	mem_free(shards);
+	return result;
+}
@@ -0,0 +1,952 @@
+/*
+ *  moto-design random image generator.
+ */
+
+/*
+ * Canvas sinks: SVG, gzip compressed SVG, PDF, a PNG preview, path
+ * statistics, shard files and .mdgeom geometry.  Each runs on its own
+ * canvas thread and keeps what it needs of a batch, like a path id, as
+ * batches are released once every sink has been through them.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "util.h"
+#include "geom.h"
+#include "mdgeom.h"
+#include "pdf.h"
+#include "raster.h"
+#include "canvas.h"
+
+static const double mm_per_unit = 25.4 / 96.0;
+
+static struct sink *sink_new(const struct sink_ops *ops, FILE *stream,
+	void *data)
+{
+	struct sink *sink = mem_alloc(sizeof(*sink));
+
+	sink->ops = ops;
+	sink->stream = stream;
+	sink->data = data;
+	return sink;
+}
+
+static unsigned int color_rgb(const char *color)
+{
+	return (color && is_hex_color(color))
+		? (unsigned int)strtoul(color + 1, NULL, 16) : 0;
+}
+
+/* SVG, path data built with the fast number formatting. */
+
+struct svg_sink {
+	struct out_buf data;
+	char id[256];
+	char fill[64];
+	bool has_fill;
+	unsigned int decimals;
+	bool open;
+	bool compressed;
+};
+
+static void svg_sink_point(struct svg_sink *ss, const char *cmd, double x,
+	double y)
+{
+	out_add_str(&ss->data, cmd);
+	out_add_number(&ss->data, x, ss->decimals);
+	out_add(&ss->data, ",", 1);
+	out_add_number(&ss->data, y, ss->decimals);
+}
+
+static int svg_sink_cmd(struct sink *sink, const struct canvas_batch *batch,
+	const struct canvas_cmd *cmd)
+{
+	struct svg_sink *ss = sink->data;
+	FILE *stream = sink->stream;
+	const char *s0 = canvas_str(batch, cmd->str[0]);
+	struct svg_rect rect;
+
+	switch (cmd->op) {
+	case canvas_op_open:
+		canvas_cmd_rect(cmd, &rect);
+		svg_open_svg(stream, &rect);
+		ss->open = true;
+		break;
+	case canvas_op_group:
+		svg_open_group(stream, s0);
+		break;
+	case canvas_op_group_end:
+		svg_close_group(stream);
+		break;
+	case canvas_op_path:
+		snprintf(ss->id, sizeof(ss->id), "%s", s0 ? s0 : "");
+		ss->has_fill = cmd->str[1];
+		if (ss->has_fill) {
+			snprintf(ss->fill, sizeof(ss->fill), "%s",
+				canvas_str(batch, cmd->str[1]));
+		}
+		/* A tenth of a unit is well under a draft pixel. */
+		ss->decimals = (cmd->flags & canvas_flag_draft) ? 1 : 3;
+		ss->data.len = 0;
+		break;
+	case canvas_op_path_end:
+		if (ss->has_fill) {
+			svg_open_path(stream, *ss->id ? ss->id : NULL,
+				ss->fill, NULL);
+		} else if (*ss->id) {
+			fprintf(stream, "  <path id=\"%s\"\n", ss->id);
+		} else {
+			fprintf(stream, "  <path\n");
+		}
+		fprintf(stream, "   d=\"%.*s\"\n", (int)ss->data.len,
+			ss->data.data);
+		svg_close_object(stream);
+		break;
+	case canvas_op_move:
+		svg_sink_point(ss, ss->data.len ? "\n    M " : "M ", cmd->p[0],
+			cmd->p[1]);
+		break;
+	case canvas_op_line:
+		svg_sink_point(ss, " L ", cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_quad:
+		svg_sink_point(ss, " Q ", cmd->p[0], cmd->p[1]);
+		svg_sink_point(ss, " ", cmd->p[2], cmd->p[3]);
+		break;
+	case canvas_op_close:
+		out_add_str(&ss->data, " Z");
+		break;
+	case canvas_op_rect:
+		canvas_cmd_rect(cmd, &rect);
+		svg_write_rect(stream, s0, canvas_str(batch, cmd->str[1]), NULL,
+			&rect);
+		break;
+	case canvas_op_tile:
+		canvas_cmd_rect(cmd, &rect);
+		svg_open_defs(stream);
+		svg_open_pattern(stream, "camo_pattern", &rect);
+		break;
+	case canvas_op_tile_end:
+		canvas_cmd_rect(cmd, &rect);
+		svg_close_pattern(stream);
+		svg_close_defs(stream);
+		svg_open_group(stream, "camo_tile");
+		svg_write_rect(stream, "camo_fill", "url(#camo_pattern)", NULL,
+			&rect);
+		svg_close_group(stream);
+		break;
+	case canvas_op_defs:
+		svg_open_defs(stream);
+		break;
+	case canvas_op_defs_end:
+		svg_close_defs(stream);
+		break;
+	case canvas_op_symbol:
+		svg_open_symbol(stream, s0);
+		break;
+	case canvas_op_symbol_end:
+		svg_close_symbol(stream);
+		break;
+	case canvas_op_use:
+		svg_write_use(stream, s0, canvas_str(batch, cmd->str[1]),
+			canvas_str(batch, cmd->str[2]),
+			canvas_str(batch, cmd->str[3]));
+		break;
+	case canvas_op_info:
+		break;
+	}
+
+	return 0;
+}
+
+static int svg_sink_finish(struct sink *sink)
+{
+	struct svg_sink *ss = sink->data;
+	int result = 0;
+
+	if (ss->open) {
+		svg_close_svg(sink->stream);
+	}
+	if (ss->compressed && fclose(sink->stream)) {
+		error("gzip write failed.\n");
+		result = -1;
+	}
+
+	out_free(&ss->data);
+	mem_free(ss);
+	return result;
+}
+
+static const struct sink_ops svg_sink_ops = {
+	.symbols = true,
+	.cmd = svg_sink_cmd,
+	.finish = svg_sink_finish,
+};
+
+struct sink *sink_svg_new(FILE *stream)
+{
+	return sink_new(&svg_sink_ops, stream, mem_alloc(
+		sizeof(struct svg_sink)));
+}
+
+/*
+ * Compressed SVG, the SVG sink writing to a stdio stream over a gzip
+ * stream, on a dup of the file descriptor so closing both is fine.
+ */
+
+static ssize_t gz_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	unsigned long long start;
+	int len;
+
+	if (!size) {
+		return 0;
+	}
+	start = trace_begin();
+	len = gzwrite(cookie, buf, size);
+	trace_end("compress", start);
+	return (len > 0) ? len : -1;
+}
+
+static int gz_cookie_close(void *cookie)
+{
+	unsigned long long start = trace_begin();
+	int result = (gzclose(cookie) == Z_OK) ? 0 : -1;
+
+	trace_end("compress", start);
+	return result;
+}
+
+struct sink *sink_svgz_new(FILE *stream)
+{
+	static const cookie_io_functions_t gz_io = {
+		.write = gz_cookie_write,
+		.close = gz_cookie_close,
+	};
+	struct sink *sink;
+	struct svg_sink *ss;
+	gzFile gz;
+	FILE *gz_stream;
+	int fd;
+
+	fflush(stream);
+	fd = dup(fileno(stream));
+	if (fd < 0) {
+		error("dup failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	gz = gzdopen(fd, "wb");
+	if (!gz) {
+		error("gzdopen failed.\n");
+		close(fd);
+		return NULL;
+	}
+
+	gz_stream = fopencookie(gz, "w", gz_io);
+	if (!gz_stream) {
+		error("fopencookie failed: %s\n", strerror(errno));
+		gzclose(gz);
+		return NULL;
+	}
+
+	sink = sink_svg_new(gz_stream);
+	ss = sink->data;
+	ss->compressed = true;
+	return sink;
+}
+
+/*
+ * Shard file, the SVG of one shard of a sharded run cut into records:
+ * the head up to the camo blobs group, each blob path with its paint
+ * order number and the tail after the group.  The head and tail are the
+ * same in every shard, shard-merge writes them around the blobs of all
+ * the shards merged in paint order.  The generator appends the end line
+ * once the shard is complete, the run hash is an FNV-1a hash of the run's
+ * cache key in 16 hex digits so shards of different runs can be told
+ * apart.
+ *
+ *   blob-generator shard\n
+ *   head <length>\n<bytes>
+ *   blob <number> <length>\n<bytes>
+ *   tail <length>\n<bytes>
+ *   end <shard> <shard count> <total blob count> <run hash>\n
+ */
+
+struct shard_sink {
+	struct sink *svg;
+	struct out_buf pending;
+	unsigned int depth;
+	unsigned int blob;
+	bool in_blobs;
+	bool head_done;
+};
+
+static ssize_t shard_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	out_add(cookie, buf, size);
+	return size;
+}
+
+static void shard_record(struct sink *sink, const char *label)
+{
+	struct shard_sink *sh = sink->data;
+
+	fflush(sh->svg->stream);
+	fprintf(sink->stream, "%s %zu\n", label, sh->pending.len);
+	fwrite(sh->pending.data, 1, sh->pending.len, sink->stream);
+	sh->pending.len = 0;
+}
+
+static int shard_sink_cmd(struct sink *sink, const struct canvas_batch *batch,
+	const struct canvas_cmd *cmd)
+{
+	struct shard_sink *sh = sink->data;
+	const char *s0 = canvas_str(batch, cmd->str[0]);
+
+	if (sh->in_blobs && cmd->op == canvas_op_group_end && !sh->depth) {
+		sh->in_blobs = false;
+	}
+
+	if (sh->in_blobs && !sh->depth && cmd->op == canvas_op_path
+		&& sscanf(s0, "blob_%u", &sh->blob) != 1) {
+		error("shard: unexpected path '%s'.\n", s0);
+		return -1;
+	}
+
+	if (svg_sink_cmd(sh->svg, batch, cmd)) {
+		return -1;
+	}
+
+	if (sh->in_blobs) {
+		if (cmd->op == canvas_op_group) {
+			sh->depth++;
+		} else if (cmd->op == canvas_op_group_end) {
+			sh->depth--;
+		} else if (cmd->op == canvas_op_path_end && !sh->depth) {
+			char label[32];
+
+			snprintf(label, sizeof(label), "blob %u", sh->blob);
+			shard_record(sink, label);
+		}
+	} else if (cmd->op == canvas_op_group && !sh->head_done
+		&& !strcmp(s0, "camo_blobs")) {
+		sh->in_blobs = true;
+		sh->head_done = true;
+		shard_record(sink, "head");
+	}
+
+	return 0;
+}
+
+static int shard_sink_finish(struct sink *sink)
+{
+	struct shard_sink *sh = sink->data;
+	int result = svg_sink_finish(sh->svg);
+
+	if (!sh->head_done) {
+		error("shard: no camo blobs group.\n");
+		result = -1;
+	}
+	shard_record(sink, "tail");
+
+	fclose(sh->svg->stream);
+	mem_free(sh->svg);
+	out_free(&sh->pending);
+	mem_free(sh);
+	return result;
+}
+
+static const struct sink_ops shard_sink_ops = {
+	.symbols = true,
+	.cmd = shard_sink_cmd,
+	.finish = shard_sink_finish,
+};
+
+struct sink *sink_shard_new(FILE *stream)
+{
+	static const cookie_io_functions_t shard_io = {
+		.write = shard_cookie_write,
+	};
+	struct shard_sink *sh = mem_alloc(sizeof(*sh));
+	FILE *svg_stream;
+
+	svg_stream = fopencookie(&sh->pending, "w", shard_io);
+	if (!svg_stream) {
+		error("fopencookie failed: %s\n", strerror(errno));
+		mem_free(sh);
+		return NULL;
+	}
+
+	sh->svg = sink_svg_new(svg_stream);
+	fprintf(stream, "blob-generator shard\n");
+	return sink_new(&shard_sink_ops, stream, sh);
+}
+
+/* PDF. */
+
+static void pdf_sink_rect(struct pdf *pdf, const char *fill,
+	const struct svg_rect *rect)
+{
+	static const double k = 0.5522847498;
+	const double x0 = rect->x;
+	const double y0 = rect->y;
+	const double x1 = rect->x + rect->width;
+	const double y1 = rect->y + rect->height;
+	double r = fmin(rect->rx, fmin(rect->width, rect->height) / 2.0);
+
+	r = (r > 0.0) ? r : 0.0;
+
+	/* Rounded corners are quarter ellipse cubics. */
+	pdf_set_fill(pdf, fill);
+	pdf_move_to(pdf, x0 + r, y0);
+	pdf_line_to(pdf, x1 - r, y0);
+	pdf_curve_to(pdf, x1 - r + k * r, y0, x1, y0 + r - k * r, x1, y0 + r);
+	pdf_line_to(pdf, x1, y1 - r);
+	pdf_curve_to(pdf, x1, y1 - r + k * r, x1 - r + k * r, y1, x1 - r, y1);
+	pdf_line_to(pdf, x0 + r, y1);
+	pdf_curve_to(pdf, x0 + r - k * r, y1, x0, y1 - r + k * r, x0, y1 - r);
+	pdf_line_to(pdf, x0, y0 + r);
+	pdf_curve_to(pdf, x0, y0 + r - k * r, x0 + r - k * r, y0, x0 + r, y0);
+	pdf_close_path(pdf);
+	pdf_fill(pdf);
+}
+
+static int pdf_sink_cmd(struct sink *sink, const struct canvas_batch *batch,
+	const struct canvas_cmd *cmd)
+{
+	struct pdf *pdf = sink->data;
+	struct svg_rect rect;
+
+	if (cmd->op == canvas_op_open) {
+		canvas_cmd_rect(cmd, &rect);
+		sink->data = pdf_open(sink->stream, &rect);
+		return sink->data ? 0 : -1;
+	}
+	if (!pdf) {
+		return -1;
+	}
+
+	switch (cmd->op) {
+	case canvas_op_path:
+		pdf_set_fill(pdf, canvas_str(batch, cmd->str[1]));
+		break;
+	case canvas_op_path_end:
+		pdf_fill(pdf);
+		break;
+	case canvas_op_move:
+		pdf_move_to(pdf, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_line:
+		pdf_line_to(pdf, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_quad:
+		pdf_quad_to(pdf, cmd->p[0], cmd->p[1], cmd->p[2], cmd->p[3]);
+		break;
+	case canvas_op_close:
+		pdf_close_path(pdf);
+		break;
+	case canvas_op_rect:
+		canvas_cmd_rect(cmd, &rect);
+		pdf_sink_rect(pdf, canvas_str(batch, cmd->str[1]), &rect);
+		break;
+	case canvas_op_tile:
+		canvas_cmd_rect(cmd, &rect);
+		pdf_save(pdf);
+		pdf_clip_rect(pdf, &rect);
+		break;
+	case canvas_op_tile_end:
+		pdf_restore(pdf);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int pdf_sink_finish(struct sink *sink)
+{
+	return sink->data ? pdf_close(sink->data) : 0;
+}
+
+static const struct sink_ops pdf_sink_ops = {
+	.symbols = false,
+	.cmd = pdf_sink_cmd,
+	.finish = pdf_sink_finish,
+};
+
+struct sink *sink_pdf_new(FILE *stream)
+{
+	return sink_new(&pdf_sink_ops, stream, NULL);
+}
+
+/* PNG preview, the page scaled to size pixels on its long side. */
+
+struct preview_sink {
+	unsigned int size;
+	struct raster raster;
+	bool open;
+	struct svg_rect page;
+	double scale;
+	struct ring_set rings;
+	unsigned int ring_count;
+	struct ring *ring;
+	struct point_d current;
+	unsigned int rgb;
+};
+
+static void preview_point(struct preview_sink *ps, double x, double y)
+{
+	ring_add(ps->ring, (x - ps->page.x) * ps->scale,
+		(y - ps->page.y) * ps->scale);
+	ps->current.x = x;
+	ps->current.y = y;
+}
+
+static struct ring *preview_ring(struct preview_sink *ps)
+{
+	struct ring *ring;
+
+	if (ps->ring_count < ps->rings.count) {
+		ring = &ps->rings.rings[ps->ring_count];
+		ring->count = 0;
+	} else {
+		ring = ring_set_add(&ps->rings);
+	}
+	ps->ring_count++;
+	return ring;
+}
+
+static void preview_fill(struct preview_sink *ps)
+{
+	struct ring_set set = {
+		.rings = ps->rings.rings,
+		.count = ps->ring_count,
+	};
+
+	raster_fill(&ps->raster, &set, ps->rgb);
+	ps->ring_count = 0;
+	ps->ring = NULL;
+}
+
+static int preview_sink_cmd(struct sink *sink,
+	const struct canvas_batch *batch, const struct canvas_cmd *cmd)
+{
+	static const unsigned int quad_steps = 8;
+	struct preview_sink *ps = sink->data;
+	struct svg_rect rect;
+	unsigned int i;
+
+	switch (cmd->op) {
+	case canvas_op_open:
+		canvas_cmd_rect(cmd, &ps->page);
+		ps->scale = ps->size / fmax(ps->page.width, ps->page.height);
+		raster_init(&ps->raster,
+			(unsigned int)fmax(1.0, lround(ps->page.width
+				* ps->scale)),
+			(unsigned int)fmax(1.0, lround(ps->page.height
+				* ps->scale)), 0xffffff);
+		ps->open = true;
+		break;
+	case canvas_op_path:
+		ps->rgb = color_rgb(canvas_str(batch, cmd->str[1]));
+		ps->ring_count = 0;
+		break;
+	case canvas_op_path_end:
+		preview_fill(ps);
+		break;
+	case canvas_op_move:
+		ps->ring = preview_ring(ps);
+		preview_point(ps, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_line:
+		preview_point(ps, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_quad: {
+		const struct point_d p0 = ps->current;
+
+		for (i = 1; i <= quad_steps; i++) {
+			double t = (double)i / quad_steps;
+			double u = 1.0 - t;
+
+			preview_point(ps,
+				u * u * p0.x + 2 * u * t * cmd->p[0]
+					+ t * t * cmd->p[2],
+				u * u * p0.y + 2 * u * t * cmd->p[1]
+					+ t * t * cmd->p[3]);
+		}
+		break;
+	}
+	case canvas_op_rect:
+		canvas_cmd_rect(cmd, &rect);
+		ps->rgb = color_rgb(canvas_str(batch, cmd->str[1]));
+		ps->ring_count = 0;
+		ps->ring = preview_ring(ps);
+		canvas_rect_outline(&rect, ps->ring);
+		for (i = 0; i < ps->ring->count; i++) {
+			ps->ring->points[i].x = (ps->ring->points[i].x
+				- ps->page.x) * ps->scale;
+			ps->ring->points[i].y = (ps->ring->points[i].y
+				- ps->page.y) * ps->scale;
+		}
+		preview_fill(ps);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int preview_sink_finish(struct sink *sink)
+{
+	struct preview_sink *ps = sink->data;
+	int result = 0;
+
+	if (ps->open) {
+		result = raster_write_png(&ps->raster, sink->stream);
+		raster_free(&ps->raster);
+	}
+	ring_set_free(&ps->rings);
+	mem_free(ps);
+	return result;
+}
+
+static const struct sink_ops preview_sink_ops = {
+	.symbols = false,
+	.cmd = preview_sink_cmd,
+	.finish = preview_sink_finish,
+};
+
+struct sink *sink_preview_new(FILE *stream, unsigned int size)
+{
+	struct preview_sink *ps = mem_alloc(sizeof(*ps));
+
+	ps->size = size;
+	return sink_new(&preview_sink_ops, stream, ps);
+}
+
+/*
+ * Statistics: path, subpath and node counts, and the painted area per
+ * color.  Quadratic pieces add two thirds of their control triangle.
+ * The background is left out, overlapping shapes count once each.
+ */
+
+struct stats_color {
+	char color[hex_color_len];
+	unsigned long paths;
+	unsigned long subpaths;
+	double area;
+};
+
+struct stats_sink {
+	struct svg_rect page;
+	unsigned long paths;
+	unsigned long subpaths;
+	unsigned long nodes;
+	struct stats_color *colors;
+	unsigned int color_count;
+	struct stats_color *current;
+	struct point_d start;
+	struct point_d point;
+	double area;
+	bool in_subpath;
+};
+
+static struct stats_color *stats_color(struct stats_sink *st,
+	const char *color)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->color_count; i++) {
+		if (!strcmp(st->colors[i].color, color)) {
+			return &st->colors[i];
+		}
+	}
+
+	st->colors = mem_realloc(st->colors, (st->color_count + 1)
+		* sizeof(*st->colors));
+	memset(&st->colors[st->color_count], 0, sizeof(*st->colors));
+	snprintf(st->colors[st->color_count].color,
+		sizeof(st->colors[st->color_count].color), "%s", color);
+	return &st->colors[st->color_count++];
+}
+
+static void stats_end_subpath(struct stats_sink *st)
+{
+	if (!st->in_subpath) {
+		return;
+	}
+	st->area += (st->point.x * st->start.y - st->start.x * st->point.y)
+		/ 2.0;
+	if (st->current) {
+		st->current->area += fabs(st->area);
+	}
+	st->in_subpath = false;
+}
+
+static void stats_edge(struct stats_sink *st, double x, double y)
+{
+	st->area += (st->point.x * y - x * st->point.y) / 2.0;
+	st->point.x = x;
+	st->point.y = y;
+	st->nodes++;
+}
+
+static int stats_sink_cmd(struct sink *sink, const struct canvas_batch *batch,
+	const struct canvas_cmd *cmd)
+{
+	struct stats_sink *st = sink->data;
+	const char *s0 = canvas_str(batch, cmd->str[0]);
+	const char *fill = canvas_str(batch, cmd->str[1]);
+	struct svg_rect rect;
+	double r;
+
+	switch (cmd->op) {
+	case canvas_op_open:
+		canvas_cmd_rect(cmd, &st->page);
+		break;
+	case canvas_op_path:
+		st->paths++;
+		st->current = stats_color(st, fill ? fill : "none");
+		st->current->paths++;
+		break;
+	case canvas_op_path_end:
+		stats_end_subpath(st);
+		st->current = NULL;
+		break;
+	case canvas_op_move:
+		stats_end_subpath(st);
+		st->subpaths++;
+		if (st->current) {
+			st->current->subpaths++;
+		}
+		st->start.x = st->point.x = cmd->p[0];
+		st->start.y = st->point.y = cmd->p[1];
+		st->area = 0.0;
+		st->nodes++;
+		st->in_subpath = true;
+		break;
+	case canvas_op_line:
+		stats_edge(st, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_quad: {
+		const struct point_d p0 = st->point;
+
+		st->area += ((cmd->p[0] - p0.x) * (cmd->p[3] - p0.y)
+			- (cmd->p[1] - p0.y) * (cmd->p[2] - p0.x)) / 3.0;
+		stats_edge(st, cmd->p[2], cmd->p[3]);
+		break;
+	}
+	case canvas_op_close:
+		stats_end_subpath(st);
+		st->point = st->start;
+		break;
+	case canvas_op_rect:
+		if (s0 && !strcmp(s0, "background")) {
+			break;
+		}
+		canvas_cmd_rect(cmd, &rect);
+		r = fmin(rect.rx, fmin(rect.width, rect.height) / 2.0);
+		st->current = stats_color(st, fill ? fill : "none");
+		st->current->paths++;
+		st->current->subpaths++;
+		st->current->area += rect.width * rect.height
+			- (4.0 - M_PI) * r * r;
+		st->current = NULL;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int stats_sink_finish(struct sink *sink)
+{
+	struct stats_sink *st = sink->data;
+	FILE *stream = sink->stream;
+	const double page_area = st->page.width * st->page.height;
+	double total = 0.0;
+	unsigned int i;
+
+	fprintf(stream, "page: %.1f x %.1f mm\n",
+		st->page.width * mm_per_unit, st->page.height * mm_per_unit);
+	fprintf(stream, "paths: %lu, subpaths: %lu, nodes: %lu\n", st->paths,
+		st->subpaths, st->nodes);
+	fprintf(stream, "%-8s %8s %9s %12s %7s\n", "color", "paths",
+		"subpaths", "area cm2", "share");
+
+	for (i = 0; i < st->color_count; i++) {
+		total += st->colors[i].area;
+	}
+	for (i = 0; i < st->color_count; i++) {
+		const struct stats_color *c = &st->colors[i];
+
+		fprintf(stream, "%-8s %8lu %9lu %12.1f %6.1f%%\n", c->color,
+			c->paths, c->subpaths,
+			c->area * mm_per_unit * mm_per_unit / 100.0,
+			total > 0.0 ? 100.0 * c->area / total : 0.0);
+	}
+	fprintf(stream, "painted: %.1f%% of the page\n",
+		page_area > 0.0 ? 100.0 * total / page_area : 0.0);
+
+	if (st->colors) {
+		mem_free(st->colors);
+	}
+	mem_free(st);
+	return 0;
+}
+
+static const struct sink_ops stats_sink_ops = {
+	.symbols = false,
+	.cmd = stats_sink_cmd,
+	.finish = stats_sink_finish,
+};
+
+struct sink *sink_stats_new(FILE *stream)
+{
+	return sink_new(&stats_sink_ops, stream, mem_alloc(
+		sizeof(struct stats_sink)));
+}
+
+/*
+ * .mdgeom geometry, see mdgeom.h.  The background rect goes in the
+ * header, other rects are paths of their outline.
+ */
+
+struct mdgeom_sink {
+	struct mdgeom_writer *mw;
+	struct ring_set outline;
+};
+
+static int mdgeom_sink_palette(struct mdgeom_writer *mw, const char *palette)
+{
+	char color[hex_color_len];
+
+	while (palette && *palette) {
+		size_t len = strcspn(palette, " ");
+
+		snprintf(color, sizeof(color), "%.*s", (int)len, palette);
+		if (len >= sizeof(color) || mdgeom_add_palette(mw, color)) {
+			return -1;
+		}
+		palette += len + (palette[len] == ' ');
+	}
+	return 0;
+}
+
+static int mdgeom_sink_rect(struct mdgeom_sink *ms, const char *id,
+	const char *fill, const struct svg_rect *rect)
+{
+	struct ring *ring;
+	unsigned int i;
+
+	if (id && !strcmp(id, "background")) {
+		return mdgeom_set_background(ms->mw, fill, rect);
+	}
+
+	if (mdgeom_open_path(ms->mw, id, fill)) {
+		return -1;
+	}
+	ring = ms->outline.count ? ms->outline.rings
+		: ring_set_add(&ms->outline);
+	canvas_rect_outline(rect, ring);
+	mdgeom_move_to(ms->mw, ring->points[0].x, ring->points[0].y);
+	for (i = 1; i < ring->count; i++) {
+		mdgeom_line_to(ms->mw, ring->points[i].x, ring->points[i].y);
+	}
+	mdgeom_close_subpath(ms->mw);
+	return 0;
+}
+
+static int mdgeom_sink_cmd(struct sink *sink, const struct canvas_batch *batch,
+	const struct canvas_cmd *cmd)
+{
+	struct mdgeom_sink *ms = sink->data;
+	struct mdgeom_writer *mw = ms->mw;
+	const char *s0 = canvas_str(batch, cmd->str[0]);
+	struct svg_rect rect;
+
+	if (cmd->flags & canvas_flag_draft) {
+		mdgeom_set_flags(mw, mdgeom_flag_draft);
+	}
+
+	switch (cmd->op) {
+	case canvas_op_open:
+		canvas_cmd_rect(cmd, &rect);
+		mdgeom_set_page(mw, &rect);
+		break;
+	case canvas_op_info:
+		mdgeom_set_params(mw, s0 ? s0 : "", (unsigned int)cmd->p[0]);
+		return mdgeom_sink_palette(mw, canvas_str(batch, cmd->str[1]));
+	case canvas_op_path:
+		return mdgeom_open_path(mw, s0, canvas_str(batch, cmd->str[1]));
+	case canvas_op_move:
+		mdgeom_move_to(mw, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_line:
+		mdgeom_line_to(mw, cmd->p[0], cmd->p[1]);
+		break;
+	case canvas_op_quad:
+		mdgeom_quad_to(mw, cmd->p[0], cmd->p[1], cmd->p[2], cmd->p[3]);
+		break;
+	case canvas_op_close:
+		mdgeom_close_subpath(mw);
+		break;
+	case canvas_op_rect:
+		canvas_cmd_rect(cmd, &rect);
+		return mdgeom_sink_rect(ms, s0, canvas_str(batch, cmd->str[1]),
+			&rect);
+	case canvas_op_tile:
+		mdgeom_set_flags(mw, mdgeom_flag_tile);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int mdgeom_sink_finish(struct sink *sink)
+{
+	struct mdgeom_sink *ms = sink->data;
+	int result = mdgeom_writer_write(ms->mw, sink->stream);
+
+	mdgeom_writer_free(ms->mw);
+	ring_set_free(&ms->outline);
+	mem_free(ms);
+	return result;
+}
+
+static const struct sink_ops mdgeom_sink_ops = {
+	.symbols = false,
+	.cmd = mdgeom_sink_cmd,
+	.finish = mdgeom_sink_finish,
+};
+
+struct sink *sink_mdgeom_new(FILE *stream)
+{
+	struct mdgeom_sink *ms = mem_alloc(sizeof(*ms));
+
+	ms->mw = mdgeom_writer_new();
+	return sink_new(&mdgeom_sink_ops, stream, ms);
+}
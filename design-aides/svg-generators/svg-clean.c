@@ -0,0 +1,592 @@
+/*
+ *  moto-design SVG metadata cleaner.
+ */
+
+/*
+ * Native replacement for admin/clean-svg-metadata.sh.  Each file is
+ * mapped and rewritten in a single streaming pass that replaces the
+ * <cc:Work> metadata, substitutes the @@...@@ tokens and checks the
+ * XML is well-formed.  Files are processed in parallel.
+ *
+ * Unlike the script, files are not re-indented with 'xmlstarlet format';
+ * the existing layout is kept and the inserted text follows the
+ * indentation of the line it replaces.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "xml.h"
+
+static const char program_name[] = "svg-clean";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	char *author;
+	char *fdl_file;
+	char *template_file;
+	unsigned int jobs;
+	enum opt_value clean;
+	enum opt_value help;
+	enum opt_value licence;
+	enum opt_value template;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Clean svg metadata.\n"
+"Usage: %s [flags] <target> <target> ...\n"
+"Option flags:\n"
+"  -a --author <author> - author/creator/owner of work. Default: '%s'.\n"
+"  -c --clean           - Remove metadata.\n"
+"  -j --jobs <count>    - Files processed in parallel. Default: '%u'.\n"
+"  -h --help            - Show this help and exit.\n"
+"  -k --keep            - Ignored, no tmp files are used.\n"
+"  -l --licence         - Replace template licence and copyright entries.\n"
+"  -t --template        - Replace metadata with template.\n"
+"  -v --verbose         - Verbose execution.\n"
+"  -V --version         - Display the program version number.\n"
+"Environment:\n"
+"  FDL                  - Default: '%s'\n"
+"  TEMPLATE             - Default: '%s'\n"
+"  AUTHOR               - Default: '%s'\n"
+"Targets are SVG files or directories searched for '*.svg' files.\n",
+		program_name, program_name,
+		opts->author,
+		opts->jobs,
+		opts->fdl_file,
+		opts->template_file,
+		opts->author
+	);
+
+	print_bugreport();
+}
+
+static char *git_author(void)
+{
+	static const char *const keys[] = {"user.name", "user.email"};
+	char values[2][256] = {"", ""};
+	char *author;
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		char cmd[64];
+		FILE *fp;
+
+		snprintf(cmd, sizeof(cmd), "git config --get %s 2>/dev/null",
+			keys[i]);
+		fp = popen(cmd, "r");
+		if (!fp) {
+			continue;
+		}
+		if (fgets(values[i], sizeof(values[i]), fp)) {
+			values[i][strcspn(values[i], "\n")] = 0;
+		}
+		pclose(fp);
+	}
+
+	author = mem_alloc(sizeof(values) + sizeof(" <>"));
+	sprintf(author, "%s <%s>", values[0], values[1]);
+	return author;
+}
+
+static char *default_path(const char *env, const char *file)
+{
+	const char *p = getenv(env);
+
+	return str_dup(p ? p : file);
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"author",   required_argument, NULL, 'a'},
+		{"clean",    no_argument,       NULL, 'c'},
+		{"jobs",     required_argument, NULL, 'j'},
+		{"help",     no_argument,       NULL, 'h'},
+		{"keep",     no_argument,       NULL, 'k'},
+		{"licence",  no_argument,       NULL, 'l'},
+		{"template", no_argument,       NULL, 't'},
+		{"verbose",  no_argument,       NULL, 'v'},
+		{"version",  no_argument,       NULL, 'V'},
+		{ NULL,      0,                 NULL, 0},
+	};
+	static const char short_options[] = "a:cj:hkltvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.author = NULL,
+		.fdl_file = default_path("FDL",
+			"admin/fabricators-design-license.txt"),
+		.template_file = default_path("TEMPLATE",
+			"admin/work-template.rdf"),
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.clean = opt_no,
+		.help = opt_no,
+		.licence = opt_no,
+		.template = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	if (getenv("AUTHOR")) {
+		opts->author = str_dup(getenv("AUTHOR"));
+	}
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'a':
+			if (opts->author) {
+				mem_free(opts->author);
+			}
+			opts->author = str_dup(optarg);
+			break;
+		case 'c':
+			opts->clean = opt_yes;
+			break;
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'k':
+			break;
+		case 'l':
+			opts->licence = opt_yes;
+			break;
+		case 't':
+			opts->template = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	if (!opts->author) {
+		opts->author = git_author();
+	}
+
+	return 0;
+}
+
+/* Removes the whitespace between the last newline and the end. */
+static void out_trim_indent(struct out_buf *out)
+{
+	size_t len = out->len;
+
+	while (len && (out->data[len - 1] == ' '
+		|| out->data[len - 1] == '\t')) {
+		len--;
+	}
+
+	if (!len || out->data[len - 1] == '\n') {
+		out->len = len;
+	}
+}
+
+/* The whitespace at the start of the last line. */
+static size_t out_indent(const struct out_buf *out, const char **indent)
+{
+	size_t start = out->len;
+	size_t end;
+
+	while (start && out->data[start - 1] != '\n') {
+		start--;
+	}
+	for (end = start; end < out->len && (out->data[end] == ' '
+		|| out->data[end] == '\t'); end++) {
+	}
+
+	*indent = out->data + start;
+	return end - start;
+}
+
+struct clean_data {
+	const struct opts *opts;
+	struct mapped_file fdl;
+	struct mapped_file template;
+	char *author_xml;
+	struct file_list files;
+};
+
+struct clean_state {
+	const struct clean_data *cd;
+	struct out_buf out;
+	bool skip_eol;
+};
+
+static const char work_token[] = "@@work@@";
+
+static void copy_span(struct clean_state *cs, const char *p,
+	const char *end);
+
+static void write_template(struct clean_state *cs)
+{
+	const struct mapped_file *t = &cs->cd->template;
+
+	/* Like 'sed /token/r', the template replaces the whole line. */
+	out_trim_indent(&cs->out);
+	copy_span(cs, t->data, t->data + t->size);
+	if (t->size && t->data[t->size - 1] != '\n') {
+		out_add(&cs->out, "\n", 1);
+	}
+	cs->skip_eol = true;
+}
+
+static void write_description(struct clean_state *cs)
+{
+	const struct mapped_file *fdl = &cs->cd->fdl;
+	const char *indent;
+	size_t indent_len;
+	char *saved;
+
+	indent_len = out_indent(&cs->out, &indent);
+	saved = mem_alloc(indent_len + 1);
+	memcpy(saved, indent, indent_len);
+
+	/* The licence text has tokens of its own, eg @@owner@@. */
+	out_add(&cs->out, "\n", 1);
+	copy_span(cs, fdl->data, fdl->data + fdl->size);
+	if (fdl->size && fdl->data[fdl->size - 1] != '\n') {
+		out_add(&cs->out, "\n", 1);
+	}
+	out_add(&cs->out, saved, indent_len);
+
+	mem_free(saved);
+}
+
+static bool substitute(struct clean_state *cs, const char *token,
+	size_t len)
+{
+	const struct opts *opts = cs->cd->opts;
+
+#define token_is(_t) (len == sizeof(_t) - 1 && !memcmp(token, _t, len))
+
+	if (opts->template == opt_yes && token_is(work_token)) {
+		write_template(cs);
+		return true;
+	}
+
+	if (opts->licence != opt_yes) {
+		return false;
+	}
+
+	if (token_is("@@description@@")) {
+		write_description(cs);
+	} else if (token_is("@@creator@@") || token_is("@@owner@@")) {
+		out_add_str(&cs->out, cs->cd->author_xml);
+	} else if (token_is("@@rights@@")) {
+		out_add_str(&cs->out, "All Rights Reserved");
+	} else if (token_is("@@licence@@")) {
+		out_add_str(&cs->out, "Fabricators Design License");
+	} else {
+		return false;
+	}
+
+#undef token_is
+
+	return true;
+}
+
+static void copy_span(struct clean_state *cs, const char *p,
+	const char *end)
+{
+	if (cs->skip_eol) {
+		const char *q = p;
+
+		while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) {
+			q++;
+		}
+		if (q == end) {
+			return;
+		}
+		cs->skip_eol = false;
+		if (*q == '\n') {
+			p = q + 1;
+		}
+	}
+
+	while (p < end) {
+		const char *t = memmem(p, end - p, "@@", 2);
+		const char *t_end;
+
+		if (!t) {
+			break;
+		}
+
+		t_end = memmem(t + 2, end - t - 2, "@@", 2);
+		if (!t_end) {
+			break;
+		}
+		t_end += 2;
+
+		out_add(&cs->out, p, t - p);
+
+		if (substitute(cs, t, t_end - t)) {
+			p = t_end;
+			if (cs->skip_eol) {
+				copy_span(cs, p, end);
+				return;
+			}
+		} else {
+			/* Not a known token, the second '@@' may start one. */
+			out_add(&cs->out, t, 2);
+			p = t + 2;
+		}
+	}
+
+	out_add(&cs->out, p, end - p);
+}
+
+static int clean_file(const struct clean_data *cd, const char *file)
+{
+	const struct opts *opts = cd->opts;
+	const bool drop_work = opts->clean == opt_yes
+		|| opts->template == opt_yes;
+	struct clean_state cs = {.cd = cd};
+	struct mapped_file mf;
+	struct xml_parser xp;
+	struct xml_token tok;
+	unsigned int skip_depth = 0;
+	int result = -1;
+
+	if (map_file(file, &mf)) {
+		return -1;
+	}
+
+	xml_parser_init(&xp, mf.data, mf.size);
+
+	while (xml_next(&xp, &tok) != xml_eof) {
+		if (tok.type == xml_error) {
+			error("Invalid XML: %s: %s\n", file, xp.error);
+			goto done;
+		}
+
+		if (skip_depth) {
+			if (tok.type == xml_start) {
+				skip_depth++;
+			} else if (tok.type == xml_end && !--skip_depth
+				&& opts->template == opt_yes) {
+				cs.skip_eol = true;
+			}
+			continue;
+		}
+
+		if (drop_work && (tok.type == xml_start
+			|| tok.type == xml_empty)
+			&& xml_name_is(&tok, "cc:Work")) {
+			if (opts->template == opt_yes) {
+				write_template(&cs);
+				cs.skip_eol = false;
+			} else {
+				out_add_str(&cs.out, work_token);
+			}
+			if (tok.type == xml_start) {
+				skip_depth = 1;
+			} else if (opts->template == opt_yes) {
+				cs.skip_eol = true;
+			}
+			continue;
+		}
+
+		copy_span(&cs, tok.start, tok.end);
+	}
+
+	if (cs.out.len == mf.size && !memcmp(cs.out.data, mf.data, mf.size)) {
+		log("%s: unchanged\n", file);
+		result = 0;
+	} else {
+		log("%s: %lu => %lu bytes\n", file, (unsigned long)mf.size,
+			(unsigned long)cs.out.len);
+		result = replace_file(file, cs.out.data, cs.out.len);
+	}
+
+done:
+	xml_parser_free(&xp);
+	unmap_file(&mf);
+	out_free(&cs.out);
+	return result;
+}
+
+static int clean_job(void *cb_data, unsigned int index)
+{
+	const struct clean_data *cd = cb_data;
+
+	return clean_file(cd, cd->files.names[index]);
+}
+
+static int check_xml(const char *file, const struct mapped_file *mf)
+{
+	struct xml_parser xp;
+	struct xml_token tok;
+	int result = 0;
+
+	xml_parser_init(&xp, mf->data, mf->size);
+
+	while (xml_next(&xp, &tok) != xml_eof) {
+		if (tok.type == xml_error) {
+			error("Invalid XML: %s: %s\n", file, xp.error);
+			result = -1;
+			break;
+		}
+	}
+
+	xml_parser_free(&xp);
+	return result;
+}
+
+/* Is p the start of an entity or character reference. */
+static bool is_reference(const char *p)
+{
+	size_t len = strspn(p + 1, "#abcdefghijklmnopqrstuvwxyz"
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+
+	return len && p[1 + len] == ';';
+}
+
+/* Escapes markup, leaving any references already in the string. */
+static char *xml_escape(const char *s)
+{
+	struct out_buf out = {0};
+
+	for (; *s; s++) {
+		if (*s == '<') {
+			out_add_str(&out, "&lt;");
+		} else if (*s == '>') {
+			out_add_str(&out, "&gt;");
+		} else if (*s == '&' && !is_reference(s)) {
+			out_add_str(&out, "&amp;");
+		} else {
+			out_add(&out, s, 1);
+		}
+	}
+	out_add(&out, "", 1);
+
+	return out.data;
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct clean_data cd = {.opts = &opts};
+	unsigned int failed_count;
+	int result = EXIT_FAILURE;
+
+	if (opts_parse(&opts, argc, argv)) {
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return EXIT_SUCCESS;
+	}
+
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+
+	set_verbose(opts.verbose == opt_yes);
+
+	if (opts.clean != opt_yes && opts.template != opt_yes
+		&& opts.licence != opt_yes) {
+		error("No options specified.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (optind == argc) {
+		error("No targets specified.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.template == opt_yes) {
+		if (map_file(opts.template_file, &cd.template)
+			|| check_xml(opts.template_file, &cd.template)) {
+			error("Bad TEMPLATE: %s.\n", opts.template_file);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opts.licence == opt_yes) {
+		if (map_file(opts.fdl_file, &cd.fdl)) {
+			error("Bad FDL: %s.\n", opts.fdl_file);
+			return EXIT_FAILURE;
+		}
+	}
+
+	cd.author_xml = xml_escape(opts.author);
+
+	if (file_list_add_targets(&cd.files, argv + optind, argc - optind,
+		".svg")) {
+		goto done;
+	}
+
+	failed_count = run_jobs(opts.jobs, cd.files.count, clean_job, &cd);
+
+	if (failed_count) {
+		error("%u of %u files failed.\n", failed_count, cd.files.count);
+	} else {
+		result = EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "%s: Done, %s.\n", program_name,
+		(result == EXIT_SUCCESS) ? "success" : "failed");
+
+done:
+	file_list_free(&cd.files);
+	mem_free(cd.author_xml);
+	unmap_file(&cd.template);
+	unmap_file(&cd.fdl);
+	return result;
+}
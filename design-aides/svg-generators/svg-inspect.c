@@ -0,0 +1,785 @@
+/*
+ *  moto-design SVG inspector.
+ */
+
+/*
+ * Reports what an SVG holds as JSON: element counts, path and node
+ * counts, path length, painted bounding box and the area, length and box
+ * of each fill.  Each file is mapped and read in one streaming pass, the
+ * XML and the path data are tokenized in place and the path segments
+ * measured as they are read, so memory only grows with the nesting depth
+ * and the number of distinct element names and fills.  Files are
+ * processed in parallel.
+ *
+ * Geometry is in the root's user units, group and path transforms
+ * applied.  Curves are measured exactly for area and box, arcs as the
+ * cubics they are split into, and to the length tolerance for length.
+ * Areas are per subpath, so holes and overlaps are not subtracted, as in
+ * blob-generator --stats.  Paths in defs, symbols, patterns, masks,
+ * markers and clip paths are counted but not painted, and <use> is not
+ * followed.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "xml.h"
+#include "walk.h"
+
+static const char program_name[] = "svg-inspect";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	char *output_file;
+	float tolerance;
+	unsigned int jobs;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Report SVG element, path and fill metrics as JSON.\n"
+"Usage: %s [flags] <target> <target> ...\n"
+"Option flags:\n"
+"  -j --jobs <count>       - Files processed in parallel. Default: '%u'.\n"
+"  -o --output-file <file> - Output file. Default: '%s'.\n"
+"  -t --tolerance <units>  - Curve length tolerance. Default: '%f'.\n"
+"  -h --help               - Show this help and exit.\n"
+"  -v --verbose            - Verbose execution.\n"
+"  -V --version            - Display the program version number.\n"
+"Targets are SVG files or directories searched for '*.svg' files.  Each\n"
+"file's report is a JSON object on a line of its own.\n",
+		program_name, program_name,
+		opts->jobs,
+		opts->output_file,
+		opts->tolerance
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"jobs",        required_argument, NULL, 'j'},
+		{"output-file", required_argument, NULL, 'o'},
+		{"tolerance",   required_argument, NULL, 't'},
+		{"help",        no_argument,       NULL, 'h'},
+		{"verbose",     no_argument,       NULL, 'v'},
+		{"version",     no_argument,       NULL, 'V'},
+		{ NULL,         0,                 NULL, 0},
+	};
+	static const char short_options[] = "j:o:t:hvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.output_file = "-",
+		.tolerance = 0.01,
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'o':
+			opts->output_file = optarg;
+			break;
+		case 't':
+			opts->tolerance = to_float(optarg);
+			if (!(opts->tolerance > 0.0)) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+struct box {
+	double x_min;
+	double y_min;
+	double x_max;
+	double y_max;
+};
+
+static void box_init(struct box *box)
+{
+	box->x_min = box->y_min = HUGE_VAL;
+	box->x_max = box->y_max = -HUGE_VAL;
+}
+
+static void box_add(struct box *box, double x, double y)
+{
+	box->x_min = fmin(box->x_min, x);
+	box->y_min = fmin(box->y_min, y);
+	box->x_max = fmax(box->x_max, x);
+	box->y_max = fmax(box->y_max, y);
+}
+
+static void box_merge(struct box *box, const struct box *other)
+{
+	if (other->x_min <= other->x_max) {
+		box_add(box, other->x_min, other->y_min);
+		box_add(box, other->x_max, other->y_max);
+	}
+}
+
+/*
+ * Counts by name, the names point into the mapped file.  An open
+ * addressing index over the tallies, which stay in first seen order.
+ */
+struct tally {
+	const char *name;
+	unsigned int name_len;
+	unsigned long count;
+	unsigned long nodes;
+	double area;
+	double length;
+	struct box box;
+};
+
+struct tally_table {
+	struct tally *items;
+	unsigned int count;
+	unsigned int alloc;
+	unsigned int *slots;
+	unsigned int slot_count;
+};
+
+static uint32_t name_hash(const char *name, unsigned int len)
+{
+	uint32_t hash = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void tally_rehash(struct tally_table *t)
+{
+	unsigned int i;
+
+	if (t->slots) {
+		mem_free(t->slots);
+	}
+	t->slot_count = t->slot_count ? 2 * t->slot_count : 64;
+	t->slots = mem_alloc(t->slot_count * sizeof(*t->slots));
+
+	/* Slots hold the item index plus one, zero is empty. */
+	for (i = 0; i < t->count; i++) {
+		uint32_t s = name_hash(t->items[i].name, t->items[i].name_len);
+
+		while (t->slots[s & (t->slot_count - 1)]) {
+			s++;
+		}
+		t->slots[s & (t->slot_count - 1)] = i + 1;
+	}
+}
+
+static struct tally *tally_get(struct tally_table *t, const char *name,
+	unsigned int len)
+{
+	uint32_t s = name_hash(name, len);
+	struct tally *item;
+
+	if (2 * (t->count + 1) > t->slot_count) {
+		tally_rehash(t);
+	}
+
+	for (;; s++) {
+		unsigned int slot = t->slots[s & (t->slot_count - 1)];
+
+		if (!slot) {
+			break;
+		}
+		item = &t->items[slot - 1];
+		if (item->name_len == len && !memcmp(item->name, name, len)) {
+			return item;
+		}
+	}
+
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? 2 * t->alloc : 16;
+		t->items = mem_realloc(t->items, t->alloc * sizeof(*t->items));
+	}
+	t->slots[s & (t->slot_count - 1)] = t->count + 1;
+
+	item = &t->items[t->count++];
+	memset(item, 0, sizeof(*item));
+	item->name = name;
+	item->name_len = len;
+	box_init(&item->box);
+	return item;
+}
+
+static void tally_free(struct tally_table *t)
+{
+	if (t->items) {
+		mem_free(t->items);
+	}
+	if (t->slots) {
+		mem_free(t->slots);
+	}
+}
+
+/* Paths by node count, bucket n is 2^n to 2^(n+1) - 1 nodes, 0 in 0. */
+#define node_buckets 32U
+
+struct inspect {
+	const struct opts *opts;
+	const char *file;
+	struct tally_table elements;
+	struct tally_table fills;
+	unsigned long paths;
+	unsigned long subpaths;
+	unsigned long nodes;
+	unsigned long nodes_min;
+	unsigned long nodes_max;
+	unsigned long node_hist[node_buckets];
+	double length;
+	struct box box;
+};
+
+struct path_measure {
+	unsigned long nodes;
+	unsigned long subpaths;
+	double area;
+	double length;
+	struct box box;
+};
+
+static double cross(const struct point_d *a, const struct point_d *b)
+{
+	return a->x * b->y - b->x * a->y;
+}
+
+/*
+ * Cubic length by subdivision, the mean of the chord and the control
+ * polygon converges with the fourth power of the step.
+ */
+static double cubic_length(const struct point_d *p, double tolerance,
+	unsigned int depth)
+{
+	double chord = hypot(p[3].x - p[0].x, p[3].y - p[0].y);
+	double poly = hypot(p[1].x - p[0].x, p[1].y - p[0].y)
+		+ hypot(p[2].x - p[1].x, p[2].y - p[1].y)
+		+ hypot(p[3].x - p[2].x, p[3].y - p[2].y);
+	struct point_d l[4];
+	struct point_d r[4];
+	struct point_d m;
+
+	if (depth >= 16 || poly - chord <= tolerance) {
+		return (chord + poly) / 2.0;
+	}
+
+	m.x = (p[1].x + p[2].x) / 2;
+	m.y = (p[1].y + p[2].y) / 2;
+	l[0] = p[0];
+	l[1].x = (p[0].x + p[1].x) / 2;
+	l[1].y = (p[0].y + p[1].y) / 2;
+	l[2].x = (l[1].x + m.x) / 2;
+	l[2].y = (l[1].y + m.y) / 2;
+	r[3] = p[3];
+	r[2].x = (p[2].x + p[3].x) / 2;
+	r[2].y = (p[2].y + p[3].y) / 2;
+	r[1].x = (m.x + r[2].x) / 2;
+	r[1].y = (m.y + r[2].y) / 2;
+	l[3].x = r[0].x = (l[2].x + r[1].x) / 2;
+	l[3].y = r[0].y = (l[2].y + r[1].y) / 2;
+
+	return cubic_length(l, tolerance, depth + 1)
+		+ cubic_length(r, tolerance, depth + 1);
+}
+
+/* Adds the cubic's extremes in one axis, the roots of its derivative. */
+static void cubic_extremes(const double *v, double *lo, double *hi)
+{
+	double a = -v[0] + 3 * v[1] - 3 * v[2] + v[3];
+	double b = 2 * (v[0] - 2 * v[1] + v[2]);
+	double c = v[1] - v[0];
+	double t[2];
+	unsigned int n = 0;
+	unsigned int i;
+
+	if (fabs(a) < 1e-12) {
+		if (fabs(b) > 1e-12) {
+			t[n++] = -c / b;
+		}
+	} else {
+		double d = b * b - 4 * a * c;
+
+		if (d >= 0) {
+			d = sqrt(d);
+			t[n++] = (-b + d) / (2 * a);
+			t[n++] = (-b - d) / (2 * a);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		double s = 1 - t[i];
+		double x;
+
+		if (!(t[i] > 0 && t[i] < 1)) {
+			continue;
+		}
+		x = s * s * s * v[0] + 3 * s * s * t[i] * v[1]
+			+ 3 * s * t[i] * t[i] * v[2] + t[i] * t[i] * t[i] * v[3];
+		*lo = fmin(*lo, x);
+		*hi = fmax(*hi, x);
+	}
+}
+
+static void measure_cubic(struct path_measure *pm, const struct point_d *p,
+	double tolerance, double *area)
+{
+	double x[4] = {p[0].x, p[1].x, p[2].x, p[3].x};
+	double y[4] = {p[0].y, p[1].y, p[2].y, p[3].y};
+
+	/* Green's theorem over the cubic, exact. */
+	*area += (6 * cross(&p[0], &p[1]) + 3 * cross(&p[0], &p[2])
+		+ cross(&p[0], &p[3]) + 3 * cross(&p[1], &p[2])
+		+ 3 * cross(&p[1], &p[3]) + 6 * cross(&p[2], &p[3])) / 20.0;
+
+	pm->length += cubic_length(p, tolerance, 0);
+
+	box_add(&pm->box, p[3].x, p[3].y);
+	cubic_extremes(x, &pm->box.x_min, &pm->box.x_max);
+	cubic_extremes(y, &pm->box.y_min, &pm->box.y_max);
+}
+
+static int measure_path(const char *d, const char *end,
+	const struct affine *ctm, double tolerance, struct path_measure *pm)
+{
+	struct path_reader pr;
+	struct path_segment seg;
+	enum path_seg_type type;
+	struct point_d from = {0.0, 0.0};
+	struct point_d start = {0.0, 0.0};
+	bool open = false;
+	double area = 0.0;
+
+	*pm = (struct path_measure){0};
+	box_init(&pm->box);
+
+	path_reader_init(&pr, d, end);
+
+	while ((type = path_read(&pr, &seg)) > path_seg_error) {
+		struct point_d p[4];
+
+		affine_apply(ctm, seg.to.x, seg.to.y, &p[3]);
+
+		/* Fill closes open subpaths. */
+		if (open && type == path_seg_move) {
+			pm->area += fabs(area + cross(&from, &start) / 2.0);
+			open = false;
+		}
+		/* Drawing after a close starts at the subpath start. */
+		if (!open && type != path_seg_close) {
+			if (type == path_seg_move) {
+				from = p[3];
+			}
+			start = from;
+			area = 0.0;
+			open = true;
+			pm->subpaths++;
+			box_add(&pm->box, from.x, from.y);
+		}
+
+		switch (type) {
+		case path_seg_line:
+			area += cross(&from, &p[3]) / 2.0;
+			pm->length += hypot(p[3].x - from.x, p[3].y - from.y);
+			box_add(&pm->box, p[3].x, p[3].y);
+			break;
+		case path_seg_cubic:
+			p[0] = from;
+			affine_apply(ctm, seg.c1.x, seg.c1.y, &p[1]);
+			affine_apply(ctm, seg.c2.x, seg.c2.y, &p[2]);
+			measure_cubic(pm, p, tolerance, &area);
+			break;
+		case path_seg_close:
+			if (open) {
+				area += cross(&from, &p[3]) / 2.0;
+				pm->area += fabs(area);
+				pm->length += hypot(p[3].x - from.x,
+					p[3].y - from.y);
+				open = false;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (seg.node && type != path_seg_close) {
+			pm->nodes++;
+		}
+		from = p[3];
+	}
+
+	if (open) {
+		pm->area += fabs(area + cross(&from, &start) / 2.0);
+	}
+
+	return (type == path_seg_error) ? -1 : 0;
+}
+
+static int inspect_path(struct inspect *in, const struct svg_frame *frame,
+	const char *d, const char *d_end)
+{
+	struct path_measure pm;
+	struct tally *fill;
+	unsigned int bucket;
+
+	if (measure_path(d, d_end, &frame->ctm, in->opts->tolerance, &pm)) {
+		return -1;
+	}
+
+	in->paths++;
+	in->subpaths += pm.subpaths;
+	in->nodes += pm.nodes;
+	in->length += pm.length;
+	if (in->paths == 1 || pm.nodes < in->nodes_min) {
+		in->nodes_min = pm.nodes;
+	}
+	if (pm.nodes > in->nodes_max) {
+		in->nodes_max = pm.nodes;
+	}
+	for (bucket = 0; bucket < node_buckets - 1
+		&& pm.nodes >> (bucket + 1); bucket++) {
+	}
+	in->node_hist[bucket]++;
+
+	if (frame->hidden) {
+		return 0;
+	}
+
+	box_merge(&in->box, &pm.box);
+
+	fill = tally_get(&in->fills, frame->fill, frame->fill_len);
+	fill->count++;
+	fill->nodes += pm.nodes;
+	fill->area += pm.area;
+	fill->length += pm.length;
+	box_merge(&fill->box, &pm.box);
+	return 0;
+}
+
+/* Counts the element and measures it when it is a path. */
+static int inspect_element(struct inspect *in, const struct xml_token *tok,
+	const struct svg_frame *frame)
+{
+	struct xml_attr attr;
+
+	tally_get(&in->elements, tok->name, tok->name_len)->count++;
+
+	if (xml_name_is(tok, "path") && xml_attr_get(tok, "d", &attr)
+		&& inspect_path(in, frame, attr.value,
+			attr.value + attr.value_len)) {
+		error("Bad path data: %s:%u\n", in->file, tok->line);
+		return -1;
+	}
+	return 0;
+}
+
+static void json_string(struct out_buf *out, const char *s, unsigned int len)
+{
+	unsigned int i;
+
+	out_add(out, "\"", 1);
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\') {
+			out_printf(out, "\\%c", c);
+		} else if (c < 0x20) {
+			out_printf(out, "\\u%04x", c);
+		} else {
+			out_add(out, s + i, 1);
+		}
+	}
+	out_add(out, "\"", 1);
+}
+
+static void json_number(struct out_buf *out, double value)
+{
+	if (isfinite(value)) {
+		out_add_number(out, value, 3);
+	} else {
+		out_add_str(out, "null");
+	}
+}
+
+static void json_box(struct out_buf *out, const struct box *box)
+{
+	if (!(box->x_min <= box->x_max)) {
+		out_add_str(out, "null");
+		return;
+	}
+	out_add(out, "[", 1);
+	json_number(out, box->x_min);
+	out_add(out, ",", 1);
+	json_number(out, box->y_min);
+	out_add(out, ",", 1);
+	json_number(out, box->x_max);
+	out_add(out, ",", 1);
+	json_number(out, box->y_max);
+	out_add(out, "]", 1);
+}
+
+static void write_report(const struct inspect *in, const char *file,
+	size_t bytes, struct out_buf *out)
+{
+	unsigned int buckets = node_buckets;
+	unsigned int i;
+
+	while (buckets && !in->node_hist[buckets - 1]) {
+		buckets--;
+	}
+
+	out_add_str(out, "{\"file\":");
+	json_string(out, file, strlen(file));
+	out_printf(out, ",\"bytes\":%lu,\"elements\":{", (unsigned long)bytes);
+	for (i = 0; i < in->elements.count; i++) {
+		const struct tally *t = &in->elements.items[i];
+
+		out_add_str(out, i ? "," : "");
+		json_string(out, t->name, t->name_len);
+		out_printf(out, ":%lu", t->count);
+	}
+
+	out_printf(out, "},\"paths\":%lu,\"subpaths\":%lu,\"nodes\":%lu,"
+		"\"nodes_min\":%lu,\"nodes_max\":%lu,\"nodes_log2\":[",
+		in->paths, in->subpaths, in->nodes, in->nodes_min,
+		in->nodes_max);
+	for (i = 0; i < buckets; i++) {
+		out_printf(out, "%s%lu", i ? "," : "", in->node_hist[i]);
+	}
+	out_add_str(out, "],\"length\":");
+	json_number(out, in->length);
+	out_add_str(out, ",\"bbox\":");
+	json_box(out, &in->box);
+
+	out_add_str(out, ",\"fills\":[");
+	for (i = 0; i < in->fills.count; i++) {
+		const struct tally *t = &in->fills.items[i];
+
+		out_add_str(out, i ? ",{\"fill\":" : "{\"fill\":");
+		json_string(out, t->name, t->name_len);
+		out_printf(out, ",\"paths\":%lu,\"nodes\":%lu,\"area\":",
+			t->count, t->nodes);
+		json_number(out, t->area);
+		out_add_str(out, ",\"length\":");
+		json_number(out, t->length);
+		out_add_str(out, ",\"bbox\":");
+		json_box(out, &t->box);
+		out_add(out, "}", 1);
+	}
+	out_add_str(out, "]}\n");
+}
+
+static int inspect_file(const struct opts *opts, const char *file,
+	struct out_buf *out)
+{
+	struct inspect in = {.opts = opts, .file = file};
+	const struct svg_frame *frame;
+	enum xml_token_type type;
+	struct mapped_file mf;
+	struct svg_walk sw;
+	struct xml_token tok;
+	struct timespec t0, t1;
+	int result = -1;
+
+	if (map_file(file, &mf)) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	box_init(&in.box);
+	svg_walk_init(&sw, mf.data, mf.size);
+
+	while ((type = svg_walk_next(&sw, &tok, &frame)) != xml_eof) {
+		if (type == xml_error) {
+			error("Invalid SVG: %s: %s\n", file, sw.error);
+			goto done;
+		}
+		if (inspect_element(&in, &tok, frame)) {
+			goto done;
+		}
+	}
+
+	write_report(&in, file, mf.size, out);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	log("%s: %lu bytes, %.1f MB/s\n", file, (unsigned long)mf.size,
+		mf.size / 1e6 / fmax(1e-9, (t1.tv_sec - t0.tv_sec)
+			+ (t1.tv_nsec - t0.tv_nsec) / 1e9));
+	result = 0;
+
+done:
+	svg_walk_free(&sw);
+	unmap_file(&mf);
+	tally_free(&in.elements);
+	tally_free(&in.fills);
+	return result;
+}
+
+struct inspect_data {
+	const struct opts *opts;
+	struct file_list files;
+	struct out_buf *reports;
+};
+
+static int inspect_job(void *cb_data, unsigned int index)
+{
+	const struct inspect_data *id = cb_data;
+
+	return inspect_file(id->opts, id->files.names[index],
+		&id->reports[index]);
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct inspect_data id = {.opts = &opts};
+	unsigned int failed_count;
+	unsigned int i;
+	FILE *out_stream = NULL;
+	int result = EXIT_FAILURE;
+
+	if (opts_parse(&opts, argc, argv)) {
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return EXIT_SUCCESS;
+	}
+
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+
+	set_verbose(opts.verbose == opt_yes);
+
+	if (optind == argc) {
+		error("No targets specified.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (file_list_add_targets(&id.files, argv + optind, argc - optind,
+		".svg")) {
+		goto done;
+	}
+
+	id.reports = mem_alloc((id.files.count + 1) * sizeof(*id.reports));
+
+	failed_count = run_jobs(opts.jobs, id.files.count, inspect_job, &id);
+
+	if (!strcmp(opts.output_file, "-")) {
+		out_stream = stdout;
+	} else {
+		out_stream = fopen(opts.output_file, "w");
+		if (!out_stream) {
+			error("open '%s' failed: %s\n", opts.output_file,
+				strerror(errno));
+			goto done;
+		}
+	}
+
+	/* Reports in target order, the failed files have none. */
+	for (i = 0; i < id.files.count; i++) {
+		fwrite(id.reports[i].data, 1, id.reports[i].len, out_stream);
+	}
+
+	if (out_stream != stdout ? fclose(out_stream) : fflush(out_stream)) {
+		error("write '%s' failed: %s\n", opts.output_file,
+			strerror(errno));
+		goto done;
+	}
+
+	if (failed_count) {
+		error("%u of %u files failed.\n", failed_count, id.files.count);
+	} else {
+		result = EXIT_SUCCESS;
+	}
+
+done:
+	if (id.reports) {
+		for (i = 0; i < id.files.count; i++) {
+			out_free(&id.reports[i]);
+		}
+		mem_free(id.reports);
+	}
+	file_list_free(&id.files);
+	return result;
+}
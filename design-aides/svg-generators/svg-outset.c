@@ -0,0 +1,428 @@
+/*
+ *  moto-design print area generator.
+ */
+
+/*
+ * Replaces the print area of a template with an outset of its magenta
+ * cut line, like Inkscape's outset done by hand as described in
+ * templates/README.md.  The shapes in the 'print' layer that make the
+ * print area are replaced by a single path, other shapes in the layer
+ * like white text are kept.  Templates without a print layer get one.
+ * Holes in the outset are filled, they come from cut lines drawn as
+ * separate open halves.  Files are processed in parallel.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "offset.h"
+#include "template.h"
+
+static const char program_name[] = "svg-outset";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	float distance;
+	float tolerance;
+	unsigned int jobs;
+	enum opt_value dry_run;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static const char default_style[] = "fill:#ffffff;fill-opacity:1;stroke:none";
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Generate template print areas from cut lines.\n"
+"Usage: %s [flags] <target> <target> ...\n"
+"Option flags:\n"
+"  -d --distance <mm>  - Print area distance beyond the cut line. Default: '%f'.\n"
+"  -t --tolerance <mm> - Curve flattening tolerance. Default: '%f'.\n"
+"  -j --jobs <count>   - Files processed in parallel. Default: '%u'.\n"
+"  -n --dry-run        - Report the print areas, don't write files.\n"
+"  -h --help           - Show this help and exit.\n"
+"  -v --verbose        - Verbose execution.\n"
+"  -V --version        - Display the program version number.\n"
+"Targets are SVG files or directories searched for '*.svg' files.\n",
+		program_name, program_name,
+		opts->distance,
+		opts->tolerance,
+		opts->jobs
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"distance",  required_argument, NULL, 'd'},
+		{"tolerance", required_argument, NULL, 't'},
+		{"jobs",      required_argument, NULL, 'j'},
+		{"dry-run",   no_argument,       NULL, 'n'},
+		{"help",      no_argument,       NULL, 'h'},
+		{"verbose",   no_argument,       NULL, 'v'},
+		{"version",   no_argument,       NULL, 'V'},
+		{ NULL,       0,                 NULL, 0},
+	};
+	static const char short_options[] = "d:t:j:nhvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.distance = 5.0,
+		.tolerance = 0.01,
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.dry_run = opt_no,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'd':
+			opts->distance = to_float(optarg);
+			if (opts->distance == HUGE_VALF || opts->distance <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 't':
+			opts->tolerance = to_float(optarg);
+			if (opts->tolerance == HUGE_VALF
+				|| opts->tolerance <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'n':
+			opts->dry_run = opt_yes;
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Start of the line p is on, or p if there is text before it. */
+static const char *line_start(const char *data, const char *p)
+{
+	const char *q = p;
+
+	while (q > data && (q[-1] == ' ' || q[-1] == '\t')) {
+		q--;
+	}
+	return (q == data || q[-1] == '\n') ? q : p;
+}
+
+static size_t indent_len(const char *data, const char *p)
+{
+	const char *start = line_start(data, p);
+
+	return (start == p) ? 0 : (size_t)(p - start);
+}
+
+static void write_area_path(struct out_buf *out, const struct template *tmpl,
+	const struct ring_set *rings, const struct affine *inverse,
+	float tolerance, const char *indent, size_t indent_len)
+{
+	double step = tolerance * tmpl->units_per_mm / 10;
+	int decimals = (int)ceil(-log10(step));
+	bool first = true;
+	unsigned int i;
+	unsigned int j;
+
+	decimals = (decimals < 0) ? 0 : (decimals > 9) ? 9 : decimals;
+
+	out_add(out, indent, indent_len);
+	out_add_str(out, "<path id=\"print-area\" style=\"");
+	if (tmpl->print_style) {
+		out_add(out, tmpl->print_style, tmpl->print_style_len);
+	} else {
+		out_add_str(out, default_style);
+	}
+	out_add_str(out, "\" d=\"");
+
+	for (i = 0; i < rings->count; i++) {
+		const struct ring *ring = &rings->rings[i];
+
+		if (ring_area(ring) <= 0) {
+			continue;
+		}
+
+		for (j = 0; j < ring->count; j++) {
+			struct point_d p;
+
+			affine_apply(inverse, ring->points[j].x,
+				ring->points[j].y, &p);
+			out_printf(out, "%s%.*f,%.*f", !j ? (first ? "M " : " M ")
+				: (j == 1) ? " L " : " ", decimals, p.x,
+				decimals, p.y);
+		}
+		out_add_str(out, " Z");
+		first = false;
+	}
+	out_add_str(out, "\"/>\n");
+}
+
+struct outset_data {
+	const struct opts *opts;
+	struct file_list files;
+};
+
+static int outset_file(const struct opts *opts, const char *file)
+{
+	struct template tmpl;
+	struct ring_set rings = {0};
+	struct out_buf out = {0};
+	const struct template_layer *layer = NULL;
+	struct affine inverse;
+	const char *data;
+	const char *p;
+	const char *insert;
+	size_t indent;
+	unsigned int points = 0;
+	unsigned int holes = 0;
+	unsigned int i;
+	int result = -1;
+
+	if (template_load(&tmpl, file, opts->tolerance)) {
+		return -1;
+	}
+	data = tmpl.file.data;
+
+	if (!tmpl.cut.count) {
+		warn("%s: no magenta cut line, skipping.\n", file);
+		result = 0;
+		goto done;
+	}
+
+	if (offset_rings(&tmpl.cut, opts->distance * tmpl.units_per_mm,
+		opts->tolerance * tmpl.units_per_mm, &rings)) {
+		goto done;
+	}
+
+	for (i = 0; i < rings.count; i++) {
+		if (ring_area(&rings.rings[i]) <= 0) {
+			holes++;
+		} else {
+			points += rings.rings[i].count;
+		}
+	}
+
+	/* The dry run's report. */
+	if (opts->dry_run == opt_yes) {
+		printf("%s: %u cut rings => %u print rings, %u points, "
+			"%u holes filled.\n", file, tmpl.cut.count,
+			rings.count - holes, points, holes);
+	} else {
+		log("%s: %u cut rings => %u print rings, %u points, "
+			"%u holes filled.\n", file, tmpl.cut.count,
+			rings.count - holes, points, holes);
+	}
+
+	if (rings.count == holes) {
+		error("%s: empty print area.\n", file);
+		goto done;
+	}
+
+	if (opts->dry_run == opt_yes) {
+		result = 0;
+		goto done;
+	}
+
+	if (tmpl.print_layer >= 0 && tmpl.layers[tmpl.print_layer].close) {
+		layer = &tmpl.layers[tmpl.print_layer];
+		if (!affine_invert(&inverse, &layer->ctm)) {
+			error("%s: print layer transform is singular.\n", file);
+			goto done;
+		}
+		insert = line_start(data, layer->close);
+		indent = indent_len(data, layer->tag.start) + 2;
+	} else {
+		affine_identity(&inverse);
+		insert = tmpl.layer_count ? tmpl.layers[0].tag.start
+			: tmpl.root_close;
+		if (!insert) {
+			error("%s: no place for a print layer.\n", file);
+			goto done;
+		}
+		indent = indent_len(data, insert);
+		insert = line_start(data, insert);
+	}
+
+	/* Copy, dropping the old print area shapes and their lines. */
+	p = data;
+	for (i = 0; i < tmpl.print_area_count; i++) {
+		const struct template_span *span = &tmpl.print_areas[i];
+		const char *start = line_start(data, span->start);
+		const char *end = span->end;
+
+		if (start != span->start && end < data + tmpl.file.size
+			&& *end == '\n') {
+			end++;
+		}
+		if (start < p) {
+			continue;
+		}
+		out_add(&out, p, start - p);
+		p = end;
+	}
+
+	assert(insert >= p);
+	out_add(&out, p, insert - p);
+
+	if (layer) {
+		char spaces[256];
+
+		indent = (indent < sizeof(spaces)) ? indent : sizeof(spaces) - 1;
+		memset(spaces, ' ', indent);
+		write_area_path(&out, &tmpl, &rings, &inverse, opts->tolerance,
+			spaces, indent);
+	} else {
+		char spaces[256];
+
+		indent = (indent < sizeof(spaces) - 2) ? indent
+			: sizeof(spaces) - 3;
+		memset(spaces, ' ', indent + 2);
+		out_add(&out, spaces, indent);
+		out_add_str(&out, "<g inkscape:groupmode=\"layer\" "
+			"id=\"layer-print\" inkscape:label=\"print\" "
+			"sodipodi:insensitive=\"true\">\n");
+		write_area_path(&out, &tmpl, &rings, &inverse, opts->tolerance,
+			spaces, indent + 2);
+		out_add(&out, spaces, indent);
+		out_add_str(&out, "</g>\n");
+	}
+
+	out_add(&out, insert, data + tmpl.file.size - insert);
+
+	if (out.len == tmpl.file.size && !memcmp(out.data, data, out.len)) {
+		log("%s: unchanged\n", file);
+		result = 0;
+	} else {
+		result = replace_file(file, out.data, out.len);
+	}
+
+done:
+	out_free(&out);
+	ring_set_free(&rings);
+	template_free(&tmpl);
+	return result;
+}
+
+static int outset_job(void *cb_data, unsigned int index)
+{
+	const struct outset_data *od = cb_data;
+
+	return outset_file(od->opts, od->files.names[index]);
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct outset_data od = {.opts = &opts};
+	unsigned int failed_count;
+	int result = EXIT_FAILURE;
+
+	if (opts_parse(&opts, argc, argv)) {
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return EXIT_SUCCESS;
+	}
+
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+
+	set_verbose(opts.verbose == opt_yes);
+
+	if (optind == argc) {
+		error("No targets specified.\n");
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (file_list_add_targets(&od.files, argv + optind, argc - optind,
+		".svg")) {
+		goto done;
+	}
+
+	failed_count = run_jobs(opts.jobs, od.files.count, outset_job, &od);
+
+	if (failed_count) {
+		error("%u of %u files failed.\n", failed_count, od.files.count);
+	} else {
+		result = EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "%s: Done, %s.\n", program_name,
+		(result == EXIT_SUCCESS) ? "success" : "failed");
+
+done:
+	file_list_free(&od.files);
+	return result;
+}
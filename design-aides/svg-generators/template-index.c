@@ -0,0 +1,327 @@
+/*
+ *  moto-design template indexer.
+ */
+
+/*
+ * Builds the template index read by template_part_get(), so tools that
+ * work with a part's cut line and print area don't parse its SVG on
+ * every run.  Entries that are still current are copied from the old
+ * index, only changed files are parsed.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "template.h"
+
+static const char program_name[] = "template-index";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	char *output;
+	float tolerance;
+	unsigned int jobs;
+	enum opt_value force;
+	enum opt_value list;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Build an index of template geometry.\n"
+"Usage: %s [flags] <target> <target> ...\n"
+"Option flags:\n"
+"  -o --output <file>  - Index file. Default: '%s'.\n"
+"  -t --tolerance <mm> - Curve flattening tolerance. Default: '%f'.\n"
+"  -j --jobs <count>   - Files processed in parallel. Default: '%u'.\n"
+"  -f --force          - Parse every file, ignoring the current index.\n"
+"  -l --list           - List the index entries and exit.\n"
+"  -h --help           - Show this help and exit.\n"
+"  -v --verbose        - Verbose execution.\n"
+"  -V --version        - Display the program version number.\n"
+"Targets are SVG files or directories searched for '*.svg' files.\n",
+		program_name, program_name,
+		opts->output,
+		opts->tolerance,
+		opts->jobs
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"output",    required_argument, NULL, 'o'},
+		{"tolerance", required_argument, NULL, 't'},
+		{"jobs",      required_argument, NULL, 'j'},
+		{"force",     no_argument,       NULL, 'f'},
+		{"list",      no_argument,       NULL, 'l'},
+		{"help",      no_argument,       NULL, 'h'},
+		{"verbose",   no_argument,       NULL, 'v'},
+		{"version",   no_argument,       NULL, 'V'},
+		{ NULL,       0,                 NULL, 0},
+	};
+	static const char short_options[] = "o:t:j:flhvV";
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*opts = (struct opts){
+		.output = "templates.idx",
+		.tolerance = 0.01,
+		.jobs = (cpus > 0) ? (unsigned int)cpus : 1U,
+		.force = opt_no,
+		.list = opt_no,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 'o':
+			opts->output = optarg;
+			break;
+		case 't':
+			opts->tolerance = to_float(optarg);
+			if (opts->tolerance == HUGE_VALF
+				|| opts->tolerance <= 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'j':
+			opts->jobs = to_unsigned(optarg);
+			if (opts->jobs == UINT_MAX || !opts->jobs) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'f':
+			opts->force = opt_yes;
+			break;
+		case 'l':
+			opts->list = opt_yes;
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+struct index_data {
+	const struct opts *opts;
+	struct template_index index;
+	struct file_list files;
+	struct template_part *parts;
+	bool *reused;
+};
+
+static int index_job(void *cb_data, unsigned int i)
+{
+	struct index_data *id = cb_data;
+	const char *file = id->files.names[i];
+	char *name = template_index_name(&id->index, file);
+	int entry = -1;
+	int result = 1;
+
+	if (id->opts->force != opt_yes) {
+		entry = template_index_find(&id->index, name);
+	}
+	if (entry >= 0) {
+		result = template_index_get(&id->index, entry,
+			id->opts->tolerance, &id->parts[i]);
+	}
+
+	if (!result) {
+		id->reused[i] = true;
+	} else {
+		result = template_part_load(&id->parts[i], file, name,
+			id->opts->tolerance);
+		if (!result) {
+			log("%s: %u cut rings, %u print rings, %u layers.\n",
+				name, id->parts[i].cut.count,
+				id->parts[i].print.count,
+				id->parts[i].layer_count);
+		}
+	}
+
+	mem_free(name);
+	return result;
+}
+
+static void list_index(const struct template_index *index)
+{
+	unsigned int i;
+
+	printf("tolerance %g mm, %u entries\n", index->tolerance,
+		index->count);
+
+	for (i = 0; i < index->count; i++) {
+		struct template_part part;
+		unsigned int points = 0;
+		unsigned int j;
+		int result;
+
+		result = template_index_get(index, i, index->tolerance, &part);
+
+		if (result < 0) {
+			continue;
+		}
+		if (result > 0) {
+			printf("  entry %u: out of date\n", i);
+			continue;
+		}
+
+		for (j = 0; j < part.cut.count; j++) {
+			points += part.cut.rings[j].count;
+		}
+		printf("  %s: %.1fx%.1f mm, ", part.name, part.width_mm,
+			part.height_mm);
+		if (part.box.x_min <= part.box.x_max) {
+			printf("box %.1f,%.1f %.1f,%.1f, ",
+				part.box.x_min / part.units_per_mm,
+				part.box.y_min / part.units_per_mm,
+				part.box.x_max / part.units_per_mm,
+				part.box.y_max / part.units_per_mm);
+		}
+		printf("cut %u/%u, print %u, layers", part.cut.count, points,
+			part.print.count);
+		for (j = 0; j < part.layer_count; j++) {
+			printf(" %s", part.layer_ids[j]);
+		}
+		printf("\n");
+		template_part_free(&part);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct index_data id = {.opts = &opts};
+	unsigned int failed_count;
+	unsigned int reused_count = 0;
+	unsigned int i;
+	int result = EXIT_FAILURE;
+
+	if (opts_parse(&opts, argc, argv)) {
+		print_usage(&opts);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return EXIT_SUCCESS;
+	}
+
+	if (opts.version == opt_yes) {
+		print_version();
+		return EXIT_SUCCESS;
+	}
+
+	set_verbose(opts.verbose == opt_yes);
+
+	if (template_index_open(&id.index, opts.output) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (opts.list == opt_yes) {
+		list_index(&id.index);
+		template_index_close(&id.index);
+		return EXIT_SUCCESS;
+	}
+
+	if (optind == argc) {
+		error("No targets specified.\n");
+		print_usage(&opts);
+		goto done;
+	}
+
+	if (file_list_add_targets(&id.files, argv + optind, argc - optind,
+		".svg")) {
+		goto done;
+	}
+
+	id.parts = mem_alloc((id.files.count + 1) * sizeof(*id.parts));
+	memset(id.parts, 0, (id.files.count + 1) * sizeof(*id.parts));
+	id.reused = mem_alloc((id.files.count + 1) * sizeof(*id.reused));
+	memset(id.reused, 0, (id.files.count + 1) * sizeof(*id.reused));
+
+	failed_count = run_jobs(opts.jobs, id.files.count, index_job, &id);
+
+	if (failed_count) {
+		error("%u of %u files failed.\n", failed_count, id.files.count);
+	} else if (!template_index_write(opts.output, id.parts, id.files.count,
+		opts.tolerance)) {
+		for (i = 0; i < id.files.count; i++) {
+			reused_count += id.reused[i];
+		}
+		log("%s: %u entries, %u parsed.\n", opts.output,
+			id.files.count, id.files.count - reused_count);
+		result = EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "%s: Done, %s.\n", program_name,
+		(result == EXIT_SUCCESS) ? "success" : "failed");
+
+done:
+	if (id.parts) {
+		for (i = 0; i < id.files.count; i++) {
+			template_part_free(&id.parts[i]);
+		}
+		mem_free(id.parts);
+		mem_free(id.reused);
+	}
+	file_list_free(&id.files);
+	template_index_close(&id.index);
+	return result;
+}
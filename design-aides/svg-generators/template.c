@@ -0,0 +1,1220 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "xml.h"
+#include "template.h"
+
+enum fill_kind {
+	fill_none,
+	fill_white,
+	fill_color,
+};
+
+struct frame {
+	struct affine ctm;
+	enum fill_kind fill;
+	bool magenta;
+	bool skip;
+	bool in_print;
+	int layer;
+	int area;
+};
+
+struct loader {
+	struct template *tmpl;
+	double tolerance;
+	struct frame *stack;
+	unsigned int depth;
+	unsigned int alloc;
+};
+
+static bool value_is(const char *value, unsigned int len, const char *s)
+{
+	return strlen(s) == len && !strncasecmp(value, s, len);
+}
+
+static bool style_get(const struct xml_attr *style, const char *prop,
+	const char **value, unsigned int *len)
+{
+	const char *p = style->value;
+	const char *end = style->value + style->value_len;
+	size_t prop_len = strlen(prop);
+
+	while (p < end) {
+		const char *decl_end = memchr(p, ';', end - p);
+		const char *colon;
+
+		decl_end = decl_end ? decl_end : end;
+		colon = memchr(p, ':', decl_end - p);
+
+		while (p < decl_end && (*p == ' ' || *p == '\t' || *p == '\n')) {
+			p++;
+		}
+
+		if (colon && (size_t)(colon - p) >= prop_len
+			&& !memcmp(p, prop, prop_len)) {
+			const char *q = p + prop_len;
+
+			while (q < colon && (*q == ' ' || *q == '\t')) {
+				q++;
+			}
+			if (q == colon) {
+				const char *v = colon + 1;
+				const char *v_end = decl_end;
+
+				while (v < v_end && (*v == ' ' || *v == '\t')) {
+					v++;
+				}
+				while (v_end > v && (v_end[-1] == ' '
+					|| v_end[-1] == '\t')) {
+					v_end--;
+				}
+				*value = v;
+				*len = v_end - v;
+				return true;
+			}
+		}
+		p = decl_end + 1;
+	}
+	return false;
+}
+
+/* A presentation attribute, overridden by the style attribute. */
+static bool paint_get(const struct xml_token *tok, const char *prop,
+	const char **value, unsigned int *len)
+{
+	struct xml_attr attr;
+	bool found = false;
+
+	if (xml_attr_get(tok, prop, &attr)) {
+		*value = attr.value;
+		*len = attr.value_len;
+		found = true;
+	}
+	if (xml_attr_get(tok, "style", &attr)
+		&& style_get(&attr, prop, value, len)) {
+		found = true;
+	}
+	return found;
+}
+
+static double attr_number(const struct xml_token *tok, const char *name,
+	double def)
+{
+	struct xml_attr attr;
+	const char *p;
+	double value;
+
+	if (!xml_attr_get(tok, name, &attr)) {
+		return def;
+	}
+	p = attr.value;
+	return path_number(&p, attr.value + attr.value_len, &value)
+		? value : def;
+}
+
+static double length_mm(const struct xml_attr *attr, bool *ok)
+{
+	static const struct {
+		const char *unit;
+		double mm;
+	} units[] = {
+		{"mm", 1.0},
+		{"cm", 10.0},
+		{"in", 25.4},
+		{"pt", 25.4 / 72.0},
+		{"pc", 25.4 / 6.0},
+		{"px", 25.4 / 96.0},
+		{"", 25.4 / 96.0},
+	};
+	const char *p = attr->value;
+	const char *end = attr->value + attr->value_len;
+	double value;
+	unsigned int i;
+
+	*ok = false;
+
+	if (!path_number(&p, end, &value)) {
+		return 0.0;
+	}
+
+	for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+		if (value_is(p, end - p, units[i].unit)) {
+			*ok = true;
+			return value * units[i].mm;
+		}
+	}
+	return 0.0;
+}
+
+static void load_root(struct loader *ld, const struct xml_token *tok)
+{
+	struct template *tmpl = ld->tmpl;
+	struct xml_attr attr;
+	double view[4];
+	bool have_width = false;
+	bool have_view = false;
+
+	if (xml_attr_get(tok, "width", &attr)) {
+		tmpl->width_mm = length_mm(&attr, &have_width);
+	}
+	if (xml_attr_get(tok, "height", &attr)) {
+		bool ok;
+
+		tmpl->height_mm = length_mm(&attr, &ok);
+	}
+
+	if (xml_attr_get(tok, "viewBox", &attr)) {
+		const char *p = attr.value;
+		const char *end = attr.value + attr.value_len;
+
+		have_view = path_number(&p, end, &view[0])
+			&& path_number(&p, end, &view[1])
+			&& path_number(&p, end, &view[2])
+			&& path_number(&p, end, &view[3]) && view[2] > 0.0;
+	}
+
+	if (have_view && have_width && tmpl->width_mm > 0.0) {
+		tmpl->units_per_mm = view[2] / tmpl->width_mm;
+	} else {
+		tmpl->units_per_mm = 96.0 / 25.4;
+	}
+
+	if (have_view && !have_width) {
+		tmpl->width_mm = view[2] / tmpl->units_per_mm;
+		tmpl->height_mm = view[3] / tmpl->units_per_mm;
+	}
+}
+
+static bool is_skipped(const struct xml_token *tok)
+{
+	static const char *const names[] = {
+		"defs",
+		"metadata",
+		"clipPath",
+		"mask",
+		"marker",
+		"pattern",
+		"symbol",
+		"sodipodi:namedview",
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (xml_name_is(tok, names[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int flatten_points(const struct xml_token *tok, const struct affine *ctm,
+	bool closed, struct ring_set *out)
+{
+	struct xml_attr attr;
+	struct ring *ring;
+	const char *p;
+	const char *end;
+	double x;
+	double y;
+
+	if (!xml_attr_get(tok, "points", &attr)) {
+		return -1;
+	}
+
+	ring = ring_set_add(out);
+	ring->closed = closed;
+	p = attr.value;
+	end = attr.value + attr.value_len;
+
+	while (path_number(&p, end, &x) && path_number(&p, end, &y)) {
+		struct point_d pt;
+
+		affine_apply(ctm, x, y, &pt);
+		ring_add(ring, pt.x, pt.y);
+	}
+	return 0;
+}
+
+/* Rings for a basic shape, by way of equivalent path data. */
+static int flatten_shape(const struct xml_token *tok, const struct affine *ctm,
+	double tolerance, struct ring_set *out)
+{
+	char d[512];
+	struct xml_attr attr;
+	int len;
+
+	if (xml_name_is(tok, "path")) {
+		if (!xml_attr_get(tok, "d", &attr)) {
+			return -1;
+		}
+		return path_flatten(attr.value, attr.value + attr.value_len,
+			ctm, tolerance, out);
+	}
+
+	if (xml_name_is(tok, "polygon")) {
+		return flatten_points(tok, ctm, true, out);
+	}
+	if (xml_name_is(tok, "polyline")) {
+		return flatten_points(tok, ctm, false, out);
+	}
+
+	if (xml_name_is(tok, "rect")) {
+		double x = attr_number(tok, "x", 0.0);
+		double y = attr_number(tok, "y", 0.0);
+		double w = attr_number(tok, "width", 0.0);
+		double h = attr_number(tok, "height", 0.0);
+		double rx = attr_number(tok, "rx", -1.0);
+		double ry = attr_number(tok, "ry", -1.0);
+
+		if (w <= 0.0 || h <= 0.0) {
+			return 0;
+		}
+
+		rx = (rx < 0.0) ? ry : rx;
+		ry = (ry < 0.0) ? rx : ry;
+		rx = fmin(fmax(rx, 0.0), w / 2);
+		ry = fmin(fmax(ry, 0.0), h / 2);
+
+		len = snprintf(d, sizeof(d), "M %.17g,%.17g H %.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g V %.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g H %.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g V %.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g Z",
+			x + rx, y, x + w - rx,
+			rx, ry, x + w, y + ry, y + h - ry,
+			rx, ry, x + w - rx, y + h, x + rx,
+			rx, ry, x, y + h - ry, y + ry,
+			rx, ry, x + rx, y);
+	} else if (xml_name_is(tok, "circle") || xml_name_is(tok, "ellipse")) {
+		double cx = attr_number(tok, "cx", 0.0);
+		double cy = attr_number(tok, "cy", 0.0);
+		double rx;
+		double ry;
+
+		if (xml_name_is(tok, "circle")) {
+			rx = ry = attr_number(tok, "r", 0.0);
+		} else {
+			rx = attr_number(tok, "rx", 0.0);
+			ry = attr_number(tok, "ry", 0.0);
+		}
+
+		if (rx <= 0.0 || ry <= 0.0) {
+			return 0;
+		}
+
+		len = snprintf(d, sizeof(d), "M %.17g,%.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g "
+			"A %.17g %.17g 0 0 1 %.17g,%.17g Z",
+			cx + rx, cy, rx, ry, cx - rx, cy, rx, ry, cx + rx, cy);
+	} else if (xml_name_is(tok, "line")) {
+		len = snprintf(d, sizeof(d), "M %.17g,%.17g L %.17g,%.17g",
+			attr_number(tok, "x1", 0.0), attr_number(tok, "y1", 0.0),
+			attr_number(tok, "x2", 0.0), attr_number(tok, "y2", 0.0));
+	} else {
+		return 1;
+	}
+
+	assert(len > 0 && (size_t)len < sizeof(d));
+	return path_flatten(d, d + len, ctm, tolerance, out);
+}
+
+static bool is_shape(const struct xml_token *tok)
+{
+	return xml_name_is(tok, "path") || xml_name_is(tok, "rect")
+		|| xml_name_is(tok, "circle") || xml_name_is(tok, "ellipse")
+		|| xml_name_is(tok, "line") || xml_name_is(tok, "polygon")
+		|| xml_name_is(tok, "polyline");
+}
+
+static struct frame *push_frame(struct loader *ld)
+{
+	if (ld->depth == ld->alloc) {
+		ld->alloc = ld->alloc ? 2 * ld->alloc : 32;
+		ld->stack = mem_realloc(ld->stack,
+			ld->alloc * sizeof(*ld->stack));
+	}
+
+	if (ld->depth) {
+		ld->stack[ld->depth] = ld->stack[ld->depth - 1];
+	} else {
+		memset(&ld->stack[0], 0, sizeof(ld->stack[0]));
+		affine_identity(&ld->stack[0].ctm);
+		ld->stack[0].fill = fill_color;
+	}
+	ld->stack[ld->depth].layer = -1;
+	ld->stack[ld->depth].area = -1;
+
+	return &ld->stack[ld->depth++];
+}
+
+static void add_layer(struct loader *ld, const struct xml_token *tok,
+	struct frame *f)
+{
+	struct template *tmpl = ld->tmpl;
+	struct template_layer *layer;
+	struct xml_attr attr;
+
+	tmpl->layers = mem_realloc(tmpl->layers,
+		(tmpl->layer_count + 1) * sizeof(*tmpl->layers));
+	layer = &tmpl->layers[tmpl->layer_count];
+	memset(layer, 0, sizeof(*layer));
+
+	if (xml_attr_get(tok, "id", &attr)) {
+		layer->id = attr.value;
+		layer->id_len = attr.value_len;
+	}
+	if (xml_attr_get(tok, "inkscape:label", &attr)) {
+		layer->label = attr.value;
+		layer->label_len = attr.value_len;
+	}
+	layer->tag.start = tok->start;
+	layer->tag.end = tok->end;
+	layer->close = tok->end;
+	layer->ctm = f->ctm;
+
+	f->layer = tmpl->layer_count;
+
+	if (tmpl->print_layer < 0 && layer->label
+		&& value_is(layer->label, layer->label_len, "print")) {
+		tmpl->print_layer = tmpl->layer_count;
+		f->in_print = true;
+	}
+	if (tmpl->cut_layer < 0 && layer->label
+		&& value_is(layer->label, layer->label_len, "cut")) {
+		tmpl->cut_layer = tmpl->layer_count;
+	}
+
+	tmpl->layer_count++;
+}
+
+static void add_print_area(struct loader *ld, const struct xml_token *tok,
+	struct frame *f)
+{
+	struct template *tmpl = ld->tmpl;
+	struct xml_attr attr;
+
+	tmpl->print_areas = mem_realloc(tmpl->print_areas,
+		(tmpl->print_area_count + 1) * sizeof(*tmpl->print_areas));
+	tmpl->print_areas[tmpl->print_area_count].start = tok->start;
+	tmpl->print_areas[tmpl->print_area_count].end = tok->end;
+
+	if (!tmpl->print_style && xml_attr_get(tok, "style", &attr)) {
+		tmpl->print_style = attr.value;
+		tmpl->print_style_len = attr.value_len;
+	}
+
+	if (tok->type == xml_start) {
+		f->area = tmpl->print_area_count;
+	}
+	tmpl->print_area_count++;
+}
+
+static int load_element(struct loader *ld, const struct xml_token *tok)
+{
+	struct template *tmpl = ld->tmpl;
+	struct frame *f = push_frame(ld);
+	struct xml_attr attr;
+	const char *value;
+	unsigned int len;
+
+	if (ld->depth == 1) {
+		if (!xml_name_is(tok, "svg")) {
+			error("root element is not svg\n");
+			return -1;
+		}
+		load_root(ld, tok);
+		return 0;
+	}
+
+	if (f->skip || is_skipped(tok)) {
+		f->skip = true;
+		return 0;
+	}
+
+	if (paint_get(tok, "display", &value, &len)
+		&& value_is(value, len, "none")) {
+		f->skip = true;
+		return 0;
+	}
+
+	if (xml_attr_get(tok, "transform", &attr)) {
+		struct affine t;
+
+		if (affine_parse(&t, attr.value,
+			attr.value + attr.value_len)) {
+			warn("line %u: bad transform '%.*s'\n", tok->line,
+				attr.value_len, attr.value);
+		} else {
+			affine_multiply(&f->ctm, &f->ctm, &t);
+		}
+	}
+
+	if (paint_get(tok, "stroke", &value, &len)) {
+		f->magenta = value_is(value, len, "#ff00ff")
+			|| value_is(value, len, "#f0f")
+			|| value_is(value, len, "magenta");
+	}
+	if (paint_get(tok, "fill", &value, &len)) {
+		if (value_is(value, len, "none")) {
+			f->fill = fill_none;
+		} else if (value_is(value, len, "#ffffff")
+			|| value_is(value, len, "#fff")
+			|| value_is(value, len, "white")) {
+			f->fill = fill_white;
+		} else {
+			f->fill = fill_color;
+		}
+	}
+
+	if (ld->depth == 2 && xml_name_is(tok, "g")
+		&& xml_attr_get(tok, "inkscape:groupmode", &attr)
+		&& value_is(attr.value, attr.value_len, "layer")) {
+		add_layer(ld, tok, f);
+		return 0;
+	}
+
+	if (!is_shape(tok)) {
+		return 0;
+	}
+
+	if (f->in_print) {
+		if (f->fill != fill_color) {
+			return 0;
+		}
+		add_print_area(ld, tok, f);
+		if (flatten_shape(tok, &f->ctm, ld->tolerance, &tmpl->print)
+			< 0) {
+			warn("line %u: bad print shape\n", tok->line);
+		}
+	} else if (f->magenta) {
+		if (flatten_shape(tok, &f->ctm, ld->tolerance, &tmpl->cut)
+			< 0) {
+			warn("line %u: bad cut shape\n", tok->line);
+		}
+	}
+
+	return 0;
+}
+
+static void close_element(struct loader *ld, const struct xml_token *tok)
+{
+	struct template *tmpl = ld->tmpl;
+	struct frame *f;
+
+	assert(ld->depth);
+	f = &ld->stack[--ld->depth];
+
+	if (f->layer >= 0) {
+		tmpl->layers[f->layer].close = (tok->type == xml_end)
+			? tok->start : NULL;
+	}
+	if (f->area >= 0) {
+		tmpl->print_areas[f->area].end = tok->end;
+	}
+	if (!ld->depth) {
+		tmpl->root_close = tok->start;
+	}
+}
+
+int template_load(struct template *tmpl, const char *path, double tolerance)
+{
+	struct loader ld;
+	struct xml_parser xp;
+	struct xml_token tok;
+	int result = 0;
+
+	memset(tmpl, 0, sizeof(*tmpl));
+	tmpl->print_layer = -1;
+	tmpl->cut_layer = -1;
+
+	if (map_file(path, &tmpl->file)) {
+		return -1;
+	}
+
+	memset(&ld, 0, sizeof(ld));
+	ld.tmpl = tmpl;
+	xml_parser_init(&xp, tmpl->file.data, tmpl->file.size);
+
+	while (!result && xml_next(&xp, &tok) != xml_eof) {
+		switch (tok.type) {
+		case xml_error:
+			error("%s: %s\n", path, xp.error);
+			result = -1;
+			break;
+		case xml_start:
+		case xml_empty:
+			result = load_element(&ld, &tok);
+			if (ld.depth == 1) {
+				/* The root has set the user unit scale. */
+				ld.tolerance = tolerance * tmpl->units_per_mm;
+			}
+			if (tok.type == xml_empty) {
+				close_element(&ld, &tok);
+			}
+			break;
+		case xml_end:
+			close_element(&ld, &tok);
+			break;
+		default:
+			break;
+		}
+	}
+
+	xml_parser_free(&xp);
+	if (ld.stack) {
+		mem_free(ld.stack);
+	}
+
+	if (result) {
+		template_free(tmpl);
+	}
+	return result;
+}
+
+void template_free(struct template *tmpl)
+{
+	ring_set_free(&tmpl->cut);
+	ring_set_free(&tmpl->print);
+	if (tmpl->layers) {
+		mem_free(tmpl->layers);
+	}
+	if (tmpl->print_areas) {
+		mem_free(tmpl->print_areas);
+	}
+	unmap_file(&tmpl->file);
+	memset(tmpl, 0, sizeof(*tmpl));
+	tmpl->print_layer = -1;
+	tmpl->cut_layer = -1;
+}
+
+static uint64_t hash_data(const char *data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static char *str_ndup(const char *s, unsigned int len)
+{
+	char *p = mem_alloc(len + 1);
+
+	memcpy(p, s, len);
+	p[len] = 0;
+	return p;
+}
+
+static void part_bbox(struct template_part *part)
+{
+	struct bbox print_box;
+	struct point_c p;
+
+	ring_set_bbox(&part->cut, &part->box);
+	ring_set_bbox(&part->print, &print_box);
+
+	if (print_box.x_min <= print_box.x_max) {
+		p.x = print_box.x_min;
+		p.y = print_box.y_min;
+		bbox_add(&part->box, &p);
+		p.x = print_box.x_max;
+		p.y = print_box.y_max;
+		bbox_add(&part->box, &p);
+	}
+}
+
+int template_part_load(struct template_part *part, const char *path,
+	const char *name, double tolerance)
+{
+	struct template tmpl;
+	struct stat st;
+	unsigned int i;
+
+	memset(part, 0, sizeof(*part));
+
+	if (stat(path, &st)) {
+		error("stat '%s' failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (template_load(&tmpl, path, tolerance)) {
+		return -1;
+	}
+
+	part->name = str_dup(name ? name : path);
+	part->stamp.size = st.st_size;
+	part->stamp.mtime_sec = st.st_mtim.tv_sec;
+	part->stamp.mtime_nsec = st.st_mtim.tv_nsec;
+	part->stamp.hash = hash_data(tmpl.file.data, tmpl.file.size);
+	part->width_mm = tmpl.width_mm;
+	part->height_mm = tmpl.height_mm;
+	part->units_per_mm = tmpl.units_per_mm;
+
+	part->cut = tmpl.cut;
+	part->print = tmpl.print;
+	memset(&tmpl.cut, 0, sizeof(tmpl.cut));
+	memset(&tmpl.print, 0, sizeof(tmpl.print));
+	part_bbox(part);
+
+	part->layer_count = tmpl.layer_count;
+	if (tmpl.layer_count) {
+		part->layer_ids = mem_alloc(tmpl.layer_count
+			* sizeof(*part->layer_ids));
+		part->layer_labels = mem_alloc(tmpl.layer_count
+			* sizeof(*part->layer_labels));
+	}
+	for (i = 0; i < tmpl.layer_count; i++) {
+		const struct template_layer *layer = &tmpl.layers[i];
+
+		part->layer_ids[i] = str_ndup(layer->id ? layer->id : "",
+			layer->id_len);
+		part->layer_labels[i] = str_ndup(layer->label ? layer->label
+			: "", layer->label_len);
+	}
+
+	template_free(&tmpl);
+	return 0;
+}
+
+void template_part_free(struct template_part *part)
+{
+	unsigned int i;
+
+	for (i = 0; i < part->layer_count; i++) {
+		mem_free(part->layer_ids[i]);
+		mem_free(part->layer_labels[i]);
+	}
+	if (part->layer_ids) {
+		mem_free(part->layer_ids);
+		mem_free(part->layer_labels);
+	}
+	if (part->name) {
+		mem_free(part->name);
+	}
+	ring_set_free(&part->cut);
+	ring_set_free(&part->print);
+	memset(part, 0, sizeof(*part));
+}
+
+/*
+ * Index file layout, native byte order.  The header and entry array
+ * come first, then per entry its rings, points, layers and strings.
+ * Offsets are from the start of the file and 8 byte aligned.
+ */
+
+static const char index_magic[8] = "MDTINDEX";
+
+enum {index_version = 1};
+
+struct index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	double tolerance;
+	uint64_t size;
+};
+
+struct index_entry {
+	uint64_t name;
+	uint64_t rings;
+	uint64_t layers;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+	double width_mm;
+	double height_mm;
+	double units_per_mm;
+	float box[4];
+	uint32_t cut_count;
+	uint32_t print_count;
+	uint32_t layer_count;
+	uint32_t reserved;
+};
+
+struct index_ring {
+	uint64_t points;
+	uint32_t count;
+	uint32_t closed;
+};
+
+struct index_layer {
+	uint64_t id;
+	uint64_t label;
+};
+
+static const void *index_ptr(const struct template_index *index,
+	uint64_t offset, uint64_t len)
+{
+	if (offset > index->file.size || len > index->file.size - offset) {
+		return NULL;
+	}
+	return index->file.data + offset;
+}
+
+static const char *index_str(const struct template_index *index,
+	uint64_t offset)
+{
+	const char *s = index_ptr(index, offset, 1);
+
+	if (!s || !memchr(s, 0, index->file.size - offset)) {
+		return NULL;
+	}
+	return s;
+}
+
+static const struct index_entry *index_entries(
+	const struct template_index *index)
+{
+	return (const struct index_entry *)(index->file.data
+		+ sizeof(struct index_header));
+}
+
+/* Returns 1 if the index does not exist, it is then empty. */
+int template_index_open(struct template_index *index, const char *path)
+{
+	const struct index_header *header;
+	char dir[PATH_MAX];
+	const char *slash = strrchr(path, '/');
+
+	memset(index, 0, sizeof(*index));
+
+	if (slash) {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path + 1), path);
+	} else {
+		strcpy(dir, ".");
+	}
+	index->dir = realpath(dir, NULL);
+	if (!index->dir) {
+		error("realpath '%s' failed: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	if (access(path, F_OK) && errno == ENOENT) {
+		return 1;
+	}
+
+	if (map_file(path, &index->file)) {
+		template_index_close(index);
+		return -1;
+	}
+
+	header = (const struct index_header *)index->file.data;
+
+	if (index->file.size < sizeof(*header)
+		|| memcmp(header->magic, index_magic, sizeof(index_magic))
+		|| header->version != index_version
+		|| header->size != index->file.size
+		|| !index_ptr(index, sizeof(*header),
+			(uint64_t)header->count * sizeof(struct index_entry))) {
+		error("%s: not a template index.\n", path);
+		template_index_close(index);
+		return -1;
+	}
+
+	index->tolerance = header->tolerance;
+	index->count = header->count;
+	return 0;
+}
+
+void template_index_close(struct template_index *index)
+{
+	unmap_file(&index->file);
+	if (index->dir) {
+		free(index->dir);
+	}
+	memset(index, 0, sizeof(*index));
+}
+
+/* Path relative to the index directory if it is below it. */
+char *template_index_name(const struct template_index *index,
+	const char *path)
+{
+	char *real = realpath(path, NULL);
+	size_t len = strlen(index->dir);
+	char *name;
+
+	if (!real) {
+		return str_dup(path);
+	}
+
+	if (!strncmp(real, index->dir, len) && real[len] == '/') {
+		name = str_dup(real + len + 1);
+	} else {
+		name = str_dup(real);
+	}
+	free(real);
+	return name;
+}
+
+static bool name_matches(const char *entry, const char *name)
+{
+	size_t entry_len = strlen(entry);
+	size_t name_len = strlen(name);
+
+	if (entry_len > 4 && !strcmp(entry + entry_len - 4, ".svg")
+		&& (name_len < 4 || strcmp(name + name_len - 4, ".svg"))) {
+		entry_len -= 4;
+	}
+
+	return name_len <= entry_len
+		&& !strncmp(entry + entry_len - name_len, name, name_len)
+		&& (name_len == entry_len
+			|| entry[entry_len - name_len - 1] == '/');
+}
+
+/*
+ * Entry for a file path, an index name or a part name like
+ * 'yz125/yz-front-fender'.  Returns -1 if there is none.
+ */
+int template_index_find(const struct template_index *index, const char *name)
+{
+	const struct index_entry *entries = index_entries(index);
+	unsigned int low = 0;
+	unsigned int high = index->count;
+	char *rel = NULL;
+	unsigned int i;
+
+	if (!index->count) {
+		return -1;
+	}
+
+	if (!access(name, F_OK)) {
+		rel = template_index_name(index, name);
+		name = rel;
+	}
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		const char *s = index_str(index, entries[mid].name);
+		int cmp = s ? strcmp(s, name) : -1;
+
+		if (!cmp) {
+			low = mid;
+			goto found;
+		}
+		if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	for (i = 0; i < index->count; i++) {
+		const char *s = index_str(index, entries[i].name);
+
+		if (s && name_matches(s, name)) {
+			low = i;
+			goto found;
+		}
+	}
+
+	if (rel) {
+		mem_free(rel);
+	}
+	return -1;
+
+found:
+	if (rel) {
+		mem_free(rel);
+	}
+	return (int)low;
+}
+
+static bool entry_current(const struct template_index *index,
+	const struct index_entry *entry, const char *name)
+{
+	struct mapped_file mf;
+	struct stat st;
+	char path[PATH_MAX];
+	bool current;
+
+	if (name[0] == '/') {
+		snprintf(path, sizeof(path), "%s", name);
+	} else {
+		snprintf(path, sizeof(path), "%s/%s", index->dir, name);
+	}
+
+	if (stat(path, &st) || (uint64_t)st.st_size != entry->size) {
+		return false;
+	}
+	if (st.st_mtim.tv_sec == entry->mtime_sec
+		&& st.st_mtim.tv_nsec == entry->mtime_nsec) {
+		return true;
+	}
+
+	/* Touched or copied, check the content. */
+	if (map_file(path, &mf)) {
+		return false;
+	}
+	current = hash_data(mf.data, mf.size) == entry->hash;
+	unmap_file(&mf);
+
+	debug("%s: mtime changed, %s\n", name,
+		current ? "content unchanged" : "stale");
+	return current;
+}
+
+/* Returns 1 if the entry is out of date. */
+int template_index_get(const struct template_index *index, unsigned int entry,
+	double tolerance, struct template_part *part)
+{
+	const struct index_entry *e = &index_entries(index)[entry];
+	const struct index_ring *rings;
+	const struct index_layer *layers;
+	const char *name;
+	unsigned int i;
+
+	memset(part, 0, sizeof(*part));
+	assert(entry < index->count);
+
+	name = index_str(index, e->name);
+	rings = index_ptr(index, e->rings, ((uint64_t)e->cut_count
+		+ e->print_count) * sizeof(*rings));
+	layers = index_ptr(index, e->layers,
+		(uint64_t)e->layer_count * sizeof(*layers));
+
+	if (!name || !rings || !layers) {
+		error("bad template index entry %u.\n", entry);
+		return -1;
+	}
+
+	if (fabs(tolerance - index->tolerance) > 1e-9
+		|| !entry_current(index, e, name)) {
+		return 1;
+	}
+
+	for (i = 0; i < e->cut_count + e->print_count; i++) {
+		struct ring_set *set = (i < e->cut_count) ? &part->cut
+			: &part->print;
+		const struct point_d *points = index_ptr(index,
+			rings[i].points, (uint64_t)rings[i].count
+				* sizeof(*points));
+		struct ring *ring;
+
+		if (!points) {
+			error("bad template index ring in '%s'.\n", name);
+			template_part_free(part);
+			return -1;
+		}
+
+		ring = ring_set_add(set);
+		ring->count = ring->alloc = rings[i].count;
+		ring->closed = rings[i].closed;
+		if (ring->count) {
+			ring->points = mem_alloc(ring->count
+				* sizeof(*ring->points));
+			memcpy(ring->points, points, ring->count
+				* sizeof(*ring->points));
+		}
+	}
+
+	part->layer_count = e->layer_count;
+	if (e->layer_count) {
+		part->layer_ids = mem_alloc(e->layer_count
+			* sizeof(*part->layer_ids));
+		part->layer_labels = mem_alloc(e->layer_count
+			* sizeof(*part->layer_labels));
+	}
+	for (i = 0; i < e->layer_count; i++) {
+		const char *id = index_str(index, layers[i].id);
+		const char *label = index_str(index, layers[i].label);
+
+		part->layer_ids[i] = str_dup(id ? id : "");
+		part->layer_labels[i] = str_dup(label ? label : "");
+	}
+
+	part->name = str_dup(name);
+	part->stamp.size = e->size;
+	part->stamp.mtime_sec = e->mtime_sec;
+	part->stamp.mtime_nsec = e->mtime_nsec;
+	part->stamp.hash = e->hash;
+	part->width_mm = e->width_mm;
+	part->height_mm = e->height_mm;
+	part->units_per_mm = e->units_per_mm;
+	part->box.x_min = e->box[0];
+	part->box.y_min = e->box[1];
+	part->box.x_max = e->box[2];
+	part->box.y_max = e->box[3];
+	return 0;
+}
+
+static uint64_t index_add(struct out_buf *out, const void *data, size_t len)
+{
+	static const char zeros[8];
+	uint64_t offset = out->len;
+
+	out_add(out, data, len);
+	out_add(out, zeros, (8 - out->len % 8) % 8);
+	return offset;
+}
+
+static uint64_t index_add_rings(struct out_buf *out,
+	const struct ring_set *set, uint64_t *offsets)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++) {
+		offsets[i] = index_add(out, set->rings[i].points,
+			set->rings[i].count * sizeof(*set->rings[i].points));
+	}
+	return set->count;
+}
+
+static int part_compare(const void *a, const void *b)
+{
+	const struct template_part *const *pa = a;
+	const struct template_part *const *pb = b;
+
+	return strcmp((*pa)->name, (*pb)->name);
+}
+
+int template_index_write(const char *path, const struct template_part *parts,
+	unsigned int count, double tolerance)
+{
+	const struct template_part **sorted;
+	struct index_header header;
+	struct index_entry *entries;
+	struct out_buf out = {0};
+	unsigned int i;
+	unsigned int j;
+	int result;
+
+	sorted = mem_alloc((count ? count : 1) * sizeof(*sorted));
+	for (i = 0; i < count; i++) {
+		sorted[i] = &parts[i];
+	}
+	qsort(sorted, count, sizeof(*sorted), part_compare);
+
+	entries = mem_alloc((count ? count : 1) * sizeof(*entries));
+	memset(entries, 0, (count ? count : 1) * sizeof(*entries));
+
+	memset(&header, 0, sizeof(header));
+	index_add(&out, &header, sizeof(header));
+	index_add(&out, entries, count * sizeof(*entries));
+
+	for (i = 0; i < count; i++) {
+		const struct template_part *part = sorted[i];
+		struct index_entry *e = &entries[i];
+		unsigned int ring_count = part->cut.count + part->print.count;
+		struct index_ring *rings = mem_alloc((ring_count ? ring_count
+			: 1) * sizeof(*rings));
+		struct index_layer *layers = mem_alloc((part->layer_count
+			? part->layer_count : 1) * sizeof(*layers));
+		uint64_t *offsets = mem_alloc((ring_count ? ring_count : 1)
+			* sizeof(*offsets));
+
+		e->name = index_add(&out, part->name, strlen(part->name) + 1);
+		e->size = part->stamp.size;
+		e->mtime_sec = part->stamp.mtime_sec;
+		e->mtime_nsec = part->stamp.mtime_nsec;
+		e->hash = part->stamp.hash;
+		e->width_mm = part->width_mm;
+		e->height_mm = part->height_mm;
+		e->units_per_mm = part->units_per_mm;
+		e->box[0] = part->box.x_min;
+		e->box[1] = part->box.y_min;
+		e->box[2] = part->box.x_max;
+		e->box[3] = part->box.y_max;
+		e->cut_count = index_add_rings(&out, &part->cut, offsets);
+		e->print_count = index_add_rings(&out, &part->print,
+			offsets + e->cut_count);
+		e->layer_count = part->layer_count;
+
+		for (j = 0; j < ring_count; j++) {
+			const struct ring *ring = (j < e->cut_count)
+				? &part->cut.rings[j]
+				: &part->print.rings[j - e->cut_count];
+
+			rings[j].points = offsets[j];
+			rings[j].count = ring->count;
+			rings[j].closed = ring->closed;
+		}
+		e->rings = index_add(&out, rings, ring_count * sizeof(*rings));
+
+		for (j = 0; j < part->layer_count; j++) {
+			layers[j].id = index_add(&out, part->layer_ids[j],
+				strlen(part->layer_ids[j]) + 1);
+			layers[j].label = index_add(&out, part->layer_labels[j],
+				strlen(part->layer_labels[j]) + 1);
+		}
+		e->layers = index_add(&out, layers,
+			part->layer_count * sizeof(*layers));
+
+		mem_free(offsets);
+		mem_free(layers);
+		mem_free(rings);
+	}
+
+	memcpy(header.magic, index_magic, sizeof(index_magic));
+	header.version = index_version;
+	header.count = count;
+	header.tolerance = tolerance;
+	header.size = out.len;
+	memcpy(out.data, &header, sizeof(header));
+	memcpy(out.data + sizeof(header), entries, count * sizeof(*entries));
+
+	result = replace_file(path, out.data, out.len);
+
+	out_free(&out);
+	mem_free(entries);
+	mem_free(sorted);
+	return result;
+}
+
+/* Geometry from the index when it is current, otherwise from the SVG. */
+int template_part_get(const struct template_index *index, const char *path,
+	double tolerance, struct template_part *part)
+{
+	char *name = NULL;
+	int entry;
+	int result;
+
+	if (index && index->dir) {
+		entry = template_index_find(index, path);
+		if (entry >= 0) {
+			result = template_index_get(index, entry, tolerance,
+				part);
+			if (result <= 0) {
+				return result;
+			}
+			debug("%s: index entry out of date.\n", path);
+		}
+		name = template_index_name(index, path);
+	}
+
+	result = template_part_load(part, path, name, tolerance);
+
+	if (name) {
+		mem_free(name);
+	}
+	return result;
+}
@@ -0,0 +1,102 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_TEMPLATE_H)
+#define _MD_GENERATOR_TEMPLATE_H
+
+/*
+ * Part template geometry.  The cut line is every magenta stroked shape
+ * outside the print layer, the print area is every filled, non-white
+ * shape inside it.  Rings are in root user units.
+ */
+
+struct template_span {
+	const char *start;
+	const char *end;
+};
+
+struct template_layer {
+	const char *id;
+	unsigned int id_len;
+	const char *label;
+	unsigned int label_len;
+	struct template_span tag;
+	const char *close;
+	struct affine ctm;
+};
+
+struct template {
+	struct mapped_file file;
+	double width_mm;
+	double height_mm;
+	double units_per_mm;
+	struct ring_set cut;
+	struct ring_set print;
+	struct template_layer *layers;
+	unsigned int layer_count;
+	int print_layer;
+	int cut_layer;
+	struct template_span *print_areas;
+	unsigned int print_area_count;
+	const char *print_style;
+	unsigned int print_style_len;
+	const char *root_close;
+};
+
+int template_load(struct template *tmpl, const char *path, double tolerance);
+void template_free(struct template *tmpl);
+
+/*
+ * Template geometry without the SVG, as kept in a template index.  The
+ * index is a single mapped file with entries sorted by name, the file
+ * path relative to the index directory.  An entry is current while the
+ * file size and mtime, or failing that its content hash, still match.
+ */
+
+struct template_stamp {
+	unsigned long long size;
+	long long mtime_sec;
+	long long mtime_nsec;
+	unsigned long long hash;
+};
+
+struct template_part {
+	char *name;
+	struct template_stamp stamp;
+	double width_mm;
+	double height_mm;
+	double units_per_mm;
+	struct bbox box;
+	struct ring_set cut;
+	struct ring_set print;
+	char **layer_ids;
+	char **layer_labels;
+	unsigned int layer_count;
+};
+
+struct template_index {
+	struct mapped_file file;
+	char *dir;
+	double tolerance;
+	unsigned int count;
+};
+
+int template_part_load(struct template_part *part, const char *path,
+	const char *name, double tolerance);
+void template_part_free(struct template_part *part);
+
+int template_index_open(struct template_index *index, const char *path);
+void template_index_close(struct template_index *index);
+char *template_index_name(const struct template_index *index,
+	const char *path);
+int template_index_find(const struct template_index *index, const char *name);
+int template_index_get(const struct template_index *index, unsigned int entry,
+	double tolerance, struct template_part *part);
+int template_index_write(const char *path, const struct template_part *parts,
+	unsigned int count, double tolerance);
+
+int template_part_get(const struct template_index *index, const char *path,
+	double tolerance, struct template_part *part);
+
+#endif /* _MD_GENERATOR_TEMPLATE_H */
@@ -0,0 +1,206 @@
+#!/bin/bash
+#
+# golden.sh: Compare seeded blob-generator output with the golden files.
+#
+# GOLDEN_MODE=exact compares bytes.  GOLDEN_MODE=geometric lets numbers
+# differ by GOLDEN_TOLERANCE user units, for other compilers or math
+# libraries.  GOLDEN_UPDATE=1 writes new golden files after an intended
+# output change.
+
+set -e
+
+name=$(basename ${0})
+
+: ${srcdir:="$(dirname ${0})/.."}
+: ${builddir:="."}
+: ${GOLDEN_MODE:="exact"}
+: ${GOLDEN_TOLERANCE:="0.002"}
+: ${GOLDEN_UPDATE:=""}
+
+generator="${builddir}/blob-generator"
+compare="${builddir}/svg-compare"
+merge="${builddir}/shard-merge"
+mdgeom="${builddir}/mdgeom-convert"
+inspect="$(cd "${builddir}" && pwd)/svg-inspect"
+golden="${srcdir}/tests/golden"
+blue="${srcdir}/blob-generator-blue.conf"
+grey="${srcdir}/blob-generator-grey.conf"
+field="${srcdir}/blob-generator-field.conf"
+
+small="--grid-columns 6 --grid-rows 5"
+
+# <name> <generator args>, the output is '<name>.svg'.
+cases=(
+	"blue -f ${blue} --seed 1"
+	"grey -f ${grey} --seed 2"
+	"grey-merge -f ${grey} -m --seed 3"
+	"blue-tile -f ${blue} -t ${small} --seed 4"
+	"blue-draft -f ${blue} --draft --seed 1"
+	"field -f ${field} --grid-columns 12 --grid-rows 10 --seed 5"
+	"field-sector-0 -f ${field} --sector_min 0 ${small} --seed 14"
+	"instances --instances 4 ${small} --seed 6"
+	"neighbors -n --min-contrast 0.3 ${small} --seed 7"
+	"digital --style digital ${small} --seed 8"
+	"voronoi --style voronoi --cell-smooth 0.5 ${small} --seed 9"
+	"sector-limit --node-count-max 16 --sector_min 21.99 ${small} --seed 10"
+	"nodes-fixed --node-count-min 3 --node-count-max 3 --sector_min 100 ${small} --seed 11"
+	"radius-equal --radius-min 40 --radius-max 40 ${small} --seed 12"
+)
+
+# Args that must be refused.
+bad_cases=(
+	"--node-count-max 16 --sector_min 22"
+	"--node-count-min 9 --node-count-max 8"
+	"--node-count-min 0"
+	"--sector_min -1"
+	"--grid-width 0"
+	"--panel-width 10 --panel-overlap 10"
+	"--shard 0/2 --seed 1"
+	"--shard 3/2 --seed 1"
+	"--shard 1/2"
+)
+
+case "${GOLDEN_MODE}" in
+exact)
+	compare_args="-t 0"
+	;;
+geometric)
+	compare_args="-t ${GOLDEN_TOLERANCE}"
+	;;
+*)
+	echo "${name}: ERROR: Bad GOLDEN_MODE '${GOLDEN_MODE}'." >&2
+	exit 2
+	;;
+esac
+
+tmp=$(mktemp -d --tmpdir golden.XXXXXXXX)
+trap "rm -rf ${tmp}" EXIT
+
+failed=0
+count=0
+
+check_file() {
+	local file=${1}
+
+	count=$((count + 1))
+
+	if [[ ${GOLDEN_UPDATE} ]]; then
+		cp "${tmp}/${file}" "${golden}/${file}"
+		echo "${name}: Updated ${file}."
+	elif [[ ! -f "${golden}/${file}" ]]; then
+		echo "${name}: FAIL: ${file}: No golden file." >&2
+		failed=$((failed + 1))
+	elif ! "${compare}" ${compare_args} "${golden}/${file}" \
+		"${tmp}/${file}"; then
+		echo "${name}: FAIL: ${file}: Output differs (${GOLDEN_MODE})." >&2
+		failed=$((failed + 1))
+	fi
+}
+
+for c in "${cases[@]}"; do
+	set -- ${c}
+	test=${1}
+	shift
+
+	if ! "${generator}" "${@}" -o "${tmp}/${test}.svg"; then
+		echo "${name}: FAIL: ${test}: blob-generator failed." >&2
+		failed=$((failed + 1))
+		continue
+	fi
+	check_file "${test}.svg"
+done
+
+# The stats sink sees the same drawing, and gives counts that don't
+# depend on the number formatting.
+if "${generator}" -f "${blue}" --seed 1 -o /dev/null \
+	--stats "${tmp}/blue-stats.txt"; then
+	check_file "blue-stats.txt"
+else
+	echo "${name}: FAIL: blue-stats: blob-generator failed." >&2
+	failed=$((failed + 1))
+fi
+
+# svg-inspect reads back the blob count, nodes and areas of the drawing.
+if (cd "${tmp}" && "${inspect}" blue.svg > blue-inspect.json); then
+	check_file "blue-inspect.json"
+else
+	echo "${name}: FAIL: blue-inspect: svg-inspect failed." >&2
+	failed=$((failed + 1))
+fi
+
+# Each panel of a split page is written to its own file.
+if "${generator}" -f "${blue}" ${small} --seed 13 --panel-width 70 \
+	--panel-overlap 15 -o "${tmp}/panels.svg"; then
+	for file in panels-1.svg panels-2.svg panels-3.svg; do
+		check_file "${file}"
+	done
+else
+	echo "${name}: FAIL: panels: blob-generator failed." >&2
+	failed=$((failed + 1))
+fi
+
+# Merged shards are the bytes of a single run, whatever the shard order.
+shards_ok=1
+for shard in 1 2 3; do
+	if ! "${generator}" -f "${blue}" --seed 1 --shard ${shard}/3 \
+		-o "${tmp}/blue-${shard}.shard"; then
+		shards_ok=
+	fi
+done
+if [[ ${shards_ok} ]] && "${merge}" -o "${tmp}/blue-shards.svg" \
+	"${tmp}/blue-3.shard" "${tmp}/blue-1.shard" "${tmp}/blue-2.shard" \
+	&& cmp -s "${tmp}/blue.svg" "${tmp}/blue-shards.svg"; then
+	:
+else
+	echo "${name}: FAIL: blue-shards: Merged output differs." >&2
+	failed=$((failed + 1))
+fi
+count=$((count + 1))
+
+# Shards of different runs are refused.
+count=$((count + 1))
+if [[ ${shards_ok} ]] && "${generator}" -f "${blue}" --seed 2 --shard 2/3 \
+	-o "${tmp}/other-2.shard" && "${merge}" -o "${tmp}/bad.svg" \
+	"${tmp}/blue-1.shard" "${tmp}/other-2.shard" "${tmp}/blue-3.shard" \
+	2> /dev/null; then
+	echo "${name}: FAIL: Shards of different runs were merged." >&2
+	failed=$((failed + 1))
+fi
+
+# A job in a manifest gives the same output as a single run.
+echo "${blue} 1 ${tmp}/blue-job.svg" > "${tmp}/manifest"
+if "${generator}" --jobs "${tmp}/manifest" > /dev/null 2>&1 \
+	&& "${compare}" ${compare_args} "${golden}/blue.svg" \
+		"${tmp}/blue-job.svg" 2> /dev/null; then
+	:
+elif [[ ! ${GOLDEN_UPDATE} ]]; then
+	echo "${name}: FAIL: blue-job: Manifest output differs." >&2
+	failed=$((failed + 1))
+fi
+count=$((count + 1))
+
+# A .mdgeom file converts back to the bytes of the SVG output.
+count=$((count + 1))
+if "${generator}" -f "${blue}" --seed 1 -o "${tmp}/blue.mdgeom" \
+	&& "${mdgeom}" -o "${tmp}/blue-mdgeom.svg" "${tmp}/blue.mdgeom" \
+	&& cmp -s "${tmp}/blue.svg" "${tmp}/blue-mdgeom.svg"; then
+	:
+else
+	echo "${name}: FAIL: blue-mdgeom: Converted output differs." >&2
+	failed=$((failed + 1))
+fi
+
+for c in "${bad_cases[@]}"; do
+	count=$((count + 1))
+	if "${generator}" ${c} -o "${tmp}/bad.svg" 2> /dev/null; then
+		echo "${name}: FAIL: '${c}' was accepted." >&2
+		failed=$((failed + 1))
+	fi
+done
+
+if [[ ${failed} -ne 0 ]]; then
+	echo "${name}: ${failed} of ${count} checks failed." >&2
+	exit 1
+fi
+
+echo "${name}: ${count} checks passed (${GOLDEN_MODE})."
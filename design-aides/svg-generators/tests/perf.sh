@@ -0,0 +1,105 @@
+#!/bin/bash
+#
+# perf.sh: Time seeded blob-generator runs and compare the node rate with
+# the stored baseline.
+#
+# A case fails when its nodes per second fall more than PERF_TOLERANCE
+# percent under the baseline.  Each case runs PERF_RUNS times and the
+# fastest counts.  The baseline is per machine, PERF_UPDATE=1 writes the
+# measured rates as the new baseline.
+
+set -e
+
+name=$(basename ${0})
+
+: ${srcdir:="$(dirname ${0})/.."}
+: ${builddir:="."}
+: ${PERF_BASELINE:="${srcdir}/tests/perf-baseline"}
+: ${PERF_TOLERANCE:="50"}
+: ${PERF_RUNS:="3"}
+: ${PERF_UPDATE:=""}
+
+generator="${builddir}/blob-generator"
+blue="${srcdir}/blob-generator-blue.conf"
+
+# <name> <generator args>
+cases=(
+	"blob -f ${blue} --grid-columns 300 --grid-rows 250 --seed 1"
+	"blob-merge -f ${blue} -m --grid-columns 120 --grid-rows 100 --seed 1"
+	"digital --style digital --grid-columns 60 --grid-rows 50 --seed 2"
+	"voronoi --style voronoi --grid-columns 60 --grid-rows 50 --seed 3"
+)
+
+if [[ ! "${PERF_TOLERANCE}" =~ ^[0-9]+$ ]]; then
+	echo "${name}: ERROR: Bad PERF_TOLERANCE '${PERF_TOLERANCE}'." >&2
+	exit 2
+fi
+
+tmp=$(mktemp -d --tmpdir perf.XXXXXXXX)
+trap "rm -rf ${tmp}" EXIT
+
+now_ns() {
+	date +%s%N
+}
+
+baseline_rate() {
+	local test=${1}
+
+	if [[ -f "${PERF_BASELINE}" ]]; then
+		awk -v t="${test}" '$1 == t {print $2}' "${PERF_BASELINE}"
+	fi
+}
+
+failed=0
+results=""
+
+for c in "${cases[@]}"; do
+	set -- ${c}
+	test=${1}
+	shift
+
+	best=0
+	for ((run = 0; run < PERF_RUNS; run++)); do
+		start=$(now_ns)
+		if ! "${generator}" "${@}" -o "${tmp}/out.svg" \
+			--stats "${tmp}/stats.txt"; then
+			echo "${name}: FAIL: ${test}: blob-generator failed." >&2
+			failed=$((failed + 1))
+			continue 2
+		fi
+		time=$(($(now_ns) - start))
+		time=$((time > 0 ? time : 1))
+		best=$((best == 0 || time < best ? time : best))
+	done
+
+	nodes=$(sed -n 's/.*nodes: \([0-9]*\).*/\1/p' "${tmp}/stats.txt")
+	rate=$((nodes * 1000000000 / best))
+	results+="${test} ${rate}"$'\n'
+
+	base=$(baseline_rate ${test})
+	if [[ ! ${base} ]]; then
+		echo "${name}: ${test}: ${nodes} nodes, ${rate} nodes/s, no baseline."
+		continue
+	fi
+
+	change=$(((rate - base) * 100 / base))
+	echo "${name}: ${test}: ${nodes} nodes, ${rate} nodes/s, baseline ${base}, ${change}%."
+
+	if [[ ! ${PERF_UPDATE} && $((-change)) -gt ${PERF_TOLERANCE} ]]; then
+		echo "${name}: FAIL: ${test}: ${rate} nodes/s is over ${PERF_TOLERANCE}% under the baseline." >&2
+		failed=$((failed + 1))
+	fi
+done
+
+if [[ ${PERF_UPDATE} && ${failed} -eq 0 ]]; then
+	{
+		echo "# perf.sh baseline: <case> <nodes per second>"
+		echo -n "${results}"
+	} > "${PERF_BASELINE}"
+	echo "${name}: Updated ${PERF_BASELINE}."
+fi
+
+if [[ ${failed} -ne 0 ]]; then
+	echo "${name}: ${failed} of ${#cases[@]} cases failed." >&2
+	exit 1
+fi
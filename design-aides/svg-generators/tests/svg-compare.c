@@ -0,0 +1,292 @@
+/*
+ *  moto-design test output compare.
+ */
+
+/*
+ * Compares two generator output files.  Text outside numbers must match
+ * exactly, numbers may differ by the tolerance, so a change in the last
+ * written digit of a coordinate passes while a lost node or a changed
+ * color fails.  Numbers inside names and colors, 'blob_12' or '#0077ff',
+ * are text.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+static const char program_name[] = "svg-compare";
+
+static void print_version(void)
+{
+	printf("%s (" PACKAGE_NAME ") " PACKAGE_VERSION "\n", program_name);
+}
+
+static void print_bugreport(void)
+{
+	fprintf(stderr, "Report bugs at " PACKAGE_BUGREPORT ".\n");
+}
+
+enum opt_value {opt_undef = 0, opt_yes, opt_no};
+
+struct opts {
+	float tolerance;
+	enum opt_value help;
+	enum opt_value verbose;
+	enum opt_value version;
+};
+
+static void print_usage(const struct opts *opts)
+{
+	print_version();
+
+	fprintf(stderr,
+"%s - Compare generator output files.\n"
+"Usage: %s [flags] <expected> <actual>\n"
+"Option flags:\n"
+"  -t --tolerance - Largest allowed number difference, 0=exact. Default: '%f'.\n"
+"  -h --help      - Show this help and exit.\n"
+"  -v --verbose   - Verbose execution.\n"
+"  -V --version   - Display the program version number.\n"
+"Exits with 0 if the files match, 1 if they differ, 2 on error.\n",
+		program_name, program_name,
+		opts->tolerance
+	);
+
+	print_bugreport();
+}
+
+static int opts_parse(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"tolerance", required_argument, NULL, 't'},
+		{"help",      no_argument,       NULL, 'h'},
+		{"verbose",   no_argument,       NULL, 'v'},
+		{"version",   no_argument,       NULL, 'V'},
+		{ NULL,       0,                 NULL, 0},
+	};
+	static const char short_options[] = "t:hvV";
+
+	*opts = (struct opts){
+		.tolerance = 0.0,
+		.help = opt_no,
+		.verbose = opt_no,
+		.version = opt_no,
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+			NULL);
+
+		if (c == EOF)
+			break;
+
+		switch (c) {
+		case 't':
+			opts->tolerance = to_float(optarg);
+			if (opts->tolerance == HUGE_VALF || opts->tolerance < 0) {
+				opts->help = opt_yes;
+				return -1;
+			}
+			break;
+		case 'h':
+			opts->help = opt_yes;
+			break;
+		case 'v':
+			opts->verbose = opt_yes;
+			set_verbose(true);
+			break;
+		case 'V':
+			opts->version = opt_yes;
+			break;
+		default:
+			opts->help = opt_yes;
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+struct scan {
+	const struct mapped_file *mf;
+	size_t pos;
+	unsigned int line;
+};
+
+static bool scan_is_word(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '#';
+}
+
+/* Length of the number at pos, 0 if there is none. */
+static size_t scan_number(const struct scan *s)
+{
+	const char *p = s->mf->data + s->pos;
+	const char *end = s->mf->data + s->mf->size;
+	const char *start = p;
+	bool digits = false;
+
+	if (s->pos && scan_is_word(p[-1])) {
+		return 0;
+	}
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	for (; p < end && isdigit((unsigned char)*p); p++) {
+		digits = true;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && isdigit((unsigned char)*p); p++) {
+			digits = true;
+		}
+	}
+	if (!digits) {
+		return 0;
+	}
+
+	if (p + 1 < end && (*p == 'e' || *p == 'E')) {
+		const char *e = p + 1;
+
+		if (*e == '-' || *e == '+') {
+			e++;
+		}
+		if (e < end && isdigit((unsigned char)*e)) {
+			for (p = e; p < end && isdigit((unsigned char)*p); p++)
+				;
+		}
+	}
+
+	/* Part of a name, 'blob_0x'. */
+	if (p < end && (isalpha((unsigned char)*p) || *p == '_')) {
+		return 0;
+	}
+	return p - start;
+}
+
+static double scan_value(const struct scan *s, size_t len)
+{
+	char buf[64];
+
+	if (len >= sizeof(buf)) {
+		return NAN;
+	}
+	memcpy(buf, s->mf->data + s->pos, len);
+	buf[len] = 0;
+	return strtod(buf, NULL);
+}
+
+static void scan_skip(struct scan *s, size_t len)
+{
+	for (; len; len--, s->pos++) {
+		if (s->mf->data[s->pos] == '\n') {
+			s->line++;
+		}
+	}
+}
+
+static int compare(const char *expected, const char *actual,
+	const struct mapped_file *a, const struct mapped_file *b,
+	double tolerance)
+{
+	struct scan sa = {a, 0, 1};
+	struct scan sb = {b, 0, 1};
+	unsigned int numbers = 0;
+	double max_diff = 0.0;
+
+	while (sa.pos < a->size && sb.pos < b->size) {
+		size_t len_a = tolerance ? scan_number(&sa) : 0;
+		size_t len_b = tolerance ? scan_number(&sb) : 0;
+
+		if (len_a && len_b) {
+			double diff = fabs(scan_value(&sa, len_a)
+				- scan_value(&sb, len_b));
+
+			if (!(diff <= tolerance)) {
+				fprintf(stderr, "%s:%u: %.*s, %s:%u: %.*s, "
+					"difference %g over %g\n",
+					expected, sa.line, (int)len_a,
+					a->data + sa.pos, actual, sb.line,
+					(int)len_b, b->data + sb.pos, diff,
+					tolerance);
+				return 1;
+			}
+			max_diff = fmax(max_diff, diff);
+			numbers++;
+			scan_skip(&sa, len_a);
+			scan_skip(&sb, len_b);
+			continue;
+		}
+
+		if (a->data[sa.pos] != b->data[sb.pos]) {
+			fprintf(stderr, "%s:%u, %s:%u: text differs\n",
+				expected, sa.line, actual, sb.line);
+			return 1;
+		}
+		scan_skip(&sa, 1);
+		scan_skip(&sb, 1);
+	}
+
+	if (sa.pos < a->size || sb.pos < b->size) {
+		fprintf(stderr, "%s:%u, %s:%u: %s is shorter\n", expected,
+			sa.line, actual, sb.line,
+			(sa.pos < a->size) ? actual : expected);
+		return 1;
+	}
+
+	log("%u numbers, largest difference %g\n", numbers, max_diff);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mapped_file expected;
+	struct mapped_file actual;
+	struct opts opts;
+	int result;
+	int arg;
+
+	arg = opts_parse(&opts, argc, argv);
+
+	if (opts.help == opt_yes) {
+		print_usage(&opts);
+		return (arg < 0) ? 2 : 0;
+	}
+	if (opts.version == opt_yes) {
+		print_version();
+		return 0;
+	}
+	if (argc - arg != 2) {
+		error("Need <expected> and <actual> files.\n");
+		print_usage(&opts);
+		return 2;
+	}
+
+	if (map_file(argv[arg], &expected)) {
+		return 2;
+	}
+	if (map_file(argv[arg + 1], &actual)) {
+		unmap_file(&expected);
+		return 2;
+	}
+
+	result = compare(argv[arg], argv[arg + 1], &expected, &actual,
+		opts.tolerance);
+
+	unmap_file(&expected);
+	unmap_file(&actual);
+	return result;
+}
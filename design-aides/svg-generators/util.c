@@ -13,13 +13,17 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <getopt.h>
 #include <limits.h>
 #include <math.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +34,7 @@
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -49,12 +54,14 @@ void  __attribute__((unused)) _error(const char *func, int line,
 {
 	va_list ap;
 
+	flockfile(stderr);
 	fprintf(stderr, "ERROR: %s:%d: ", func, line);
 
 	va_start(ap, fmt);
 
 	vfprintf(stderr, fmt, ap);
 	fflush(stderr);
+	funlockfile(stderr);
 
 	va_end(ap);
 }
@@ -68,12 +75,14 @@ void  __attribute__((unused)) _log(const char *func, int line,
 		return;
 	}
 
+	flockfile(stderr);
 	fprintf(stderr, "%s:%d: ", func, line);
 
 	va_start(ap, fmt);
 
 	vfprintf(stderr, fmt, ap);
 	fflush(stderr);
+	funlockfile(stderr);
 
 	va_end(ap);
 }
@@ -83,16 +92,200 @@ void  __attribute__((unused)) _warn(const char *func, int line,
 {
 	va_list ap;
 
+	flockfile(stderr);
 	fprintf(stderr, "WARNING: %s:%d: ", func, line);
 
 	va_start(ap, fmt);
 
 	vfprintf(stderr, fmt, ap);
 	fflush(stderr);
+	funlockfile(stderr);
 
 	va_end(ap);
 }
 
+/*
+ * Each thread appends its spans to its own chunk list, registered once on
+ * a global list by compare and swap, so the hooks never take a lock.  The
+ * lists are only read by trace_write() after the threads are joined.
+ */
+#if !defined(NO_TRACE)
+#define trace_chunk_len 4096U
+
+struct trace_event {
+	const char *name;
+	unsigned long long start;
+	unsigned long long end;
+};
+
+struct trace_chunk {
+	struct trace_chunk *next;
+	unsigned int count;
+	struct trace_event events[trace_chunk_len];
+};
+
+struct trace_buf {
+	struct trace_buf *next;
+	unsigned int tid;
+	const char *name;
+	struct trace_chunk *first;
+	struct trace_chunk *last;
+};
+
+bool trace_enabled = false;
+
+static struct trace_buf *trace_bufs;
+static unsigned int trace_tid;
+static unsigned long long trace_epoch;
+static __thread struct trace_buf *trace_self;
+
+unsigned long long _trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct trace_buf *trace_buf_get(void)
+{
+	struct trace_buf *buf = trace_self;
+
+	if (buf) {
+		return buf;
+	}
+
+	buf = mem_alloc(sizeof(*buf));
+	buf->tid = __atomic_add_fetch(&trace_tid, 1, __ATOMIC_RELAXED);
+	buf->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_bufs, &buf->next, buf,
+		false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+	trace_self = buf;
+	return buf;
+}
+
+void _trace_span(const char *name, unsigned long long start)
+{
+	struct trace_buf *buf;
+	struct trace_chunk *chunk;
+
+	/* Begun before trace_start(). */
+	if (!start) {
+		return;
+	}
+
+	buf = trace_buf_get();
+	chunk = buf->last;
+	if (!chunk || chunk->count == trace_chunk_len) {
+		chunk = mem_alloc(sizeof(*chunk));
+		if (buf->last) {
+			buf->last->next = chunk;
+		} else {
+			buf->first = chunk;
+		}
+		buf->last = chunk;
+	}
+
+	chunk->events[chunk->count++] = (struct trace_event){
+		.name = name,
+		.start = start,
+		.end = _trace_now(),
+	};
+}
+
+void _trace_thread(const char *name)
+{
+	trace_buf_get()->name = name;
+}
+
+int trace_start(void)
+{
+	trace_epoch = _trace_now();
+	trace_enabled = true;
+	_trace_thread("main");
+	return 0;
+}
+
+static void trace_write_us(FILE *stream, unsigned long long ns)
+{
+	fprintf(stream, "%llu.%03llu", ns / 1000, ns % 1000);
+}
+
+/* Writes and frees the spans, the other threads must be done. */
+int trace_write(const char *file)
+{
+	FILE *stream = fopen(file, "w");
+	struct trace_buf *buf;
+	const char *sep = "";
+	int result = 0;
+
+	trace_enabled = false;
+
+	if (!stream) {
+		error("open '%s' failed: %s\n", file, strerror(errno));
+		result = -1;
+	} else {
+		fprintf(stream, "{\"traceEvents\":[");
+	}
+
+	while ((buf = trace_bufs)) {
+		struct trace_chunk *chunk;
+
+		if (stream && buf->name) {
+			fprintf(stream, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				sep, buf->tid, buf->name);
+			sep = ",";
+		}
+
+		while ((chunk = buf->first)) {
+			unsigned int i;
+
+			for (i = 0; stream && i < chunk->count; i++) {
+				const struct trace_event *e = &chunk->events[i];
+
+				fprintf(stream, "%s\n{\"name\":\"%s\",\"ph\":\"X\","
+					"\"pid\":1,\"tid\":%u,\"ts\":", sep,
+					e->name, buf->tid);
+				trace_write_us(stream, e->start - trace_epoch);
+				fprintf(stream, ",\"dur\":");
+				trace_write_us(stream, e->end - e->start);
+				fprintf(stream, "}");
+				sep = ",";
+			}
+			buf->first = chunk->next;
+			mem_free(chunk);
+		}
+
+		trace_bufs = buf->next;
+		mem_free(buf);
+	}
+	trace_self = NULL;
+
+	if (stream) {
+		fprintf(stream, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		if (fclose(stream)) {
+			error("write '%s' failed: %s\n", file, strerror(errno));
+			result = -1;
+		}
+	}
+	return result;
+}
+#else
+int trace_start(void)
+{
+	error("built without trace support.\n");
+	return -1;
+}
+
+int trace_write(const char *file)
+{
+	(void)file;
+	return 0;
+}
+#endif
+
 void *mem_alloc(size_t size)
 {
 	void *p = malloc(size);
@@ -131,6 +324,440 @@ void mem_free(void *p)
 	free(p);
 }
 
+int map_file(const char *path, struct mapped_file *mf)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		error("open '%s' failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		error("stat '%s' failed: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (!st.st_size) {
+		close(fd);
+		mf->data = "";
+		mf->size = 0;
+		return 0;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		error("mmap '%s' failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+	mf->data = p;
+	mf->size = st.st_size;
+	return 0;
+}
+
+void unmap_file(struct mapped_file *mf)
+{
+	if (mf->size) {
+		munmap((void *)mf->data, mf->size);
+	}
+	mf->data = NULL;
+	mf->size = 0;
+}
+
+char *str_dup(const char *s)
+{
+	char *p = mem_alloc(strlen(s) + 1);
+
+	strcpy(p, s);
+	return p;
+}
+
+void out_add(struct out_buf *out, const char *p, size_t len)
+{
+	if (out->len + len > out->alloc) {
+		out->alloc = 2 * (out->len + len) + 4096;
+		out->data = mem_realloc(out->data, out->alloc);
+	}
+	memcpy(out->data + out->len, p, len);
+	out->len += len;
+}
+
+void out_add_str(struct out_buf *out, const char *s)
+{
+	out_add(out, s, strlen(s));
+}
+
+void out_printf(struct out_buf *out, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	/* Format in place, only growing and retrying when it doesn't fit. */
+	va_start(ap, fmt);
+	len = vsnprintf(out->data ? out->data + out->len : NULL,
+		out->alloc - out->len, fmt, ap);
+	va_end(ap);
+
+	assert(len >= 0);
+	if (out->len + len + 1 > out->alloc) {
+		out->alloc = 2 * (out->len + len + 1) + 4096;
+		out->data = mem_realloc(out->data, out->alloc);
+
+		va_start(ap, fmt);
+		vsnprintf(out->data + out->len, len + 1, fmt, ap);
+		va_end(ap);
+	}
+
+	out->len += len;
+}
+
+/* Like "%.*f" but much faster, and without trailing zeros. */
+void out_add_number(struct out_buf *out, double value, unsigned int decimals)
+{
+	static const double scale[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+	char buf[32];
+	char *p = buf + sizeof(buf);
+	unsigned long long n;
+	bool negative = value < 0.0;
+
+	assert(decimals < sizeof(scale) / sizeof(scale[0]));
+
+	if (!(fabs(value) * scale[decimals] < 1e18)) {
+		out_printf(out, "%.*f", (int)decimals, value);
+		return;
+	}
+
+	n = (unsigned long long)llround(fabs(value) * scale[decimals]);
+
+	for (; decimals && n % 10 == 0; decimals--) {
+		n /= 10;
+	}
+	for (; decimals; decimals--) {
+		*--p = '0' + n % 10;
+		n /= 10;
+		if (decimals == 1) {
+			*--p = '.';
+		}
+	}
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	/* No sign on a value that rounds to 0. */
+	if (negative && (p[0] != '0' || p + 1 < buf + sizeof(buf))) {
+		*--p = '-';
+	}
+	out_add(out, p, buf + sizeof(buf) - p);
+}
+
+void out_free(struct out_buf *out)
+{
+	if (out->data) {
+		mem_free(out->data);
+	}
+	memset(out, 0, sizeof(*out));
+}
+
+/* Writes a temp file then renames it over the target. */
+int replace_file(const char *file, const char *data, size_t len)
+{
+	char path[PATH_MAX];
+	char *tmp;
+	struct stat st;
+	int fd;
+	int result = -1;
+
+	/* Write through symlinks like 'cp -H'. */
+	if (!realpath(file, path)) {
+		if (errno != ENOENT || strlen(file) >= sizeof(path)) {
+			error("realpath '%s' failed: %s\n", file,
+				strerror(errno));
+			return -1;
+		}
+		strcpy(path, file);
+	}
+
+	tmp = mem_alloc(strlen(path) + sizeof(".XXXXXX"));
+	sprintf(tmp, "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		error("mkstemp '%s' failed: %s\n", tmp, strerror(errno));
+		goto done;
+	}
+
+	if (!stat(path, &st)) {
+		fchmod(fd, st.st_mode & 07777);
+	} else {
+		mode_t mask = umask(0);
+
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+
+	if (write(fd, data, len) != (ssize_t)len) {
+		error("write '%s' failed: %s\n", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		goto done;
+	}
+	close(fd);
+
+	if (rename(tmp, path)) {
+		error("rename '%s' failed: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		goto done;
+	}
+	result = 0;
+
+done:
+	mem_free(tmp);
+	return result;
+}
+
+static void file_list_add(struct file_list *list, const char *name)
+{
+	list->names = mem_realloc(list->names,
+		(list->count + 1) * sizeof(*list->names));
+	list->names[list->count++] = str_dup(name);
+}
+
+static struct {
+	struct file_list *list;
+	const char *suffix;
+} nftw_data;
+
+static int nftw_cb(const char *path, const struct stat *st, int type,
+	struct FTW *ftw)
+{
+	size_t len = strlen(path);
+	size_t suffix_len = strlen(nftw_data.suffix);
+
+	(void)st;
+	(void)ftw;
+
+	if (type == FTW_F && len > suffix_len
+		&& !strcmp(path + len - suffix_len, nftw_data.suffix)) {
+		file_list_add(nftw_data.list, path);
+	}
+	return 0;
+}
+
+static int compare_str(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Adds file targets, and the files in directory targets that end with
+ * suffix.  The list is sorted.
+ */
+int file_list_add_targets(struct file_list *list, char *const *targets,
+	unsigned int target_count, const char *suffix)
+{
+	unsigned int i;
+
+	nftw_data.list = list;
+	nftw_data.suffix = suffix;
+
+	for (i = 0; i < target_count; i++) {
+		struct stat st;
+
+		if (stat(targets[i], &st)) {
+			error("Bad target: %s\n", targets[i]);
+			return -1;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			nftw(targets[i], nftw_cb, 16, 0);
+		} else if (S_ISREG(st.st_mode)) {
+			file_list_add(list, targets[i]);
+		} else {
+			error("Not file target: %s\n", targets[i]);
+			return -1;
+		}
+	}
+
+	qsort(list->names, list->count, sizeof(*list->names), compare_str);
+	return 0;
+}
+
+void file_list_free(struct file_list *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->count; i++) {
+		mem_free(list->names[i]);
+	}
+	if (list->names) {
+		mem_free(list->names);
+	}
+	memset(list, 0, sizeof(*list));
+}
+
+/*
+ * Each worker owns a range of indices, begin in the high and end in the
+ * low half of one word, and takes from its front.  A worker with an empty
+ * range steals the back half of another's, so a few long jobs don't leave
+ * the other threads idle.  Indices are never handed out twice, so a range
+ * word never repeats and a plain compare and swap is enough.
+ */
+struct job_worker {
+	struct job_data *jd;
+	unsigned int self;
+	uint64_t range __attribute__((aligned(64)));
+};
+
+struct job_data {
+	job_callback cb;
+	void *cb_data;
+	struct job_worker *workers;
+	unsigned int worker_count;
+	unsigned int failed;
+};
+
+static uint64_t job_range(unsigned int begin, unsigned int end)
+{
+	return ((uint64_t)begin << 32) | end;
+}
+
+static bool job_take(struct job_worker *w, unsigned int *index)
+{
+	uint64_t range = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+	while (1) {
+		unsigned int begin = range >> 32;
+		unsigned int end = (unsigned int)range;
+
+		if (begin >= end) {
+			return false;
+		}
+		if (__atomic_compare_exchange_n(&w->range, &range,
+			job_range(begin + 1, end), false, __ATOMIC_ACQ_REL,
+			__ATOMIC_ACQUIRE)) {
+			*index = begin;
+			return true;
+		}
+	}
+}
+
+static bool job_steal(struct job_worker *w, unsigned int *index)
+{
+	struct job_data *jd = w->jd;
+	unsigned int i;
+
+	for (i = 1; i < jd->worker_count; i++) {
+		struct job_worker *victim =
+			&jd->workers[(w->self + i) % jd->worker_count];
+		uint64_t range = __atomic_load_n(&victim->range,
+			__ATOMIC_ACQUIRE);
+
+		while (1) {
+			unsigned int begin = range >> 32;
+			unsigned int end = (unsigned int)range;
+			unsigned int half = (end - begin + 1) / 2;
+
+			if (begin >= end) {
+				break;
+			}
+			if (__atomic_compare_exchange_n(&victim->range, &range,
+				job_range(begin, end - half), false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				*index = end - half;
+				__atomic_store_n(&w->range,
+					job_range(end - half + 1, end),
+					__ATOMIC_RELEASE);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void *job_worker(void *arg)
+{
+	struct job_worker *w = arg;
+	struct job_data *jd = w->jd;
+	unsigned int i;
+
+	if (w->self) {
+		trace_thread("job worker");
+	}
+
+	while (job_take(w, &i) || job_steal(w, &i)) {
+		unsigned long long start = trace_begin();
+
+		if (jd->cb(jd->cb_data, i)) {
+			__atomic_fetch_add(&jd->failed, 1, __ATOMIC_RELAXED);
+		}
+		trace_end("job", start);
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs cb for every index on up to jobs threads, the calling thread is
+ * one of them.  Returns the number of calls that failed.
+ */
+unsigned int run_jobs(unsigned int jobs, unsigned int count, job_callback cb,
+	void *cb_data)
+{
+	struct job_data jd = {
+		.cb = cb,
+		.cb_data = cb_data,
+	};
+	pthread_t *threads;
+	unsigned int i;
+	int result;
+
+	jd.worker_count = (jobs < count) ? jobs : count;
+	jd.worker_count = jd.worker_count ? jd.worker_count : 1;
+	jd.workers = mem_alloc(jd.worker_count * sizeof(*jd.workers));
+	threads = mem_alloc(jd.worker_count * sizeof(*threads));
+
+	debug("%u jobs, %u threads\n", count, jd.worker_count);
+
+	for (i = 0; i < jd.worker_count; i++) {
+		jd.workers[i].jd = &jd;
+		jd.workers[i].self = i;
+		jd.workers[i].range = job_range(
+			(uint64_t)count * i / jd.worker_count,
+			(uint64_t)count * (i + 1) / jd.worker_count);
+	}
+
+	/* Workers that fail to start have their share stolen. */
+	for (i = 1; i < jd.worker_count; i++) {
+		result = pthread_create(&threads[i], NULL, job_worker,
+			&jd.workers[i]);
+		if (result) {
+			error("pthread_create failed: %s\n", strerror(result));
+			break;
+		}
+	}
+
+	job_worker(&jd.workers[0]);
+
+	while (--i) {
+		pthread_join(threads[i], NULL);
+	}
+	mem_free(threads);
+	mem_free(jd.workers);
+
+	return jd.failed;
+}
+
 const char *eat_front_ws(const char *p)
 {
 	//char *const start = p;
@@ -234,19 +861,51 @@ float to_float(const char *str)
 	return f;
 }
 
+/*
+ * Per thread splitmix64 state, so threads running separate jobs each
+ * get the sequence of their own seed.
+ */
+static __thread uint64_t random_state;
+
+void random_seed(unsigned int seed)
+{
+	random_state = seed;
+}
+
+/*
+ * Stream number stream of a seed, separate from the seed's own sequence,
+ * so an item can be generated without generating the ones before it.
+ */
+void random_seed_stream(unsigned int seed, unsigned int stream)
+{
+	random_state = ((uint64_t)seed << 32 | stream) * 0xd1342543de82ef95ULL
+		+ 0x9e3779b97f4a7c15ULL;
+}
+
+unsigned int random_next(void)
+{
+	uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (unsigned int)((z ^ (z >> 31)) >> 32);
+}
+
 int random_int(int min, int max)
 {
-	return min + (rand() % (max - min + 1));
+	return min + (int)(random_next() % (unsigned int)(max - min + 1));
 }
 
 unsigned int random_unsigned(unsigned int min, unsigned int max)
 {
-	return (unsigned int)(min + (rand() % (max - min + 1)));
+	return min + (random_next() % (max - min + 1));
 }
 
 float random_float(float min, float max)
 {
-    return min + (float)rand() / (float)RAND_MAX * (max - min);
+	/* 24 bits, the float mantissa, for 0 to 1 inclusive. */
+	return min + (float)(random_next() >> 8) / (float)0xffffff
+		* (max - min);
 }
 
 void palette_fill(struct palette *palette, const struct color_data *data,
@@ -287,12 +946,13 @@ void svg_open_svg(FILE *stream, const struct svg_rect *background_rect)
 	fprintf(stream, "<svg \n"
 		"  xmlns=\"http://www.w3.org/2000/svg\"\n"
 		"  xmlns:inkscape=\"http://www.inkscape.org/namespaces/inkscape\"\n"
+		"  xmlns:xlink=\"http://www.w3.org/1999/xlink\"\n"
 		"  width=\"%f\"\n"
 		"  height=\"%f\"\n"
 		"  viewBox=\"%f %f %f %f\">\n",
-		background_rect->width, background_rect->width,
+		background_rect->width, background_rect->height,
 		background_rect->x, background_rect->y,
-		background_rect->width, background_rect->width);
+		background_rect->width, background_rect->height);
 }
 
 void svg_close_svg(FILE *stream)
@@ -320,8 +980,13 @@ void svg_open_object(FILE *stream, const char *type, const char *id,
 
 	(void)stroke;
 
-	fprintf(stream, "  <%s id=\"%s\" style=\"fill:%s%s\"\n", type, id, fill,
-		debug_stroke);
+	if (id) {
+		fprintf(stream, "  <%s id=\"%s\" style=\"fill:%s%s\"\n", type,
+			id, fill, debug_stroke);
+	} else {
+		fprintf(stream, "  <%s style=\"fill:%s%s\"\n", type, fill,
+			debug_stroke);
+	}
 }
 
 void svg_close_object(FILE *stream)
@@ -347,6 +1012,54 @@ void svg_write_rect(FILE *stream, const char *id, const char *fill,
 	svg_close_object(stream);
 }
 
+void svg_open_defs(FILE *stream)
+{
+	fprintf(stream, " <defs>\n");
+}
+
+void svg_close_defs(FILE *stream)
+{
+	fprintf(stream, " </defs>\n");
+}
+
+void svg_open_pattern(FILE *stream, const char *id,
+	const struct svg_rect *tile_rect)
+{
+	fprintf(stream,
+		"  <pattern id=\"%s\" patternUnits=\"userSpaceOnUse\"\n"
+		"   x=\"%f\" y=\"%f\" width=\"%f\" height=\"%f\">\n",
+		id, tile_rect->x, tile_rect->y, tile_rect->width,
+		tile_rect->height);
+}
+
+void svg_close_pattern(FILE *stream)
+{
+	fprintf(stream, "  </pattern>\n");
+}
+
+void svg_open_symbol(FILE *stream, const char *id)
+{
+	/* No viewBox, so overflow must be visible for nodes left of or
+	 * above the symbol origin. */
+	fprintf(stream, "  <symbol id=\"%s\" overflow=\"visible\">\n", id);
+}
+
+void svg_close_symbol(FILE *stream)
+{
+	fprintf(stream, "  </symbol>\n");
+}
+
+void svg_write_use(FILE *stream, const char *id, const char *href,
+	const char *fill, const char *transform)
+{
+	svg_open_object(stream, "use", id, fill, NULL);
+
+	fprintf(stream, "   xlink:href=\"#%s\"\n   transform=\"%s\"\n",
+		href, transform);
+
+	svg_close_object(stream);
+}
+
 float deg_to_rad(float deg)
 {
 	return deg * M_PI / 180.0;
@@ -375,7 +1088,7 @@ unsigned int *random_array(unsigned int len)
 		unsigned int j;
 		unsigned int tmp;
 
-		j = rand() % len;
+		j = random_next() % len;
 		tmp = p[i];
 		p[i] = p[j];
 		p[j] = tmp;
@@ -397,81 +1110,233 @@ bool is_hex_color(const char *str)
 		&& *(str + 6) && isxdigit(*(str + 6)));
 }
 
-char *config_clean_data(char *p)
+static bool config_is_color(const char *p, const char *end)
 {
-	char *start;
+	unsigned int i;
 
-	assert(p);
+	if (end - p < (ptrdiff_t)hex_color_len - 1 || *p != '#') {
+		return false;
+	}
+	for (i = 1; i < hex_color_len - 1; i++) {
+		if (!isxdigit((unsigned char)p[i])) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	p = start = (char *)eat_front_ws(p);
+static struct config_str config_trim(const char *p, const char *end)
+{
+	while (p < end && isspace((unsigned char)*p)) {
+		p++;
+	}
+	while (end > p && isspace((unsigned char)end[-1])) {
+		end--;
+	}
+	return (struct config_str){p, (unsigned int)(end - p)};
+}
 
-	while (*p) {
-		if (is_hex_color(p)) {
-			p += 7;
-			continue;
+bool config_str_eq(const struct config_str *str, const char *s)
+{
+	return (strlen(s) == str->len && !memcmp(str->p, s, str->len));
+}
+
+int config_set_error(struct config_error *err, const struct config_line *line,
+	const char *at, const char *fmt, ...)
+{
+	va_list ap;
+
+	err->line = line->number;
+	err->col = (at && at >= line->start)
+		? (unsigned int)(at - line->start) + 1 : 0;
+
+	va_start(ap, fmt);
+	vsnprintf(err->msg, sizeof(err->msg), fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+int config_str_unsigned(const struct config_line *line,
+	const struct config_str *v, unsigned int *value,
+	struct config_error *err)
+{
+	unsigned long long u = 0;
+	unsigned int i;
+
+	if (!v->len) {
+		return config_set_error(err, line, v->p, "missing value");
+	}
+	for (i = 0; i < v->len; i++) {
+		if (!isdigit((unsigned char)v->p[i])) {
+			return config_set_error(err, line, v->p + i,
+				"bad unsigned value '%.*s'", (int)v->len, v->p);
 		}
-		if (*p == '\n'  || *p == '\r' || *p == '#') {
-			*p = 0;
-			eat_tail_ws(start);
-			return start;
+		u = u * 10 + (v->p[i] - '0');
+		if (u >= UINT_MAX) {
+			return config_set_error(err, line, v->p,
+				"value '%.*s' too big", (int)v->len, v->p);
 		}
-		p++;
 	}
-	eat_tail_ws(start);
-	return start;
+	*value = (unsigned int)u;
+	return 0;
 }
 
-void config_process_file(const char *config_file, config_file_callback cb,
-	void *cb_data, const char * const*sections, unsigned int section_count)
+int config_get_unsigned(const struct config_line *line, unsigned int *value,
+	struct config_error *err)
 {
-	FILE *fp;
-	char buf[512];
-	const char *current_section = NULL;
+	return config_str_unsigned(line, &line->value, value, err);
+}
 
-	fp = fopen(config_file, "r");
+int config_get_float(const struct config_line *line, float *value,
+	struct config_error *err)
+{
+	const struct config_str *v = &line->value;
+	char buf[64];
+	char *end;
+	float f;
 
-	if (!fp) {
-		error("open config '%s' failed: %s\n", config_file,
-		      strerror(errno));
-		assert(0);
-		exit(EXIT_FAILURE);
+	/* A number is short, the copy just terminates it. */
+	if (!v->len || v->len >= sizeof(buf)) {
+		return config_set_error(err, line, v->p, "bad float value '%.*s'",
+			(int)v->len, v->p);
+	}
+	memcpy(buf, v->p, v->len);
+	buf[v->len] = 0;
+
+	errno = 0;
+	f = strtof(buf, &end);
+	if (*end || errno || !isfinite(f)) {
+		return config_set_error(err, line, v->p + (*end ? end - buf : 0),
+			"bad float value '%.*s'", (int)v->len, v->p);
+	}
+	*value = f;
+	return 0;
+}
+
+int config_get_str(const struct config_line *line, char *buf, size_t size,
+	struct config_error *err)
+{
+	const struct config_str *v = &line->value;
+
+	if (!v->len || v->len >= size) {
+		return config_set_error(err, line, v->p, "bad value '%.*s'",
+			(int)v->len, v->p);
+	}
+	memcpy(buf, v->p, v->len);
+	buf[v->len] = 0;
+	return 0;
+}
+
+/* Splits a line into name and value at the first '=' or ','. */
+static void config_split(struct config_line *line)
+{
+	const char *end = line->text.p + line->text.len;
+	const char *p;
+
+	for (p = line->text.p; p < end && *p != '=' && *p != ','; p++)
+		;
+
+	if (p == end) {
+		line->sep = 0;
+		line->name = line->text;
+		line->value = (struct config_str){end, 0};
+		return;
+	}
+	line->sep = *p;
+	line->name = config_trim(line->text.p, p);
+	line->value = config_trim(p + 1, end);
+}
+
+int config_process_file(const char *config_file, config_file_callback cb,
+	void *cb_data, const char * const*sections, unsigned int section_count,
+	struct config_error *err)
+{
+	struct config_line line = {0};
+	struct mapped_file mf;
+	unsigned long long start = trace_begin();
+	const char *end;
+	const char *p;
+	int result = 0;
+
+	*err = (struct config_error){.file = config_file};
+
+	if (map_file(config_file, &mf)) {
+		snprintf(err->msg, sizeof(err->msg), "can't read file");
+		return -1;
 	}
 
-	while (fgets(buf, sizeof(buf), fp)) {
+	end = mf.data + mf.size;
+
+	for (p = mf.data; p < end && !result; ) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *line_end = eol ? eol : end;
+		const char *c;
 		unsigned int i;
-		char *p;
 
-		p = config_clean_data(buf);
+		line.number++;
+		line.start = p;
+		p = eol ? eol + 1 : end;
+
+		for (c = line.start; (c = memchr(c, '#', line_end - c)); ) {
+			if (!config_is_color(c, line_end)) {
+				line_end = c;
+				break;
+			}
+			c += hex_color_len - 1;
+		}
 
-		if (!*p) {
-			debug("null line\n");
+		line.text = config_trim(line.start, line_end);
+		if (!line.text.len) {
 			continue;
 		}
 
 		for (i = 0; i < section_count; i++) {
-			const char *s = sections[i];
-
-			if (!strcmp(p, s)) {
-				debug("new section: %s => %s:\n", current_section, s);
-				current_section = s;
-				goto next_line;
+			if (config_str_eq(&line.text, sections[i])) {
+				debug("new section: %s => %s:\n", line.section,
+					sections[i]);
+				line.section = sections[i];
+				break;
 			}
 		}
+		if (i < section_count) {
+			continue;
+		}
 
-		if (!current_section) {
-			error("Bad config data '%s' (%s)\n", p, config_file);
-			assert(0);
-			exit(EXIT_FAILURE);
+		if (*line.text.p == '[') {
+			result = config_set_error(err, &line, line.text.p,
+				"unknown section '%.*s'", (int)line.text.len,
+				line.text.p);
+			break;
 		}
+		if (!line.section) {
+			result = config_set_error(err, &line, line.text.p,
+				"data before a section");
+			break;
+		}
+
+		config_split(&line);
+		result = cb(cb_data, &line, err);
+	}
+
+	if (!result) {
+		line = (struct config_line){
+			.section = "ON_EXIT",
+			.number = line.number + 1,
+			.start = end,
+			.text = {end, 0},
+			.name = {end, 0},
+			.value = {end, 0},
+		};
+		result = cb(cb_data, &line, err);
+	}
 
-		debug("cb: %s, '%s'\n", current_section, buf);
-		cb(cb_data, current_section, buf);
-next_line:
-		(void)0;
+	if (result && !err->msg[0]) {
+		config_set_error(err, &line, line.text.p, "bad config data");
 	}
 
-	debug("ON_EXIT\n");
-	cb(cb_data, "ON_EXIT", NULL);
+	unmap_file(&mf);
+	trace_end("config", start);
+	return result ? -1 : 0;
 }
 
 
@@ -22,16 +22,83 @@ void set_verbose(bool state);
 # define log(_args...) do {_log(__func__, __LINE__, _args);} while(0)
 # define warn(_args...) do {_warn(__func__, __LINE__, _args);} while(0)
 
+/*
+ * Timeline tracing.  A span is trace_begin() to trace_end() on one thread,
+ * named by a string constant.  Spans go to per thread buffers, and
+ * trace_write() writes them as Chrome trace event JSON once the other
+ * threads are joined.  Until trace_start() the hooks are a flag test, and
+ * building with NO_TRACE leaves them out.
+ */
+#if defined(NO_TRACE)
+# define trace_begin() (0ULL)
+# define trace_end(_name, _start) do {(void)(_start);} while(0)
+# define trace_thread(_name) do {} while(0)
+#else
+extern bool trace_enabled;
+unsigned long long _trace_now(void);
+void _trace_span(const char *name, unsigned long long start);
+void _trace_thread(const char *name);
+# define trace_begin() (trace_enabled ? _trace_now() : 0ULL)
+# define trace_end(_name, _start) do {if (trace_enabled) \
+	{_trace_span(_name, _start);}} while(0)
+# define trace_thread(_name) do {if (trace_enabled) \
+	{_trace_thread(_name);}} while(0)
+#endif
+int trace_start(void);
+int trace_write(const char *file);
+
 void *mem_alloc(size_t size);
 void *mem_realloc(void *p, size_t size);
 void mem_free(void *p);
 
+struct mapped_file {
+	const char *data;
+	size_t size;
+};
+
+int map_file(const char *path, struct mapped_file *mf);
+void unmap_file(struct mapped_file *mf);
+
+char *str_dup(const char *s);
+
+struct out_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+void out_add(struct out_buf *out, const char *p, size_t len);
+void out_add_str(struct out_buf *out, const char *s);
+void __attribute__ ((format (printf, 2, 3)))
+	out_printf(struct out_buf *out, const char *fmt, ...);
+void out_add_number(struct out_buf *out, double value, unsigned int decimals);
+void out_free(struct out_buf *out);
+
+int replace_file(const char *file, const char *data, size_t len);
+
+struct file_list {
+	char **names;
+	unsigned int count;
+};
+
+int file_list_add_targets(struct file_list *list, char *const *targets,
+	unsigned int target_count, const char *suffix);
+void file_list_free(struct file_list *list);
+
+typedef int (*job_callback)(void *cb_data, unsigned int index);
+
+unsigned int run_jobs(unsigned int jobs, unsigned int count, job_callback cb,
+	void *cb_data);
+
 const char *eat_front_ws(const char *p);
 void eat_tail_ws(char *p);
 
 unsigned int to_unsigned(const char *str);
 float to_float(const char *str);
 
+void random_seed(unsigned int seed);
+void random_seed_stream(unsigned int seed, unsigned int stream);
+unsigned int random_next(void);
 int random_int(int min, int max);
 unsigned int random_unsigned(unsigned int min, unsigned int max);
 float random_float(float min, float max);
@@ -77,6 +144,15 @@ void svg_open_path(FILE *stream, const char *id, const char *fill,
 	const char *stroke);
 void svg_write_rect(FILE *stream, const char *id, const char *fill,
 	const char *stroke, const struct svg_rect *rect);
+void svg_open_defs(FILE *stream);
+void svg_close_defs(FILE *stream);
+void svg_open_pattern(FILE *stream, const char *id,
+	const struct svg_rect *tile_rect);
+void svg_close_pattern(FILE *stream);
+void svg_open_symbol(FILE *stream, const char *id);
+void svg_close_symbol(FILE *stream);
+void svg_write_use(FILE *stream, const char *id, const char *href,
+	const char *fill, const char *transform);
 
 struct point_c {
 	float x;
@@ -91,11 +167,60 @@ struct point_p {
 float deg_to_rad(float deg);
 void polar_to_cart(const struct point_p *p, struct point_c *c);
 
-typedef void (*config_file_callback)(void *cb_data, const char *section,
-	char *config_data);
+/*
+ * Config files are mapped and split in place.  Strings point into the
+ * mapping and are not terminated, so any line length is fine.  A line is
+ * '<name> = <value>' or '<name>, <value>', '#' starts a comment unless it
+ * starts a hex color.
+ */
+struct config_str {
+	const char *p;
+	unsigned int len;
+};
+
+struct config_line {
+	const char *section;
+	unsigned int number;
+	const char *start;
+	struct config_str text;
+	struct config_str name;
+	struct config_str value;
+	char sep;
+};
+
+struct config_error {
+	const char *file;
+	unsigned int line;
+	unsigned int col;
+	char msg[160];
+};
 
-char *config_clean_data(char *p);
-void config_process_file(const char *config_file, config_file_callback cb,
-	void *cb_data, const char * const*sections, unsigned int section_count);
+/* The last call has section "ON_EXIT" and empty text. */
+typedef int (*config_file_callback)(void *cb_data,
+	const struct config_line *line, struct config_error *err);
+
+bool config_str_eq(const struct config_str *str, const char *s);
+
+/* Sets err at 'at', a pointer into the line, and returns -1. */
+int __attribute__ ((format (printf, 4, 5)))
+	config_set_error(struct config_error *err,
+	const struct config_line *line, const char *at, const char *fmt, ...);
+
+int config_str_unsigned(const struct config_line *line,
+	const struct config_str *str, unsigned int *value,
+	struct config_error *err);
+
+/* The line's value. */
+int config_get_unsigned(const struct config_line *line, unsigned int *value,
+	struct config_error *err);
+int config_get_float(const struct config_line *line, float *value,
+	struct config_error *err);
+int config_get_str(const struct config_line *line, char *buf, size_t size,
+	struct config_error *err);
+
+/* Returns -1 with err set on errors, stops at the first bad line. */
+int config_process_file(const char *config_file, config_file_callback cb,
+	void *cb_data, const char * const*sections, unsigned int section_count,
+	struct config_error *err);
 
 #endif /* _MD_GENERATOR_UTIL_H */
@@ -0,0 +1,407 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "geom.h"
+#include "path.h"
+#include "xml.h"
+#include "walk.h"
+
+bool svg_value_is(const char *value, unsigned int len, const char *s)
+{
+	return len == strlen(s) && !memcmp(value, s, len);
+}
+
+/* The element's name, without a namespace prefix, is one of names. */
+bool svg_name_in(const struct xml_token *tok, const char *const *names,
+	unsigned int count)
+{
+	const char *name = tok->name;
+	unsigned int len = tok->name_len;
+	const char *colon = memchr(name, ':', len);
+	unsigned int i;
+
+	if (colon) {
+		len -= colon + 1 - name;
+		name = colon + 1;
+	}
+	for (i = 0; i < count; i++) {
+		if (svg_value_is(name, len, names[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The SVG color keywords, sorted. */
+static const struct svg_named_color {
+	const char *name;
+	unsigned int rgb;
+} svg_named_colors[] = {
+	{"aliceblue", 0xf0f8ff},
+	{"antiquewhite", 0xfaebd7},
+	{"aqua", 0x00ffff},
+	{"aquamarine", 0x7fffd4},
+	{"azure", 0xf0ffff},
+	{"beige", 0xf5f5dc},
+	{"bisque", 0xffe4c4},
+	{"black", 0x000000},
+	{"blanchedalmond", 0xffebcd},
+	{"blue", 0x0000ff},
+	{"blueviolet", 0x8a2be2},
+	{"brown", 0xa52a2a},
+	{"burlywood", 0xdeb887},
+	{"cadetblue", 0x5f9ea0},
+	{"chartreuse", 0x7fff00},
+	{"chocolate", 0xd2691e},
+	{"coral", 0xff7f50},
+	{"cornflowerblue", 0x6495ed},
+	{"cornsilk", 0xfff8dc},
+	{"crimson", 0xdc143c},
+	{"cyan", 0x00ffff},
+	{"darkblue", 0x00008b},
+	{"darkcyan", 0x008b8b},
+	{"darkgoldenrod", 0xb8860b},
+	{"darkgray", 0xa9a9a9},
+	{"darkgreen", 0x006400},
+	{"darkgrey", 0xa9a9a9},
+	{"darkkhaki", 0xbdb76b},
+	{"darkmagenta", 0x8b008b},
+	{"darkolivegreen", 0x556b2f},
+	{"darkorange", 0xff8c00},
+	{"darkorchid", 0x9932cc},
+	{"darkred", 0x8b0000},
+	{"darksalmon", 0xe9967a},
+	{"darkseagreen", 0x8fbc8f},
+	{"darkslateblue", 0x483d8b},
+	{"darkslategray", 0x2f4f4f},
+	{"darkslategrey", 0x2f4f4f},
+	{"darkturquoise", 0x00ced1},
+	{"darkviolet", 0x9400d3},
+	{"deeppink", 0xff1493},
+	{"deepskyblue", 0x00bfff},
+	{"dimgray", 0x696969},
+	{"dimgrey", 0x696969},
+	{"dodgerblue", 0x1e90ff},
+	{"firebrick", 0xb22222},
+	{"floralwhite", 0xfffaf0},
+	{"forestgreen", 0x228b22},
+	{"fuchsia", 0xff00ff},
+	{"gainsboro", 0xdcdcdc},
+	{"ghostwhite", 0xf8f8ff},
+	{"gold", 0xffd700},
+	{"goldenrod", 0xdaa520},
+	{"gray", 0x808080},
+	{"green", 0x008000},
+	{"greenyellow", 0xadff2f},
+	{"grey", 0x808080},
+	{"honeydew", 0xf0fff0},
+	{"hotpink", 0xff69b4},
+	{"indianred", 0xcd5c5c},
+	{"indigo", 0x4b0082},
+	{"ivory", 0xfffff0},
+	{"khaki", 0xf0e68c},
+	{"lavender", 0xe6e6fa},
+	{"lavenderblush", 0xfff0f5},
+	{"lawngreen", 0x7cfc00},
+	{"lemonchiffon", 0xfffacd},
+	{"lightblue", 0xadd8e6},
+	{"lightcoral", 0xf08080},
+	{"lightcyan", 0xe0ffff},
+	{"lightgoldenrodyellow", 0xfafad2},
+	{"lightgray", 0xd3d3d3},
+	{"lightgreen", 0x90ee90},
+	{"lightgrey", 0xd3d3d3},
+	{"lightpink", 0xffb6c1},
+	{"lightsalmon", 0xffa07a},
+	{"lightseagreen", 0x20b2aa},
+	{"lightskyblue", 0x87cefa},
+	{"lightslategray", 0x778899},
+	{"lightslategrey", 0x778899},
+	{"lightsteelblue", 0xb0c4de},
+	{"lightyellow", 0xffffe0},
+	{"lime", 0x00ff00},
+	{"limegreen", 0x32cd32},
+	{"linen", 0xfaf0e6},
+	{"magenta", 0xff00ff},
+	{"maroon", 0x800000},
+	{"mediumaquamarine", 0x66cdaa},
+	{"mediumblue", 0x0000cd},
+	{"mediumorchid", 0xba55d3},
+	{"mediumpurple", 0x9370db},
+	{"mediumseagreen", 0x3cb371},
+	{"mediumslateblue", 0x7b68ee},
+	{"mediumspringgreen", 0x00fa9a},
+	{"mediumturquoise", 0x48d1cc},
+	{"mediumvioletred", 0xc71585},
+	{"midnightblue", 0x191970},
+	{"mintcream", 0xf5fffa},
+	{"mistyrose", 0xffe4e1},
+	{"moccasin", 0xffe4b5},
+	{"navajowhite", 0xffdead},
+	{"navy", 0x000080},
+	{"oldlace", 0xfdf5e6},
+	{"olive", 0x808000},
+	{"olivedrab", 0x6b8e23},
+	{"orange", 0xffa500},
+	{"orangered", 0xff4500},
+	{"orchid", 0xda70d6},
+	{"palegoldenrod", 0xeee8aa},
+	{"palegreen", 0x98fb98},
+	{"paleturquoise", 0xafeeee},
+	{"palevioletred", 0xdb7093},
+	{"papayawhip", 0xffefd5},
+	{"peachpuff", 0xffdab9},
+	{"peru", 0xcd853f},
+	{"pink", 0xffc0cb},
+	{"plum", 0xdda0dd},
+	{"powderblue", 0xb0e0e6},
+	{"purple", 0x800080},
+	{"red", 0xff0000},
+	{"rosybrown", 0xbc8f8f},
+	{"royalblue", 0x4169e1},
+	{"saddlebrown", 0x8b4513},
+	{"salmon", 0xfa8072},
+	{"sandybrown", 0xf4a460},
+	{"seagreen", 0x2e8b57},
+	{"seashell", 0xfff5ee},
+	{"sienna", 0xa0522d},
+	{"silver", 0xc0c0c0},
+	{"skyblue", 0x87ceeb},
+	{"slateblue", 0x6a5acd},
+	{"slategray", 0x708090},
+	{"slategrey", 0x708090},
+	{"snow", 0xfffafa},
+	{"springgreen", 0x00ff7f},
+	{"steelblue", 0x4682b4},
+	{"tan", 0xd2b48c},
+	{"teal", 0x008080},
+	{"thistle", 0xd8bfd8},
+	{"tomato", 0xff6347},
+	{"turquoise", 0x40e0d0},
+	{"violet", 0xee82ee},
+	{"wheat", 0xf5deb3},
+	{"white", 0xffffff},
+	{"whitesmoke", 0xf5f5f5},
+	{"yellow", 0xffff00},
+	{"yellowgreen", 0x9acd32},
+};
+
+static int named_color_cmp(const void *key, const void *entry)
+{
+	return strcmp(key, ((const struct svg_named_color *)entry)->name);
+}
+
+/*
+ * The paint as #rrggbb: six digit hex as written, three digit hex and the
+ * color keywords expanded.  False for anything else, like paint servers,
+ * rgb() or currentColor.
+ */
+bool svg_fill_color(const char *value, unsigned int len,
+	char color[hex_color_len])
+{
+	const struct svg_named_color *named;
+	char name[24];
+	unsigned int i;
+
+	if (len && value[0] == '#') {
+		for (i = 1; i < len; i++) {
+			if (!isxdigit((unsigned char)value[i])) {
+				return false;
+			}
+		}
+		if (len == hex_color_len - 1) {
+			memcpy(color, value, len);
+			color[len] = 0;
+			return true;
+		}
+		if (len == 4) {
+			snprintf(color, hex_color_len, "#%c%c%c%c%c%c",
+				value[1], value[1], value[2], value[2],
+				value[3], value[3]);
+			return true;
+		}
+		return false;
+	}
+
+	if (len >= sizeof(name)) {
+		return false;
+	}
+	for (i = 0; i < len; i++) {
+		name[i] = tolower((unsigned char)value[i]);
+	}
+	name[len] = 0;
+
+	named = bsearch(name, svg_named_colors,
+		sizeof(svg_named_colors) / sizeof(svg_named_colors[0]),
+		sizeof(svg_named_colors[0]), named_color_cmp);
+	if (!named) {
+		return false;
+	}
+	snprintf(color, hex_color_len, "#%06x", named->rgb);
+	return true;
+}
+
+/* Element names whose content isn't painted where it is. */
+static bool is_hidden(const struct xml_token *tok)
+{
+	static const char *const names[] = {
+		"defs", "symbol", "pattern", "mask", "marker", "clipPath",
+	};
+
+	return svg_name_in(tok, names, sizeof(names) / sizeof(names[0]));
+}
+
+/* The fill property of a style attribute, if it has one. */
+static bool style_fill(const char *p, const char *end, const char **fill,
+	unsigned int *fill_len)
+{
+	bool found = false;
+
+	while (p < end) {
+		const char *semi = memchr(p, ';', end - p);
+		const char *decl_end = semi ? semi : end;
+		const char *colon = memchr(p, ':', decl_end - p);
+
+		if (colon) {
+			const char *name = p;
+			const char *name_end = colon;
+			const char *value = colon + 1;
+			const char *value_end = decl_end;
+
+			while (name < name_end && isspace(*name)) {
+				name++;
+			}
+			while (name_end > name && isspace(name_end[-1])) {
+				name_end--;
+			}
+			while (value < value_end && isspace(*value)) {
+				value++;
+			}
+			while (value_end > value && isspace(value_end[-1])) {
+				value_end--;
+			}
+			if (svg_value_is(name, name_end - name, "fill")
+				&& value_end > value) {
+				*fill = value;
+				*fill_len = value_end - value;
+				found = true;
+			}
+		}
+		p = decl_end + 1;
+	}
+	return found;
+}
+
+/* Opens the element's frame from its parent's. */
+static int open_frame(const struct xml_token *tok,
+	const struct svg_frame *parent, struct svg_frame *frame)
+{
+	const char *pos = tok->attrs;
+	const char *style = NULL;
+	const char *style_end = NULL;
+	struct xml_attr attr;
+
+	*frame = *parent;
+	frame->hidden = parent->hidden || is_hidden(tok);
+
+	while (pos && xml_attr_next(&pos, tok->attrs_end, &attr)) {
+		if (xml_attr_is(&attr, "transform")) {
+			struct affine t;
+
+			if (affine_parse(&t, attr.value,
+				attr.value + attr.value_len)) {
+				return -1;
+			}
+			affine_multiply(&frame->ctm, &frame->ctm, &t);
+		} else if (xml_attr_is(&attr, "fill")) {
+			frame->fill = attr.value;
+			frame->fill_len = attr.value_len;
+		} else if (xml_attr_is(&attr, "style")) {
+			style = attr.value;
+			style_end = attr.value + attr.value_len;
+		}
+	}
+
+	/* A style property wins over the attribute. */
+	if (style) {
+		style_fill(style, style_end, &frame->fill, &frame->fill_len);
+	}
+	return 0;
+}
+
+void svg_walk_init(struct svg_walk *sw, const char *data, size_t len)
+{
+	*sw = (struct svg_walk){0};
+	xml_parser_init(&sw->xp, data, len);
+
+	/* The root frame, the initial fill is black. */
+	sw->frame_alloc = 16;
+	sw->frames = mem_alloc(sw->frame_alloc * sizeof(*sw->frames));
+	affine_identity(&sw->frames[0].ctm);
+	sw->frames[0].fill = "black";
+	sw->frames[0].fill_len = sizeof("black") - 1;
+}
+
+void svg_walk_free(struct svg_walk *sw)
+{
+	xml_parser_free(&sw->xp);
+	mem_free(sw->frames);
+	sw->frames = NULL;
+}
+
+enum xml_token_type svg_walk_next(struct svg_walk *sw, struct xml_token *tok,
+	const struct svg_frame **frame)
+{
+	struct xml_parser *xp = &sw->xp;
+
+	while (xml_next(xp, tok) != xml_eof) {
+		struct svg_frame *f;
+
+		if (tok->type == xml_error) {
+			snprintf(sw->error, sizeof(sw->error), "%s",
+				xp->error);
+			return xml_error;
+		}
+		if (tok->type != xml_start && tok->type != xml_empty) {
+			continue;
+		}
+
+		/* xp->depth counts this element when it is a start tag. */
+		if (tok->type == xml_start) {
+			if (xp->depth + 1 > sw->frame_alloc) {
+				sw->frame_alloc *= 2;
+				sw->frames = mem_realloc(sw->frames,
+					sw->frame_alloc * sizeof(*sw->frames));
+			}
+			f = &sw->frames[xp->depth];
+		} else {
+			f = &sw->scratch;
+		}
+
+		if (open_frame(tok, &sw->frames[xp->depth
+			- (tok->type == xml_start)], f)) {
+			snprintf(sw->error, sizeof(sw->error),
+				"line %u: bad transform", tok->line);
+			return xml_error;
+		}
+		*frame = f;
+		return tok->type;
+	}
+	return xml_eof;
+}
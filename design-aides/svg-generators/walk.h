@@ -0,0 +1,47 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_WALK_H)
+#define _MD_GENERATOR_WALK_H
+
+/*
+ * SVG element walk over the XML tokenizer.  Each start or empty element tag
+ * is returned with its frame, the transform, fill and visibility it has and
+ * its children inherit.  The fill points into the document as written, a
+ * style fill property wins over the fill attribute.
+ */
+
+/* One per open element. */
+struct svg_frame {
+	struct affine ctm;
+	const char *fill;
+	unsigned int fill_len;
+	bool hidden;
+};
+
+struct svg_walk {
+	struct xml_parser xp;
+	struct svg_frame *frames;
+	unsigned int frame_alloc;
+	struct svg_frame scratch;
+	char error[256];
+};
+
+void svg_walk_init(struct svg_walk *sw, const char *data, size_t len);
+void svg_walk_free(struct svg_walk *sw);
+
+/*
+ * The next start or empty element tag and its frame, xml_eof at the end or
+ * xml_error with the message in sw->error.
+ */
+enum xml_token_type svg_walk_next(struct svg_walk *sw, struct xml_token *tok,
+	const struct svg_frame **frame);
+
+bool svg_name_in(const struct xml_token *tok, const char *const *names,
+	unsigned int count);
+bool svg_value_is(const char *value, unsigned int len, const char *s);
+bool svg_fill_color(const char *value, unsigned int len,
+	char color[hex_color_len]);
+
+#endif /* _MD_GENERATOR_WALK_H */
@@ -0,0 +1,490 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#define _GNU_SOURCE
+#define _ISOC99_SOURCE
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "xml.h"
+
+void xml_parser_init(struct xml_parser *xp, const char *data, size_t len)
+{
+	memset(xp, 0, sizeof(*xp));
+
+	xp->data = data;
+	xp->p = data;
+	xp->end = data + len;
+	xp->line = 1;
+
+	/* Skip a UTF-8 byte order mark. */
+	if (len >= 3 && !memcmp(data, "\xef\xbb\xbf", 3)) {
+		xp->p += 3;
+	}
+}
+
+void xml_parser_free(struct xml_parser *xp)
+{
+	if (xp->stack) {
+		mem_free(xp->stack);
+	}
+	xp->stack = NULL;
+	xp->depth = xp->stack_alloc = 0;
+}
+
+static enum xml_token_type __attribute__ ((format (printf, 2, 3)))
+	xml_fail(struct xml_parser *xp, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	len = snprintf(xp->error, sizeof(xp->error), "line %u: ", xp->line);
+
+	va_start(ap, fmt);
+	vsnprintf(xp->error + len, sizeof(xp->error) - len, fmt, ap);
+	va_end(ap);
+
+	xp->p = xp->end;
+	return xml_error;
+}
+
+static bool is_ws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_name_start(unsigned char c)
+{
+	return isalpha(c) || c == '_' || c == ':' || c >= 0x80;
+}
+
+static bool is_name_char(unsigned char c)
+{
+	return is_name_start(c) || isdigit(c) || c == '-' || c == '.';
+}
+
+static const char *skip_ws(const char *p, const char *end)
+{
+	while (p < end && is_ws(*p)) {
+		p++;
+	}
+	return p;
+}
+
+static const char *scan_name(const char *p, const char *end)
+{
+	if (p >= end || !is_name_start(*p)) {
+		return p;
+	}
+	for (p++; p < end && is_name_char(*p); p++) {
+	}
+	return p;
+}
+
+static void count_lines(struct xml_parser *xp, const char *p,
+	const char *end)
+{
+	while ((p = memchr(p, '\n', end - p))) {
+		xp->line++;
+		p++;
+	}
+}
+
+/* Checks the entity and character references in a text or value span. */
+static bool check_references(const char *p, const char *end)
+{
+	while ((p = memchr(p, '&', end - p))) {
+		const char *q = p + 1;
+
+		if (q < end && *q == '#') {
+			q++;
+			if (q < end && *q == 'x') {
+				for (q++; q < end && isxdigit(*q); q++) {
+				}
+			} else {
+				for (; q < end && isdigit(*q); q++) {
+				}
+			}
+			if (q == p + 2 || (q == p + 3 && p[2] == 'x')) {
+				return false;
+			}
+		} else {
+			const char *n = scan_name(q, end);
+
+			if (n == q) {
+				return false;
+			}
+			q = n;
+		}
+
+		if (q >= end || *q != ';') {
+			return false;
+		}
+		p = q + 1;
+	}
+
+	return true;
+}
+
+static void stack_push(struct xml_parser *xp, const char *name,
+	unsigned int name_len)
+{
+	if (xp->depth == xp->stack_alloc) {
+		xp->stack_alloc = xp->stack_alloc ? 2 * xp->stack_alloc : 32;
+		xp->stack = mem_realloc(xp->stack,
+			xp->stack_alloc * sizeof(*xp->stack));
+	}
+	xp->stack[xp->depth].name = name;
+	xp->stack[xp->depth].name_len = name_len;
+	xp->depth++;
+}
+
+static enum xml_token_type scan_text(struct xml_parser *xp,
+	struct xml_token *tok)
+{
+	const char *q = memchr(xp->p, '<', xp->end - xp->p);
+
+	if (!q) {
+		q = xp->end;
+	}
+
+	if (!check_references(xp->p, q)) {
+		return xml_fail(xp, "bad reference in text");
+	}
+
+	if (!xp->depth && skip_ws(xp->p, q) != q) {
+		return xml_fail(xp, "text outside root element");
+	}
+
+	tok->end = xp->p = q;
+	return tok->type = xml_text;
+}
+
+static enum xml_token_type scan_delimited(struct xml_parser *xp,
+	struct xml_token *tok, enum xml_token_type type, unsigned int skip,
+	const char *close)
+{
+	const char *q = memmem(xp->p + skip, xp->end - xp->p - skip, close,
+		strlen(close));
+
+	if (!q) {
+		return xml_fail(xp, "unterminated '%.*s'", skip, xp->p);
+	}
+
+	tok->end = xp->p = q + strlen(close);
+	return tok->type = type;
+}
+
+static enum xml_token_type scan_doctype(struct xml_parser *xp,
+	struct xml_token *tok)
+{
+	const char *p;
+	unsigned int brackets = 0;
+	char quote = 0;
+
+	if (xp->root_seen) {
+		return xml_fail(xp, "DOCTYPE after root element");
+	}
+
+	for (p = xp->p + 9; p < xp->end; p++) {
+		if (quote) {
+			if (*p == quote) {
+				quote = 0;
+			}
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == '[') {
+			brackets++;
+		} else if (*p == ']') {
+			brackets--;
+		} else if (*p == '>' && !brackets) {
+			tok->end = xp->p = p + 1;
+			return tok->type = xml_doctype;
+		}
+	}
+
+	return xml_fail(xp, "unterminated DOCTYPE");
+}
+
+static enum xml_token_type scan_end_tag(struct xml_parser *xp,
+	struct xml_token *tok)
+{
+	const char *p = xp->p + 2;
+	const struct xml_stack_entry *top;
+
+	tok->name = p;
+	p = scan_name(p, xp->end);
+	tok->name_len = p - tok->name;
+
+	if (!tok->name_len) {
+		return xml_fail(xp, "bad end tag name");
+	}
+
+	p = skip_ws(p, xp->end);
+	if (p >= xp->end || *p != '>') {
+		return xml_fail(xp, "bad end tag '%.*s'", tok->name_len,
+			tok->name);
+	}
+
+	if (!xp->depth) {
+		return xml_fail(xp, "end tag '%.*s' without start tag",
+			tok->name_len, tok->name);
+	}
+
+	top = &xp->stack[xp->depth - 1];
+	if (top->name_len != tok->name_len
+		|| memcmp(top->name, tok->name, tok->name_len)) {
+		return xml_fail(xp, "end tag '%.*s' does not match '%.*s'",
+			tok->name_len, tok->name, top->name_len, top->name);
+	}
+	xp->depth--;
+
+	tok->end = xp->p = p + 1;
+	return tok->type = xml_end;
+}
+
+static enum xml_token_type scan_start_tag(struct xml_parser *xp,
+	struct xml_token *tok)
+{
+	const char *p = xp->p + 1;
+	const char *pos;
+	struct xml_attr a;
+
+	tok->name = p;
+	p = scan_name(p, xp->end);
+	tok->name_len = p - tok->name;
+
+	if (!tok->name_len) {
+		return xml_fail(xp, "bad element name");
+	}
+
+	tok->attrs = p;
+
+	while (1) {
+		const char *ws = p;
+		const char *value;
+		char quote;
+
+		p = skip_ws(p, xp->end);
+
+		if (p >= xp->end) {
+			return xml_fail(xp, "unterminated tag '%.*s'",
+				tok->name_len, tok->name);
+		}
+		if (*p == '>') {
+			tok->attrs_end = p;
+			tok->type = xml_start;
+			p++;
+			break;
+		}
+		if (*p == '/') {
+			if (p + 1 >= xp->end || p[1] != '>') {
+				return xml_fail(xp, "bad empty tag '%.*s'",
+					tok->name_len, tok->name);
+			}
+			tok->attrs_end = p;
+			tok->type = xml_empty;
+			p += 2;
+			break;
+		}
+
+		if (p == ws) {
+			return xml_fail(xp, "missing space in tag '%.*s'",
+				tok->name_len, tok->name);
+		}
+
+		ws = p;
+		p = scan_name(p, xp->end);
+		if (p == ws) {
+			return xml_fail(xp, "bad attribute name in '%.*s'",
+				tok->name_len, tok->name);
+		}
+
+		p = skip_ws(p, xp->end);
+		if (p >= xp->end || *p != '=') {
+			return xml_fail(xp, "missing '=' in '%.*s'",
+				tok->name_len, tok->name);
+		}
+		p = skip_ws(p + 1, xp->end);
+		if (p >= xp->end || (*p != '"' && *p != '\'')) {
+			return xml_fail(xp, "unquoted attribute in '%.*s'",
+				tok->name_len, tok->name);
+		}
+
+		quote = *p++;
+		value = p;
+		p = memchr(p, quote, xp->end - p);
+		if (!p) {
+			return xml_fail(xp, "unterminated attribute in '%.*s'",
+				tok->name_len, tok->name);
+		}
+		if (memchr(value, '<', p - value)
+			|| !check_references(value, p)) {
+			return xml_fail(xp, "bad attribute value in '%.*s'",
+				tok->name_len, tok->name);
+		}
+		p++;
+	}
+
+	/* Attribute names must be unique within a tag. */
+	for (pos = tok->attrs; xml_attr_next(&pos, tok->attrs_end, &a); ) {
+		const char *pos2 = pos;
+		struct xml_attr b;
+
+		while (xml_attr_next(&pos2, tok->attrs_end, &b)) {
+			if (a.name_len == b.name_len
+				&& !memcmp(a.name, b.name, a.name_len)) {
+				return xml_fail(xp,
+					"duplicate attribute '%.*s' in '%.*s'",
+					a.name_len, a.name, tok->name_len,
+					tok->name);
+			}
+		}
+	}
+
+	if (!xp->depth) {
+		if (xp->root_seen) {
+			return xml_fail(xp, "multiple root elements");
+		}
+		xp->root_seen = true;
+	}
+
+	if (tok->type == xml_start) {
+		stack_push(xp, tok->name, tok->name_len);
+	}
+
+	tok->end = xp->p = p;
+	return tok->type;
+}
+
+enum xml_token_type xml_next(struct xml_parser *xp, struct xml_token *tok)
+{
+	enum xml_token_type type;
+	const char *p = xp->p;
+	size_t left = xp->end - p;
+
+	memset(tok, 0, sizeof(*tok));
+	tok->start = p;
+	tok->line = xp->line;
+
+	if (!left) {
+		if (xp->error[0]) {
+			return tok->type = xml_error;
+		}
+		if (xp->depth) {
+			return tok->type = xml_fail(xp, "unclosed element '%.*s'",
+				xp->stack[xp->depth - 1].name_len,
+				xp->stack[xp->depth - 1].name);
+		}
+		if (!xp->root_seen) {
+			return tok->type = xml_fail(xp, "no root element");
+		}
+		tok->end = p;
+		return tok->type = xml_eof;
+	}
+
+	if (*p != '<') {
+		type = scan_text(xp, tok);
+	} else if (left >= 4 && !memcmp(p, "<!--", 4)) {
+		type = scan_delimited(xp, tok, xml_comment, 4, "-->");
+	} else if (left >= 9 && !memcmp(p, "<![CDATA[", 9)) {
+		if (!xp->depth) {
+			return tok->type = xml_fail(xp,
+				"CDATA outside root element");
+		}
+		type = scan_delimited(xp, tok, xml_cdata, 9, "]]>");
+	} else if (left >= 9 && !memcmp(p, "<!DOCTYPE", 9)) {
+		type = scan_doctype(xp, tok);
+	} else if (left >= 2 && p[1] == '?') {
+		tok->name = p + 2;
+		tok->name_len = scan_name(p + 2, xp->end) - tok->name;
+		if (!tok->name_len) {
+			return tok->type = xml_fail(xp, "bad PI target");
+		}
+		type = scan_delimited(xp, tok, xml_pi, 2, "?>");
+	} else if (left >= 2 && p[1] == '/') {
+		type = scan_end_tag(xp, tok);
+	} else {
+		type = scan_start_tag(xp, tok);
+	}
+
+	if (type == xml_error) {
+		return tok->type = xml_error;
+	}
+
+	count_lines(xp, tok->start, tok->end);
+	return type;
+}
+
+bool xml_name_is(const struct xml_token *tok, const char *name)
+{
+	size_t len = strlen(name);
+
+	return tok->name_len == len && !memcmp(tok->name, name, len);
+}
+
+bool xml_attr_next(const char **pos, const char *end, struct xml_attr *attr)
+{
+	const char *p = skip_ws(*pos, end);
+	const char *q;
+	char quote;
+
+	if (p >= end || !is_name_start(*p)) {
+		return false;
+	}
+
+	attr->name = p;
+	p = scan_name(p, end);
+	attr->name_len = p - attr->name;
+
+	p = skip_ws(p, end);
+	assert(p < end && *p == '=');
+	p = skip_ws(p + 1, end);
+
+	quote = *p++;
+	q = memchr(p, quote, end - p);
+	assert(q);
+
+	attr->value = p;
+	attr->value_len = q - p;
+	*pos = q + 1;
+
+	return true;
+}
+
+bool xml_attr_is(const struct xml_attr *attr, const char *name)
+{
+	size_t len = strlen(name);
+
+	return attr->name_len == len && !memcmp(attr->name, name, len);
+}
+
+bool xml_attr_get(const struct xml_token *tok, const char *name,
+	struct xml_attr *attr)
+{
+	const char *pos = tok->attrs;
+
+	if (!pos) {
+		return false;
+	}
+
+	while (xml_attr_next(&pos, tok->attrs_end, attr)) {
+		if (xml_attr_is(attr, name)) {
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,71 @@
+/*
+ *  moto-design random image generator.
+ */
+
+#if ! defined(_MD_GENERATOR_XML_H)
+#define _MD_GENERATOR_XML_H
+
+/*
+ * Zero-copy streaming XML tokenizer.  Tokens point into the caller's
+ * buffer (usually a mapped file), nothing is copied or NUL terminated.
+ * Well-formedness (names, quoting, references, tag nesting, a single
+ * root element) is checked as the tokens are read.
+ */
+
+enum xml_token_type {
+	xml_eof = 0,
+	xml_error,
+	xml_start,
+	xml_end,
+	xml_empty,
+	xml_text,
+	xml_comment,
+	xml_pi,
+	xml_cdata,
+	xml_doctype,
+};
+
+struct xml_token {
+	enum xml_token_type type;
+	const char *start;
+	const char *end;
+	const char *name;
+	unsigned int name_len;
+	const char *attrs;
+	const char *attrs_end;
+	unsigned int line;
+};
+
+struct xml_attr {
+	const char *name;
+	unsigned int name_len;
+	const char *value;
+	unsigned int value_len;
+};
+
+struct xml_parser {
+	const char *data;
+	const char *p;
+	const char *end;
+	unsigned int line;
+	struct xml_stack_entry {
+		const char *name;
+		unsigned int name_len;
+	} *stack;
+	unsigned int depth;
+	unsigned int stack_alloc;
+	bool root_seen;
+	char error[256];
+};
+
+void xml_parser_init(struct xml_parser *xp, const char *data, size_t len);
+void xml_parser_free(struct xml_parser *xp);
+enum xml_token_type xml_next(struct xml_parser *xp, struct xml_token *tok);
+
+bool xml_name_is(const struct xml_token *tok, const char *name);
+bool xml_attr_next(const char **pos, const char *end, struct xml_attr *attr);
+bool xml_attr_get(const struct xml_token *tok, const char *name,
+	struct xml_attr *attr);
+bool xml_attr_is(const struct xml_attr *attr, const char *name);
+
+#endif /* _MD_GENERATOR_XML_H */